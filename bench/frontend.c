@@ -0,0 +1,381 @@
+/*
+ * Frontend throughput benchmark.
+ *
+ * Generates synthetic sources of the requested sizes and times the lexer
+ * (a bare next_token loop), parse() and generate_code() separately, so
+ * compile-speed regressions show up independently of VM speed, and the
+ * single-pass compiler and the threaded pipeline, whose bytecode is checked
+ * against generate_code's. Allocations are counted per phase by wrapping the allocator at link time with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=strdup (see the
+ * bench-frontend target in the Makefile).
+ */
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "compiler.h"
+#include "pipeline.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_SIZES 16
+#define MAX_SIZE_MB 500
+
+/**
+ * @brief Allocation counters, updated by the --wrap hooks below.
+ */
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+} AllocCounts;
+
+static AllocCounts alloc_counts;
+
+// Atomic, since the pipeline allocates on three threads
+static void count_allocation(size_t size) {
+    __atomic_fetch_add(&alloc_counts.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_counts.bytes, size, __ATOMIC_RELAXED);
+}
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+char* __real_strdup(const char* text);
+
+void* __wrap_malloc(size_t size) {
+    count_allocation(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    count_allocation(count * size);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    count_allocation(size);
+    return __real_realloc(pointer, size);
+}
+
+char* __wrap_strdup(const char* text) {
+    count_allocation(strlen(text) + 1);
+    return __real_strdup(text);
+}
+
+/**
+ * @brief Measurements for one phase of one source size.
+ */
+typedef struct {
+    double seconds;     // Fastest of the runs
+    uint64_t items;     // Tokens, AST nodes or bytecode bytes
+    AllocCounts allocs;
+} PhaseResult;
+
+enum { PHASE_LEX, PHASE_PARSE, PHASE_CODEGEN, PHASE_SINGLE_PASS, PHASE_PIPELINE, PHASE_COUNT };
+
+static const char* phase_names[PHASE_COUNT] = {"lex", "parse", "codegen", "single", "pipeline"};
+static const char* item_names[PHASE_COUNT] = {"tokens", "nodes", "bytes", "bytes", "bytes"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Generates a script of at least the given size that exercises every
+ * construct the frontend knows: functions, locals, if/else, while, for,
+ * calls, tables, arithmetic, comparisons, logical operators, strings and
+ * concatenation.
+ *
+ * @param target The minimum size in bytes.
+ * @param length Receives the actual size.
+ * @return The NUL-terminated source. The caller frees it.
+ */
+static char* generate_source(size_t target, size_t* length) {
+    size_t capacity = target + 1024;
+    char* source = (char*)malloc(capacity);
+    size_t used = 0;
+    for (long i = 0; used < target; i++) {
+        char block[1024];
+        int n = snprintf(block, sizeof(block),
+            "-- block %ld\n"
+            "function f%ld(a, b)\n"
+            "  local t = a * %ld + b - (a - %ld) / 3\n"
+            "  if t > %ld and not (a == b) or false then\n"
+            "    t = t - 1\n"
+            "  else\n"
+            "    t = \"v%ld\" .. t\n"
+            "  end\n"
+            "  while t < 0 do\n"
+            "    t = t + 10\n"
+            "  end\n"
+            "  for i = 1, b, 2 do\n"
+            "    t = t + i\n"
+            "  end\n"
+            "  local r = {t, %ld, n = a, [\"k\"] = b}\n"
+            "  r.n = r[1] + #r\n"
+            "  return g(t, -a)\n"
+            "end\n"
+            "x%ld = f%ld(%ld.5, \"s\")\n"
+            "print(x%ld)\n",
+            i, i, i, i % 97, i, i, i % 100, i % 1000, i, i, i % 1000);
+        if (used + n + 1 > capacity) {
+            capacity = (used + n + 1) * 2;
+            source = (char*)realloc(source, capacity);
+        }
+        memcpy(source + used, block, n);
+        used += n;
+    }
+    source[used] = '\0';
+    *length = used;
+    return source;
+}
+
+/**
+ * @brief Sums the bytecode of a chunk and of every function nested in it.
+ */
+static uint64_t bytecode_size(Chunk* chunk) {
+    uint64_t size = chunk->count;
+    for (int i = 0; i < chunk->constants_count; i++) {
+        if (chunk->constants[i].type == VAL_FUNCTION) {
+            size += bytecode_size(chunk->constants[i].as.function);
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Checks that two chunks hold the same code, lines, locals and
+ * constants, recursing into the functions among the constants.
+ */
+static int same_chunk(Chunk* a, Chunk* b) {
+    if (a->count != b->count || a->constants_count != b->constants_count ||
+        a->locals_count != b->locals_count || a->arity != b->arity ||
+        memcmp(a->code, b->code, a->count) != 0 ||
+        memcmp(a->lines, b->lines, sizeof(int) * a->count) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < a->locals_count; i++) {
+        if (strcmp(a->locals[i], b->locals[i]) != 0) return 0;
+    }
+    for (int i = 0; i < a->constants_count; i++) {
+        Value x = a->constants[i];
+        Value y = b->constants[i];
+        if (x.type != y.type) return 0;
+        switch (x.type) {
+            case VAL_NUMBER:
+            case VAL_INTEGER:
+                if (x.as.integer != y.as.integer) return 0;
+                break;
+            case VAL_STRING:
+                if (strcmp(x.as.string, y.as.string) != 0) return 0;
+                break;
+            case VAL_FUNCTION:
+                if (strcmp(x.as.function->name, y.as.function->name) != 0 ||
+                    !same_chunk(x.as.function, y.as.function)) {
+                    return 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+static void record(PhaseResult* result, double seconds, uint64_t items, AllocCounts* before) {
+    if (result->seconds == 0 || seconds < result->seconds) result->seconds = seconds;
+    result->items = items;
+    result->allocs.calls = alloc_counts.calls - before->calls;
+    result->allocs.bytes = alloc_counts.bytes - before->bytes;
+}
+
+/**
+ * @brief Times the threaded pipeline in a child process: once a process
+ * has started threads, glibc's malloc locks its arenas for good, which
+ * would slow every phase measured after it.
+ *
+ * @return 1 on success, 0 if the pipeline failed or its bytecode differs
+ * from generate_code's.
+ */
+static int run_pipeline(const char* source, int runs, PhaseResult* result) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        AST* ast = parse(source);
+        Chunk expected;
+        init_chunk(&expected);
+        generate_code(ast, &expected);
+        free_ast(ast);
+
+        int same = 1;
+        for (int run = 0; run < runs && same; run++) {
+            Chunk piped;
+            init_chunk(&piped);
+            AllocCounts before = alloc_counts;
+            double start = now();
+            int compiled = compile_pipelined(source, &piped, 0);
+            record(result, now() - start, bytecode_size(&piped), &before);
+            same = compiled && same_chunk(&expected, &piped);
+            free_chunk(&piped);
+        }
+        if (write(fds[1], result, sizeof(PhaseResult)) != sizeof(PhaseResult)) same = 0;
+        _exit(same ? 0 : 1);
+    }
+    close(fds[1]);
+    int received = read(fds[0], result, sizeof(PhaseResult)) == sizeof(PhaseResult);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief Runs every phase on the source, keeping the fastest time of each.
+ *
+ * @return 1 on success, 0 if the generated source failed to parse or
+ * the single-pass compiler's or the pipeline's bytecode differs from
+ * generate_code's.
+ */
+static int run_phases(const char* source, int runs, PhaseResult* results) {
+    memset(results, 0, sizeof(PhaseResult) * PHASE_COUNT);
+    for (int run = 0; run < runs; run++) {
+        AllocCounts before = alloc_counts;
+        double start = now();
+        init_lexer(source);
+        uint64_t tokens = 0;
+        for (;;) {
+            Token token = next_token();
+            tokens++;
+            if (token.type == TOKEN_EOF) break;
+        }
+        record(&results[PHASE_LEX], now() - start, tokens, &before);
+
+        before = alloc_counts;
+        start = now();
+        AST* ast = parse(source);
+        double elapsed = now() - start;
+        if (ast == NULL) return 0;
+        record(&results[PHASE_PARSE], elapsed, ast->count - 1, &before);
+
+        Chunk chunk;
+        init_chunk(&chunk);
+        before = alloc_counts;
+        start = now();
+        generate_code(ast, &chunk);
+        record(&results[PHASE_CODEGEN], now() - start, bytecode_size(&chunk), &before);
+
+        free_ast(ast);
+
+        Chunk single;
+        init_chunk(&single);
+        before = alloc_counts;
+        start = now();
+        int compiled = compile_single_pass(source, &single);
+        record(&results[PHASE_SINGLE_PASS], now() - start, bytecode_size(&single), &before);
+
+        int same = compiled && same_chunk(&chunk, &single);
+        free_chunk(&single);
+        free_chunk(&chunk);
+        if (!same) return 0;
+    }
+    return run_pipeline(source, runs, &results[PHASE_PIPELINE]);
+}
+
+static void print_header(void) {
+    printf("%8s %-8s %9s %9s %14s %12s %14s\n",
+           "size", "phase", "time", "MB/s", "items/s", "allocs", "alloc bytes");
+}
+
+static void print_results(size_t length, PhaseResult* results) {
+    double mb = length / (1024.0 * 1024.0);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        PhaseResult* r = &results[p];
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.3g %s", r->items / r->seconds, item_names[p]);
+        printf("%6.1fMB %-8s %8.3fs %9.1f %14s %12llu %14llu\n",
+               mb, phase_names[p], r->seconds, mb / r->seconds, rate,
+               (unsigned long long)r->allocs.calls, (unsigned long long)r->allocs.bytes);
+    }
+}
+
+static void print_json(size_t length, PhaseResult* results, int first) {
+    printf("%s  {\"bytes\": %zu", first ? "" : ",\n", length);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        PhaseResult* r = &results[p];
+        printf(", \"%s\": {\"seconds\": %.6f, \"%s\": %llu, \"allocs\": %llu, \"alloc_bytes\": %llu}",
+               phase_names[p], r->seconds, item_names[p], (unsigned long long)r->items,
+               (unsigned long long)r->allocs.calls, (unsigned long long)r->allocs.bytes);
+    }
+    printf("}");
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--sizes=1,16,64] [--runs=3] [--json]\n", program);
+    fprintf(stderr, "  --sizes=<list>  Source sizes in MB, each between 1 and %d\n", MAX_SIZE_MB);
+    fprintf(stderr, "  --runs=<n>      Runs per size; the fastest time is reported\n");
+    fprintf(stderr, "  --json          Print the results as JSON\n");
+}
+
+int main(int argc, char* argv[]) {
+    int sizes[MAX_SIZES] = {1, 16, 64};
+    int size_count = 3;
+    int runs = 3;
+    int json = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--sizes=", 8) == 0) {
+            size_count = 0;
+            for (char* p = argv[i] + 8; *p && size_count < MAX_SIZES; ) {
+                int size = (int)strtol(p, &p, 10);
+                if (size < 1 || size > MAX_SIZE_MB) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                sizes[size_count++] = size;
+                if (*p == ',') p++;
+                else if (*p) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = atoi(argv[i] + 7);
+            if (runs < 1) runs = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (json) printf("[\n");
+    else print_header();
+
+    for (int s = 0; s < size_count; s++) {
+        size_t length;
+        char* source = generate_source((size_t)sizes[s] * 1024 * 1024, &length);
+
+        PhaseResult results[PHASE_COUNT];
+        if (!run_phases(source, runs, results)) {
+            fprintf(stderr, "Generated source failed to compile, or single-pass or pipeline bytecode differs.\n");
+            free(source);
+            return 1;
+        }
+        if (json) print_json(length, results, s == 0);
+        else print_results(length, results);
+        fflush(stdout);
+        free(source);
+    }
+
+    if (json) printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Runs the benchmark workloads and compares them against a saved baseline.
+
+Each workload in bench/workloads/ (plus a large generated source that
+stresses the compiler) is run N times. The median wall time, the peak RSS
+and the executed instruction count are written to a JSON results file.
+The instruction count comes from a separate, untimed run with --stats=json.
+When a baseline exists, any workload whose median wall time grew by more
+than the noise threshold is reported as a regression and the script exits
+with status 1.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+WORKLOAD_DIR = os.path.join(BENCH_DIR, "workloads")
+GENERATED_DIR = os.path.join(BENCH_DIR, "generated")
+
+
+def generate_large_source(path, functions):
+    """Writes a large script that is cheap to run but expensive to compile."""
+    with open(path, "w") as out:
+        out.write("-- Generated by bench/run.py; measures compile speed.\n")
+        for i in range(functions):
+            out.write(
+                f"function f{i}(a, b)\n"
+                f"  local t = a * {i} + b - (a - {i % 97}) / 3\n"
+                f"  if t > {i} and not (a == b) then\n"
+                f"    t = t - 1\n"
+                f"  else\n"
+                f"    t = t + 1\n"
+                f"  end\n"
+                f"  while t < 0 do\n"
+                f"    t = t + 10\n"
+                f"  end\n"
+                f"  return t\n"
+                f"end\n"
+            )
+        out.write(f"print(f{functions - 1}(1, 2))\n")
+
+
+def workloads(args):
+    names = sorted(f for f in os.listdir(WORKLOAD_DIR) if f.endswith(".lua"))
+    paths = {name[:-4]: os.path.join(WORKLOAD_DIR, name) for name in names}
+
+    os.makedirs(GENERATED_DIR, exist_ok=True)
+    large = os.path.join(GENERATED_DIR, "large_source.lua")
+    generate_large_source(large, args.large_functions)
+    paths["large_source"] = large
+
+    if args.only:
+        paths = {k: v for k, v in paths.items() if k in args.only}
+    return paths
+
+
+def run_once(binary, script):
+    """Runs a script once and returns (wall seconds, peak RSS in KiB)."""
+    start = time.perf_counter()
+    process = subprocess.Popen([binary, script], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    stderr = process.stderr.read().decode(errors="replace")
+    process.stderr.close()
+    if process.returncode != 0:
+        raise RuntimeError(f"{script} exited with {process.returncode}:\n{stderr}")
+    return elapsed, usage.ru_maxrss
+
+
+def instruction_count(binary, script):
+    """Counts executed VM instructions with an untimed --stats=json run."""
+    result = subprocess.run([binary, "--stats=json", script],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, check=True)
+    lines = result.stderr.decode().strip().splitlines()
+    return json.loads(lines[-1])["instructions"]
+
+
+def measure(binary, name, script, runs):
+    times = []
+    peak_rss = 0
+    for _ in range(runs):
+        elapsed, rss = run_once(binary, script)
+        times.append(elapsed)
+        peak_rss = max(peak_rss, rss)
+
+    median = statistics.median(times)
+    instructions = instruction_count(binary, script)
+    return {
+        "runs": runs,
+        "median_s": median,
+        "min_s": min(times),
+        "max_s": max(times),
+        "stdev_s": statistics.stdev(times) if runs > 1 else 0.0,
+        "instructions": instructions,
+        "instructions_per_s": instructions / median if median > 0 else 0.0,
+        "peak_rss_kib": peak_rss,
+    }
+
+
+def compare(results, baseline, threshold):
+    """Prints a comparison table and returns the names of regressed workloads."""
+    regressions = []
+    print(f"\n{'workload':<16} {'baseline':>10} {'current':>10} {'change':>8}")
+    for name, current in results.items():
+        if name not in baseline:
+            print(f"{name:<16} {'-':>10} {current['median_s']:>9.3f}s {'new':>8}")
+            continue
+        before = baseline[name]["median_s"]
+        change = (current["median_s"] / before - 1.0) * 100.0 if before > 0 else 0.0
+        verdict = ""
+        if change > threshold:
+            verdict = "  REGRESSION"
+            regressions.append(name)
+        elif change < -threshold:
+            verdict = "  improved"
+        print(f"{name:<16} {before:>9.3f}s {current['median_s']:>9.3f}s {change:>+7.1f}%{verdict}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--binary", default="./luac-release", help="interpreter to benchmark")
+    parser.add_argument("--runs", type=int, default=5, help="timed runs per workload")
+    parser.add_argument("--output", default=os.path.join(BENCH_DIR, "results.json"),
+                        help="where to write the results")
+    parser.add_argument("--baseline", default=os.path.join(BENCH_DIR, "baseline.json"),
+                        help="results to compare against")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="also store the results as the new baseline")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="slowdown in percent that counts as a regression")
+    parser.add_argument("--large-functions", type=int, default=20000,
+                        help="function definitions in the generated compile workload")
+    parser.add_argument("--only", nargs="*", help="workload names to run")
+    args = parser.parse_args()
+
+    results = {}
+    print(f"{'workload':<16} {'median':>10} {'min':>10} {'Minstr/s':>10} {'peak RSS':>10}")
+    for name, script in workloads(args).items():
+        result = measure(args.binary, name, script, args.runs)
+        results[name] = result
+        print(f"{name:<16} {result['median_s']:>9.3f}s {result['min_s']:>9.3f}s "
+              f"{result['instructions_per_s'] / 1e6:>10.1f} {result['peak_rss_kib']:>7d} KiB")
+
+    with open(args.output, "w") as out:
+        json.dump(results, out, indent=2, sort_keys=True)
+        out.write("\n")
+
+    status = 0
+    if os.path.exists(args.baseline) and not args.save_baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.threshold):
+            status = 1
+
+    if args.save_baseline:
+        with open(args.baseline, "w") as out:
+            json.dump(results, out, indent=2, sort_keys=True)
+            out.write("\n")
+        print(f"\nSaved baseline to {args.baseline}")
+
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
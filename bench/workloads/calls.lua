@@ -0,0 +1,26 @@
+-- Deep chains of small non-tail calls.
+function f1(x) return x + 1 end
+function f2(x) return f1(x) + 1 end
+function f3(x) return f2(x) + 1 end
+function f4(x) return f3(x) + 1 end
+function f5(x) return f4(x) + 1 end
+function f6(x) return f5(x) + 1 end
+function f7(x) return f6(x) + 1 end
+function f8(x) return f7(x) + 1 end
+function f9(x) return f8(x) + 1 end
+function f10(x) return f9(x) + 1 end
+
+function depth(n)
+  if n == 0 then
+    return 0
+  end
+  return 1 + depth(n - 1)
+end
+
+total = 0
+i = 0
+while i < 200000 do
+  total = total + f10(i) + depth(20)
+  i = i + 1
+end
+print(total)
@@ -0,0 +1,18 @@
+-- String building with repeated concatenation.
+function build(n)
+  local s = ""
+  local piece = "abcdefgh"
+  local count = 0
+  while count < n do
+    s = s .. piece
+    count = count + 1
+  end
+  return s
+end
+
+rounds = 0
+while rounds < 40 do
+  last = build(2000)
+  rounds = rounds + 1
+end
+print(rounds)
@@ -0,0 +1,6 @@
+-- The while_loop workload written as a numeric for loop.
+local sum = 0
+for i = 0, 4999999 do
+  sum = sum + i * 2 - 1
+end
+print(sum)
@@ -0,0 +1,23 @@
+-- Reads and writes many globals every iteration.
+a = 1
+b = 2
+c = 3
+d = 4
+e = 5
+f = 6
+g = 7
+h = 8
+n = 0
+while n < 1000000 do
+  t = a
+  a = b
+  b = c
+  c = d + 1
+  d = e
+  e = f - 1
+  f = g
+  g = h * 1
+  h = t + n
+  n = n + 1
+end
+print(a + b + c + d + e + f + g + h)
@@ -0,0 +1,11 @@
+-- Small helper functions called from a hot loop.
+function add(a, b) return a + b end
+function sq(x) return x * x end
+function clamp(v, hi) return v > hi and hi or v end
+function mix(a, b) return add(sq(a), b) end
+
+local total = 0
+for i = 1, 2000000 do
+  total = add(total, clamp(mix(i, 3), 1000))
+end
+print(total)
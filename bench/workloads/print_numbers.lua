@@ -0,0 +1,6 @@
+-- Output-heavy: prints integers and short and long floats.
+for i = 1, 300000 do
+  print(i)
+  print(i / 4)
+  print(i / 7)
+end
@@ -0,0 +1,25 @@
+-- Sieve of Eratosthenes over the array part, plus field reads and writes.
+local n = 2000000
+local sieve = {}
+for i = 1, n do
+  sieve[i] = true
+end
+local i = 2
+while i * i <= n do
+  if sieve[i] then
+    for j = i * i, n, i do
+      sieve[j] = false
+    end
+  end
+  i = i + 1
+end
+
+local stats = {primes = 0, last = 0}
+for k = 2, #sieve do
+  if sieve[k] then
+    stats.primes = stats.primes + 1
+    stats.last = k
+  end
+end
+print(stats.primes)
+print(stats.last)
@@ -0,0 +1,8 @@
+-- Numeric while loops over locals.
+local i = 0
+local sum = 0
+while i < 5000000 do
+  sum = sum + i * 2 - 1
+  i = i + 1
+end
+print(sum)
@@ -34,24 +34,213 @@ for test_file in test/*.lua; do
     expected_file=${test_file%.lua}.expected
     output_file=${test_file%.lua}.output
     debug_log=${test_file%.lua}.log
+    profile=${test_file%.lua}.profile
 
-    echo "Running test: $test_file"
-    timeout 30s $COMPILER "$test_file" > "$output_file" 2> "$debug_log"
-
-    if diff -q "$output_file" "$expected_file"; then
-        echo "Test passed!"
-    else
-        echo "Test failed!"
-        echo "Diff:"
-        diff "$output_file" "$expected_file"
-        echo "Output:"
-        cat "$output_file"
-        echo "Expected:"
-        cat "$expected_file"
-        if [ -s "$debug_log" ]; then
-            echo "Debug log:"
-            cat "$debug_log"
+    # Every test also runs on peephole-optimized bytecode, on the
+    # single-pass compiler's bytecode, through the threaded pipeline,
+    # streamed one top-level statement at a time, and recompiled, with and
+    # without -O, from a profile of a run of itself
+    for options in "" "-O" "--single-pass" "--pipeline" "--stream=1" \
+                   "--profile-out=$profile" "--profile-in=$profile" \
+                   "-O --profile-out=$profile" "-O --profile-in=$profile"; do
+        echo "Running test: $test_file $options"
+        timeout 30s $COMPILER $options "$test_file" > "$output_file" 2> "$debug_log"
+
+        if diff -q "$output_file" "$expected_file"; then
+            echo "Test passed!"
+        else
+            echo "Test failed!"
+            echo "Diff:"
+            diff "$output_file" "$expected_file"
+            echo "Output:"
+            cat "$output_file"
+            echo "Expected:"
+            cat "$expected_file"
+            if [ -s "$debug_log" ]; then
+                echo "Debug log:"
+                cat "$debug_log"
+            fi
+            exit 1
         fi
-        exit 1
+    done
+done
+
+# The cases below run on luac-release and objects built like it, so that
+# tracing neither slows them down nor adds to their output
+make release test/verifier
+
+report_failure() {
+    echo "Test failed!"
+    echo "Diff:"
+    diff "$1" "$2"
+    if [ -s "$3" ]; then
+        echo "Debug log:"
+        cat "$3"
     fi
+    exit 1
+}
+
+# Chunks the compiler would never emit, which the verifier must reject,
+# and the max_stack it computes for valid ones
+echo "Running test: test/verifier"
+./test/verifier > test/verifier.output 2>&1
+diff -q test/verifier.output test/verifier.expected > /dev/null ||
+    report_failure test/verifier.output test/verifier.expected /dev/null
+echo "Test passed!"
+
+# A recursion whose frames each hold 300 values runs out of stack well
+# before it runs out of frames, which only the verified max_stack catches
+echo "Running test: stack overflow"
+overflow=$(mktemp --suffix=.lua)
+{
+    echo 'function f(n)'
+    echo '    if n == 0 then return 0 end'
+    printf '    return '
+    for i in $(seq 300); do printf '1 + ('; done
+    printf 'f(n - 1)'
+    for i in $(seq 300); do printf ')'; done
+    echo
+    echo 'end'
+    echo 'print(f(10))'
+    echo 'print(f(60))'
+} > "$overflow"
+timeout 30s ./luac-release "$overflow" > test/overflow.output 2> test/overflow.log
+rm -f "$overflow"
+diff -q test/overflow.output <(echo 3000) > /dev/null && grep -q "Stack overflow." test/overflow.log ||
+    report_failure test/overflow.output <(echo 3000) test/overflow.log
+echo "Test passed!"
+
+# --hot-reload, driven from outside: a loop calls value() until it returns
+# "after". A rewrite with a syntax error, which also changes value(), must
+# be ignored as a whole; the valid rewrite after it must be picked up.
+echo "Running test: hot reload"
+reloaded=$(mktemp --suffix=.lua)
+write_script() {
+    {
+        echo 'function value()'
+        echo "    return \"$1\""
+        echo 'end'
+        echo "$2"
+        echo 'local last = nil'
+        echo 'while last ~= "after" do'
+        echo '    local current = value()'
+        echo '    if current ~= last then'
+        echo '        print(current)'
+        echo '        last = current'
+        echo '    end'
+        echo 'end'
+    } > "$reloaded"
+}
+wait_for_log() {
+    for i in $(seq 100); do
+        grep -q "$1" test/reload.log && return 0
+        sleep 0.1
+    done
+    return 1
+}
+write_script before ""
+# --foreground, or timeout would also signal itself and its process group
+# and pass on only the first SIGHUP
+timeout --foreground 30s ./luac-release --hot-reload "$reloaded" > test/reload.output 2> test/reload.log &
+program=$!
+# SIGHUP ends the program until it installs its handler, and its output
+# only comes at the end, so give it time to start
+sleep 0.5
+write_script broken 'function syntax_error( end'
+kill -HUP $program
+wait_for_log "has errors"
+write_script after ""
+kill -HUP $program
+wait_for_log "replaced"
+wait $program
+rm -f "$reloaded"
+diff -q test/reload.output <(printf 'before\nafter\n') > /dev/null ||
+    report_failure test/reload.output <(printf 'before\nafter\n') test/reload.log
+echo "Test passed!"
+
+# --serve and --connect: a path served twice comes from the cache, a
+# rewrite of the same size is still picked up, a source comes from stdin,
+# and compile errors, runtime errors and paths that are not scripts get
+# their own exit status
+echo "Running test: server"
+socket=$(mktemp -u --suffix=.sock)
+served=$(mktemp --suffix=.lua)
+./luac-release --serve "$socket" 2> test/server.log &
+server=$!
+for i in $(seq 100); do
+    [ -S "$socket" ] && break
+    sleep 0.1
 done
+connect() {
+    timeout 30s ./luac-release --connect "$socket" "$1" 2>> test/server.log
+    echo "status $?"
+}
+{
+    echo 'print("first")' > "$served"
+    connect "$served"
+    connect "$served"
+    echo 'print("again")' > "$served"
+    connect "$served"
+    echo 'print(1 + nil)' > "$served"
+    connect "$served"
+    echo 'print(' > "$served"
+    connect "$served"
+    connect test
+    echo 'print("stdin")' | connect -
+} > test/server.output
+kill $server
+wait $server 2> /dev/null
+rm -f "$socket" "$served"
+server_expected='first\nstatus 0\nfirst\nstatus 0\nagain\nstatus 0\nstatus 70\nstatus 65\nstatus 1\nstdin\nstatus 0\n'
+diff -q test/server.output <(printf "$server_expected") > /dev/null && grep -q "Error opening file" test/server.log ||
+    report_failure test/server.output <(printf "$server_expected") test/server.log
+echo "Test passed!"
+
+# --profile on a loop that spends all its time in spin(): both reports
+# must be written and name it, whatever the sample counts
+echo "Running test: profiler"
+profiled=$(mktemp --suffix=.lua)
+profile=$(mktemp)
+cat > "$profiled" <<'LUA'
+function spin(n)
+    local total = 0
+    local i = 0
+    while i < n do
+        total = total + i
+        i = i + 1
+    end
+    return total
+end
+print(spin(10000000))
+LUA
+timeout 30s ./luac-release --profile="$profile" --profile-hz=10000 "$profiled" > test/profiler.output 2> test/profiler.log
+cat "$profile" "$profile.folded" >> test/profiler.log 2> /dev/null
+diff -q test/profiler.output <(echo 49999995000000) > /dev/null &&
+    grep -q " spin$" "$profile" && grep -q " spin:5$" "$profile" && grep -q "^main;spin " "$profile.folded" ||
+    report_failure test/profiler.output <(echo 49999995000000) test/profiler.log
+rm -f "$profiled" "$profile" "$profile.folded"
+echo "Test passed!"
+
+# --stats=json leaves the program's output alone and counts, on stderr,
+# what it ran: ten calls to double(), each one OP_CALL and a global read
+echo "Running test: stats"
+counted=$(mktemp --suffix=.lua)
+cat > "$counted" <<'LUA'
+function double(x)
+    return x + x
+end
+local i = 0
+local total = 0
+while i < 10 do
+    total = total + double(i)
+    i = i + 1
+end
+print(total)
+LUA
+timeout 30s ./luac-release --stats=json "$counted" > test/stats.output 2> test/stats.log
+rm -f "$counted"
+diff -q test/stats.output <(echo 90) > /dev/null &&
+    grep -q '\["double", 10\]' test/stats.log && grep -q '"OP_CALL": 10,' test/stats.log &&
+    grep -q '"globals": {"reads": 10,' test/stats.log ||
+    report_failure test/stats.output <(echo 90) test/stats.log
+echo "Test passed!"
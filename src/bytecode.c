@@ -3,9 +3,123 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+static const char* opcode_names[OP_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_POP] = "OP_POP",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_NOT] = "OP_NOT",
+    [OP_CONCAT] = "OP_CONCAT",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NIL] = "OP_NIL",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+    [OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+    [OP_FORPREP] = "OP_FORPREP",
+    [OP_FORLOOP] = "OP_FORLOOP",
+    [OP_NEW_TABLE] = "OP_NEW_TABLE",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_INIT_FIELD] = "OP_INIT_FIELD",
+    [OP_SET_LIST] = "OP_SET_LIST",
+    [OP_LENGTH] = "OP_LENGTH",
+    [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+    [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+    [OP_POP_JUMP_IF_TRUE] = "OP_POP_JUMP_IF_TRUE",
+    [OP_INLINE_GUARD] = "OP_INLINE_GUARD",
+    [OP_ADD_INT] = "OP_ADD_INT",
+    [OP_ADD_FLOAT] = "OP_ADD_FLOAT",
+    [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+    [OP_SUBTRACT_FLOAT] = "OP_SUBTRACT_FLOAT",
+    [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+    [OP_MULTIPLY_FLOAT] = "OP_MULTIPLY_FLOAT",
+    [OP_GREATER_INT] = "OP_GREATER_INT",
+    [OP_GREATER_FLOAT] = "OP_GREATER_FLOAT",
+    [OP_GREATER_EQUAL_INT] = "OP_GREATER_EQUAL_INT",
+    [OP_GREATER_EQUAL_FLOAT] = "OP_GREATER_EQUAL_FLOAT",
+    [OP_LESS_INT] = "OP_LESS_INT",
+    [OP_LESS_FLOAT] = "OP_LESS_FLOAT",
+    [OP_LESS_EQUAL_INT] = "OP_LESS_EQUAL_INT",
+    [OP_LESS_EQUAL_FLOAT] = "OP_LESS_EQUAL_FLOAT",
+};
+
+/**
+ * @brief Returns the name of an opcode.
+ * 
+ * @param opcode The opcode.
+ * @return The opcode's name, or "OP_UNKNOWN" for invalid values.
+ */
+const char* opcode_name(uint8_t opcode) {
+    if (opcode >= OP_COUNT || opcode_names[opcode] == NULL) return "OP_UNKNOWN";
+    return opcode_names[opcode];
+}
+
+/**
+ * @brief Returns the size of an instruction in bytes, operands included.
+ * 
+ * @param opcode The opcode.
+ * @return The size, or 0 for invalid opcodes.
+ */
+int instruction_length(uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONSTANT:
+        case OP_SET_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_GET_LOCAL:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return 2;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_JUMP:
+        case OP_NEW_TABLE:
+            return 3;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_FORPREP:
+        case OP_FORLOOP:
+        case OP_INLINE_GUARD:
+            return 4;
+        case OP_SET_LIST:
+            return 5;
+        default:
+            return opcode < OP_COUNT ? 1 : 0;
+    }
+}
+
 static int local_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
     uint8_t local_index = chunk->code[offset + 1];
-    fprintf(stream, "%-16s %4d '%s'\n", name, local_index, chunk->locals[local_index]);
+    // Block locals are gone once their block is compiled, so only the
+    // outermost scope still has names.
+    if (local_index < chunk->locals_count) {
+        fprintf(stream, "%-16s %4d '%s'\n", name, local_index, chunk->locals[local_index]);
+    } else {
+        fprintf(stream, "%-16s %4d\n", name, local_index);
+    }
     return offset + 2;
 }
 
@@ -14,6 +128,12 @@ static int simple_instruction(const char* name, int offset, FILE* stream) {
     return offset + 1;
 }
 
+static int byte_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint8_t operand = chunk->code[offset + 1];
+    fprintf(stream, "%-16s %4d\n", name, operand);
+    return offset + 2;
+}
+
 static int constant_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
     uint8_t constant_index = chunk->code[offset + 1];
     fprintf(stream, "%-16s %4d '", name, constant_index);
@@ -22,13 +142,48 @@ static int constant_instruction(const char* name, Chunk* chunk, int offset, FILE
     return offset + 2;
 }
 
+static int constant_long_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint32_t constant_index = (chunk->code[offset + 1] << 16) | (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    fprintf(stream, "%-16s %4d '", name, constant_index);
+    print_value_to_stream(stream, chunk->constants[constant_index]);
+    fprintf(stream, "'\n");
+    return offset + 4;
+}
 
 static int short_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
-    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]);
+    int16_t jump = (int16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]);
     fprintf(stream, "%-16s %4d\n", name, offset + 3 + jump);
     return offset + 3;
 }
 
+static int for_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint8_t base = chunk->code[offset + 1];
+    int16_t jump = (int16_t)(chunk->code[offset + 2] << 8 | chunk->code[offset + 3]);
+    fprintf(stream, "%-16s %4d -> %d\n", name, base, offset + 4 + jump);
+    return offset + 4;
+}
+
+static int guard_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint8_t index = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8 | chunk->code[offset + 3]);
+    fprintf(stream, "%-16s %4d '%s' -> %d\n", name, index, chunk->inlined[index]->name, offset + 4 + jump);
+    return offset + 4;
+}
+
+static int table_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint8_t array_size = chunk->code[offset + 1];
+    uint8_t hash_size = chunk->code[offset + 2];
+    fprintf(stream, "%-16s %4d %d\n", name, array_size, hash_size);
+    return offset + 3;
+}
+
+static int set_list_instruction(const char* name, Chunk* chunk, int offset, FILE* stream) {
+    uint8_t count = chunk->code[offset + 1];
+    uint32_t first = (chunk->code[offset + 2] << 16) | (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+    fprintf(stream, "%-16s %4d @%u\n", name, count, first);
+    return offset + 5;
+}
+
 void disassemble_instruction_to_stream(FILE* stream, Chunk* chunk, int offset) {
     fprintf(stream, "%04d ", offset);
     if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
@@ -40,7 +195,10 @@ void disassemble_instruction_to_stream(FILE* stream, Chunk* chunk, int offset) {
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
         case OP_CALL:
-            simple_instruction("OP_CALL", offset, stream);
+            byte_instruction("OP_CALL", chunk, offset, stream);
+            break;
+        case OP_TAIL_CALL:
+            byte_instruction("OP_TAIL_CALL", chunk, offset, stream);
             break;
         case OP_RETURN:
             simple_instruction("OP_RETURN", offset, stream);
@@ -120,6 +278,93 @@ void disassemble_instruction_to_stream(FILE* stream, Chunk* chunk, int offset) {
         case OP_CONCAT:
             simple_instruction("OP_CONCAT", offset, stream);
             break;
+        case OP_CONSTANT_LONG:
+            constant_long_instruction("OP_CONSTANT_LONG", chunk, offset, stream);
+            break;
+        case OP_GET_GLOBAL_LONG:
+            constant_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset, stream);
+            break;
+        case OP_SET_GLOBAL_LONG:
+            constant_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset, stream);
+            break;
+        case OP_FORPREP:
+            for_instruction("OP_FORPREP", chunk, offset, stream);
+            break;
+        case OP_FORLOOP:
+            for_instruction("OP_FORLOOP", chunk, offset, stream);
+            break;
+        case OP_NEW_TABLE:
+            table_instruction("OP_NEW_TABLE", chunk, offset, stream);
+            break;
+        case OP_GET_INDEX:
+            simple_instruction("OP_GET_INDEX", offset, stream);
+            break;
+        case OP_SET_INDEX:
+            simple_instruction("OP_SET_INDEX", offset, stream);
+            break;
+        case OP_INIT_FIELD:
+            simple_instruction("OP_INIT_FIELD", offset, stream);
+            break;
+        case OP_SET_LIST:
+            set_list_instruction("OP_SET_LIST", chunk, offset, stream);
+            break;
+        case OP_LENGTH:
+            simple_instruction("OP_LENGTH", offset, stream);
+            break;
+        case OP_JUMP_IF_TRUE:
+            short_instruction("OP_JUMP_IF_TRUE", chunk, offset, stream);
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            short_instruction("OP_POP_JUMP_IF_FALSE", chunk, offset, stream);
+            break;
+        case OP_POP_JUMP_IF_TRUE:
+            short_instruction("OP_POP_JUMP_IF_TRUE", chunk, offset, stream);
+            break;
+        case OP_INLINE_GUARD:
+            guard_instruction("OP_INLINE_GUARD", chunk, offset, stream);
+            break;
+        case OP_ADD_INT:
+            simple_instruction("OP_ADD_INT", offset, stream);
+            break;
+        case OP_ADD_FLOAT:
+            simple_instruction("OP_ADD_FLOAT", offset, stream);
+            break;
+        case OP_SUBTRACT_INT:
+            simple_instruction("OP_SUBTRACT_INT", offset, stream);
+            break;
+        case OP_SUBTRACT_FLOAT:
+            simple_instruction("OP_SUBTRACT_FLOAT", offset, stream);
+            break;
+        case OP_MULTIPLY_INT:
+            simple_instruction("OP_MULTIPLY_INT", offset, stream);
+            break;
+        case OP_MULTIPLY_FLOAT:
+            simple_instruction("OP_MULTIPLY_FLOAT", offset, stream);
+            break;
+        case OP_GREATER_INT:
+            simple_instruction("OP_GREATER_INT", offset, stream);
+            break;
+        case OP_GREATER_FLOAT:
+            simple_instruction("OP_GREATER_FLOAT", offset, stream);
+            break;
+        case OP_GREATER_EQUAL_INT:
+            simple_instruction("OP_GREATER_EQUAL_INT", offset, stream);
+            break;
+        case OP_GREATER_EQUAL_FLOAT:
+            simple_instruction("OP_GREATER_EQUAL_FLOAT", offset, stream);
+            break;
+        case OP_LESS_INT:
+            simple_instruction("OP_LESS_INT", offset, stream);
+            break;
+        case OP_LESS_FLOAT:
+            simple_instruction("OP_LESS_FLOAT", offset, stream);
+            break;
+        case OP_LESS_EQUAL_INT:
+            simple_instruction("OP_LESS_EQUAL_INT", offset, stream);
+            break;
+        case OP_LESS_EQUAL_FLOAT:
+            simple_instruction("OP_LESS_EQUAL_FLOAT", offset, stream);
+            break;
         default:
             fprintf(stream, "Unknown opcode %d\n", instruction);
             break;
@@ -137,7 +382,9 @@ int disassemble_instruction(Chunk* chunk, int offset) {
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
         case OP_CALL:
-            return simple_instruction("OP_CALL", offset, stdout);
+            return byte_instruction("OP_CALL", chunk, offset, stdout);
+        case OP_TAIL_CALL:
+            return byte_instruction("OP_TAIL_CALL", chunk, offset, stdout);
         case OP_RETURN:
             return simple_instruction("OP_RETURN", offset, stdout);
         case OP_CONSTANT:
@@ -190,6 +437,64 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return simple_instruction("OP_NOT", offset, stdout);
         case OP_CONCAT:
             return simple_instruction("OP_CONCAT", offset, stdout);
+        case OP_CONSTANT_LONG:
+            return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset, stdout);
+        case OP_GET_GLOBAL_LONG:
+            return constant_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset, stdout);
+        case OP_SET_GLOBAL_LONG:
+            return constant_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset, stdout);
+        case OP_FORPREP:
+            return for_instruction("OP_FORPREP", chunk, offset, stdout);
+        case OP_FORLOOP:
+            return for_instruction("OP_FORLOOP", chunk, offset, stdout);
+        case OP_NEW_TABLE:
+            return table_instruction("OP_NEW_TABLE", chunk, offset, stdout);
+        case OP_GET_INDEX:
+            return simple_instruction("OP_GET_INDEX", offset, stdout);
+        case OP_SET_INDEX:
+            return simple_instruction("OP_SET_INDEX", offset, stdout);
+        case OP_INIT_FIELD:
+            return simple_instruction("OP_INIT_FIELD", offset, stdout);
+        case OP_SET_LIST:
+            return set_list_instruction("OP_SET_LIST", chunk, offset, stdout);
+        case OP_LENGTH:
+            return simple_instruction("OP_LENGTH", offset, stdout);
+        case OP_JUMP_IF_TRUE:
+            return short_instruction("OP_JUMP_IF_TRUE", chunk, offset, stdout);
+        case OP_POP_JUMP_IF_FALSE:
+            return short_instruction("OP_POP_JUMP_IF_FALSE", chunk, offset, stdout);
+        case OP_POP_JUMP_IF_TRUE:
+            return short_instruction("OP_POP_JUMP_IF_TRUE", chunk, offset, stdout);
+        case OP_INLINE_GUARD:
+            return guard_instruction("OP_INLINE_GUARD", chunk, offset, stdout);
+        case OP_ADD_INT:
+            return simple_instruction("OP_ADD_INT", offset, stdout);
+        case OP_ADD_FLOAT:
+            return simple_instruction("OP_ADD_FLOAT", offset, stdout);
+        case OP_SUBTRACT_INT:
+            return simple_instruction("OP_SUBTRACT_INT", offset, stdout);
+        case OP_SUBTRACT_FLOAT:
+            return simple_instruction("OP_SUBTRACT_FLOAT", offset, stdout);
+        case OP_MULTIPLY_INT:
+            return simple_instruction("OP_MULTIPLY_INT", offset, stdout);
+        case OP_MULTIPLY_FLOAT:
+            return simple_instruction("OP_MULTIPLY_FLOAT", offset, stdout);
+        case OP_GREATER_INT:
+            return simple_instruction("OP_GREATER_INT", offset, stdout);
+        case OP_GREATER_FLOAT:
+            return simple_instruction("OP_GREATER_FLOAT", offset, stdout);
+        case OP_GREATER_EQUAL_INT:
+            return simple_instruction("OP_GREATER_EQUAL_INT", offset, stdout);
+        case OP_GREATER_EQUAL_FLOAT:
+            return simple_instruction("OP_GREATER_EQUAL_FLOAT", offset, stdout);
+        case OP_LESS_INT:
+            return simple_instruction("OP_LESS_INT", offset, stdout);
+        case OP_LESS_FLOAT:
+            return simple_instruction("OP_LESS_FLOAT", offset, stdout);
+        case OP_LESS_EQUAL_INT:
+            return simple_instruction("OP_LESS_EQUAL_INT", offset, stdout);
+        case OP_LESS_EQUAL_FLOAT:
+            return simple_instruction("OP_LESS_EQUAL_FLOAT", offset, stdout);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -213,6 +518,13 @@ void init_chunk(Chunk* chunk) {
     chunk->arity = 0;
     chunk->locals_count = 0;
     chunk->locals = NULL;
+    chunk->name = NULL;
+    chunk->line = 0;
+    chunk->max_stack = CHUNK_UNVERIFIED;
+    chunk->inlined = NULL;
+    chunk->inlined_count = 0;
+    chunk->deferred_source = NULL;
+    chunk->deferred_line = 0;
 }
 
 /**
@@ -279,5 +591,7 @@ void free_chunk(Chunk* chunk) {
     }
     free(chunk->locals);
     free(chunk->constants);
+    free(chunk->name);
+    free(chunk->inlined);
     init_chunk(chunk);
 }
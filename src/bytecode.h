@@ -28,17 +28,55 @@ typedef enum {
     OP_JUMP_IF_FALSE,
     OP_JUMP,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_RETURN,
     OP_TRUE,
     OP_FALSE,
-    OP_NIL
+    OP_NIL,
+    OP_CONSTANT_LONG,
+    OP_GET_GLOBAL_LONG,
+    OP_SET_GLOBAL_LONG,
+    OP_FORPREP,
+    OP_FORLOOP,
+    OP_NEW_TABLE,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_INIT_FIELD,
+    OP_SET_LIST,
+    OP_LENGTH,
+    // Emitted by the peephole optimizer, and for if statements laid out
+    // from a profile
+    OP_JUMP_IF_TRUE,
+    OP_POP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_TRUE,
+    // Emitted only for calls the AST optimizer inlined
+    OP_INLINE_GUARD,
+    // Quickened forms, written over the generic instruction by the VM, or
+    // emitted by codegen where the optimizer proved the operand subtypes
+    OP_ADD_INT,
+    OP_ADD_FLOAT,
+    OP_SUBTRACT_INT,
+    OP_SUBTRACT_FLOAT,
+    OP_MULTIPLY_INT,
+    OP_MULTIPLY_FLOAT,
+    OP_GREATER_INT,
+    OP_GREATER_FLOAT,
+    OP_GREATER_EQUAL_INT,
+    OP_GREATER_EQUAL_FLOAT,
+    OP_LESS_INT,
+    OP_LESS_FLOAT,
+    OP_LESS_EQUAL_INT,
+    OP_LESS_EQUAL_FLOAT,
+    OP_COUNT // Number of opcodes, not an instruction
 } OpCode;
 
 void init_chunk(Chunk* chunk);
 void write_chunk(Chunk* chunk, uint8_t byte, int line);
 void write_short(Chunk* chunk, uint16_t value, int line);
 int add_constant(Chunk* chunk, Value value);
+const char* opcode_name(uint8_t opcode);
 void free_chunk(Chunk* chunk);
+int instruction_length(uint8_t opcode);
 int disassemble_instruction(Chunk* chunk, int offset);
 void disassemble_instruction_to_stream(FILE* stream, Chunk* chunk, int offset);
 
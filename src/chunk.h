@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include "value.h"
 
+// max_stack of a chunk verify_chunk has not checked yet, more than any
+// stack can hold
+#define CHUNK_UNVERIFIED INT32_MAX
+
 typedef struct Chunk {
     int count;
     int capacity;
@@ -16,6 +20,17 @@ typedef struct Chunk {
     int arity;
     int locals_count;
     char** locals;
+    char* name; // Function name, NULL for the main chunk
+    int line;   // Where the function is defined, 0 for the main chunk
+    int max_stack;  // The most values its frame holds at once, arguments included
+    // Functions whose calls were inlined here, which OP_INLINE_GUARD
+    // compares the callee against; the chunks that define them own them
+    struct Chunk** inlined;
+    int inlined_count;
+    // Where the definition of a function not compiled yet starts, or NULL;
+    // the VM compiles it from there on its first call
+    const char* deferred_source;
+    int deferred_line;
 } Chunk;
 
 #endif // CHUNK_H
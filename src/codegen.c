@@ -5,8 +5,530 @@
 #include <stdlib.h>
 
 // Forward declarations
-static void generate_expression(struct ASTNode* node, Chunk* chunk);
-static void generate_statement(struct ASTNode* node, Chunk* chunk);
+static void generate_expression(NodeId id, Chunk* chunk);
+static void generate_statement(NodeId id, Chunk* chunk);
+static void generate_call(struct ASTNode* node, Chunk* chunk, OpCode op);
+static void generate_arguments(struct ASTNode* node, Chunk* chunk, OpCode op);
+
+/**
+ * @brief The AST code is being generated from.
+ */
+static AST* current_ast;
+
+static struct ASTNode* node_at(NodeId id) {
+    return ast_node(current_ast, id);
+}
+
+/**
+ * @brief The profile guiding code generation, or NULL.
+ */
+static const Feedback* feedback;
+
+/**
+ * @brief How many sites of each kind each line of each chunk has had so
+ * far. It lives for one generate_code call.
+ */
+static SiteOrdinals site_ordinals;
+
+/**
+ * @brief Makes code generation, from now on, use a profile of a training
+ * run: an if whose then branch ran more often gets it last, where it
+ * falls through to the code after the if, and an operator that only saw
+ * one subtype of operands starts out quickened for it.
+ *
+ * @param profile The profile, which must outlive every function compiled
+ * later, or NULL to stop using one.
+ */
+void use_feedback(const Feedback* profile) {
+    feedback = profile;
+}
+
+/**
+ * @brief Counts a site about to be emitted, so that each site has the
+ * position among those of its kind on its line that it had in the
+ * training run, and looks it up in the profile. Every site is counted,
+ * whether or not its profile is used.
+ *
+ * @param chunk The chunk the site goes in.
+ * @param op The instruction.
+ * @param line Its line.
+ * @return What the profile has for the site, or NULL.
+ */
+static const Site* count_site(Chunk* chunk, OpCode op, int line) {
+    SiteKind kind = site_kind(op);
+    if (feedback == NULL || kind == SITE_NONE) return NULL;
+    return find_site(feedback, chunk, line, kind, next_ordinal(&site_ordinals, chunk, line, kind));
+}
+
+/**
+ * @brief Emits an instruction that takes a constant index, switching to the
+ * 24-bit _LONG form when the index does not fit in a byte.
+ * 
+ * @param chunk The chunk to write the code to.
+ * @param op OP_CONSTANT, OP_GET_GLOBAL or OP_SET_GLOBAL.
+ * @param constant_index The index of the constant operand.
+ * @param line The source line.
+ */
+void emit_constant_instruction(Chunk* chunk, OpCode op, int constant_index, int line) {
+    if (constant_index <= UINT8_MAX) {
+        write_chunk(chunk, op, line);
+        write_chunk(chunk, constant_index, line);
+        return;
+    }
+
+    switch (op) {
+        case OP_CONSTANT:   write_chunk(chunk, OP_CONSTANT_LONG, line); break;
+        case OP_GET_GLOBAL: write_chunk(chunk, OP_GET_GLOBAL_LONG, line); break;
+        case OP_SET_GLOBAL: write_chunk(chunk, OP_SET_GLOBAL_LONG, line); break;
+        default: break; // Should not happen
+    }
+    write_chunk(chunk, (constant_index >> 16) & 0xFF, line);
+    write_short(chunk, constant_index & 0xFFFF, line);
+}
+
+/**
+ * @brief An entry of the string constant table: the constant with the
+ * given text in the given chunk.
+ */
+typedef struct {
+    Chunk* chunk;   // NULL for an empty slot
+    uint32_t hash;
+    int index;
+} StringConstant;
+
+/**
+ * @brief String constants already added to each chunk, so a name or
+ * literal used many times is copied once. Open-addressed by chunk and
+ * text; it lives for one generate_code call.
+ */
+static struct {
+    StringConstant* entries;
+    int count;
+    int capacity;
+} string_constants;
+
+static uint32_t hash_span(Chunk* chunk, Span text) {
+    uint32_t hash = 2166136261u ^ (uint32_t)((uintptr_t)chunk >> 4);
+    for (int i = 0; i < text.length; i++) {
+        hash ^= (uint8_t)text.start[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static int span_equals(Span text, const char* string) {
+    return strncmp(string, text.start, text.length) == 0 && string[text.length] == '\0';
+}
+
+static StringConstant* find_string_constant(StringConstant* entries, int capacity, Chunk* chunk, Span text, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        StringConstant* entry = &entries[index];
+        if (entry->chunk == NULL) return entry;
+        if (entry->chunk == chunk && entry->hash == hash &&
+            span_equals(text, chunk->constants[entry->index].as.string)) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+/**
+ * @brief Returns the index of a string constant with the given text,
+ * adding it to the chunk the first time. Constants outlive the source, so
+ * this is where the text gets copied.
+ * 
+ * @param chunk The chunk that owns the constant.
+ * @param text The text of the string.
+ * @return The constant's index.
+ */
+int string_constant(Chunk* chunk, Span text) {
+    if (string_constants.count + 1 > string_constants.capacity * 0.75) {
+        int capacity = string_constants.capacity < 64 ? 64 : string_constants.capacity * 2;
+        StringConstant* entries = (StringConstant*)calloc(capacity, sizeof(StringConstant));
+        for (int i = 0; i < string_constants.capacity; i++) {
+            StringConstant* entry = &string_constants.entries[i];
+            if (entry->chunk == NULL) continue;
+            uint32_t index = entry->hash & (capacity - 1);
+            while (entries[index].chunk != NULL) index = (index + 1) & (capacity - 1);
+            entries[index] = *entry;
+        }
+        free(string_constants.entries);
+        string_constants.entries = entries;
+        string_constants.capacity = capacity;
+    }
+
+    uint32_t hash = hash_span(chunk, text);
+    StringConstant* entry = find_string_constant(string_constants.entries, string_constants.capacity, chunk, text, hash);
+    if (entry->chunk == NULL) {
+        Value value = {VAL_STRING, {.string = strndup(text.start, text.length)}};
+        entry->chunk = chunk;
+        entry->hash = hash;
+        entry->index = add_constant(chunk, value);
+        string_constants.count++;
+    }
+    return entry->index;
+}
+
+void free_string_constants() {
+    free(string_constants.entries);
+    string_constants.entries = NULL;
+    string_constants.count = 0;
+    string_constants.capacity = 0;
+}
+
+/**
+ * @brief An entry of the function chunk table: the chunk generated for a
+ * function definition.
+ */
+typedef struct {
+    struct ASTNode* definition;     // NULL for an empty slot
+    Chunk* chunk;
+} FunctionChunk;
+
+/**
+ * @brief The chunk of each function definition generated so far. An
+ * inlined call needs the chunk of the function it inlined, which may come
+ * before the definition itself. Open-addressed by node; it lives for one
+ * generate_code call.
+ */
+static struct {
+    FunctionChunk* entries;
+    int count;
+    int capacity;
+} function_chunks;
+
+static FunctionChunk* find_function_chunk(FunctionChunk* entries, int capacity, struct ASTNode* definition) {
+    uint32_t index = (uint32_t)((uintptr_t)definition >> 4) * 2654435761u & (capacity - 1);
+    while (entries[index].definition != NULL && entries[index].definition != definition) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+static void free_function_chunks() {
+    free(function_chunks.entries);
+    function_chunks.entries = NULL;
+    function_chunks.count = 0;
+    function_chunks.capacity = 0;
+}
+
+/**
+ * @brief Looks up a local variable by name.
+ * 
+ * @param chunk The chunk whose locals to search.
+ * @param name The variable name.
+ * @return The local's slot, or -1 if it is not a local.
+ */
+int resolve_local(Chunk* chunk, Span name) {
+    // Search backwards so the most recent declaration wins
+    for (int i = chunk->locals_count - 1; i >= 0; i--) {
+        if (span_equals(name, chunk->locals[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Declares a local in the next free stack slot.
+ * 
+ * @param chunk The chunk that owns the local.
+ * @param name The variable name. It is copied, since the disassembler
+ * shows local names after the source is gone.
+ * @return The local's slot.
+ */
+int add_local(Chunk* chunk, Span name) {
+    chunk->locals = (char**)realloc(chunk->locals, sizeof(char*) * (chunk->locals_count + 1));
+    chunk->locals[chunk->locals_count] = strndup(name.start, name.length);
+    return chunk->locals_count++;
+}
+
+/**
+ * @brief Wraps a NUL-terminated string in a span.
+ */
+static Span span_of(const char* text) {
+    return (Span){text, (int)strlen(text)};
+}
+
+/**
+ * @brief Ends a scope: pops every local declared since the scope began so
+ * the stack and the slot numbering match again.
+ * 
+ * @param chunk The chunk to write the code to.
+ * @param locals_count The number of locals when the scope began.
+ * @param line The source line.
+ */
+void end_scope(Chunk* chunk, int locals_count, int line) {
+    while (chunk->locals_count > locals_count) {
+        free(chunk->locals[--chunk->locals_count]);
+        write_chunk(chunk, OP_POP, line);
+    }
+}
+
+/**
+ * @brief Generates code for the body of an if, while or for statement.
+ * Locals declared in the block go out of scope at its end.
+ * 
+ * @param node The block, a NODE_STATEMENTS node.
+ * @param chunk The chunk to write the code to.
+ */
+static void generate_block(NodeId id, Chunk* chunk) {
+    int locals_count = chunk->locals_count;
+    generate_statement(id, chunk);
+    end_scope(chunk, locals_count, node_at(id)->line);
+}
+
+/**
+ * @brief Generates the code of a function into its chunk.
+ * 
+ * @param node The NODE_FUNCTION_DEF node, with its body.
+ * @param func_chunk The function's chunk, which has no code yet.
+ */
+static void generate_function_body(struct ASTNode* node, Chunk* func_chunk) {
+    func_chunk->arity = 0;
+    struct ASTNode* param = node_at(node->data.function_def.parameters);
+    while (param) {
+        func_chunk->arity++;
+        add_local(func_chunk, param->data.identifier_name);
+        param = node_at(param->next);
+    }
+
+    generate_statement(node->data.function_def.body, func_chunk);
+    // Falling off the end of a function returns nil
+    write_chunk(func_chunk, OP_NIL, node->line);
+    write_chunk(func_chunk, OP_RETURN, node->line);
+}
+
+/**
+ * @brief Returns the chunk of a function definition, generating it the
+ * first time. A definition whose body was deferred gets a chunk without
+ * code, which generate_deferred_function fills in later.
+ * 
+ * @param node The NODE_FUNCTION_DEF node.
+ * @return The function's chunk, which belongs in the constants of the
+ * chunk holding the definition.
+ */
+static Chunk* generate_function(struct ASTNode* node) {
+    if (function_chunks.count + 1 > function_chunks.capacity * 0.75) {
+        int capacity = function_chunks.capacity < 16 ? 16 : function_chunks.capacity * 2;
+        FunctionChunk* entries = (FunctionChunk*)calloc(capacity, sizeof(FunctionChunk));
+        for (int i = 0; i < function_chunks.capacity; i++) {
+            FunctionChunk* entry = &function_chunks.entries[i];
+            if (entry->definition != NULL) *find_function_chunk(entries, capacity, entry->definition) = *entry;
+        }
+        free(function_chunks.entries);
+        function_chunks.entries = entries;
+        function_chunks.capacity = capacity;
+    }
+    FunctionChunk* entry = find_function_chunk(function_chunks.entries, function_chunks.capacity, node);
+    if (entry->definition != NULL) return entry->chunk;
+
+    Chunk* func_chunk = (Chunk*)malloc(sizeof(Chunk));
+    init_chunk(func_chunk);
+    func_chunk->locals_count = 0;
+    Span name = node_at(node->data.function_def.name)->data.identifier_name;
+    func_chunk->name = strndup(name.start, name.length);
+    func_chunk->line = node->line;
+    // Recorded before the body is generated, since the body may add
+    // entries and move the table
+    entry->definition = node;
+    entry->chunk = func_chunk;
+    function_chunks.count++;
+
+    if (node->data.function_def.body == 0) {
+        // Compiled by the VM when first called; callers need the arity now
+        for (struct ASTNode* param = node_at(node->data.function_def.parameters); param; param = node_at(param->next)) {
+            func_chunk->arity++;
+        }
+        func_chunk->deferred_source = node->data.function_def.source;
+        func_chunk->deferred_line = node->line;
+        return func_chunk;
+    }
+    generate_function_body(node, func_chunk);
+    return func_chunk;
+}
+
+/**
+ * @brief Generates a call the optimizer inlined: the callee is checked to
+ * still be the function that was inlined, and the inlined body runs in
+ * its place; otherwise the arguments are evaluated and the function is
+ * called as usual.
+ * 
+ * @param node The NODE_INLINE_CALL node.
+ * @param chunk The chunk to write the code to.
+ */
+static void generate_inline_call(struct ASTNode* node, Chunk* chunk) {
+    struct ASTNode* call = node_at(node->data.inline_call.call);
+    Chunk* function = generate_function(node_at(node->data.inline_call.function));
+    int index = 0;
+    while (index < chunk->inlined_count && chunk->inlined[index] != function) index++;
+    if (index > UINT8_MAX) {
+        generate_call(call, chunk, OP_CALL);
+        return;
+    }
+    if (index == chunk->inlined_count) {
+        chunk->inlined = (Chunk**)realloc(chunk->inlined, sizeof(Chunk*) * (chunk->inlined_count + 1));
+        chunk->inlined[chunk->inlined_count++] = function;
+    }
+
+    generate_expression(call->data.function_call.callee, chunk);
+    count_site(chunk, OP_INLINE_GUARD, node->line);
+    write_chunk(chunk, OP_INLINE_GUARD, node->line);
+    write_chunk(chunk, index, node->line);
+    int call_jump = chunk->count;
+    write_short(chunk, 0, node->line); // Placeholder for jump offset
+
+    generate_expression(node->data.inline_call.body, chunk);
+    write_chunk(chunk, OP_JUMP, node->line);
+    int exit_jump = chunk->count;
+    write_short(chunk, 0, node->line); // Placeholder for jump offset
+
+    // The guard left the callee on the stack
+    chunk->code[call_jump] = (chunk->count - call_jump - 2) >> 8;
+    chunk->code[call_jump + 1] = (chunk->count - call_jump - 2) & 0xFF;
+    generate_arguments(call, chunk, OP_CALL);
+
+    chunk->code[exit_jump] = (chunk->count - exit_jump - 2) >> 8;
+    chunk->code[exit_jump + 1] = (chunk->count - exit_jump - 2) & 0xFF;
+}
+
+/**
+ * @brief Generates code for a function call.
+ * 
+ * @param node The function call node.
+ * @param chunk The chunk to write the code to.
+ * @param op The call instruction to emit, OP_CALL or OP_TAIL_CALL.
+ */
+static void generate_call(struct ASTNode* node, Chunk* chunk, OpCode op) {
+    // Get the function on the stack
+    generate_expression(node->data.function_call.callee, chunk);
+    generate_arguments(node, chunk, op);
+}
+
+/**
+ * @brief Generates the arguments of a function call whose callee is
+ * already on the stack, and the call instruction.
+ * 
+ * @param node The function call node.
+ * @param chunk The chunk to write the code to.
+ * @param op The call instruction to emit, OP_CALL or OP_TAIL_CALL.
+ */
+static void generate_arguments(struct ASTNode* node, Chunk* chunk, OpCode op) {
+    NodeId arg = node->data.function_call.argument;
+    int arg_count = 0;
+    while (arg) {
+        generate_expression(arg, chunk);
+        arg = node_at(arg)->next;
+        arg_count++;
+    }
+    count_site(chunk, op, node->line);
+    write_chunk(chunk, op, node->line);
+    write_chunk(chunk, arg_count, node->line);
+}
+
+/**
+ * @brief Emits an OP_SET_LIST that stores the positional constructor
+ * values on top of the stack at keys first, first + 1, ...
+ */
+void emit_set_list(Chunk* chunk, int count, int first, int line) {
+    write_chunk(chunk, OP_SET_LIST, line);
+    write_chunk(chunk, count, line);
+    write_chunk(chunk, (first >> 16) & 0xFF, line);
+    write_short(chunk, first & 0xFFFF, line);
+}
+
+/**
+ * @brief Generates code for a table constructor. Positional values are
+ * pushed in batches of up to TABLE_FIELDS_PER_FLUSH and stored by a single
+ * OP_SET_LIST, which appends them to the array part. A keyed field is
+ * stored on its own, after flushing the pending batch so the table is
+ * right below its key and value.
+ * 
+ * @param node The NODE_TABLE node.
+ * @param chunk The chunk to write the code to.
+ */
+static void generate_table(struct ASTNode* node, Chunk* chunk) {
+    int array_count = node->data.table.array_count;
+    int hash_count = node->data.table.hash_count;
+    write_chunk(chunk, OP_NEW_TABLE, node->line);
+    write_chunk(chunk, array_count > UINT8_MAX ? UINT8_MAX : array_count, node->line);
+    write_chunk(chunk, hash_count > UINT8_MAX ? UINT8_MAX : hash_count, node->line);
+
+    int pending = 0;    // Positional values on the stack, not yet stored
+    int stored = 0;     // Positional values already stored
+    for (struct ASTNode* field = node_at(node->data.table.fields); field != NULL; field = node_at(field->next)) {
+        if (field->data.table_field.key != 0) {
+            if (pending > 0) {
+                emit_set_list(chunk, pending, stored + 1, field->line);
+                stored += pending;
+                pending = 0;
+            }
+            generate_expression(field->data.table_field.key, chunk);
+            generate_expression(field->data.table_field.value, chunk);
+            write_chunk(chunk, OP_INIT_FIELD, field->line);
+            continue;
+        }
+
+        generate_expression(field->data.table_field.value, chunk);
+        if (++pending == TABLE_FIELDS_PER_FLUSH) {
+            emit_set_list(chunk, pending, stored + 1, field->line);
+            stored += pending;
+            pending = 0;
+        }
+    }
+    if (pending > 0) {
+        emit_set_list(chunk, pending, stored + 1, node->line);
+    }
+}
+
+/**
+ * @brief Returns the instruction of a binary operator other than and/or.
+ */
+OpCode binary_opcode(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUS:          return OP_ADD;
+        case TOKEN_MINUS:         return OP_SUBTRACT;
+        case TOKEN_MUL:           return OP_MULTIPLY;
+        case TOKEN_DIV:           return OP_DIVIDE;
+        case TOKEN_GREATER:       return OP_GREATER;
+        case TOKEN_GREATER_EQUAL: return OP_GREATER_EQUAL;
+        case TOKEN_LESS:          return OP_LESS;
+        case TOKEN_LESS_EQUAL:    return OP_LESS_EQUAL;
+        case TOKEN_EQUAL:         return OP_EQUAL;
+        case TOKEN_NOT_EQUAL:     return OP_NOT_EQUAL;
+        default:                  return OP_CONCAT;
+    }
+}
+
+/**
+ * @brief Returns the instruction of a unary operator.
+ */
+OpCode unary_opcode(TokenType op) {
+    switch (op) {
+        case TOKEN_MINUS: return OP_NEGATE;
+        case TOKEN_NOT:   return OP_NOT;
+        default:          return OP_LENGTH;
+    }
+}
+
+/**
+ * @brief Returns the quickened form of an arithmetic or comparison operator
+ * whose operands the optimizer proved to have one subtype. The VM would
+ * rewrite the generic instruction to it on first execution anyway.
+ */
+static OpCode typed_opcode(TokenType op, OperandTypes operands) {
+    int integer = operands == OPERANDS_INTEGER;
+    switch (op) {
+        case TOKEN_PLUS:          return integer ? OP_ADD_INT : OP_ADD_FLOAT;
+        case TOKEN_MINUS:         return integer ? OP_SUBTRACT_INT : OP_SUBTRACT_FLOAT;
+        case TOKEN_MUL:           return integer ? OP_MULTIPLY_INT : OP_MULTIPLY_FLOAT;
+        case TOKEN_GREATER:       return integer ? OP_GREATER_INT : OP_GREATER_FLOAT;
+        case TOKEN_GREATER_EQUAL: return integer ? OP_GREATER_EQUAL_INT : OP_GREATER_EQUAL_FLOAT;
+        case TOKEN_LESS:          return integer ? OP_LESS_INT : OP_LESS_FLOAT;
+        default:                  return integer ? OP_LESS_EQUAL_INT : OP_LESS_EQUAL_FLOAT;
+    }
+}
 
 /**
  * @brief Generates code for an expression.
@@ -14,7 +536,8 @@ static void generate_statement(struct ASTNode* node, Chunk* chunk);
  * @param node The expression node.
  * @param chunk The chunk to write the code to.
  */
-static void generate_expression(struct ASTNode* node, Chunk* chunk) {
+static void generate_expression(NodeId id, Chunk* chunk) {
+    struct ASTNode* node = node_at(id);
 #ifdef DEBUG_TRACE_CODEGEN
     debug_log("Generating expression for node type %s\n", node_type_to_string(node->type));
 #endif
@@ -22,70 +545,60 @@ static void generate_expression(struct ASTNode* node, Chunk* chunk) {
         case NODE_NUMBER: {
             Value value = {VAL_NUMBER, {.number = node->data.number_value}};
             int constant_index = add_constant(chunk, value);
-            write_chunk(chunk, OP_CONSTANT, node->line);
-            write_chunk(chunk, constant_index, node->line);
+            emit_constant_instruction(chunk, OP_CONSTANT, constant_index, node->line);
             break;
         }
-        case NODE_STRING: {
-            Value value = {VAL_STRING, {.string = strdup(node->data.string_value)}};
+        case NODE_INTEGER: {
+            Value value = {VAL_INTEGER, {.integer = node->data.integer_value}};
             int constant_index = add_constant(chunk, value);
-            write_chunk(chunk, OP_CONSTANT, node->line);
-            write_chunk(chunk, constant_index, node->line);
+            emit_constant_instruction(chunk, OP_CONSTANT, constant_index, node->line);
+            break;
+        }
+        case NODE_STRING: {
+            int constant_index = string_constant(chunk, node->data.string_value);
+            emit_constant_instruction(chunk, OP_CONSTANT, constant_index, node->line);
             break;
         }
         case NODE_IDENTIFIER: {
-            // Check if the identifier is a local variable
-            int local_index = -1;
-            for (int i = 0; i < chunk->locals_count; i++) {
-                if (strcmp(chunk->locals[i], node->data.identifier_name) == 0) {
-                    local_index = i;
-                    break;
-                }
-            }
-
+            int local_index = resolve_local(chunk, node->data.identifier_name);
             if (local_index != -1) {
                 write_chunk(chunk, OP_GET_LOCAL, node->line);
                 write_chunk(chunk, local_index, node->line);
             } else {
-                Value value = {VAL_STRING, {.string = strdup(node->data.identifier_name)}};
-                int constant_index = add_constant(chunk, value);
-                write_chunk(chunk, OP_GET_GLOBAL, node->line);
-                write_chunk(chunk, constant_index, node->line);
+                int constant_index = string_constant(chunk, node->data.identifier_name);
+                emit_constant_instruction(chunk, OP_GET_GLOBAL, constant_index, node->line);
             }
             break;
         }
         case NODE_BINARY_OP: {
             generate_expression(node->data.binary_op.left, chunk);
             generate_expression(node->data.binary_op.right, chunk);
-            switch (node->data.binary_op.op) {
-                case TOKEN_PLUS:          write_chunk(chunk, OP_ADD, node->line); break;
-                case TOKEN_MINUS:         write_chunk(chunk, OP_SUBTRACT, node->line); break;
-                case TOKEN_MUL:           write_chunk(chunk, OP_MULTIPLY, node->line); break;
-                case TOKEN_DIV:           write_chunk(chunk, OP_DIVIDE, node->line); break;
-                case TOKEN_GREATER:       write_chunk(chunk, OP_GREATER, node->line); break;
-                case TOKEN_GREATER_EQUAL: write_chunk(chunk, OP_GREATER_EQUAL, node->line); break;
-                case TOKEN_LESS:          write_chunk(chunk, OP_LESS, node->line); break;
-                case TOKEN_LESS_EQUAL:    write_chunk(chunk, OP_LESS_EQUAL, node->line); break;
-                case TOKEN_EQUAL:         write_chunk(chunk, OP_EQUAL, node->line); break;
-                case TOKEN_NOT_EQUAL:     write_chunk(chunk, OP_NOT_EQUAL, node->line); break;
-                case TOKEN_CONCAT:        write_chunk(chunk, OP_CONCAT, node->line); break;
-                default: break; // Should not happen
+            OperandTypes operands = node->data.binary_op.operands;
+            OpCode op = binary_opcode(node->data.binary_op.op);
+            const Site* site = count_site(chunk, op, node->line);
+            if (operands == OPERANDS_UNKNOWN && site != NULL && site->counts[COUNT_OTHERS] == 0) {
+                // The training run saw one subtype, which the VM would
+                // quicken the instruction for the first time it ran
+                if (site->counts[COUNT_FLOATS] == 0) operands = OPERANDS_INTEGER;
+                if (site->counts[COUNT_INTEGERS] == 0) operands = OPERANDS_FLOAT;
             }
+            if (operands != OPERANDS_UNKNOWN) {
+                write_chunk(chunk, typed_opcode(node->data.binary_op.op, operands), node->line);
+                break;
+            }
+            write_chunk(chunk, op, node->line);
             break;
         }
         case NODE_UNARY_OP: {
             generate_expression(node->data.unary_op.right, chunk);
-            switch (node->data.unary_op.op) {
-                case TOKEN_MINUS: write_chunk(chunk, OP_NEGATE, node->line); break;
-                case TOKEN_NOT: write_chunk(chunk, OP_NOT, node->line); break;
-                default: break; // Should not happen
-            }
+            write_chunk(chunk, unary_opcode(node->data.unary_op.op), node->line);
             break;
         }
         case NODE_LOGICAL_OP: {
             generate_expression(node->data.logical_op.left, chunk);
             switch (node->data.logical_op.op) {
                 case TOKEN_AND: {
+                    count_site(chunk, OP_JUMP_IF_FALSE, node->line);
                     write_chunk(chunk, OP_JUMP_IF_FALSE, node->line);
                     int end_jump = chunk->count;
                     write_short(chunk, 0, node->line);
@@ -96,6 +609,7 @@ static void generate_expression(struct ASTNode* node, Chunk* chunk) {
                     break;
                 }
                 case TOKEN_OR: {
+                    count_site(chunk, OP_JUMP_IF_FALSE, node->line);
                     write_chunk(chunk, OP_JUMP_IF_FALSE, node->line);
                     int else_jump = chunk->count;
                     write_short(chunk, 0, node->line);
@@ -114,24 +628,20 @@ static void generate_expression(struct ASTNode* node, Chunk* chunk) {
             }
             break;
         }
-        case NODE_FUNCTION_CALL: {
-            // Get the function on the stack
-            Value value = {VAL_STRING, {.string = strdup(node->data.function_call.function_name)}};
-            int constant_index = add_constant(chunk, value);
-            write_chunk(chunk, OP_GET_GLOBAL, node->line);
-            write_chunk(chunk, constant_index, node->line);
-
-            struct ASTNode* arg = node->data.function_call.argument;
-            int arg_count = 0;
-            while (arg) {
-                generate_expression(arg, chunk);
-                arg = arg->next;
-                arg_count++;
-            }
-            write_chunk(chunk, OP_CALL, node->line);
-            write_chunk(chunk, arg_count, node->line);
+        case NODE_FUNCTION_CALL:
+            generate_call(node, chunk, OP_CALL);
+            break;
+        case NODE_INLINE_CALL:
+            generate_inline_call(node, chunk);
+            break;
+        case NODE_TABLE:
+            generate_table(node, chunk);
+            break;
+        case NODE_INDEX:
+            generate_expression(node->data.index.object, chunk);
+            generate_expression(node->data.index.key, chunk);
+            write_chunk(chunk, OP_GET_INDEX, node->line);
             break;
-        }
         case NODE_TRUE:
             write_chunk(chunk, OP_TRUE, node->line);
             break;
@@ -146,13 +656,57 @@ static void generate_expression(struct ASTNode* node, Chunk* chunk) {
     }
 }
 
+/**
+ * @brief Generates the branches of an if statement whose condition is on
+ * the stack. The branch that runs when the jump is not taken comes first
+ * and jumps over the other, which falls through to the code after the if.
+ * 
+ * @param node The NODE_IF node.
+ * @param chunk The chunk to write the code to.
+ * @param jump OP_JUMP_IF_FALSE, with the then branch first, or
+ * OP_JUMP_IF_TRUE, with the else branch first.
+ * @param first The branch that comes first. Either branch may be 0, for
+ * an if without else.
+ * @param second The branch that comes last.
+ */
+static void generate_branches(struct ASTNode* node, Chunk* chunk, OpCode jump, NodeId first, NodeId second) {
+    // Emit jump instruction
+    write_chunk(chunk, jump, node->line);
+    int second_jump = chunk->count;
+    write_short(chunk, 0, node->line); // Placeholder for jump offset
+    write_chunk(chunk, OP_POP, node->line); // Pop the condition
+
+    if (first) {
+        generate_block(first, chunk);
+    }
+
+    // Emit jump instruction to skip the second branch
+    write_chunk(chunk, OP_JUMP, node->line);
+    int exit_jump = chunk->count;
+    write_short(chunk, 0, node->line); // Placeholder for jump offset
+
+    // Patch the jump to the second branch
+    chunk->code[second_jump] = (chunk->count - second_jump - 2) >> 8;
+    chunk->code[second_jump + 1] = (chunk->count - second_jump - 2) & 0xFF;
+    write_chunk(chunk, OP_POP, node->line); // Pop the condition
+
+    if (second) {
+        generate_block(second, chunk);
+    }
+
+    // Patch exit jump
+    chunk->code[exit_jump] = (chunk->count - exit_jump - 2) >> 8;
+    chunk->code[exit_jump + 1] = (chunk->count - exit_jump - 2) & 0xFF;
+}
+
 /**
  * @brief Generates code for a statement.
  * 
  * @param node The statement node.
  * @param chunk The chunk to write the code to.
  */
-static void generate_statement(struct ASTNode* node, Chunk* chunk) {
+static void generate_statement(NodeId id, Chunk* chunk) {
+    struct ASTNode* node = node_at(id);
 #ifdef DEBUG_TRACE_CODEGEN
     debug_log("Generating statement for node type %s\n", node_type_to_string(node->type));
 #endif
@@ -164,65 +718,103 @@ static void generate_statement(struct ASTNode* node, Chunk* chunk) {
             break;
         case NODE_ASSIGN: {
             generate_expression(node->data.assignment.expression, chunk);
-            Value value = {VAL_STRING, {.string = strdup(node->data.assignment.identifier)}};
-            int constant_index = add_constant(chunk, value);
-            write_chunk(chunk, OP_SET_GLOBAL, node->line);
-            write_chunk(chunk, constant_index, node->line);
+            int local_index = resolve_local(chunk, node->data.assignment.identifier);
+            if (local_index != -1) {
+                write_chunk(chunk, OP_SET_LOCAL, node->line);
+                write_chunk(chunk, local_index, node->line);
+                write_chunk(chunk, OP_POP, node->line);
+                break;
+            }
+            int constant_index = string_constant(chunk, node->data.assignment.identifier);
+            emit_constant_instruction(chunk, OP_SET_GLOBAL, constant_index, node->line);
+            write_chunk(chunk, OP_POP, node->line);
             break;
         }
+        case NODE_INDEX_ASSIGN:
+            generate_expression(node->data.index_assign.object, chunk);
+            generate_expression(node->data.index_assign.key, chunk);
+            generate_expression(node->data.index_assign.value, chunk);
+            write_chunk(chunk, OP_SET_INDEX, node->line);
+            break;
         case NODE_IF: {
             generate_expression(node->data.if_statement.condition, chunk);
+            const Site* site = count_site(chunk, OP_JUMP_IF_FALSE, node->line);
+            if (site != NULL && site->counts[COUNT_TRUTHY] > site->counts[COUNT_FALSEY]) {
+                // The then branch goes last, where it needs no jump to
+                // reach the code after the if
+                generate_branches(node, chunk, OP_JUMP_IF_TRUE, node->data.if_statement.else_branch,
+                                  node->data.if_statement.then_branch);
+            } else {
+                generate_branches(node, chunk, OP_JUMP_IF_FALSE, node->data.if_statement.then_branch,
+                                  node->data.if_statement.else_branch);
+            }
+            break;
+        }
+        case NODE_WHILE: {
+            int loop_start = chunk->count;
+            generate_expression(node->data.while_statement.condition, chunk);
 
             // Emit jump instruction
+            count_site(chunk, OP_JUMP_IF_FALSE, node->line);
             write_chunk(chunk, OP_JUMP_IF_FALSE, node->line);
-            int else_jump = chunk->count;
-            write_short(chunk, 0, node->line); // Placeholder for jump offset
-
-            generate_statement(node->data.if_statement.then_branch, chunk);
-
-            // Emit jump instruction to skip else block
-            write_chunk(chunk, OP_JUMP, node->line);
             int exit_jump = chunk->count;
             write_short(chunk, 0, node->line); // Placeholder for jump offset
+            write_chunk(chunk, OP_POP, node->line); // Pop the condition
 
-            // Patch else jump
-            chunk->code[else_jump] = (chunk->count - else_jump - 2) >> 8;
-            chunk->code[else_jump + 1] = (chunk->count - else_jump - 2) & 0xFF;
+            generate_block(node->data.while_statement.body, chunk);
 
-            if (node->data.if_statement.else_branch) {
-                generate_statement(node->data.if_statement.else_branch, chunk);
-            }
+            // Emit jump to loop start
+            write_chunk(chunk, OP_JUMP, node->line);
+            write_short(chunk, (int16_t)(loop_start - chunk->count - 2), node->line);
 
             // Patch exit jump
             chunk->code[exit_jump] = (chunk->count - exit_jump - 2) >> 8;
             chunk->code[exit_jump + 1] = (chunk->count - exit_jump - 2) & 0xFF;
+            write_chunk(chunk, OP_POP, node->line); // Pop the condition
             break;
         }
-        case NODE_WHILE: {
-            int loop_start = chunk->count;
-            generate_expression(node->data.while_statement.condition, chunk);
+        case NODE_FOR: {
+            // The counter, limit and step live in three hidden locals below
+            // the loop variable, so OP_FORLOOP can step, test and branch in
+            // a single instruction.
+            int locals_count = chunk->locals_count;
+            generate_expression(node->data.for_statement.start, chunk);
+            generate_expression(node->data.for_statement.limit, chunk);
+            if (node->data.for_statement.step) {
+                generate_expression(node->data.for_statement.step, chunk);
+            } else {
+                Value one = {VAL_INTEGER, {.integer = 1}};
+                emit_constant_instruction(chunk, OP_CONSTANT, add_constant(chunk, one), node->line);
+            }
+            write_chunk(chunk, OP_NIL, node->line);
+            int base = add_local(chunk, span_of("(for index)"));
+            add_local(chunk, span_of("(for limit)"));
+            add_local(chunk, span_of("(for step)"));
+            add_local(chunk, node_at(node->data.for_statement.variable)->data.identifier_name);
 
-            // Emit jump instruction
-            write_chunk(chunk, OP_JUMP_IF_FALSE, node->line);
+            write_chunk(chunk, OP_FORPREP, node->line);
+            write_chunk(chunk, base, node->line);
             int exit_jump = chunk->count;
             write_short(chunk, 0, node->line); // Placeholder for jump offset
 
-            generate_statement(node->data.while_statement.body, chunk);
+            int body_start = chunk->count;
+            generate_block(node->data.for_statement.body, chunk);
 
-            // Emit jump to loop start
-            write_chunk(chunk, OP_JUMP, node->line);
-            write_short(chunk, (int16_t)(loop_start - chunk->count - 2), node->line);
+            write_chunk(chunk, OP_FORLOOP, node->line);
+            write_chunk(chunk, base, node->line);
+            write_short(chunk, (int16_t)(body_start - chunk->count - 2), node->line);
 
             // Patch exit jump
             chunk->code[exit_jump] = (chunk->count - exit_jump - 2) >> 8;
             chunk->code[exit_jump + 1] = (chunk->count - exit_jump - 2) & 0xFF;
+            end_scope(chunk, locals_count, node->line);
             break;
         }
         case NODE_STATEMENTS: {
-            struct ASTNode* current = node->data.statements.statement;
+            NodeId current = node->data.statements.statement;
             while (current) {
                 generate_statement(current, chunk);
-                current = current->next;
+                current = node_at(current)->next;
             }
             break;
         }
@@ -232,35 +824,28 @@ static void generate_statement(struct ASTNode* node, Chunk* chunk) {
             break;
         }
         case NODE_FUNCTION_DEF: {
-            Chunk* func_chunk = (Chunk*)malloc(sizeof(Chunk));
-            init_chunk(func_chunk);
-            func_chunk->locals_count = 0;
-            
-            struct ASTNode* param = node->data.function_def.parameters;
-            while (param) {
-                func_chunk->arity++;
-                func_chunk->locals_count++;
-                func_chunk->locals = (char**)realloc(func_chunk->locals, sizeof(char*) * func_chunk->locals_count);
-                func_chunk->locals[func_chunk->locals_count - 1] = strdup(param->data.identifier_name);
-                param = param->next;
-            }
-
-            generate_statement(node->data.function_def.body, func_chunk);
-            write_chunk(func_chunk, OP_RETURN, node->line);
-
+            Chunk* func_chunk = generate_function(node);
             Value func_val = {VAL_FUNCTION, {.function = func_chunk}};
             int constant_index = add_constant(chunk, func_val);
-            write_chunk(chunk, OP_CONSTANT, node->line);
-            write_chunk(chunk, constant_index, node->line);
+            emit_constant_instruction(chunk, OP_CONSTANT, constant_index, node->line);
 
-            Value name_val = {VAL_STRING, {.string = strdup(node->data.function_def.function_name)}};
-            constant_index = add_constant(chunk, name_val);
-            write_chunk(chunk, OP_SET_GLOBAL, node->line);
-            write_chunk(chunk, constant_index, node->line);
+            constant_index = string_constant(chunk, node_at(node->data.function_def.name)->data.identifier_name);
+            emit_constant_instruction(chunk, OP_SET_GLOBAL, constant_index, node->line);
+            write_chunk(chunk, OP_POP, node->line);
             break;
         }
         case NODE_RETURN: {
-            generate_expression(node->data.return_statement.expression, chunk);
+            struct ASTNode* expression = node_at(node->data.return_statement.expression);
+            if (expression == NULL) {
+                write_chunk(chunk, OP_NIL, node->line);
+            } else if (expression->type == NODE_FUNCTION_CALL) {
+                // return f(...) reuses the current frame. The OP_RETURN that
+                // follows is only reached when the VM cannot do that, e.g. at
+                // the top level.
+                generate_call(expression, chunk, OP_TAIL_CALL);
+            } else {
+                generate_expression(expression->id, chunk);
+            }
             write_chunk(chunk, OP_RETURN, node->line);
             break;
         }
@@ -270,10 +855,9 @@ static void generate_statement(struct ASTNode* node, Chunk* chunk) {
             } else {
                 write_chunk(chunk, OP_NIL, node->line);
             }
-            chunk->locals = (char**)realloc(chunk->locals, sizeof(char*) * (chunk->locals_count + 1));
-            chunk->locals[chunk->locals_count] = strdup(node->data.local_declaration.identifier);
-            write_chunk(chunk, OP_SET_LOCAL, node->line);
-            write_chunk(chunk, chunk->locals_count++, node->line);
+            // The value is already on top of the stack, which is the new
+            // local's slot
+            add_local(chunk, node->data.local_declaration.identifier);
             break;
         }
         default:
@@ -284,10 +868,72 @@ static void generate_statement(struct ASTNode* node, Chunk* chunk) {
 /**
  * @brief Generates code for the given AST.
  * 
- * @param node The root of the AST.
+ * @param ast The AST.
+ * @param chunk The chunk to write the code to.
+ */
+void generate_code(AST* ast, Chunk* chunk) {
+    generate_top_level(ast, ast->root, chunk);
+    finish_code(chunk);
+}
+
+/**
+ * @brief Generates the code of one top-level statement, after the code of
+ * the statements before it. finish_code ends the program.
+ * 
+ * @param ast The AST holding the statement. Only its pages are used, so
+ * it may be a view of a tree that is still growing.
+ * @param statement The statement.
  * @param chunk The chunk to write the code to.
  */
-void generate_code(struct ASTNode* node, Chunk* chunk) {
-    generate_statement(node, chunk);
-    write_chunk(chunk, OP_RETURN, -1); // No line number for return
+void generate_top_level(AST* ast, NodeId statement, Chunk* chunk) {
+    current_ast = ast;
+    generate_statement(statement, chunk);
+}
+
+/**
+ * @brief Ends the program generate_top_level wrote to a chunk.
+ * 
+ * @param chunk The chunk to write the code to.
+ */
+void finish_code(Chunk* chunk) {
+    write_chunk(chunk, OP_NIL, -1); // No line number for return
+    write_chunk(chunk, OP_RETURN, -1);
+    free_string_constants();
+    free_function_chunks();
+    free_site_ordinals(&site_ordinals);
+}
+
+/**
+ * @brief Generates the chunk of a single function definition, outside the
+ * program that defines it, as a reload does for a function that changed.
+ * 
+ * @param ast The AST holding the definition.
+ * @param definition The NODE_FUNCTION_DEF node. With its body deferred,
+ * the chunk is compiled on its first call.
+ * @return The function's chunk. The caller owns it.
+ */
+Chunk* generate_function_code(AST* ast, NodeId definition) {
+    current_ast = ast;
+    Chunk* chunk = generate_function(node_at(definition));
+    free_string_constants();
+    free_function_chunks();
+    free_site_ordinals(&site_ordinals);
+    return chunk;
+}
+
+/**
+ * @brief Generates the code of a function whose body was deferred, once
+ * parse_function has parsed it.
+ * 
+ * @param ast The AST from parse_function.
+ * @param chunk The chunk generate_code made for the function, with no
+ * code yet. Its constants and locals are filled in too.
+ */
+void generate_deferred_function(AST* ast, Chunk* chunk) {
+    current_ast = ast;
+    chunk->deferred_source = NULL;
+    generate_function_body(node_at(ast->root), chunk);
+    free_string_constants();
+    free_function_chunks();
+    free_site_ordinals(&site_ordinals);
 }
\ No newline at end of file
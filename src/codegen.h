@@ -3,7 +3,29 @@
 
 #include "parser.h"
 #include "bytecode.h"
+#include "feedback.h"
 
-void generate_code(struct ASTNode* node, Chunk* chunk);
+// Positional constructor values pushed before an OP_SET_LIST stores them
+#define TABLE_FIELDS_PER_FLUSH 50
+
+void generate_code(AST* ast, Chunk* chunk);
+void generate_deferred_function(AST* ast, Chunk* chunk);
+void generate_top_level(AST* ast, NodeId statement, Chunk* chunk);
+void finish_code(Chunk* chunk);
+Chunk* generate_function_code(AST* ast, NodeId definition);
+void use_feedback(const Feedback* profile);
+
+// Emission helpers, shared with the single-pass compiler so both produce
+// the same bytecode. String constants are deduplicated until
+// free_string_constants is called.
+void emit_constant_instruction(Chunk* chunk, OpCode op, int constant_index, int line);
+void emit_set_list(Chunk* chunk, int count, int first, int line);
+int string_constant(Chunk* chunk, Span text);
+void free_string_constants();
+int resolve_local(Chunk* chunk, Span name);
+int add_local(Chunk* chunk, Span name);
+void end_scope(Chunk* chunk, int locals_count, int line);
+OpCode binary_opcode(TokenType op);
+OpCode unary_opcode(TokenType op);
 
 #endif // CODEGEN_H
@@ -0,0 +1,704 @@
+#include "compiler.h"
+#include "codegen.h"
+#include "debug.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The state of the single-pass compiler: the parser's tokens and
+ * the chunk code is written to.
+ */
+typedef struct {
+    Token current;
+    Token previous;
+    int had_error;
+    int panic_mode;
+    Chunk* chunk;   // The chunk of the function being compiled
+} Compiler;
+
+static Compiler compiler;
+
+/**
+ * @brief What is known about an expression once its code is emitted: the
+ * little of its AST node that the code after it depends on.
+ */
+typedef struct {
+    int line;       // The line codegen would give its node
+    int call;       // Offset of its OP_CALL if it is a call, or -1
+    bool assigned;  // An assignment, which leaves nothing on the stack
+} Expression;
+
+static Expression expression_at(int line) {
+    return (Expression){line, -1, false};
+}
+
+static void error_at(Token* token, const char* message) {
+    if (compiler.panic_mode) return;
+    compiler.panic_mode = 1;
+    fprintf(stderr, "[line %d] Error", token->line);
+
+    if (token->type == TOKEN_EOF) {
+        fprintf(stderr, " at end");
+    } else if (token->type == TOKEN_UNKNOWN) {
+        // Nothing
+    } else {
+        fprintf(stderr, " at '%.*s'", token->length, token->start);
+    }
+
+    fprintf(stderr, ": %s\n", message);
+    compiler.had_error = 1;
+}
+
+static void error(const char* message) {
+    error_at(&compiler.previous, message);
+}
+
+static void error_at_current(const char* message) {
+    error_at(&compiler.current, message);
+}
+
+static void advance() {
+    compiler.previous = compiler.current;
+    compiler.current = next_token();
+#ifdef DEBUG_TRACE_PARSER
+    debug_log("Advanced to token %s '%.*s'\n", token_type_to_string(compiler.current.type), compiler.current.length, compiler.current.start);
+#endif
+    if (compiler.current.type == TOKEN_UNKNOWN) {
+        error_at_current("Unexpected character.");
+    }
+}
+
+static int check(TokenType type) {
+    return compiler.current.type == type;
+}
+
+static int match(TokenType type) {
+    if (check(type)) {
+        advance();
+        return 1;
+    }
+    return 0;
+}
+
+static void consume(TokenType type, const char* message) {
+    if (check(type)) {
+        advance();
+        return;
+    }
+    error_at_current(message);
+}
+
+static Span previous_span() {
+    return (Span){compiler.previous.start, compiler.previous.length};
+}
+
+static Span span_of(const char* text) {
+    return (Span){text, (int)strlen(text)};
+}
+
+static void emit(uint8_t byte, int line) {
+    write_chunk(compiler.chunk, byte, line);
+}
+
+/**
+ * @brief Emits a jump with a placeholder offset.
+ *
+ * @return The offset of the placeholder, for patch_jump.
+ */
+static int emit_jump(OpCode op, int line) {
+    emit(op, line);
+    int offset = compiler.chunk->count;
+    write_short(compiler.chunk, 0, line);
+    return offset;
+}
+
+/**
+ * @brief Points a forward jump at the next instruction to be emitted.
+ */
+static void patch_jump(int offset) {
+    Chunk* chunk = compiler.chunk;
+    chunk->code[offset] = (chunk->count - offset - 2) >> 8;
+    chunk->code[offset + 1] = (chunk->count - offset - 2) & 0xFF;
+}
+
+/**
+ * @brief Emits a backward jump to the given offset after an instruction
+ * whose last operand is the jump offset.
+ */
+static void emit_loop(int target, int line) {
+    write_short(compiler.chunk, (int16_t)(target - compiler.chunk->count - 2), line);
+}
+
+typedef enum {
+    PREC_NONE,
+    PREC_ASSIGNMENT,  // =
+    PREC_OR,          // or
+    PREC_AND,         // and
+    PREC_EQUALITY,    // == ~=
+    PREC_COMPARISON,  // < > <= >=
+    PREC_TERM,        // + -
+    PREC_FACTOR,      // * /
+    PREC_UNARY,       // not -
+    PREC_CALL,        // . ()
+    PREC_PRIMARY
+} Precedence;
+
+static Expression expression();
+static void statement();
+static Expression parse_precedence(Precedence precedence);
+static Expression unary(bool can_assign);
+static Expression binary(bool can_assign);
+static Expression number(bool can_assign);
+static Expression string(bool can_assign);
+static Expression identifier(bool can_assign);
+static Expression grouping(bool can_assign);
+static Expression literal(bool can_assign);
+static Expression table_constructor(bool can_assign);
+static Expression call(bool can_assign);
+static Expression subscript(bool can_assign);
+static Expression dot(bool can_assign);
+static Expression logical(bool can_assign);
+
+typedef Expression (*PrefixParseFn)(bool can_assign);
+// The left operand's code is already emitted when an infix rule runs
+typedef Expression (*InfixParseFn)(bool can_assign);
+
+typedef struct {
+    PrefixParseFn prefix;
+    InfixParseFn infix;
+    Precedence precedence;
+} ParseRule;
+
+static ParseRule rules[TOKEN_UNKNOWN + 1] = {
+    [TOKEN_LPAREN]    = {grouping, call,   PREC_CALL},
+    [TOKEN_MINUS]     = {unary,    binary, PREC_TERM},
+    [TOKEN_PLUS]      = {NULL,     binary, PREC_TERM},
+    [TOKEN_DIV]       = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_MUL]       = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_EQUAL]     = {NULL,     binary, PREC_EQUALITY},
+    [TOKEN_NOT_EQUAL] = {NULL,     binary, PREC_EQUALITY},
+    [TOKEN_GREATER]   = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_LESS]      = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS_EQUAL] = {NULL,    binary, PREC_COMPARISON},
+    [TOKEN_IDENTIFIER] = {identifier, NULL, PREC_NONE},
+    [TOKEN_STRING]    = {string,   NULL,   PREC_NONE},
+    [TOKEN_NUMBER]    = {number,   NULL,   PREC_NONE},
+    [TOKEN_AND]       = {NULL,     logical, PREC_AND},
+    [TOKEN_OR]        = {NULL,     logical, PREC_OR},
+    [TOKEN_TRUE]      = {literal,  NULL,   PREC_NONE},
+    [TOKEN_FALSE]     = {literal,  NULL,   PREC_NONE},
+    [TOKEN_NIL]       = {literal,  NULL,   PREC_NONE},
+    [TOKEN_NOT]       = {unary,    NULL,   PREC_NONE},
+    [TOKEN_CONCAT]    = {NULL,     binary, PREC_TERM},
+    [TOKEN_LBRACE]    = {table_constructor, NULL, PREC_NONE},
+    [TOKEN_LBRACKET]  = {NULL,     subscript, PREC_CALL},
+    [TOKEN_DOT]       = {NULL,     dot,    PREC_CALL},
+    [TOKEN_HASH]      = {unary,    NULL,   PREC_NONE},
+};
+
+static ParseRule* get_rule(TokenType type) {
+    return &rules[type];
+}
+
+static Expression expression() {
+    return parse_precedence(PREC_OR);
+}
+
+/**
+ * @brief Compiles an expression whose first token was just consumed, and
+ * every operator after it that binds at least as tightly as precedence.
+ */
+static Expression continue_expression(Precedence precedence) {
+    PrefixParseFn prefix_rule = get_rule(compiler.previous.type)->prefix;
+    if (prefix_rule == NULL) {
+        error("Expect expression.");
+        return expression_at(compiler.previous.line);
+    }
+
+    bool can_assign = precedence <= PREC_ASSIGNMENT;
+    Expression result = prefix_rule(can_assign);
+
+    while (precedence <= get_rule(compiler.current.type)->precedence) {
+        advance();
+        InfixParseFn infix_rule = get_rule(compiler.previous.type)->infix;
+        result = infix_rule(can_assign);
+    }
+
+    if (can_assign && match(TOKEN_ASSIGN)) {
+        error("Invalid assignment target.");
+    }
+    return result;
+}
+
+static Expression parse_precedence(Precedence precedence) {
+    advance();
+    return continue_expression(precedence);
+}
+
+static Expression number(bool can_assign) {
+    Value value;
+    value.type = number_literal(compiler.previous.start, compiler.previous.length,
+                                &value.as.integer, &value.as.number) ? VAL_INTEGER : VAL_NUMBER;
+    int constant_index = add_constant(compiler.chunk, value);
+    emit_constant_instruction(compiler.chunk, OP_CONSTANT, constant_index, compiler.previous.line);
+    return expression_at(compiler.previous.line);
+}
+
+static Expression string(bool can_assign) {
+    // Without the quotes
+    Span text = {compiler.previous.start + 1, compiler.previous.length - 2};
+    int constant_index = string_constant(compiler.chunk, text);
+    emit_constant_instruction(compiler.chunk, OP_CONSTANT, constant_index, compiler.previous.line);
+    return expression_at(compiler.previous.line);
+}
+
+static Expression identifier(bool can_assign) {
+    Span name = previous_span();
+    int line = compiler.previous.line;
+
+    if (can_assign && check(TOKEN_ASSIGN)) {
+        advance();
+        expression();
+        int local_index = resolve_local(compiler.chunk, name);
+        if (local_index != -1) {
+            emit(OP_SET_LOCAL, line);
+            emit(local_index, line);
+        } else {
+            int constant_index = string_constant(compiler.chunk, name);
+            emit_constant_instruction(compiler.chunk, OP_SET_GLOBAL, constant_index, line);
+        }
+        emit(OP_POP, line);
+        return (Expression){line, -1, true};
+    }
+
+    int local_index = resolve_local(compiler.chunk, name);
+    if (local_index != -1) {
+        emit(OP_GET_LOCAL, line);
+        emit(local_index, line);
+    } else {
+        int constant_index = string_constant(compiler.chunk, name);
+        emit_constant_instruction(compiler.chunk, OP_GET_GLOBAL, constant_index, line);
+    }
+    return expression_at(line);
+}
+
+static Expression grouping(bool can_assign) {
+    Expression inner = expression();
+    consume(TOKEN_RPAREN, "Expect ')' after expression.");
+    return inner;
+}
+
+static Expression unary(bool can_assign) {
+    TokenType op_type = compiler.previous.type;
+    parse_precedence(PREC_UNARY);
+    emit(unary_opcode(op_type), compiler.previous.line);
+    return expression_at(compiler.previous.line);
+}
+
+static Expression binary(bool can_assign) {
+    TokenType op_type = compiler.previous.type;
+    ParseRule* rule = get_rule(op_type);
+    parse_precedence((Precedence)(rule->precedence + 1));
+    emit(binary_opcode(op_type), compiler.previous.line);
+    return expression_at(compiler.previous.line);
+}
+
+/**
+ * @brief Compiles the right operand of and/or. codegen puts the line of
+ * the operator's last token on the jumps in front of the right operand,
+ * so their lines are filled in once it has been parsed.
+ */
+static Expression logical(bool can_assign) {
+    TokenType op_type = compiler.previous.type;
+    ParseRule* rule = get_rule(op_type);
+    Chunk* chunk = compiler.chunk;
+    int start = chunk->count;
+
+    int end_jump;
+    if (op_type == TOKEN_AND) {
+        end_jump = emit_jump(OP_JUMP_IF_FALSE, 0);
+        emit(OP_POP, 0);
+    } else {
+        int else_jump = emit_jump(OP_JUMP_IF_FALSE, 0);
+        end_jump = emit_jump(OP_JUMP, 0);
+        patch_jump(else_jump);
+        emit(OP_POP, 0);
+    }
+    int jumps_end = chunk->count;
+
+    parse_precedence((Precedence)(rule->precedence + 1));
+    patch_jump(end_jump);
+
+    int line = compiler.previous.line;
+    for (int i = start; i < jumps_end; i++) {
+        chunk->lines[i] = line;
+    }
+    return expression_at(line);
+}
+
+static Expression literal(bool can_assign) {
+    // codegen leaves literals without a line
+    switch (compiler.previous.type) {
+        case TOKEN_TRUE: emit(OP_TRUE, 0); break;
+        case TOKEN_FALSE: emit(OP_FALSE, 0); break;
+        default: emit(OP_NIL, 0); break;
+    }
+    return expression_at(0);
+}
+
+static Expression call(bool can_assign) {
+    int line = compiler.previous.line;
+    int arg_count = 0;
+    if (!check(TOKEN_RPAREN)) {
+        do {
+            expression();
+            arg_count++;
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RPAREN, "Expect ')' after arguments.");
+
+    int offset = compiler.chunk->count;
+    emit(OP_CALL, line);
+    emit(arg_count, line);
+    return (Expression){line, offset, false};
+}
+
+/**
+ * @brief Finishes an index expression whose object and key are on the
+ * stack, or an index assignment when '=' follows where one is allowed.
+ */
+static Expression finish_index(bool can_assign, int line) {
+    if (can_assign && match(TOKEN_ASSIGN)) {
+        expression();
+        emit(OP_SET_INDEX, line);
+        return (Expression){line, -1, true};
+    }
+    emit(OP_GET_INDEX, line);
+    return expression_at(line);
+}
+
+static Expression subscript(bool can_assign) {
+    int line = compiler.previous.line;
+    expression();
+    consume(TOKEN_RBRACKET, "Expect ']' after index.");
+    return finish_index(can_assign, line);
+}
+
+static Expression dot(bool can_assign) {
+    int line = compiler.previous.line;
+    consume(TOKEN_IDENTIFIER, "Expect field name after '.'.");
+    int constant_index = string_constant(compiler.chunk, previous_span());
+    emit_constant_instruction(compiler.chunk, OP_CONSTANT, constant_index, compiler.previous.line);
+    return finish_index(can_assign, line);
+}
+
+/**
+ * @brief Compiles a table constructor the way generate_table does. The
+ * size hints of OP_NEW_TABLE are only known at the closing brace, so they
+ * are patched in then.
+ */
+static Expression table_constructor(bool can_assign) {
+    int line = compiler.previous.line;
+    emit(OP_NEW_TABLE, line);
+    int sizes = compiler.chunk->count;
+    emit(0, line);
+    emit(0, line);
+
+    int array_count = 0;
+    int hash_count = 0;
+    int pending = 0;    // Positional values on the stack, not yet stored
+    int stored = 0;     // Positional values already stored
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF)) {
+        int field_line = compiler.current.line;
+        bool keyed = false;
+        Span name = {NULL, 0};
+        int name_line = 0;
+
+        // "name = value" is told from an expression starting with a name
+        // by the token after the name
+        if (match(TOKEN_LBRACKET)) {
+            keyed = true;
+        } else if (match(TOKEN_IDENTIFIER)) {
+            if (check(TOKEN_ASSIGN)) {
+                keyed = true;
+                name = previous_span();
+                name_line = compiler.previous.line;
+                advance();
+            }
+        } else {
+            advance();
+        }
+
+        if (keyed) {
+            if (pending > 0) {
+                emit_set_list(compiler.chunk, pending, stored + 1, field_line);
+                stored += pending;
+                pending = 0;
+            }
+            if (name.start != NULL) {
+                int constant_index = string_constant(compiler.chunk, name);
+                emit_constant_instruction(compiler.chunk, OP_CONSTANT, constant_index, name_line);
+                expression();
+                if (match(TOKEN_ASSIGN)) {
+                    error("Invalid assignment target.");
+                }
+            } else {
+                expression();
+                consume(TOKEN_RBRACKET, "Expect ']' after table key.");
+                consume(TOKEN_ASSIGN, "Expect '=' after table key.");
+                expression();
+            }
+            emit(OP_INIT_FIELD, field_line);
+            hash_count++;
+        } else {
+            if (continue_expression(PREC_ASSIGNMENT).assigned) {
+                error("Invalid table field.");
+            }
+            array_count++;
+            if (++pending == TABLE_FIELDS_PER_FLUSH) {
+                emit_set_list(compiler.chunk, pending, stored + 1, field_line);
+                stored += pending;
+                pending = 0;
+            }
+        }
+
+        if (!match(TOKEN_COMMA)) break;
+    }
+
+    consume(TOKEN_RBRACE, "Expect '}' after table fields.");
+    if (pending > 0) {
+        emit_set_list(compiler.chunk, pending, stored + 1, line);
+    }
+    compiler.chunk->code[sizes] = array_count > UINT8_MAX ? UINT8_MAX : array_count;
+    compiler.chunk->code[sizes + 1] = hash_count > UINT8_MAX ? UINT8_MAX : hash_count;
+    return expression_at(line);
+}
+
+/**
+ * @brief Compiles statements until one of the given tokens or the end of
+ * the source, and pops the locals they declared.
+ *
+ * @param line The line of the scope's POPs: that of the token opening it.
+ * @param stop The token that ends the block besides 'end'.
+ */
+static void block(int line, TokenType stop) {
+    int locals_count = compiler.chunk->locals_count;
+    while (!check(stop) && !check(TOKEN_END) && !check(TOKEN_EOF)) {
+        statement();
+    }
+    end_scope(compiler.chunk, locals_count, line);
+}
+
+static void if_statement() {
+    int line = compiler.previous.line;
+    expression();
+    consume(TOKEN_THEN, "Expect 'then' after if condition.");
+    int then_line = compiler.previous.line;
+
+    int else_jump = emit_jump(OP_JUMP_IF_FALSE, line);
+    emit(OP_POP, line); // Pop the condition
+    block(then_line, TOKEN_ELSE);
+    int exit_jump = emit_jump(OP_JUMP, line);
+
+    patch_jump(else_jump);
+    emit(OP_POP, line); // Pop the condition
+    if (match(TOKEN_ELSE)) {
+        block(compiler.previous.line, TOKEN_END);
+    }
+    patch_jump(exit_jump);
+
+    consume(TOKEN_END, "Expect 'end' after if branches.");
+}
+
+static void while_statement() {
+    int line = compiler.previous.line;
+    int loop_start = compiler.chunk->count;
+    expression();
+    consume(TOKEN_DO, "Expect 'do' after while condition.");
+    int body_line = compiler.previous.line;
+
+    int exit_jump = emit_jump(OP_JUMP_IF_FALSE, line);
+    emit(OP_POP, line); // Pop the condition
+    block(body_line, TOKEN_END);
+
+    emit(OP_JUMP, line);
+    emit_loop(loop_start, line);
+
+    patch_jump(exit_jump);
+    emit(OP_POP, line); // Pop the condition
+
+    consume(TOKEN_END, "Expect 'end' after while body.");
+}
+
+static void for_statement() {
+    int line = compiler.previous.line;
+    Chunk* chunk = compiler.chunk;
+    consume(TOKEN_IDENTIFIER, "Expect variable name after 'for'.");
+    Span variable = previous_span();
+
+    // The counter, limit and step live in three hidden locals below the
+    // loop variable, as in codegen
+    int locals_count = chunk->locals_count;
+    consume(TOKEN_ASSIGN, "Expect '=' after for variable.");
+    expression();
+    consume(TOKEN_COMMA, "Expect ',' after for initial value.");
+    expression();
+    if (match(TOKEN_COMMA)) {
+        expression();
+    } else {
+        Value one = {VAL_INTEGER, {.integer = 1}};
+        emit_constant_instruction(chunk, OP_CONSTANT, add_constant(chunk, one), line);
+    }
+    consume(TOKEN_DO, "Expect 'do' after for clauses.");
+    int body_line = compiler.previous.line;
+
+    emit(OP_NIL, line);
+    int base = add_local(chunk, span_of("(for index)"));
+    add_local(chunk, span_of("(for limit)"));
+    add_local(chunk, span_of("(for step)"));
+    add_local(chunk, variable);
+
+    emit(OP_FORPREP, line);
+    emit(base, line);
+    int exit_jump = chunk->count;
+    write_short(chunk, 0, line); // Placeholder for jump offset
+
+    int body_start = chunk->count;
+    block(body_line, TOKEN_END);
+
+    emit(OP_FORLOOP, line);
+    emit(base, line);
+    emit_loop(body_start, line);
+
+    patch_jump(exit_jump);
+    end_scope(chunk, locals_count, line);
+
+    consume(TOKEN_END, "Expect 'end' after for body.");
+}
+
+/**
+ * @brief Compiles a function definition into a chunk of its own, which
+ * becomes a constant of the enclosing chunk and is stored in a global.
+ */
+static void function_declaration() {
+    int line = compiler.previous.line;
+    consume(TOKEN_IDENTIFIER, "Expect function name.");
+    Span name = previous_span();
+    consume(TOKEN_LPAREN, "Expect '(' after function name.");
+
+    Chunk* enclosing = compiler.chunk;
+    Chunk* function = (Chunk*)malloc(sizeof(Chunk));
+    init_chunk(function);
+    function->locals_count = 0;
+    function->name = strndup(name.start, name.length);
+    function->line = line;
+    compiler.chunk = function;
+
+    if (!check(TOKEN_RPAREN)) {
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect parameter name.");
+            function->arity++;
+            add_local(function, previous_span());
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RPAREN, "Expect ')' after parameters.");
+
+    while (!check(TOKEN_END) && !check(TOKEN_EOF)) {
+        statement();
+    }
+    // Falling off the end of a function returns nil
+    emit(OP_NIL, line);
+    emit(OP_RETURN, line);
+    consume(TOKEN_END, "Expect 'end' after function body.");
+    compiler.chunk = enclosing;
+
+    Value function_value = {VAL_FUNCTION, {.function = function}};
+    emit_constant_instruction(enclosing, OP_CONSTANT, add_constant(enclosing, function_value), line);
+    emit_constant_instruction(enclosing, OP_SET_GLOBAL, string_constant(enclosing, name), line);
+    emit(OP_POP, line);
+}
+
+static void return_statement() {
+    int line = compiler.previous.line;
+    if (check(TOKEN_END) || check(TOKEN_ELSE) || check(TOKEN_EOF)) {
+        emit(OP_NIL, line);
+    } else {
+        Expression result = expression();
+        if (result.call >= 0) {
+            // return f(...) reuses the current frame
+            compiler.chunk->code[result.call] = OP_TAIL_CALL;
+        }
+    }
+    emit(OP_RETURN, line);
+}
+
+static void local_declaration() {
+    consume(TOKEN_IDENTIFIER, "Expect variable name.");
+    Span name = previous_span();
+    int line = compiler.previous.line;
+    if (match(TOKEN_ASSIGN)) {
+        expression();
+    } else {
+        emit(OP_NIL, line);
+    }
+    // The value is already on top of the stack, which is the new local's
+    // slot
+    add_local(compiler.chunk, name);
+}
+
+static void statement() {
+    if (match(TOKEN_PRINT)) {
+        consume(TOKEN_LPAREN, "Expect '(' after 'print'.");
+        expression();
+        consume(TOKEN_RPAREN, "Expect ')' after expression.");
+        emit(OP_PRINT, compiler.previous.line);
+    } else if (match(TOKEN_IF)) {
+        if_statement();
+    } else if (match(TOKEN_WHILE)) {
+        while_statement();
+    } else if (match(TOKEN_FOR)) {
+        for_statement();
+    } else if (match(TOKEN_FUNCTION)) {
+        function_declaration();
+    } else if (match(TOKEN_RETURN)) {
+        return_statement();
+    } else if (match(TOKEN_LOCAL)) {
+        local_declaration();
+    } else {
+        // Assignments emit their own code; anything else is evaluated for
+        // its effects and dropped
+        Expression result = parse_precedence(PREC_ASSIGNMENT);
+        if (!result.assigned) {
+            emit(OP_POP, result.line);
+        }
+    }
+}
+
+/**
+ * @brief Compiles source code straight to bytecode as it is parsed,
+ * without building an AST. The code is the same generate_code produces
+ * from parse()'s AST, and errors are reported the same way, but every
+ * function body is compiled up front and nothing is optimized.
+ *
+ * @param source The source code to compile. It may be freed afterwards.
+ * @param chunk The chunk to write the code to. It must be initialized.
+ * @return 1 on success, 0 if there were compile errors.
+ */
+int compile_single_pass(const char* source, Chunk* chunk) {
+    init_lexer(source);
+    compiler.had_error = 0;
+    compiler.panic_mode = 0;
+    compiler.chunk = chunk;
+    advance();
+
+    while (!check(TOKEN_EOF)) {
+        statement();
+    }
+    emit(OP_NIL, -1); // No line number for return
+    emit(OP_RETURN, -1);
+    free_string_constants();
+    return !compiler.had_error;
+}
@@ -0,0 +1,8 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "bytecode.h"
+
+int compile_single_pass(const char* source, Chunk* chunk);
+
+#endif // COMPILER_H
@@ -13,6 +13,7 @@ void debug_log(const char *format, ...) {
 const char* node_type_to_string(NodeType type) {
     switch (type) {
         case NODE_NUMBER: return "NODE_NUMBER";
+        case NODE_INTEGER: return "NODE_INTEGER";
         case NODE_STRING: return "NODE_STRING";
         case NODE_IDENTIFIER: return "NODE_IDENTIFIER";
         case NODE_BINARY_OP: return "NODE_BINARY_OP";
@@ -22,6 +23,7 @@ const char* node_type_to_string(NodeType type) {
         case NODE_PRINT: return "NODE_PRINT";
         case NODE_IF: return "NODE_IF";
         case NODE_WHILE: return "NODE_WHILE";
+        case NODE_FOR: return "NODE_FOR";
         case NODE_STATEMENTS: return "NODE_STATEMENTS";
         case NODE_EXPRESSION_STATEMENT: return "NODE_EXPRESSION_STATEMENT";
         case NODE_FUNCTION_DEF: return "NODE_FUNCTION_DEF";
@@ -31,6 +33,11 @@ const char* node_type_to_string(NodeType type) {
         case NODE_TRUE: return "NODE_TRUE";
         case NODE_FALSE: return "NODE_FALSE";
         case NODE_NIL: return "NODE_NIL";
+        case NODE_TABLE: return "NODE_TABLE";
+        case NODE_TABLE_FIELD: return "NODE_TABLE_FIELD";
+        case NODE_INDEX: return "NODE_INDEX";
+        case NODE_INDEX_ASSIGN: return "NODE_INDEX_ASSIGN";
+        case NODE_INLINE_CALL: return "NODE_INLINE_CALL";
         default: return "UNKNOWN_NODE";
     }
 }
@@ -72,6 +79,13 @@ const char* token_type_to_string(TokenType type) {
         case TOKEN_FALSE: return "TOKEN_FALSE";
         case TOKEN_RETURN: return "TOKEN_RETURN";
         case TOKEN_LOCAL: return "TOKEN_LOCAL";
+        case TOKEN_FOR: return "TOKEN_FOR";
+        case TOKEN_LBRACE: return "TOKEN_LBRACE";
+        case TOKEN_RBRACE: return "TOKEN_RBRACE";
+        case TOKEN_LBRACKET: return "TOKEN_LBRACKET";
+        case TOKEN_RBRACKET: return "TOKEN_RBRACKET";
+        case TOKEN_DOT: return "TOKEN_DOT";
+        case TOKEN_HASH: return "TOKEN_HASH";
         case TOKEN_UNKNOWN: return "TOKEN_UNKNOWN";
         default: return "UNKNOWN_TOKEN";
     }
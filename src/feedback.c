@@ -0,0 +1,470 @@
+#include "feedback.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The first word of every profile, followed by the script's hash and
+// whether it was compiled with -O
+#define FEEDBACK_HEADER "luac-profile-1"
+
+/**
+ * @brief Returns what a profile records at an instruction. Quickened
+ * forms count as the generic instruction, since the VM rewrites one into
+ * the other while the program runs.
+ */
+SiteKind site_kind(uint8_t opcode) {
+    switch (opcode) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+            return SITE_BRANCH;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD_INT:
+        case OP_ADD_FLOAT:
+        case OP_SUBTRACT_INT:
+        case OP_SUBTRACT_FLOAT:
+        case OP_MULTIPLY_INT:
+        case OP_MULTIPLY_FLOAT:
+        case OP_GREATER_INT:
+        case OP_GREATER_FLOAT:
+        case OP_GREATER_EQUAL_INT:
+        case OP_GREATER_EQUAL_FLOAT:
+        case OP_LESS_INT:
+        case OP_LESS_FLOAT:
+        case OP_LESS_EQUAL_INT:
+        case OP_LESS_EQUAL_FLOAT:
+            return SITE_OPERANDS;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INLINE_GUARD:
+            return SITE_CALL;
+        default:
+            return SITE_NONE;
+    }
+}
+
+static uint32_t hash_chunk(Chunk* chunk) {
+    return (uint32_t)((uintptr_t)chunk >> 4) * 2654435761u;
+}
+
+static uint32_t hash_text(uint32_t hash, const char* text, int length) {
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static uint32_t hash_int(uint32_t hash, int value) {
+    hash ^= (uint32_t)value;
+    return hash * 16777619;
+}
+
+/**
+ * @brief Fingerprints a script, so a profile is only used for the source
+ * it was recorded from.
+ */
+static uint64_t hash_source(const char* source) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = source; *c != '\0'; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static const char* function_name(Chunk* chunk) {
+    return chunk->name != NULL ? chunk->name : "main";
+}
+
+void init_feedback_recorder(FeedbackRecorder* recorder) {
+    recorder->chunks = NULL;
+    recorder->count = 0;
+    recorder->capacity = 0;
+    recorder->last = NULL;
+}
+
+static ChunkSites* find_chunk_sites(ChunkSites* entries, int capacity, Chunk* chunk) {
+    uint32_t index = hash_chunk(chunk) & (capacity - 1);
+    while (entries[index].chunk != NULL && entries[index].chunk != chunk) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+/**
+ * @brief Returns the counts of a chunk, adding them the first time it
+ * runs and growing them with its code.
+ *
+ * @param recorder The recorder.
+ * @param chunk The chunk.
+ * @return The chunk's entry, which stays valid until the next call.
+ */
+ChunkSites* chunk_sites(FeedbackRecorder* recorder, Chunk* chunk) {
+    if (recorder->count + 1 > recorder->capacity * 0.75) {
+        int capacity = recorder->capacity < 16 ? 16 : recorder->capacity * 2;
+        ChunkSites* entries = (ChunkSites*)calloc(capacity, sizeof(ChunkSites));
+        for (int i = 0; i < recorder->capacity; i++) {
+            ChunkSites* entry = &recorder->chunks[i];
+            if (entry->chunk != NULL) *find_chunk_sites(entries, capacity, entry->chunk) = *entry;
+        }
+        free(recorder->chunks);
+        recorder->chunks = entries;
+        recorder->capacity = capacity;
+    }
+
+    ChunkSites* entry = find_chunk_sites(recorder->chunks, recorder->capacity, chunk);
+    if (entry->chunk == NULL) {
+        entry->chunk = chunk;
+        recorder->count++;
+    }
+    if (entry->size < chunk->count) {
+        // A streamed program's main chunk grows with every batch
+        entry->sites = (SiteCounts*)realloc(entry->sites, sizeof(SiteCounts) * chunk->count);
+        memset(entry->sites + entry->size, 0, sizeof(SiteCounts) * (chunk->count - entry->size));
+        entry->size = chunk->count;
+    }
+    recorder->last = entry;
+    return entry;
+}
+
+static int compare_chunk_sites(const void* a, const void* b) {
+    Chunk* x = (*(ChunkSites* const*)a)->chunk;
+    Chunk* y = (*(ChunkSites* const*)b)->chunk;
+    if (x->line != y->line) return x->line - y->line;
+    return strcmp(function_name(x), function_name(y));
+}
+
+static void write_site(FILE* out, SiteKind kind, int line, int ordinal, SiteCounts* site) {
+    switch (kind) {
+        case SITE_BRANCH:
+            fprintf(out, "branch %d %d %llu %llu\n", line, ordinal,
+                    (unsigned long long)site->counts[COUNT_FALSEY], (unsigned long long)site->counts[COUNT_TRUTHY]);
+            break;
+        case SITE_OPERANDS:
+            fprintf(out, "operands %d %d %llu %llu %llu\n", line, ordinal,
+                    (unsigned long long)site->counts[COUNT_INTEGERS], (unsigned long long)site->counts[COUNT_FLOATS],
+                    (unsigned long long)site->counts[COUNT_OTHERS]);
+            break;
+        case SITE_CALL:
+            fprintf(out, "call %d %d %llu %s\n", line, ordinal, (unsigned long long)site->counts[COUNT_CALLS],
+                    site->callee != NULL ? function_name(site->callee) : "-");
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Writes what a training run recorded as a profile for
+ * --profile-in: a "function <name> <line>" line for each function that
+ * ran, followed by a line for each of its sites that did. Must be called
+ * while the recorded chunks are still alive.
+ *
+ * @param recorder The recorder the VM filled in.
+ * @param path The file to write.
+ * @param source The script that ran.
+ * @param optimized Whether it was compiled with -O, which the profile must
+ * then be used with too.
+ * @return 1 on success, 0 if the file could not be written.
+ */
+int write_feedback(FeedbackRecorder* recorder, const char* path, const char* source, int optimized) {
+    FILE* out = fopen(path, "w");
+    if (!out) return 0;
+    fprintf(out, "%s %016llx %d\n", FEEDBACK_HEADER, (unsigned long long)hash_source(source), optimized);
+
+    // In source order, so profiles of one script can be compared
+    ChunkSites** chunks = (ChunkSites**)malloc(sizeof(ChunkSites*) * (recorder->count > 0 ? recorder->count : 1));
+    int count = 0;
+    for (int i = 0; i < recorder->capacity; i++) {
+        if (recorder->chunks[i].chunk != NULL) chunks[count++] = &recorder->chunks[i];
+    }
+    qsort(chunks, count, sizeof(ChunkSites*), compare_chunk_sites);
+
+    SiteOrdinals ordinals = {NULL, 0, 0};
+    for (int i = 0; i < count; i++) {
+        Chunk* chunk = chunks[i]->chunk;
+        fprintf(out, "function %s %d\n", function_name(chunk), chunk->line);
+        for (int offset = 0; offset < chunk->count;) {
+            int length = instruction_length(chunk->code[offset]);
+            if (length == 0) break;
+            SiteKind kind = site_kind(chunk->code[offset]);
+            if (kind != SITE_NONE) {
+                int ordinal = next_ordinal(&ordinals, chunk, chunk->lines[offset], kind);
+                SiteCounts* site = offset < chunks[i]->size ? &chunks[i]->sites[offset] : NULL;
+                if (site != NULL && (site->counts[0] | site->counts[1] | site->counts[2]) != 0) {
+                    write_site(out, kind, chunk->lines[offset], ordinal, site);
+                }
+            }
+            offset += length;
+        }
+    }
+    free_site_ordinals(&ordinals);
+    free(chunks);
+    return fclose(out) == 0;
+}
+
+void free_feedback_recorder(FeedbackRecorder* recorder) {
+    for (int i = 0; i < recorder->capacity; i++) {
+        free(recorder->chunks[i].sites);
+    }
+    free(recorder->chunks);
+    init_feedback_recorder(recorder);
+}
+
+void init_feedback(Feedback* feedback) {
+    memset(feedback, 0, sizeof(Feedback));
+}
+
+static const char* add_name(Feedback* feedback, const char* name) {
+    if (feedback->names_count == feedback->names_capacity) {
+        feedback->names_capacity = feedback->names_capacity < 16 ? 16 : feedback->names_capacity * 2;
+        feedback->names = (char**)realloc(feedback->names, sizeof(char*) * feedback->names_capacity);
+    }
+    return feedback->names[feedback->names_count++] = strdup(name);
+}
+
+static uint32_t hash_site(const char* function, int function_line, int line, SiteKind kind, int ordinal) {
+    uint32_t hash = hash_text(2166136261u, function, (int)strlen(function));
+    hash = hash_int(hash, function_line);
+    hash = hash_int(hash, line);
+    hash = hash_int(hash, kind);
+    return hash_int(hash, ordinal);
+}
+
+static Site* find_site_slot(Site* sites, int capacity, const char* function, int function_line, int line,
+                            SiteKind kind, int ordinal) {
+    uint32_t index = hash_site(function, function_line, line, kind, ordinal) & (capacity - 1);
+    for (;;) {
+        Site* site = &sites[index];
+        if (site->function == NULL) return site;
+        if (site->function_line == function_line && site->line == line && site->kind == kind &&
+            site->ordinal == ordinal && strcmp(site->function, function) == 0) {
+            return site;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void add_site(Feedback* feedback, Site* site) {
+    if (feedback->sites_count + 1 > feedback->sites_capacity * 0.75) {
+        int capacity = feedback->sites_capacity < 64 ? 64 : feedback->sites_capacity * 2;
+        Site* sites = (Site*)calloc(capacity, sizeof(Site));
+        for (int i = 0; i < feedback->sites_capacity; i++) {
+            Site* old = &feedback->sites[i];
+            if (old->function == NULL) continue;
+            *find_site_slot(sites, capacity, old->function, old->function_line, old->line, old->kind, old->ordinal) = *old;
+        }
+        free(feedback->sites);
+        feedback->sites = sites;
+        feedback->sites_capacity = capacity;
+    }
+    Site* slot = find_site_slot(feedback->sites, feedback->sites_capacity, site->function, site->function_line,
+                                site->line, site->kind, site->ordinal);
+    if (slot->function == NULL) {
+        *slot = *site;
+        feedback->sites_count++;
+        return;
+    }
+    // Two functions of one name defined on one line share their counts
+    for (int i = 0; i < 3; i++) slot->counts[i] += site->counts[i];
+    if (slot->callee != NULL && (site->callee == NULL || strcmp(slot->callee, site->callee) != 0)) {
+        slot->callee = NULL;
+    }
+}
+
+static LineCalls* find_line_calls(LineCalls* entries, int capacity, int line, const char* callee, int length) {
+    uint32_t index = hash_int(hash_text(2166136261u, callee, length), line) & (capacity - 1);
+    for (;;) {
+        LineCalls* entry = &entries[index];
+        if (entry->callee == NULL) return entry;
+        if (entry->line == line && strncmp(entry->callee, callee, length) == 0 && entry->callee[length] == '\0') {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void add_line_calls(Feedback* feedback, int line, const char* callee, uint64_t calls) {
+    if (feedback->calls_count + 1 > feedback->calls_capacity * 0.75) {
+        int capacity = feedback->calls_capacity < 64 ? 64 : feedback->calls_capacity * 2;
+        LineCalls* entries = (LineCalls*)calloc(capacity, sizeof(LineCalls));
+        for (int i = 0; i < feedback->calls_capacity; i++) {
+            LineCalls* entry = &feedback->calls[i];
+            if (entry->callee == NULL) continue;
+            *find_line_calls(entries, capacity, entry->line, entry->callee, (int)strlen(entry->callee)) = *entry;
+        }
+        free(feedback->calls);
+        feedback->calls = entries;
+        feedback->calls_capacity = capacity;
+    }
+    LineCalls* entry = find_line_calls(feedback->calls, feedback->calls_capacity, line, callee, (int)strlen(callee));
+    if (entry->callee == NULL) {
+        *entry = (LineCalls){callee, line, 0};
+        feedback->calls_count++;
+    }
+    entry->calls += calls;
+}
+
+/**
+ * @brief Reads a profile written by write_feedback. A profile of another
+ * version of the script, or of the script compiled with different
+ * optimizations, is reported and not read, as its sites would not match.
+ *
+ * @param feedback The profile to fill in. It must be initialized.
+ * @param path The file to read.
+ * @param source The script that will be compiled.
+ * @param optimized Whether it will be compiled with -O.
+ * @return 1 on success, 0 after reporting why the profile is not used.
+ */
+int read_feedback(Feedback* feedback, const char* path, const char* source, int optimized) {
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Could not read profile '%s'.\n", path);
+        return 0;
+    }
+
+    char text[512];
+    unsigned long long hash;
+    int profile_optimized;
+    if (fgets(text, sizeof(text), in) == NULL ||
+        sscanf(text, FEEDBACK_HEADER " %llx %d", &hash, &profile_optimized) != 2) {
+        fprintf(stderr, "'%s' is not a profile.\n", path);
+        fclose(in);
+        return 0;
+    }
+    if (hash != hash_source(source)) {
+        fprintf(stderr, "Profile '%s' is of another version of the script; ignoring it.\n", path);
+        fclose(in);
+        return 0;
+    }
+    if (profile_optimized != optimized) {
+        fprintf(stderr, "Profile '%s' was recorded %s -O; ignoring it.\n", path, optimized ? "without" : "with");
+        fclose(in);
+        return 0;
+    }
+
+    const char* function = NULL;
+    int function_line = 0;
+    int number = 1;
+    while (fgets(text, sizeof(text), in) != NULL) {
+        number++;
+        char name[256];
+        unsigned long long counts[3] = {0, 0, 0};
+        Site site = {function, function_line, 0, 0, SITE_NONE, {0, 0, 0}, NULL};
+        if (sscanf(text, "function %255s %d", name, &function_line) == 2) {
+            function = add_name(feedback, name);
+            continue;
+        }
+        if (function == NULL) {
+            site.kind = SITE_NONE;
+        } else if (sscanf(text, "branch %d %d %llu %llu", &site.line, &site.ordinal, &counts[0], &counts[1]) == 4) {
+            site.kind = SITE_BRANCH;
+        } else if (sscanf(text, "operands %d %d %llu %llu %llu", &site.line, &site.ordinal,
+                          &counts[0], &counts[1], &counts[2]) == 5) {
+            site.kind = SITE_OPERANDS;
+        } else if (sscanf(text, "call %d %d %llu %255s", &site.line, &site.ordinal, &counts[0], name) == 4) {
+            site.kind = SITE_CALL;
+            if (strcmp(name, "-") != 0) {
+                site.callee = add_name(feedback, name);
+                add_line_calls(feedback, site.line, site.callee, counts[0]);
+            }
+        }
+        if (site.kind == SITE_NONE) {
+            fprintf(stderr, "Profile '%s' is malformed at line %d; ignoring it.\n", path, number);
+            fclose(in);
+            free_feedback(feedback);
+            return 0;
+        }
+        for (int i = 0; i < 3; i++) site.counts[i] = counts[i];
+        add_site(feedback, &site);
+    }
+    fclose(in);
+    return 1;
+}
+
+/**
+ * @brief Returns what a profile has for a site of a function.
+ *
+ * @param feedback The profile.
+ * @param chunk The function's chunk; its name and line identify it.
+ * @param line The site's line.
+ * @param kind What the site records.
+ * @param ordinal The site's position among those of its kind on its line.
+ * @return The site, or NULL if it never ran in the training run.
+ */
+const Site* find_site(const Feedback* feedback, Chunk* chunk, int line, SiteKind kind, int ordinal) {
+    if (feedback->sites_count == 0) return NULL;
+    Site* site = find_site_slot(feedback->sites, feedback->sites_capacity, function_name(chunk), chunk->line,
+                                line, kind, ordinal);
+    return site->function != NULL ? site : NULL;
+}
+
+/**
+ * @brief Returns how many calls the training run made from a line to a
+ * function, wherever the code of the line ended up, such as in the
+ * functions a call on it was inlined into.
+ */
+uint64_t line_calls(const Feedback* feedback, int line, const char* callee, int length) {
+    if (feedback->calls_count == 0) return 0;
+    LineCalls* entry = find_line_calls(feedback->calls, feedback->calls_capacity, line, callee, length);
+    return entry->callee != NULL ? entry->calls : 0;
+}
+
+void free_feedback(Feedback* feedback) {
+    for (int i = 0; i < feedback->names_count; i++) {
+        free(feedback->names[i]);
+    }
+    free(feedback->names);
+    free(feedback->sites);
+    free(feedback->calls);
+    init_feedback(feedback);
+}
+
+static SiteOrdinal* find_ordinal(SiteOrdinal* entries, int capacity, Chunk* chunk, int line, SiteKind kind) {
+    uint32_t index = hash_int(hash_int(hash_chunk(chunk), line), kind) & (capacity - 1);
+    for (;;) {
+        SiteOrdinal* entry = &entries[index];
+        if (entry->chunk == NULL) return entry;
+        if (entry->chunk == chunk && entry->line == line && entry->kind == kind) return entry;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+/**
+ * @brief Counts a site, returning its position among the sites of its
+ * kind counted so far on its line of its chunk.
+ */
+int next_ordinal(SiteOrdinals* ordinals, Chunk* chunk, int line, SiteKind kind) {
+    if (ordinals->count + 1 > ordinals->capacity * 0.75) {
+        int capacity = ordinals->capacity < 64 ? 64 : ordinals->capacity * 2;
+        SiteOrdinal* entries = (SiteOrdinal*)calloc(capacity, sizeof(SiteOrdinal));
+        for (int i = 0; i < ordinals->capacity; i++) {
+            SiteOrdinal* entry = &ordinals->entries[i];
+            if (entry->chunk != NULL) *find_ordinal(entries, capacity, entry->chunk, entry->line, entry->kind) = *entry;
+        }
+        free(ordinals->entries);
+        ordinals->entries = entries;
+        ordinals->capacity = capacity;
+    }
+    SiteOrdinal* entry = find_ordinal(ordinals->entries, ordinals->capacity, chunk, line, kind);
+    if (entry->chunk == NULL) {
+        *entry = (SiteOrdinal){chunk, line, kind, 0};
+        ordinals->count++;
+    }
+    return entry->next++;
+}
+
+void free_site_ordinals(SiteOrdinals* ordinals) {
+    free(ordinals->entries);
+    ordinals->entries = NULL;
+    ordinals->count = 0;
+    ordinals->capacity = 0;
+}
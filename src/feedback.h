@@ -0,0 +1,140 @@
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <stdint.h>
+#include "bytecode.h"
+
+/**
+ * @brief What a profile records at an instruction, by the kind of
+ * instruction.
+ */
+typedef enum {
+    SITE_NONE,
+    SITE_BRANCH,    // A conditional jump: how often its condition was falsey and truthy
+    SITE_OPERANDS,  // An operator with quickened forms: the subtypes of its operands
+    SITE_CALL,      // A call, or an inline guard that passed: how often, and to what
+} SiteKind;
+
+// Indexes of the counts of each kind of site
+#define COUNT_FALSEY 0
+#define COUNT_TRUTHY 1
+#define COUNT_INTEGERS 0    // Both operands integers
+#define COUNT_FLOATS 1      // Both operands floats
+#define COUNT_OTHERS 2      // Anything else
+#define COUNT_CALLS 0
+
+/**
+ * @brief What a training run saw at one instruction.
+ */
+typedef struct {
+    uint64_t counts[3];
+    Chunk* callee;      // The function every call went to, or NULL
+} SiteCounts;
+
+/**
+ * @brief The counts of one chunk, one entry per byte of its code so an
+ * instruction's offset indexes them.
+ */
+typedef struct {
+    Chunk* chunk;       // NULL for an empty slot
+    SiteCounts* sites;
+    int size;
+} ChunkSites;
+
+/**
+ * @brief What the VM records for --profile-out, by chunk and instruction
+ * offset.
+ */
+typedef struct FeedbackRecorder {
+    ChunkSites* chunks;     // Open-addressed by chunk
+    int count;
+    int capacity;
+    ChunkSites* last;       // The entry recorded to last, NULL after the table moves
+} FeedbackRecorder;
+
+/**
+ * @brief A site of a loaded profile. Offsets change as soon as codegen
+ * uses the profile, so a site is known by its function, its line and its
+ * position among the sites of its kind on that line instead.
+ */
+typedef struct {
+    const char* function;   // NULL for an empty slot
+    int function_line;
+    int line;
+    int ordinal;
+    SiteKind kind;
+    uint64_t counts[3];
+    const char* callee;     // Of a call that always went to one function, or NULL
+} Site;
+
+/**
+ * @brief The calls made from one line to one function, summed over every
+ * site and function the line's code ended up in.
+ */
+typedef struct {
+    const char* callee;     // NULL for an empty slot
+    int line;
+    uint64_t calls;
+} LineCalls;
+
+/**
+ * @brief A profile read back for --profile-in.
+ */
+typedef struct Feedback {
+    Site* sites;            // Open-addressed by function, line, kind and ordinal
+    int sites_count;
+    int sites_capacity;
+    LineCalls* calls;       // Open-addressed by line and callee
+    int calls_count;
+    int calls_capacity;
+    char** names;           // The function names the entries point to
+    int names_count;
+    int names_capacity;
+} Feedback;
+
+/**
+ * @brief The next position among the sites of a kind on a line of a
+ * chunk, counted as codegen emits them or as a chunk is read in order.
+ */
+typedef struct {
+    Chunk* chunk;           // NULL for an empty slot
+    int line;
+    SiteKind kind;
+    int next;
+} SiteOrdinal;
+
+typedef struct {
+    SiteOrdinal* entries;
+    int count;
+    int capacity;
+} SiteOrdinals;
+
+SiteKind site_kind(uint8_t opcode);
+
+void init_feedback_recorder(FeedbackRecorder* recorder);
+ChunkSites* chunk_sites(FeedbackRecorder* recorder, Chunk* chunk);
+int write_feedback(FeedbackRecorder* recorder, const char* path, const char* source, int optimized);
+void free_feedback_recorder(FeedbackRecorder* recorder);
+
+void init_feedback(Feedback* feedback);
+int read_feedback(Feedback* feedback, const char* path, const char* source, int optimized);
+const Site* find_site(const Feedback* feedback, Chunk* chunk, int line, SiteKind kind, int ordinal);
+uint64_t line_calls(const Feedback* feedback, int line, const char* callee, int length);
+void free_feedback(Feedback* feedback);
+
+int next_ordinal(SiteOrdinals* ordinals, Chunk* chunk, int line, SiteKind kind);
+void free_site_ordinals(SiteOrdinals* ordinals);
+
+/**
+ * @brief Returns the counts of the instruction at an offset of a chunk.
+ * Kept inline since it runs for every site a training run executes.
+ */
+static inline SiteCounts* recorded_site(FeedbackRecorder* recorder, Chunk* chunk, int offset) {
+    ChunkSites* entry = recorder->last;
+    if (entry == NULL || entry->chunk != chunk || offset >= entry->size) {
+        entry = chunk_sites(recorder, chunk);
+    }
+    return &entry->sites[offset];
+}
+
+#endif // FEEDBACK_H
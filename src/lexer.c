@@ -22,6 +22,33 @@ void init_lexer(const char *src) {
     line = 1;
 }
 
+/**
+ * @brief Initializes the lexer partway through a source, as when parsing a
+ * function whose body was skipped the first time.
+ *
+ * @param src Where to start scanning.
+ * @param start_line The line src is on.
+ */
+void init_lexer_at(const char *src, int start_line) {
+    source = src;
+    line = start_line;
+}
+
+/**
+ * @brief Returns where the lexer is, for restore_lexer.
+ */
+LexerState save_lexer() {
+    return (LexerState){source, line};
+}
+
+/**
+ * @brief Returns the lexer to a position save_lexer returned.
+ */
+void restore_lexer(LexerState state) {
+    source = state.source;
+    line = state.line;
+}
+
 /**
  * @brief Creates a new token.
  *
@@ -123,10 +150,10 @@ static void skip_whitespace() {
  */
 static TokenType identifier_type(const char* start) {
     static const char* keywords[] = {
-        "and", "or", "print", "function", "false", "end", "else", "if", "then", "true", "nil", "not", "while", "do", "local", "return", NULL
+        "and", "or", "print", "function", "false", "end", "else", "if", "then", "true", "nil", "not", "while", "do", "local", "return", "for", NULL
     };
     static TokenType types[] = {
-        TOKEN_AND, TOKEN_OR, TOKEN_PRINT, TOKEN_FUNCTION, TOKEN_FALSE, TOKEN_END, TOKEN_ELSE, TOKEN_IF, TOKEN_THEN, TOKEN_TRUE, TOKEN_NIL, TOKEN_NOT, TOKEN_WHILE, TOKEN_DO, TOKEN_LOCAL, TOKEN_RETURN
+        TOKEN_AND, TOKEN_OR, TOKEN_PRINT, TOKEN_FUNCTION, TOKEN_FALSE, TOKEN_END, TOKEN_ELSE, TOKEN_IF, TOKEN_THEN, TOKEN_TRUE, TOKEN_NIL, TOKEN_NOT, TOKEN_WHILE, TOKEN_DO, TOKEN_LOCAL, TOKEN_RETURN, TOKEN_FOR
     };
 
     int length = source - start;
@@ -201,6 +228,11 @@ Token next_token() {
         case '(': source++; return make_token(TOKEN_LPAREN, start, 1);
         case ')': source++; return make_token(TOKEN_RPAREN, start, 1);
         case ',': source++; return make_token(TOKEN_COMMA, start, 1);
+        case '{': source++; return make_token(TOKEN_LBRACE, start, 1);
+        case '}': source++; return make_token(TOKEN_RBRACE, start, 1);
+        case '[': source++; return make_token(TOKEN_LBRACKET, start, 1);
+        case ']': source++; return make_token(TOKEN_RBRACKET, start, 1);
+        case '#': source++; return make_token(TOKEN_HASH, start, 1);
         case '+': source++; return make_token(TOKEN_PLUS, start, 1);
         case '-': source++; return make_token(TOKEN_MINUS, start, 1);
         case '*': source++; return make_token(TOKEN_MUL, start, 1);
@@ -240,7 +272,7 @@ Token next_token() {
                 source++;
                 return make_token(TOKEN_CONCAT, start, 2);
             }
-            break;
+            return make_token(TOKEN_DOT, start, 1);
     }
 
     return error_token();
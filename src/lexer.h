@@ -37,6 +37,13 @@ typedef enum {
     TOKEN_FALSE,
     TOKEN_RETURN,
     TOKEN_LOCAL,
+    TOKEN_FOR,
+    TOKEN_LBRACE,
+    TOKEN_RBRACE,
+    TOKEN_LBRACKET,
+    TOKEN_RBRACKET,
+    TOKEN_DOT,
+    TOKEN_HASH,
     TOKEN_UNKNOWN
 } TokenType;
 
@@ -47,7 +54,19 @@ typedef struct {
     int line;
 } Token;
 
+/**
+ * @brief Where the lexer is, saved so that it can return there after
+ * scanning other source.
+ */
+typedef struct {
+    const char *source;
+    int line;
+} LexerState;
+
 void init_lexer(const char *source);
+void init_lexer_at(const char *source, int start_line);
+LexerState save_lexer();
+void restore_lexer(LexerState state);
 Token next_token();
 int is_at_end();
 
@@ -0,0 +1,280 @@
+#include "lua_table.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MAX_LOAD 0.75
+
+/**
+ * @brief Creates an empty table with room for the given number of array
+ * and hash entries, so constructors do not have to grow it.
+ *
+ * @param array_size Expected number of keys 1..n.
+ * @param hash_size Expected number of other keys.
+ * @return The new table. Free it with free_lua_table.
+ */
+LuaTable* new_lua_table(int array_size, int hash_size) {
+    LuaTable* table = (LuaTable*)malloc(sizeof(LuaTable));
+    table->array = array_size > 0 ? (Value*)malloc(sizeof(Value) * array_size) : NULL;
+    table->array_count = 0;
+    table->array_capacity = array_size;
+    table->entries = NULL;
+    table->hash_count = 0;
+    table->hash_capacity = 0;
+    table->next = NULL;
+    table->marked = 0;
+
+    if (hash_size > 0) {
+        int capacity = 8;
+        while (hash_size > capacity * TABLE_MAX_LOAD) capacity *= 2;
+        table->entries = (LuaTableEntry*)malloc(sizeof(LuaTableEntry) * capacity);
+        for (int i = 0; i < capacity; i++) {
+            table->entries[i].key = (Value){VAL_NIL};
+            table->entries[i].value = (Value){VAL_NIL};
+        }
+        table->hash_capacity = capacity;
+    }
+    return table;
+}
+
+void free_lua_table(LuaTable* table) {
+    free(table->array);
+    free(table->entries);
+    free(table);
+}
+
+/**
+ * @brief Turns a float key with an integral value into the equal integer,
+ * so that t[2.0] and t[2] are the same entry, as Lua requires.
+ */
+static Value normalize_key(Value key) {
+    if (key.type == VAL_NUMBER) {
+        double number = key.as.number;
+        if (number >= -9223372036854775808.0 && number < 9223372036854775808.0 && floor(number) == number) {
+            return (Value){VAL_INTEGER, {.integer = (int64_t)number}};
+        }
+    }
+    return key;
+}
+
+static uint32_t hash_bits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hash_string(const char* key) {
+    uint32_t hash = 2166136261u;
+    for (; *key; key++) {
+        hash ^= (uint8_t)*key;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static uint32_t hash_key(Value key) {
+    switch (key.type) {
+        case VAL_INTEGER:
+            return hash_bits((uint64_t)key.as.integer);
+        case VAL_NUMBER: {
+            uint64_t bits;
+            memcpy(&bits, &key.as.number, sizeof(bits));
+            return hash_bits(bits);
+        }
+        case VAL_STRING:
+            return hash_string(key.as.string);
+        case VAL_FUNCTION:
+            return hash_bits((uint64_t)(uintptr_t)key.as.function);
+        case VAL_TABLE:
+            return hash_bits((uint64_t)(uintptr_t)key.as.table);
+        default:
+            return key.type; // true and false
+    }
+}
+
+/**
+ * @brief Compares two normalized keys. Integers and floats never compare
+ * equal here, since an integral float has already become an integer.
+ */
+static int keys_equal(Value a, Value b) {
+    if (a.type != b.type) return 0;
+    switch (a.type) {
+        case VAL_INTEGER:
+            return a.as.integer == b.as.integer;
+        case VAL_NUMBER:
+            return a.as.number == b.as.number;
+        case VAL_STRING:
+            return a.as.string == b.as.string || strcmp(a.as.string, b.as.string) == 0;
+        case VAL_FUNCTION:
+            return a.as.function == b.as.function;
+        case VAL_TABLE:
+            return a.as.table == b.as.table;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Finds the slot for a key by linear probing. Returns the key's slot
+ * if it is present, otherwise the first tombstone or empty slot passed.
+ * The capacity must be a power of two with at least one empty slot.
+ */
+static LuaTableEntry* find_entry(LuaTableEntry* entries, int capacity, Value key) {
+    uint32_t index = hash_key(key) & (capacity - 1);
+    LuaTableEntry* tombstone = NULL;
+    for (;;) {
+        LuaTableEntry* entry = &entries[index];
+        if (entry->key.type == VAL_NIL) {
+            if (entry->value.type == VAL_NIL) {
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL) tombstone = entry;
+        } else if (keys_equal(entry->key, key)) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+/**
+ * @brief Rehashes the live entries into a new slot array, dropping the
+ * tombstones.
+ */
+static void adjust_capacity(LuaTable* table, int capacity) {
+    LuaTableEntry* entries = (LuaTableEntry*)malloc(sizeof(LuaTableEntry) * capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = (Value){VAL_NIL};
+        entries[i].value = (Value){VAL_NIL};
+    }
+
+    table->hash_count = 0;
+    for (int i = 0; i < table->hash_capacity; i++) {
+        LuaTableEntry* entry = &table->entries[i];
+        if (entry->key.type == VAL_NIL) continue;
+        *find_entry(entries, capacity, entry->key) = *entry;
+        table->hash_count++;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->hash_capacity = capacity;
+}
+
+static Value hash_get(LuaTable* table, Value key) {
+    if (table->hash_count == 0) return (Value){VAL_NIL};
+    LuaTableEntry* entry = find_entry(table->entries, table->hash_capacity, key);
+    if (entry->key.type == VAL_NIL) return (Value){VAL_NIL};
+    return entry->value;
+}
+
+/**
+ * @brief Removes a key from the hash part, leaving a tombstone.
+ *
+ * @return The removed value, or nil if the key was not present.
+ */
+static Value hash_remove(LuaTable* table, Value key) {
+    if (table->hash_count == 0) return (Value){VAL_NIL};
+    LuaTableEntry* entry = find_entry(table->entries, table->hash_capacity, key);
+    if (entry->key.type == VAL_NIL) return (Value){VAL_NIL};
+    Value value = entry->value;
+    entry->key = (Value){VAL_NIL};
+    entry->value = (Value){VAL_TRUE, {.boolean = 1}};
+    return value;
+}
+
+static void hash_set(LuaTable* table, Value key, Value value) {
+    if (value.type == VAL_NIL) {
+        hash_remove(table, key);
+        return;
+    }
+
+    if (table->hash_count + 1 > table->hash_capacity * TABLE_MAX_LOAD) {
+        adjust_capacity(table, table->hash_capacity < 8 ? 8 : table->hash_capacity * 2);
+    }
+
+    LuaTableEntry* entry = find_entry(table->entries, table->hash_capacity, key);
+    if (entry->key.type == VAL_NIL) {
+        // Reusing a tombstone leaves the count unchanged
+        if (entry->value.type == VAL_NIL) table->hash_count++;
+        entry->key = key;
+    }
+    entry->value = value;
+}
+
+static void array_append(LuaTable* table, Value value) {
+    if (table->array_count == table->array_capacity) {
+        table->array_capacity = table->array_capacity < 4 ? 4 : table->array_capacity * 2;
+        table->array = (Value*)realloc(table->array, sizeof(Value) * table->array_capacity);
+    }
+    table->array[table->array_count++] = value;
+}
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param table The table.
+ * @param key Any value. Nil and NaN keys are never present.
+ * @return The value stored under the key, or nil.
+ */
+Value lua_table_get(LuaTable* table, Value key) {
+    key = normalize_key(key);
+    if (key.type == VAL_INTEGER && (uint64_t)key.as.integer - 1 < (uint64_t)table->array_count) {
+        return table->array[key.as.integer - 1];
+    }
+    return hash_get(table, key);
+}
+
+/**
+ * @brief Stores a value under a key. Storing nil removes the key.
+ *
+ * @param table The table.
+ * @param key The key. The caller has checked that it is neither nil nor NaN.
+ * @param value The value.
+ */
+void lua_table_set(LuaTable* table, Value key, Value value) {
+    key = normalize_key(key);
+    if (key.type == VAL_INTEGER) {
+        int64_t index = key.as.integer;
+        if ((uint64_t)index - 1 < (uint64_t)table->array_count) {
+            table->array[index - 1] = value;
+            return;
+        }
+        if (index == (int64_t)table->array_count + 1 && value.type != VAL_NIL) {
+            array_append(table, value);
+            // Keys stored out of order are waiting in the hash part
+            while (table->hash_count > 0) {
+                Value next = hash_remove(table, (Value){VAL_INTEGER, {.integer = table->array_count + 1}});
+                if (next.type == VAL_NIL) break;
+                array_append(table, next);
+            }
+            return;
+        }
+    }
+    hash_set(table, key, value);
+}
+
+/**
+ * @brief Returns a border of the table: an n such that t[n] is not nil and
+ * t[n + 1] is nil, or 0 if t[1] is nil. When the array part ends in nil
+ * the border is found by binary search inside it.
+ */
+int64_t lua_table_length(LuaTable* table) {
+    int count = table->array_count;
+    if (count == 0 || table->array[count - 1].type != VAL_NIL) {
+        return count;
+    }
+
+    // array[low - 1] is not nil (or low is 0) and array[high - 1] is nil
+    int low = 0;
+    int high = count;
+    while (high - low > 1) {
+        int middle = low + (high - low) / 2;
+        if (table->array[middle - 1].type == VAL_NIL) {
+            high = middle;
+        } else {
+            low = middle;
+        }
+    }
+    return low;
+}
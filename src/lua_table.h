@@ -0,0 +1,55 @@
+#ifndef LUA_TABLE_H
+#define LUA_TABLE_H
+
+#include <stdint.h>
+#include "value.h"
+
+/**
+ * @brief A slot in the hash part of a Lua table. An empty slot has a nil
+ * key and a nil value; a deleted one (a tombstone) has a nil key and a
+ * true value, so probing continues past it.
+ */
+typedef struct {
+    Value key;
+    Value value;
+} LuaTableEntry;
+
+/**
+ * @brief A Lua table. Integer keys 1..array_count live in the array part,
+ * where a lookup is a bounds check and a load; every other key lives in
+ * the open-addressed hash part. Key array_count + 1 is never in the hash
+ * part: storing it appends to the array and pulls any following keys over
+ * from the hash part, so the length of a table without holes is just
+ * array_count.
+ */
+typedef struct LuaTable {
+    Value* array;
+    int array_count;
+    int array_capacity;
+
+    LuaTableEntry* entries;
+    int hash_count;     // Live entries plus tombstones
+    int hash_capacity;
+
+    struct LuaTable* next;  // Every table the VM has created, for freeing
+    uint8_t marked;         // Reachable, while the VM collects tables
+} LuaTable;
+
+LuaTable* new_lua_table(int array_size, int hash_size);
+void free_lua_table(LuaTable* table);
+Value lua_table_get(LuaTable* table, Value key);
+void lua_table_set(LuaTable* table, Value key, Value value);
+int64_t lua_table_length(LuaTable* table);
+
+/**
+ * @brief Returns the value stored under an integer key, taking the array
+ * part fast path when the key is in range.
+ */
+static inline Value lua_table_get_integer(LuaTable* table, int64_t key) {
+    if ((uint64_t)key - 1 < (uint64_t)table->array_count) {
+        return table->array[key - 1];
+    }
+    return lua_table_get(table, (Value){VAL_INTEGER, {.integer = key}});
+}
+
+#endif // LUA_TABLE_H
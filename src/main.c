@@ -1,15 +1,96 @@
 #include "vm.h"
+#include "server.h"
+#include "profiler.h"
+#include "peephole.h"
+#include "reload.h"
+#include "codegen.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <source_file>\n", program);
+    fprintf(stderr, "       %s --serve <socket>\n", program);
+    fprintf(stderr, "       %s --connect <socket> <source_file|->\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --profile=<file>    Write a sampling profile to <file> and <file>.folded\n");
+    fprintf(stderr, "  --profile-hz=<n>    Samples per second of CPU time (default %d)\n", PROFILER_DEFAULT_HZ);
+    fprintf(stderr, "  --profile-out=<file>\n");
+    fprintf(stderr, "                      Record branch directions, operand types and calls to <file>\n");
+    fprintf(stderr, "  --profile-in=<file> Compile with a profile from --profile-out; not with --single-pass\n");
+    fprintf(stderr, "  --stats[=json]      Print execution statistics to stderr at exit\n");
+    fprintf(stderr, "  -O                  Optimize the AST and the bytecode and report what changed\n");
+    fprintf(stderr, "  --single-pass       Emit bytecode while parsing, without an AST; not with -O\n");
+    fprintf(stderr, "  --pipeline          Lex, parse and generate code on separate threads; not with -O\n");
+    fprintf(stderr, "  --stream[=<nodes>]  Run top-level statements in batches of about <nodes> AST nodes\n");
+    fprintf(stderr, "                      (default %d) as they are compiled; not with -O\n", STREAM_BATCH_NODES);
+    fprintf(stderr, "  --hot-reload        On SIGHUP, reload the functions that changed in <source_file>;\n");
+    fprintf(stderr, "                      not with --stream\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <source_file>\n", argv[0]);
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        return serve(argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--connect") == 0) {
+        return run_client(argv[2], argv[3]);
+    }
+
+    const char* profile_path = NULL;
+    int profile_hz = PROFILER_DEFAULT_HZ;
+    const char* profile_out = NULL;
+    const char* profile_in = NULL;
+    int stats_mode = 0; // 0 off, 1 text, 2 json
+    int optimize = 0;
+    int single_pass = 0;
+    int pipeline = 0;
+    int stream = 0;
+    int batch_nodes = STREAM_BATCH_NODES;
+    int hot_reload = 0;
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--profile-hz=", 13) == 0) {
+            profile_hz = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--profile-out=", 14) == 0) {
+            profile_out = argv[i] + 14;
+        } else if (strncmp(argv[i], "--profile-in=", 13) == 0) {
+            profile_in = argv[i] + 13;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_mode = 1;
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            stats_mode = 2;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[i], "--single-pass") == 0) {
+            single_pass = 1;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strncmp(argv[i], "--stream=", 9) == 0) {
+            stream = 1;
+            batch_nodes = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "--hot-reload") == 0) {
+            hot_reload = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage(argv[0]);
+            return 1;
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path == NULL || optimize + single_pass + pipeline + stream > 1 || (hot_reload && stream) ||
+        (profile_in && single_pass)) {
+        usage(argv[0]);
         return 1;
     }
 
-    FILE *file = fopen(argv[1], "r");
+    FILE *file = fopen(path, "r");
     if (!file) {
         perror("Error opening file");
         return 1;
@@ -28,9 +109,86 @@ int main(int argc, char *argv[]) {
     VM vm;
     init_vm(&vm);
 
-    InterpretResult result = interpret(&vm, buffer);
+    Reloader reloader;
+    if (hot_reload) {
+        init_reloader(&reloader, path, buffer);
+        vm.reloader = &reloader;
+        if (!watch_for_reload()) fprintf(stderr, "Could not watch for SIGHUP.\n");
+    }
+
+    VMStats stats;
+    if (stats_mode) {
+        init_stats(&stats);
+        vm.stats = &stats;
+    }
+
+    Chunk chunk;
+    init_chunk(&chunk);
+
+    Optimizer optimizer;
+    init_optimizer(&optimizer);
+
+    Feedback feedback;
+    init_feedback(&feedback);
+    if (profile_in && read_feedback(&feedback, profile_in, buffer, optimize)) {
+        use_feedback(&feedback);
+        optimizer.feedback = &feedback;
+    }
+
+    FeedbackRecorder recorder;
+    if (profile_out) {
+        init_feedback_recorder(&recorder);
+        vm.feedback = &recorder;
+    }
+
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    CompileMode mode = single_pass ? COMPILE_SINGLE_PASS : pipeline ? COMPILE_PIPELINED : COMPILE_LAZY;
+    if (stream || compile(buffer, &chunk, optimize ? &optimizer : NULL, mode)) {
+        if (optimize) {
+            fprintf(stderr, "AST: %d constants folded, %d locals propagated, %d statements removed, "
+                            "%d values reused, %d values hoisted, %d calls inlined, %d operators typed\n",
+                    optimizer.constants_folded, optimizer.locals_propagated, optimizer.statements_removed,
+                    optimizer.values_reused, optimizer.values_hoisted, optimizer.calls_inlined,
+                    optimizer.operators_typed);
+            PeepholeStats peephole = {0, 0};
+            optimize_chunk(&chunk, &peephole);
+            fprintf(stderr, "Peephole: %d -> %d instructions\n", peephole.before, peephole.after);
+        }
+
+        if (profile_path && !profiler_start(&vm, profile_hz)) {
+            fprintf(stderr, "Could not start the profiler.\n");
+            profile_path = NULL;
+        }
+
+        result = stream ? interpret_streaming(&vm, &chunk, buffer, batch_nodes) : interpret_chunk(&vm, &chunk);
+
+        if (profile_path) {
+            profiler_stop();
+            // Samples point into the chunks, so write before freeing them.
+            profiler_write(profile_path);
+        }
+
+        if (profile_out && !write_feedback(&recorder, profile_out, buffer, optimize)) {
+            perror("Error writing profile");
+        }
+
+        if (stats_mode) {
+            fflush(stdout);
+            if (stats_mode == 2) {
+                print_stats_json(stderr, &stats);
+            } else {
+                print_stats(stderr, &stats);
+            }
+        }
+    }
 
+    free_optimizer(&optimizer);
+    free_chunk(&chunk);
     free_vm(&vm);
+    if (stats_mode) free_stats(&stats);
+    if (hot_reload) free_reloader(&reloader);
+    if (profile_out) free_feedback_recorder(&recorder);
+    free_feedback(&feedback);
     free(buffer);
 
     if (result == INTERPRET_COMPILE_ERROR) return 65;
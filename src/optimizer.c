@@ -0,0 +1,2446 @@
+#include "optimizer.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The folding and elimination passes repeat until nothing changes, but
+// never more often than this
+#define OPTIMIZER_MAX_PASSES 8
+
+// Temporaries are only introduced while fewer locals than this are live,
+// leaving room below the 256 slots a frame can address
+#define OPTIMIZER_MAX_LOCALS 200
+
+// A temporary costs a GET_LOCAL where the value was first computed and a
+// POP where its block ends; reusing a value must save more than that
+#define REUSE_OVERHEAD 2
+
+// Nodes a search for further occurrences of a value may visit, which keeps
+// long straight-line scripts from taking quadratic time
+#define REUSE_SCAN_BUDGET 64
+
+// Nodes the check that nothing in a while loop changes a value may visit;
+// a larger loop keeps its invariant values where they are
+#define LOOP_SCAN_BUDGET 4096
+
+// Functions with more parameters than this, or whose result has more
+// nodes, are not inlined
+#define INLINE_MAX_PARAMETERS 8
+#define INLINE_MAX_NODES 16
+
+// An inlined call, counting its arguments where they were put in the body
+// and the call kept for when the guard fails, may not grow past this
+#define INLINE_MAX_EXPANSION 64
+
+// With a profile, calls the training run made at least this often may
+// inline larger functions, and calls it never made are not inlined
+#define INLINE_HOT_CALLS 1000
+#define INLINE_HOT_MAX_NODES 48
+#define INLINE_HOT_MAX_EXPANSION 192
+
+// A function whose result calls another becomes inlinable once that call
+// is inlined, one level per round
+#define INLINE_MAX_ROUNDS 4
+
+/**
+ * @brief A local variable of the function being optimized: a parameter,
+ * a loop variable, a local declaration or a temporary.
+ */
+typedef struct {
+    Span name;
+    struct ASTNode* declaration;    // NULL for parameters and loop variables
+    int assignments;
+    int uses;
+    int copy_of;                    // Local it was initialized from, or -1
+    bool copy_shadowed;             // That local's name means something else at a use
+} Binding;
+
+/**
+ * @brief Which binding an identifier, assignment, declaration or for loop
+ * node refers to. Kept in a hash table keyed by node index so the AST needs
+ * no extra field; -1 means a global.
+ */
+typedef struct {
+    NodeId node;
+    int binding;
+} Resolution;
+
+typedef struct {
+    Optimizer* optimizer;
+    struct ASTNode* parameters;
+    struct ASTNode* body;
+
+    Binding* bindings;
+    int bindings_count;
+    int bindings_capacity;
+
+    int* scope;             // Bindings visible at the current point
+    int scope_count;
+    int scope_capacity;
+
+    Resolution* resolutions;
+    int resolutions_count;
+    int resolutions_capacity;
+
+    int temporaries;
+    bool changed;
+} Function;
+
+/**
+ * @brief The AST being optimized.
+ */
+static AST* current_ast;
+
+static struct ASTNode* node_at(NodeId id) {
+    return ast_node(current_ast, id);
+}
+
+static bool spans_equal(Span a, Span b) {
+    return a.length == b.length && memcmp(a.start, b.start, a.length) == 0;
+}
+
+static void set_resolution(Function* function, struct ASTNode* node, int binding);
+
+/*
+ * Resolutions
+ */
+
+static uint32_t hash_node(NodeId node) {
+    return node * 2654435761u;
+}
+
+static Resolution* find_resolution(Resolution* entries, int capacity, NodeId node) {
+    uint32_t index = hash_node(node) & (capacity - 1);
+    while (entries[index].node != 0 && entries[index].node != node) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+static void set_resolution(Function* function, struct ASTNode* node, int binding) {
+    if (function->resolutions_count + 1 > function->resolutions_capacity / 2) {
+        int capacity = function->resolutions_capacity < 64 ? 64 : function->resolutions_capacity * 2;
+        Resolution* entries = (Resolution*)calloc(capacity, sizeof(Resolution));
+        for (int i = 0; i < function->resolutions_capacity; i++) {
+            Resolution* old = &function->resolutions[i];
+            if (old->node != 0) *find_resolution(entries, capacity, old->node) = *old;
+        }
+        free(function->resolutions);
+        function->resolutions = entries;
+        function->resolutions_capacity = capacity;
+    }
+    Resolution* entry = find_resolution(function->resolutions, function->resolutions_capacity, node->id);
+    if (entry->node == 0) function->resolutions_count++;
+    entry->node = node->id;
+    entry->binding = binding;
+}
+
+/**
+ * @brief Returns the binding a node refers to, or -1 for a global.
+ */
+static int resolution_of(Function* function, struct ASTNode* node) {
+    if (function->resolutions_count == 0) return -1;
+    Resolution* entry = find_resolution(function->resolutions, function->resolutions_capacity, node->id);
+    return entry->node == 0 ? -1 : entry->binding;
+}
+
+/*
+ * Analysis: resolves every name the way codegen will, and counts the
+ * uses and assignments of each local.
+ */
+
+static int lookup(Function* function, Span name) {
+    for (int i = function->scope_count - 1; i >= 0; i--) {
+        if (spans_equal(function->bindings[function->scope[i]].name, name)) {
+            return function->scope[i];
+        }
+    }
+    return -1;
+}
+
+static int declare(Function* function, Span name, struct ASTNode* declaration) {
+    if (function->bindings_count == function->bindings_capacity) {
+        function->bindings_capacity = function->bindings_capacity < 16 ? 16 : function->bindings_capacity * 2;
+        function->bindings = (Binding*)realloc(function->bindings, sizeof(Binding) * function->bindings_capacity);
+    }
+    if (function->scope_count == function->scope_capacity) {
+        function->scope_capacity = function->scope_capacity < 16 ? 16 : function->scope_capacity * 2;
+        function->scope = (int*)realloc(function->scope, sizeof(int) * function->scope_capacity);
+    }
+    int binding = function->bindings_count++;
+    function->bindings[binding] = (Binding){name, declaration, 0, 0, -1, false};
+    function->scope[function->scope_count++] = binding;
+    return binding;
+}
+
+static void analyze_expression(Function* function, struct ASTNode* node) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            int binding = lookup(function, node->data.identifier_name);
+            set_resolution(function, node, binding);
+            if (binding < 0) break;
+            Binding* local = &function->bindings[binding];
+            local->uses++;
+            if (local->copy_of >= 0 &&
+                lookup(function, function->bindings[local->copy_of].name) != local->copy_of) {
+                local->copy_shadowed = true;
+            }
+            break;
+        }
+        case NODE_BINARY_OP:
+            analyze_expression(function, node_at(node->data.binary_op.left));
+            analyze_expression(function, node_at(node->data.binary_op.right));
+            break;
+        case NODE_UNARY_OP:
+            analyze_expression(function, node_at(node->data.unary_op.right));
+            break;
+        case NODE_LOGICAL_OP:
+            analyze_expression(function, node_at(node->data.logical_op.left));
+            analyze_expression(function, node_at(node->data.logical_op.right));
+            break;
+        case NODE_FUNCTION_CALL:
+            analyze_expression(function, node_at(node->data.function_call.callee));
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                analyze_expression(function, arg);
+            }
+            break;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                analyze_expression(function, node_at(field->data.table_field.key));
+                analyze_expression(function, node_at(field->data.table_field.value));
+            }
+            break;
+        case NODE_INDEX:
+            analyze_expression(function, node_at(node->data.index.object));
+            analyze_expression(function, node_at(node->data.index.key));
+            break;
+        case NODE_INLINE_CALL:
+            analyze_expression(function, node_at(node->data.inline_call.call));
+            analyze_expression(function, node_at(node->data.inline_call.body));
+            break;
+        default:
+            break;
+    }
+}
+
+static void analyze_statement(Function* function, struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_PRINT:
+            analyze_expression(function, node_at(node->data.print_statement.expression));
+            break;
+        case NODE_ASSIGN: {
+            analyze_expression(function, node_at(node->data.assignment.expression));
+            int binding = lookup(function, node->data.assignment.identifier);
+            set_resolution(function, node, binding);
+            if (binding >= 0) function->bindings[binding].assignments++;
+            break;
+        }
+        case NODE_INDEX_ASSIGN:
+            analyze_expression(function, node_at(node->data.index_assign.object));
+            analyze_expression(function, node_at(node->data.index_assign.key));
+            analyze_expression(function, node_at(node->data.index_assign.value));
+            break;
+        case NODE_IF: {
+            analyze_expression(function, node_at(node->data.if_statement.condition));
+            int scope_count = function->scope_count;
+            analyze_statement(function, node_at(node->data.if_statement.then_branch));
+            function->scope_count = scope_count;
+            if (node->data.if_statement.else_branch) {
+                analyze_statement(function, node_at(node->data.if_statement.else_branch));
+                function->scope_count = scope_count;
+            }
+            break;
+        }
+        case NODE_WHILE: {
+            analyze_expression(function, node_at(node->data.while_statement.condition));
+            int scope_count = function->scope_count;
+            analyze_statement(function, node_at(node->data.while_statement.body));
+            function->scope_count = scope_count;
+            break;
+        }
+        case NODE_FOR: {
+            analyze_expression(function, node_at(node->data.for_statement.start));
+            analyze_expression(function, node_at(node->data.for_statement.limit));
+            analyze_expression(function, node_at(node->data.for_statement.step));
+            int scope_count = function->scope_count;
+            // The hidden counter, limit and step locals cannot be named
+            set_resolution(function, node, declare(function, node_at(node->data.for_statement.variable)->data.identifier_name, NULL));
+            analyze_statement(function, node_at(node->data.for_statement.body));
+            function->scope_count = scope_count;
+            break;
+        }
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                analyze_statement(function, statement);
+            }
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            analyze_expression(function, node_at(node->data.expression_statement.expression));
+            break;
+        case NODE_RETURN:
+            analyze_expression(function, node_at(node->data.return_statement.expression));
+            break;
+        case NODE_LOCAL_DECLARATION: {
+            struct ASTNode* expression = node_at(node->data.local_declaration.expression);
+            analyze_expression(function, expression);
+            int copy_of = -1;
+            if (expression != NULL && expression->type == NODE_IDENTIFIER) {
+                copy_of = resolution_of(function, expression);
+            }
+            int binding = declare(function, node->data.local_declaration.identifier, node);
+            function->bindings[binding].copy_of = copy_of;
+            set_resolution(function, node, binding);
+            break;
+        }
+        default:
+            // Function definitions are optimized as functions of their own
+            break;
+    }
+}
+
+static void analyze(Function* function) {
+    function->bindings_count = 0;
+    function->scope_count = 0;
+    if (function->resolutions != NULL) {
+        memset(function->resolutions, 0, sizeof(Resolution) * function->resolutions_capacity);
+    }
+    function->resolutions_count = 0;
+
+    for (struct ASTNode* param = function->parameters; param; param = node_at(param->next)) {
+        declare(function, param->data.identifier_name, NULL);
+    }
+    analyze_statement(function, function->body);
+}
+
+/*
+ * Constant folding and propagation
+ */
+
+static bool is_literal(struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_NUMBER:
+        case NODE_INTEGER:
+        case NODE_STRING:
+        case NODE_TRUE:
+        case NODE_FALSE:
+        case NODE_NIL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_truthy_literal(struct ASTNode* node) {
+    return node->type != NODE_FALSE && node->type != NODE_NIL;
+}
+
+/**
+ * @brief Converts a literal other than a string to the value it produces.
+ */
+static bool literal_value(struct ASTNode* node, Value* value) {
+    switch (node->type) {
+        case NODE_NUMBER:  *value = (Value){VAL_NUMBER, {.number = node->data.number_value}}; return true;
+        case NODE_INTEGER: *value = (Value){VAL_INTEGER, {.integer = node->data.integer_value}}; return true;
+        case NODE_TRUE:    *value = (Value){VAL_TRUE, {.boolean = 1}}; return true;
+        case NODE_FALSE:   *value = (Value){VAL_FALSE, {.boolean = 0}}; return true;
+        case NODE_NIL:     *value = (Value){VAL_NIL}; return true;
+        default:           return false;
+    }
+}
+
+/**
+ * @brief Turns an operator node into a literal, keeping its place in any
+ * list and its line.
+ */
+static void replace_with_value(struct ASTNode* node, Value value) {
+    switch (value.type) {
+        case VAL_INTEGER:
+            node->type = NODE_INTEGER;
+            node->data.integer_value = value.as.integer;
+            break;
+        case VAL_NUMBER:
+            node->type = NODE_NUMBER;
+            node->data.number_value = value.as.number;
+            break;
+        case VAL_TRUE:
+            node->type = NODE_TRUE;
+            break;
+        case VAL_FALSE:
+            node->type = NODE_FALSE;
+            break;
+        default:
+            node->type = NODE_NIL;
+            break;
+    }
+}
+
+static Value boolean_value(bool value) {
+    return value ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}};
+}
+
+/**
+ * @brief Compares two literals the way OP_EQUAL compares their values.
+ */
+static bool literals_equal(struct ASTNode* a, struct ASTNode* b) {
+    if (a->type == NODE_STRING || b->type == NODE_STRING) {
+        return a->type == b->type && spans_equal(a->data.string_value, b->data.string_value);
+    }
+    Value x, y;
+    literal_value(a, &x);
+    literal_value(b, &y);
+    if (x.type == VAL_INTEGER && y.type == VAL_INTEGER) return x.as.integer == y.as.integer;
+    return values_equal(x, y);
+}
+
+/**
+ * @brief Folds a binary operator over two literals, with the VM's
+ * semantics. Operations that would raise a runtime error are left alone.
+ */
+static bool fold_binary(struct ASTNode* node) {
+    struct ASTNode* left = node_at(node->data.binary_op.left);
+    struct ASTNode* right = node_at(node->data.binary_op.right);
+    if (!is_literal(left) || !is_literal(right)) return false;
+
+    TokenType op = node->data.binary_op.op;
+    if (op == TOKEN_EQUAL || op == TOKEN_NOT_EQUAL) {
+        bool equal = literals_equal(left, right);
+        replace_with_value(node, boolean_value(op == TOKEN_EQUAL ? equal : !equal));
+        return true;
+    }
+
+    Value a, b;
+    if (!literal_value(left, &a) || !literal_value(right, &b) || !is_number(a) || !is_number(b)) {
+        return false;
+    }
+    bool integers = a.type == VAL_INTEGER && b.type == VAL_INTEGER;
+    switch (op) {
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+        case TOKEN_MUL: {
+            if (integers) {
+                uint64_t x = (uint64_t)a.as.integer;
+                uint64_t y = (uint64_t)b.as.integer;
+                uint64_t result = op == TOKEN_PLUS ? x + y : op == TOKEN_MINUS ? x - y : x * y;
+                replace_with_value(node, (Value){VAL_INTEGER, {.integer = (int64_t)result}});
+            } else {
+                double x = as_float(a);
+                double y = as_float(b);
+                double result = op == TOKEN_PLUS ? x + y : op == TOKEN_MINUS ? x - y : x * y;
+                replace_with_value(node, (Value){VAL_NUMBER, {.number = result}});
+            }
+            return true;
+        }
+        case TOKEN_DIV:
+            replace_with_value(node, (Value){VAL_NUMBER, {.number = as_float(a) / as_float(b)}});
+            return true;
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL:
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL: {
+            int order;  // As compare_numbers: 2 when unordered
+            if (integers) {
+                order = a.as.integer < b.as.integer ? -1 : a.as.integer > b.as.integer;
+            } else if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
+                double x = a.as.number;
+                double y = b.as.number;
+                order = x < y ? -1 : x > y ? 1 : x == y ? 0 : 2;
+            } else {
+                order = compare_numbers(a, b);
+            }
+            bool result = false;
+            if (order != 2) {
+                switch (op) {
+                    case TOKEN_LESS:          result = order < 0; break;
+                    case TOKEN_LESS_EQUAL:    result = order <= 0; break;
+                    case TOKEN_GREATER:       result = order > 0; break;
+                    default:                  result = order >= 0; break;
+                }
+            }
+            replace_with_value(node, boolean_value(result));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool fold_unary(struct ASTNode* node) {
+    struct ASTNode* operand = node_at(node->data.unary_op.right);
+    if (!is_literal(operand)) return false;
+
+    switch (node->data.unary_op.op) {
+        case TOKEN_NOT:
+            replace_with_value(node, boolean_value(!is_truthy_literal(operand)));
+            return true;
+        case TOKEN_MINUS:
+            if (operand->type == NODE_INTEGER) {
+                uint64_t negated = 0 - (uint64_t)operand->data.integer_value;
+                replace_with_value(node, (Value){VAL_INTEGER, {.integer = (int64_t)negated}});
+                return true;
+            }
+            if (operand->type == NODE_NUMBER) {
+                replace_with_value(node, (Value){VAL_NUMBER, {.number = -operand->data.number_value}});
+                return true;
+            }
+            return false;
+        case TOKEN_HASH:
+            if (operand->type == NODE_STRING) {
+                int64_t length = operand->data.string_value.length;
+                replace_with_value(node, (Value){VAL_INTEGER, {.integer = length}});
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Gives a node the contents of another, keeping its own index and
+ * its place in any list.
+ */
+static void overwrite_node(struct ASTNode* node, struct ASTNode* source) {
+    NodeId id = node->id;
+    NodeId next = node->next;
+    *node = *source;
+    node->id = id;
+    node->next = next;
+}
+
+/**
+ * @brief Allocates a node with the contents of another, outside any list.
+ */
+static struct ASTNode* clone_node(struct ASTNode* node) {
+    struct ASTNode* copy = new_node(current_ast, node->type);
+    overwrite_node(copy, node);
+    return copy;
+}
+
+/**
+ * @brief Replaces a node with one of its operands, which moves into the
+ * node's place. The other is dropped with the operand's old node, and both
+ * stay unused until the AST is freed.
+ */
+static void replace_with_operand(Function* function, struct ASTNode* node, struct ASTNode* keep) {
+    int binding = keep->type == NODE_IDENTIFIER ? resolution_of(function, keep) : -1;
+    overwrite_node(node, keep);
+    if (node->type == NODE_IDENTIFIER) set_resolution(function, node, binding);
+}
+
+/**
+ * @brief Short-circuits and/or whose left operand is a literal.
+ */
+static bool fold_logical(Function* function, struct ASTNode* node) {
+    struct ASTNode* left = node_at(node->data.logical_op.left);
+    struct ASTNode* right = node_at(node->data.logical_op.right);
+    if (!is_literal(left)) return false;
+
+    bool keep_left = node->data.logical_op.op == TOKEN_AND ? !is_truthy_literal(left) : is_truthy_literal(left);
+    if (keep_left) {
+        replace_with_operand(function, node, left);
+    } else {
+        replace_with_operand(function, node, right);
+    }
+    return true;
+}
+
+/**
+ * @brief Replaces a use of a local that is never assigned after its
+ * declaration: by the literal it was initialized with, or by the local
+ * it was copied from when that one is never assigned either.
+ */
+static void propagate(Function* function, struct ASTNode* node) {
+    int binding = resolution_of(function, node);
+    if (binding < 0) return;
+    Binding* local = &function->bindings[binding];
+    if (local->declaration == NULL || local->assignments > 0) return;
+
+    struct ASTNode* initializer = node_at(local->declaration->data.local_declaration.expression);
+    if (initializer == NULL || is_literal(initializer)) {
+        int line = node->line;
+        if (initializer == NULL) {
+            node->type = NODE_NIL;
+        } else {
+            overwrite_node(node, initializer);
+        }
+        node->line = line;
+        function->optimizer->locals_propagated++;
+        function->changed = true;
+        return;
+    }
+
+    if (local->copy_of >= 0 && !local->copy_shadowed && function->bindings[local->copy_of].assignments == 0) {
+        node->data.identifier_name = function->bindings[local->copy_of].name;
+        set_resolution(function, node, local->copy_of);
+        function->optimizer->locals_propagated++;
+        function->changed = true;
+    }
+}
+
+static void rewrite_expression(Function* function, struct ASTNode* node) {
+    if (node == NULL) return;
+    bool folded = false;
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            propagate(function, node);
+            break;
+        case NODE_BINARY_OP:
+            rewrite_expression(function, node_at(node->data.binary_op.left));
+            rewrite_expression(function, node_at(node->data.binary_op.right));
+            folded = fold_binary(node);
+            break;
+        case NODE_UNARY_OP:
+            rewrite_expression(function, node_at(node->data.unary_op.right));
+            folded = fold_unary(node);
+            break;
+        case NODE_LOGICAL_OP:
+            rewrite_expression(function, node_at(node->data.logical_op.left));
+            rewrite_expression(function, node_at(node->data.logical_op.right));
+            folded = fold_logical(function, node);
+            break;
+        case NODE_FUNCTION_CALL:
+            rewrite_expression(function, node_at(node->data.function_call.callee));
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                rewrite_expression(function, arg);
+            }
+            break;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                rewrite_expression(function, node_at(field->data.table_field.key));
+                rewrite_expression(function, node_at(field->data.table_field.value));
+            }
+            break;
+        case NODE_INDEX:
+            rewrite_expression(function, node_at(node->data.index.object));
+            rewrite_expression(function, node_at(node->data.index.key));
+            break;
+        default:
+            break;
+    }
+    if (folded) {
+        function->optimizer->constants_folded++;
+        function->changed = true;
+    }
+}
+
+static void rewrite_statement(Function* function, struct ASTNode* node) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_PRINT:
+            rewrite_expression(function, node_at(node->data.print_statement.expression));
+            break;
+        case NODE_ASSIGN:
+            rewrite_expression(function, node_at(node->data.assignment.expression));
+            break;
+        case NODE_INDEX_ASSIGN:
+            rewrite_expression(function, node_at(node->data.index_assign.object));
+            rewrite_expression(function, node_at(node->data.index_assign.key));
+            rewrite_expression(function, node_at(node->data.index_assign.value));
+            break;
+        case NODE_IF:
+            rewrite_expression(function, node_at(node->data.if_statement.condition));
+            rewrite_statement(function, node_at(node->data.if_statement.then_branch));
+            rewrite_statement(function, node_at(node->data.if_statement.else_branch));
+            break;
+        case NODE_WHILE:
+            rewrite_expression(function, node_at(node->data.while_statement.condition));
+            rewrite_statement(function, node_at(node->data.while_statement.body));
+            break;
+        case NODE_FOR:
+            rewrite_expression(function, node_at(node->data.for_statement.start));
+            rewrite_expression(function, node_at(node->data.for_statement.limit));
+            rewrite_expression(function, node_at(node->data.for_statement.step));
+            rewrite_statement(function, node_at(node->data.for_statement.body));
+            break;
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                rewrite_statement(function, statement);
+            }
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            rewrite_expression(function, node_at(node->data.expression_statement.expression));
+            break;
+        case NODE_RETURN:
+            rewrite_expression(function, node_at(node->data.return_statement.expression));
+            break;
+        case NODE_LOCAL_DECLARATION:
+            rewrite_expression(function, node_at(node->data.local_declaration.expression));
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Dead code elimination
+ */
+
+/**
+ * @brief Returns whether evaluating an expression can neither fail nor
+ * have an effect, so that it can be dropped when its value is unused.
+ */
+static bool is_pure(Function* function, struct ASTNode* node) {
+    if (node == NULL || is_literal(node)) return true;
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            return resolution_of(function, node) >= 0;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                // A key may be nil or NaN, which raises an error
+                if (field->data.table_field.key != 0 || !is_pure(function, node_at(field->data.table_field.value))) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool declares_locals(struct ASTNode* block) {
+    for (struct ASTNode* statement = node_at(block->data.statements.statement); statement; statement = node_at(statement->next)) {
+        if (statement->type == NODE_LOCAL_DECLARATION) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Unlinks a statement from its list.
+ */
+static void remove_statement(Function* function, NodeId* link) {
+    struct ASTNode* statement = node_at(*link);
+    *link = statement->next;
+    statement->next = 0;
+    function->optimizer->statements_removed++;
+    function->changed = true;
+}
+
+static void eliminate_dead_code(Function* function, struct ASTNode* block);
+
+/**
+ * @brief Replaces an if whose condition is a literal by the branch that
+ * always runs. The branch's statements move into the enclosing list
+ * unless it declares locals, which must go out of scope at its end.
+ */
+static void fold_if(Function* function, NodeId* link) {
+    struct ASTNode* node = node_at(*link);
+    bool truthy = is_truthy_literal(node_at(node->data.if_statement.condition));
+    struct ASTNode* taken = truthy ? node_at(node->data.if_statement.then_branch) : node_at(node->data.if_statement.else_branch);
+
+    if (taken == NULL) {
+        remove_statement(function, link);
+        return;
+    }
+    if (declares_locals(taken)) {
+        // Keep the block, but drop the branch that never runs
+        struct ASTNode* dead = truthy ? node_at(node->data.if_statement.else_branch) : node_at(node->data.if_statement.then_branch);
+        if (dead == NULL) return;
+        node->data.if_statement.then_branch = taken->id;
+        node->data.if_statement.else_branch = 0;
+        node_at(node->data.if_statement.condition)->type = NODE_TRUE;
+        function->optimizer->statements_removed++;
+        function->changed = true;
+        return;
+    }
+
+    struct ASTNode* first = node_at(taken->data.statements.statement);
+    taken->data.statements.statement = 0;
+    if (first == NULL) {
+        remove_statement(function, link);
+        return;
+    }
+    struct ASTNode* last = first;
+    while (last->next) last = node_at(last->next);
+    last->next = node->next;
+    node->next = 0;
+    *link = first->id;
+    function->optimizer->statements_removed++;
+    function->changed = true;
+}
+
+/**
+ * @brief Removes, from a statement list and the blocks nested in it,
+ * declarations of unused locals with pure initializers, branches that
+ * can never run and statements after a return.
+ */
+static void eliminate_dead_code(Function* function, struct ASTNode* block) {
+    NodeId* link = &block->data.statements.statement;
+    while (*link) {
+        struct ASTNode* statement = node_at(*link);
+        switch (statement->type) {
+            case NODE_IF:
+                eliminate_dead_code(function, node_at(statement->data.if_statement.then_branch));
+                if (statement->data.if_statement.else_branch) {
+                    eliminate_dead_code(function, node_at(statement->data.if_statement.else_branch));
+                }
+                if (is_literal(node_at(statement->data.if_statement.condition))) {
+                    NodeId before = statement->id;
+                    fold_if(function, link);
+                    // Look at whatever took its place, unless it was kept
+                    if (*link != before) continue;
+                }
+                break;
+            case NODE_WHILE:
+                if (is_literal(node_at(statement->data.while_statement.condition)) &&
+                    !is_truthy_literal(node_at(statement->data.while_statement.condition))) {
+                    remove_statement(function, link);
+                    continue;
+                }
+                eliminate_dead_code(function, node_at(statement->data.while_statement.body));
+                break;
+            case NODE_FOR:
+                eliminate_dead_code(function, node_at(statement->data.for_statement.body));
+                break;
+            case NODE_LOCAL_DECLARATION: {
+                Binding* local = &function->bindings[resolution_of(function, statement)];
+                if (local->uses == 0 && local->assignments == 0 &&
+                    is_pure(function, node_at(statement->data.local_declaration.expression))) {
+                    remove_statement(function, link);
+                    continue;
+                }
+                break;
+            }
+            case NODE_RETURN:
+                while (statement->next) remove_statement(function, &statement->next);
+                break;
+            default:
+                break;
+        }
+        link = &statement->next;
+    }
+}
+
+/*
+ * Value reuse: a value computed again while its inputs are unchanged is
+ * computed once into a temporary local.
+ */
+
+/**
+ * @brief Returns whether a node is a value worth keeping in a temporary:
+ * a global load, or arithmetic over literals, locals and globals.
+ */
+static bool is_value_tree(struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_NUMBER:
+        case NODE_INTEGER:
+        case NODE_IDENTIFIER:
+            return true;
+        case NODE_BINARY_OP:
+            switch (node->data.binary_op.op) {
+                case TOKEN_PLUS:
+                case TOKEN_MINUS:
+                case TOKEN_MUL:
+                case TOKEN_DIV:
+                    return is_value_tree(node_at(node->data.binary_op.left)) && is_value_tree(node_at(node->data.binary_op.right));
+                default:
+                    return false;
+            }
+        case NODE_UNARY_OP:
+            return node->data.unary_op.op == TOKEN_MINUS && is_value_tree(node_at(node->data.unary_op.right));
+        default:
+            return false;
+    }
+}
+
+static bool is_reusable(Function* function, struct ASTNode* node) {
+    if (node->type == NODE_IDENTIFIER) return resolution_of(function, node) < 0;
+    return (node->type == NODE_BINARY_OP || node->type == NODE_UNARY_OP) && is_value_tree(node);
+}
+
+/**
+ * @brief Roughly what evaluating a value costs, in instructions. A global
+ * load is a hash lookup and counts as three.
+ */
+static int value_weight(Function* function, struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            return resolution_of(function, node) < 0 ? 3 : 1;
+        case NODE_BINARY_OP:
+            return 1 + value_weight(function, node_at(node->data.binary_op.left)) +
+                       value_weight(function, node_at(node->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return 1 + value_weight(function, node_at(node->data.unary_op.right));
+        default:
+            return 1;
+    }
+}
+
+static bool same_value(Function* function, struct ASTNode* a, struct ASTNode* b) {
+    if (a->type != b->type) return false;
+    switch (a->type) {
+        case NODE_NUMBER:
+            return memcmp(&a->data.number_value, &b->data.number_value, sizeof(double)) == 0;
+        case NODE_INTEGER:
+            return a->data.integer_value == b->data.integer_value;
+        case NODE_IDENTIFIER: {
+            int binding = resolution_of(function, a);
+            if (binding != resolution_of(function, b)) return false;
+            return binding >= 0 || spans_equal(a->data.identifier_name, b->data.identifier_name);
+        }
+        case NODE_BINARY_OP:
+            return a->data.binary_op.op == b->data.binary_op.op &&
+                   same_value(function, node_at(a->data.binary_op.left), node_at(b->data.binary_op.left)) &&
+                   same_value(function, node_at(a->data.binary_op.right), node_at(b->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return a->data.unary_op.op == b->data.unary_op.op &&
+                   same_value(function, node_at(a->data.unary_op.right), node_at(b->data.unary_op.right));
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Returns whether a value reads a local, or a global (any global
+ * when name is NULL).
+ */
+static bool reads_variable(Function* function, struct ASTNode* node, int binding, Span* name) {
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            int resolved = resolution_of(function, node);
+            if (resolved >= 0) return resolved == binding;
+            return binding < 0 && (name == NULL || spans_equal(*name, node->data.identifier_name));
+        }
+        case NODE_BINARY_OP:
+            return reads_variable(function, node_at(node->data.binary_op.left), binding, name) ||
+                   reads_variable(function, node_at(node->data.binary_op.right), binding, name);
+        case NODE_UNARY_OP:
+            return reads_variable(function, node_at(node->data.unary_op.right), binding, name);
+        default:
+            return false;
+    }
+}
+
+static NodeId copy_value(Function* function, struct ASTNode* node);
+
+static NodeId copy_list(Function* function, struct ASTNode* first) {
+    NodeId head = 0;
+    NodeId* tail = &head;
+    for (; first != NULL; first = node_at(first->next)) {
+        *tail = copy_value(function, first);
+        tail = &node_at(*tail)->next;
+    }
+    return head;
+}
+
+/**
+ * @brief Copies an expression, giving the names in the copy the same
+ * resolutions.
+ */
+static NodeId copy_value(Function* function, struct ASTNode* node) {
+    if (node == NULL) return 0;
+    struct ASTNode* copy = clone_node(node);
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            set_resolution(function, copy, resolution_of(function, node));
+            break;
+        case NODE_BINARY_OP:
+            copy->data.binary_op.left = copy_value(function, node_at(node->data.binary_op.left));
+            copy->data.binary_op.right = copy_value(function, node_at(node->data.binary_op.right));
+            break;
+        case NODE_UNARY_OP:
+            copy->data.unary_op.right = copy_value(function, node_at(node->data.unary_op.right));
+            break;
+        case NODE_LOGICAL_OP:
+            copy->data.logical_op.left = copy_value(function, node_at(node->data.logical_op.left));
+            copy->data.logical_op.right = copy_value(function, node_at(node->data.logical_op.right));
+            break;
+        case NODE_INDEX:
+            copy->data.index.object = copy_value(function, node_at(node->data.index.object));
+            copy->data.index.key = copy_value(function, node_at(node->data.index.key));
+            break;
+        case NODE_FUNCTION_CALL:
+            copy->data.function_call.callee = copy_value(function, node_at(node->data.function_call.callee));
+            copy->data.function_call.argument = copy_list(function, node_at(node->data.function_call.argument));
+            break;
+        case NODE_TABLE:
+            copy->data.table.fields = copy_list(function, node_at(node->data.table.fields));
+            break;
+        case NODE_TABLE_FIELD:
+            copy->data.table_field.key = copy_value(function, node_at(node->data.table_field.key));
+            copy->data.table_field.value = copy_value(function, node_at(node->data.table_field.value));
+            break;
+        case NODE_INLINE_CALL:
+            copy->data.inline_call.call = copy_value(function, node_at(node->data.inline_call.call));
+            copy->data.inline_call.body = copy_value(function, node_at(node->data.inline_call.body));
+            break;
+        default:
+            break;
+    }
+    return copy->id;
+}
+
+/**
+ * @brief A value being reused, and the occurrences of it found so far.
+ */
+typedef struct {
+    struct ASTNode* value;
+    int occurrences;
+    bool replace;           // Replace occurrences by the temporary, or only count them
+    int budget;             // Nodes left to visit when only counting; when
+                            // replacing, what a nested loop's probe may visit
+    int temporary;
+    Span name;
+} Reuse;
+
+static bool reuse_in_statement(Function* function, Reuse* reuse, struct ASTNode* node);
+
+/**
+ * @brief Walks an expression in evaluation order, counting or replacing
+ * occurrences of the value.
+ *
+ * @return false once the value may have changed; nothing after that point
+ * is touched.
+ */
+static bool reuse_in_expression(Function* function, Reuse* reuse, struct ASTNode* node) {
+    if (node == NULL) return true;
+    if (!reuse->replace && --reuse->budget < 0) return false;
+    if (same_value(function, node, reuse->value)) {
+        reuse->occurrences++;
+        if (reuse->replace) {
+            node->type = NODE_IDENTIFIER;
+            node->data.identifier_name = reuse->name;
+            set_resolution(function, node, reuse->temporary);
+        }
+        return true;
+    }
+
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            return reuse_in_expression(function, reuse, node_at(node->data.binary_op.left)) &&
+                   reuse_in_expression(function, reuse, node_at(node->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return reuse_in_expression(function, reuse, node_at(node->data.unary_op.right));
+        case NODE_LOGICAL_OP:
+            return reuse_in_expression(function, reuse, node_at(node->data.logical_op.left)) &&
+                   reuse_in_expression(function, reuse, node_at(node->data.logical_op.right));
+        case NODE_FUNCTION_CALL:
+            if (!reuse_in_expression(function, reuse, node_at(node->data.function_call.callee))) return false;
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                if (!reuse_in_expression(function, reuse, arg)) return false;
+            }
+            // The callee may assign any global, but cannot see our locals
+            return !reads_variable(function, reuse->value, -1, NULL);
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                if (!reuse_in_expression(function, reuse, node_at(field->data.table_field.key)) ||
+                    !reuse_in_expression(function, reuse, node_at(field->data.table_field.value))) {
+                    return false;
+                }
+            }
+            return true;
+        case NODE_INDEX:
+            return reuse_in_expression(function, reuse, node_at(node->data.index.object)) &&
+                   reuse_in_expression(function, reuse, node_at(node->data.index.key));
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Walks a loop, touching occurrences only if nothing in the loop
+ * can change the value, since the loop runs its parts again.
+ */
+static bool reuse_in_loop(Function* function, Reuse* reuse, struct ASTNode* condition, struct ASTNode* body) {
+    Reuse probe = *reuse;
+    probe.replace = false;
+    if (reuse->replace) probe.budget = reuse->budget;
+    bool unchanged = reuse_in_expression(function, &probe, condition) && reuse_in_statement(function, &probe, body);
+    if (!reuse->replace) reuse->budget = probe.budget;
+    if (!unchanged) return false;
+    reuse_in_expression(function, reuse, condition);
+    reuse_in_statement(function, reuse, body);
+    return true;
+}
+
+static bool reuse_in_statement(Function* function, Reuse* reuse, struct ASTNode* node) {
+    if (!reuse->replace && --reuse->budget < 0) return false;
+    switch (node->type) {
+        case NODE_PRINT:
+            return reuse_in_expression(function, reuse, node_at(node->data.print_statement.expression));
+        case NODE_ASSIGN: {
+            if (!reuse_in_expression(function, reuse, node_at(node->data.assignment.expression))) return false;
+            int binding = resolution_of(function, node);
+            return !reads_variable(function, reuse->value, binding, &node->data.assignment.identifier);
+        }
+        case NODE_INDEX_ASSIGN:
+            return reuse_in_expression(function, reuse, node_at(node->data.index_assign.object)) &&
+                   reuse_in_expression(function, reuse, node_at(node->data.index_assign.key)) &&
+                   reuse_in_expression(function, reuse, node_at(node->data.index_assign.value));
+        case NODE_IF: {
+            if (!reuse_in_expression(function, reuse, node_at(node->data.if_statement.condition))) return false;
+            bool then_kept = reuse_in_statement(function, reuse, node_at(node->data.if_statement.then_branch));
+            bool else_kept = node->data.if_statement.else_branch == 0 ||
+                             reuse_in_statement(function, reuse, node_at(node->data.if_statement.else_branch));
+            return then_kept && else_kept;
+        }
+        case NODE_WHILE:
+            return reuse_in_loop(function, reuse, node_at(node->data.while_statement.condition),
+                                 node_at(node->data.while_statement.body));
+        case NODE_FOR:
+            if (!reuse_in_expression(function, reuse, node_at(node->data.for_statement.start)) ||
+                !reuse_in_expression(function, reuse, node_at(node->data.for_statement.limit)) ||
+                !reuse_in_expression(function, reuse, node_at(node->data.for_statement.step))) {
+                return false;
+            }
+            return reuse_in_loop(function, reuse, NULL, node_at(node->data.for_statement.body));
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                if (!reuse_in_statement(function, reuse, statement)) return false;
+            }
+            return true;
+        case NODE_EXPRESSION_STATEMENT:
+            return reuse_in_expression(function, reuse, node_at(node->data.expression_statement.expression));
+        case NODE_RETURN:
+            // Nothing runs after a return, so whatever it changes does not matter
+            reuse_in_expression(function, reuse, node_at(node->data.return_statement.expression));
+            return true;
+        case NODE_LOCAL_DECLARATION:
+            return reuse_in_expression(function, reuse, node_at(node->data.local_declaration.expression));
+        case NODE_FUNCTION_DEF:
+            return !reads_variable(function, reuse->value, -1, &node_at(node->data.function_def.name)->data.identifier_name);
+        default:
+            return true;
+    }
+}
+
+static bool reuse_in_statements(Function* function, Reuse* reuse, struct ASTNode* first) {
+    for (struct ASTNode* statement = first; statement; statement = node_at(statement->next)) {
+        if (!reuse_in_statement(function, reuse, statement)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief A search for a value worth computing ahead of where it is used:
+ * worth decides for each value met, given the statement or loop the search
+ * is for.
+ */
+typedef struct {
+    bool (*worth)(Function* function, struct ASTNode* context, struct ASTNode* value);
+    struct ASTNode* context;
+    struct ASTNode* found;
+} Search;
+
+/**
+ * @brief Returns whether a value occurs often enough from a statement on,
+ * unchanged, to pay for a temporary.
+ */
+static bool worth_reusing(Function* function, struct ASTNode* statement, struct ASTNode* value) {
+    if (!is_reusable(function, value)) return false;
+    Reuse reuse = {value, 0, false, REUSE_SCAN_BUDGET, -1, {NULL, 0}};
+    reuse_in_statements(function, &reuse, statement);
+    return (reuse.occurrences - 1) * (value_weight(function, value) - 1) > REUSE_OVERHEAD;
+}
+
+/**
+ * @brief Looks for a value to compute ahead of a statement. Walks the part
+ * of the statement that always runs, in evaluation order, and stops at
+ * the first operation that could fail or have an effect, since running
+ * anything ahead of it would change which error is raised, or whether.
+ *
+ * @return false once the search has to stop.
+ */
+static bool find_reusable(Function* function, Search* search, struct ASTNode* node) {
+    if (node == NULL || is_literal(node)) return true;
+
+    if (search->worth(function, search->context, node)) {
+        search->found = node;
+        return false;
+    }
+
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            // Reading a global fails when it is not defined
+            return resolution_of(function, node) >= 0;
+        case NODE_BINARY_OP:
+            if (!find_reusable(function, search, node_at(node->data.binary_op.left)) ||
+                !find_reusable(function, search, node_at(node->data.binary_op.right))) {
+                return false;
+            }
+            return node->data.binary_op.op == TOKEN_EQUAL || node->data.binary_op.op == TOKEN_NOT_EQUAL;
+        case NODE_UNARY_OP:
+            if (!find_reusable(function, search, node_at(node->data.unary_op.right))) return false;
+            return node->data.unary_op.op == TOKEN_NOT;
+        case NODE_LOGICAL_OP:
+            // The right operand does not always run
+            find_reusable(function, search, node_at(node->data.logical_op.left));
+            return false;
+        case NODE_FUNCTION_CALL:
+            if (!find_reusable(function, search, node_at(node->data.function_call.callee))) return false;
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                if (!find_reusable(function, search, arg)) return false;
+            }
+            return false;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                if (!find_reusable(function, search, node_at(field->data.table_field.key)) ||
+                    !find_reusable(function, search, node_at(field->data.table_field.value))) {
+                    return false;
+                }
+                if (field->data.table_field.key != 0) return false;
+            }
+            return true;
+        case NODE_INDEX:
+            if (find_reusable(function, search, node_at(node->data.index.object))) {
+                find_reusable(function, search, node_at(node->data.index.key));
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static struct ASTNode* reusable_in_statement(Function* function, Search* search, struct ASTNode* statement) {
+    search->found = NULL;
+    switch (statement->type) {
+        case NODE_PRINT:
+            find_reusable(function, search, node_at(statement->data.print_statement.expression));
+            break;
+        case NODE_ASSIGN:
+            find_reusable(function, search, node_at(statement->data.assignment.expression));
+            break;
+        case NODE_INDEX_ASSIGN:
+            if (find_reusable(function, search, node_at(statement->data.index_assign.object)) &&
+                find_reusable(function, search, node_at(statement->data.index_assign.key))) {
+                find_reusable(function, search, node_at(statement->data.index_assign.value));
+            }
+            break;
+        case NODE_IF:
+            find_reusable(function, search, node_at(statement->data.if_statement.condition));
+            break;
+        case NODE_FOR:
+            if (find_reusable(function, search, node_at(statement->data.for_statement.start)) &&
+                find_reusable(function, search, node_at(statement->data.for_statement.limit))) {
+                find_reusable(function, search, node_at(statement->data.for_statement.step));
+            }
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            find_reusable(function, search, node_at(statement->data.expression_statement.expression));
+            break;
+        case NODE_RETURN:
+            find_reusable(function, search, node_at(statement->data.return_statement.expression));
+            break;
+        case NODE_LOCAL_DECLARATION:
+            find_reusable(function, search, node_at(statement->data.local_declaration.expression));
+            break;
+        default:
+            // A while condition runs again on every iteration
+            break;
+    }
+    return search->found;
+}
+
+static Span temporary_name(Function* function) {
+    Optimizer* optimizer = function->optimizer;
+    if (optimizer->names_count == optimizer->names_capacity) {
+        optimizer->names_capacity = optimizer->names_capacity < 8 ? 8 : optimizer->names_capacity * 2;
+        optimizer->names = (char**)realloc(optimizer->names, sizeof(char*) * optimizer->names_capacity);
+    }
+    // Parentheses keep it apart from every name a script can use
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "(temporary %d)", function->temporaries++);
+    char* name = strdup(buffer);
+    optimizer->names[optimizer->names_count++] = name;
+    return (Span){name, length};
+}
+
+/**
+ * @brief Declares a new temporary holding a copy of a value, and inserts
+ * the declaration at link.
+ *
+ * @return A replacing Reuse for the temporary. It compares against the
+ * copy, since the value itself is replaced on the way.
+ */
+static Reuse declare_temporary(Function* function, NodeId* link, struct ASTNode* value) {
+    Span name = temporary_name(function);
+
+    struct ASTNode* declaration = new_node(current_ast, NODE_LOCAL_DECLARATION);
+    declaration->line = node_at(*link)->line;
+    declaration->data.local_declaration.identifier = name;
+    declaration->data.local_declaration.expression = copy_value(function, value);
+
+    // Only the function's resolutions are needed, so no scope is pushed
+    int scope_count = function->scope_count;
+    int temporary = declare(function, name, declaration);
+    function->scope_count = scope_count;
+    set_resolution(function, declaration, temporary);
+
+    declaration->next = *link;
+    *link = declaration->id;
+    return (Reuse){node_at(declaration->data.local_declaration.expression), 0, true, REUSE_SCAN_BUDGET, temporary, name};
+}
+
+/**
+ * @brief Computes a value into a new temporary declared just before the
+ * statement at link, and replaces the value everywhere it is still the
+ * same from there on.
+ */
+static void introduce_temporary(Function* function, NodeId* link, struct ASTNode* value) {
+    struct ASTNode* statement = node_at(*link);
+    Reuse reuse = declare_temporary(function, link, value);
+    reuse_in_statements(function, &reuse, statement);
+    function->optimizer->values_reused += reuse.occurrences - 1;
+}
+
+/**
+ * @brief Runs value reuse over a statement list and the blocks nested in
+ * it.
+ *
+ * @param block A NODE_STATEMENTS node.
+ * @param live_locals Locals live when the block starts, hidden ones
+ * included.
+ */
+static void reuse_values(Function* function, struct ASTNode* block, int live_locals) {
+    NodeId* link = &block->data.statements.statement;
+    while (*link) {
+        struct ASTNode* statement = node_at(*link);
+        Search search = {worth_reusing, statement, NULL};
+        struct ASTNode* value;
+        while (live_locals < OPTIMIZER_MAX_LOCALS &&
+               (value = reusable_in_statement(function, &search, statement)) != NULL) {
+            introduce_temporary(function, link, value);
+            link = &node_at(*link)->next;
+            live_locals++;
+        }
+
+        switch (statement->type) {
+            case NODE_IF:
+                reuse_values(function, node_at(statement->data.if_statement.then_branch), live_locals);
+                if (statement->data.if_statement.else_branch) {
+                    reuse_values(function, node_at(statement->data.if_statement.else_branch), live_locals);
+                }
+                break;
+            case NODE_WHILE:
+                reuse_values(function, node_at(statement->data.while_statement.body), live_locals);
+                break;
+            case NODE_FOR:
+                reuse_values(function, node_at(statement->data.for_statement.body), live_locals + 4);
+                break;
+            case NODE_LOCAL_DECLARATION:
+                live_locals++;
+                break;
+            default:
+                break;
+        }
+        link = &statement->next;
+    }
+}
+
+/*
+ * Loop-invariant code motion: a value a while loop computes on every
+ * iteration, though nothing in the loop can change it, is computed once
+ * into a temporary before the loop.
+ */
+
+/**
+ * @brief Returns whether nothing in a while loop can change a value:
+ * neither its condition nor its body assigns a local or global the value
+ * reads, and, if it reads a global, neither calls a function.
+ */
+static bool is_invariant(Function* function, struct ASTNode* loop, struct ASTNode* value) {
+    if (!is_reusable(function, value)) return false;
+    Reuse probe = {value, 0, false, LOOP_SCAN_BUDGET, -1, {NULL, 0}};
+    return reuse_in_expression(function, &probe, node_at(loop->data.while_statement.condition)) &&
+           reuse_in_statement(function, &probe, node_at(loop->data.while_statement.body));
+}
+
+/**
+ * @brief Returns whether an expression can be evaluated a second time
+ * without any effect, and copied with copy_value.
+ */
+static bool is_repeatable(struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            return is_repeatable(node_at(node->data.binary_op.left)) && is_repeatable(node_at(node->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return is_repeatable(node_at(node->data.unary_op.right));
+        case NODE_LOGICAL_OP:
+            return is_repeatable(node_at(node->data.logical_op.left)) && is_repeatable(node_at(node->data.logical_op.right));
+        case NODE_INDEX:
+            return is_repeatable(node_at(node->data.index.object)) && is_repeatable(node_at(node->data.index.key));
+        case NODE_FUNCTION_CALL:
+        case NODE_TABLE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Computes a loop-invariant value into a new temporary declared at
+ * link, ahead of the loop, and replaces it throughout the loop.
+ */
+static void hoist_value(Function* function, NodeId* link, struct ASTNode* loop, struct ASTNode* value) {
+    Reuse reuse = declare_temporary(function, link, value);
+    reuse.budget = LOOP_SCAN_BUDGET;
+    reuse_in_expression(function, &reuse, node_at(loop->data.while_statement.condition));
+    reuse_in_statement(function, &reuse, node_at(loop->data.while_statement.body));
+    function->optimizer->values_hoisted++;
+}
+
+/**
+ * @brief Wraps the while loop at link in "if <condition> then ... end",
+ * the condition copied, so values its body computes can be computed once
+ * the loop is known to run.
+ *
+ * @return The link inside the new block where the loop now is.
+ */
+static NodeId* guard_loop(Function* function, NodeId* link) {
+    struct ASTNode* loop = node_at(*link);
+    struct ASTNode* block = new_node(current_ast, NODE_STATEMENTS);
+    block->line = loop->line;
+    block->data.statements.statement = loop->id;
+
+    struct ASTNode* guard = new_node(current_ast, NODE_IF);
+    guard->line = loop->line;
+    guard->data.if_statement.condition = copy_value(function, node_at(loop->data.while_statement.condition));
+    guard->data.if_statement.then_branch = block->id;
+
+    guard->next = loop->next;
+    loop->next = 0;
+    *link = guard->id;
+    return &block->data.statements.statement;
+}
+
+/**
+ * @brief Moves the invariant values of the while loop at link in front of
+ * it. Only values the first iteration is sure to compute before anything
+ * that could fail or have an effect are moved, so that hoisting changes
+ * neither which error is raised nor the output before it. What the
+ * condition computes first is computed just before the loop; what the
+ * body computes first is computed behind a copy of the condition, which
+ * is why a condition that calls a function keeps the body as it is.
+ *
+ * @return Locals live after the loop's statement, hidden ones included.
+ */
+static void hoist_invariants(Function* function, struct ASTNode* block, int live_locals);
+
+static int hoist_from_loop(Function* function, NodeId** link, int live_locals) {
+    struct ASTNode* loop = node_at(**link);
+    Search search = {is_invariant, loop, NULL};
+    while (live_locals < OPTIMIZER_MAX_LOCALS) {
+        search.found = NULL;
+        find_reusable(function, &search, node_at(loop->data.while_statement.condition));
+        if (search.found == NULL) break;
+        hoist_value(function, *link, loop, search.found);
+        *link = &node_at(**link)->next;
+        live_locals++;
+    }
+
+    NodeId* guarded = NULL;
+    int guarded_locals = live_locals;
+    struct ASTNode* first = node_at(node_at(loop->data.while_statement.body)->data.statements.statement);
+    while (first != NULL && guarded_locals < OPTIMIZER_MAX_LOCALS &&
+           is_repeatable(node_at(loop->data.while_statement.condition)) &&
+           reusable_in_statement(function, &search, first) != NULL) {
+        if (guarded == NULL) guarded = guard_loop(function, *link);
+        hoist_value(function, guarded, loop, search.found);
+        guarded = &node_at(*guarded)->next;
+        guarded_locals++;
+    }
+    hoist_invariants(function, node_at(loop->data.while_statement.body), guarded_locals);
+    return live_locals;
+}
+
+/**
+ * @brief Runs loop-invariant code motion over the while loops of a
+ * statement list and the blocks nested in it, outer loops first.
+ *
+ * @param block A NODE_STATEMENTS node.
+ * @param live_locals Locals live when the block starts, hidden ones
+ * included.
+ */
+static void hoist_invariants(Function* function, struct ASTNode* block, int live_locals) {
+    NodeId* link = &block->data.statements.statement;
+    while (*link) {
+        struct ASTNode* statement = node_at(*link);
+        switch (statement->type) {
+            case NODE_IF:
+                hoist_invariants(function, node_at(statement->data.if_statement.then_branch), live_locals);
+                if (statement->data.if_statement.else_branch) {
+                    hoist_invariants(function, node_at(statement->data.if_statement.else_branch), live_locals);
+                }
+                break;
+            case NODE_WHILE:
+                live_locals = hoist_from_loop(function, &link, live_locals);
+                break;
+            case NODE_FOR:
+                hoist_invariants(function, node_at(statement->data.for_statement.body), live_locals + 4);
+                break;
+            case NODE_LOCAL_DECLARATION:
+                live_locals++;
+                break;
+            default:
+                break;
+        }
+        // A hoisted loop may now sit behind new statements or inside a guard
+        link = &node_at(*link)->next;
+    }
+}
+
+/*
+ * Inlining: a call to a small global function that is defined once and
+ * never assigned is replaced by the function's result with the arguments
+ * put in place of the parameters, behind a guard that the global still
+ * holds that function.
+ */
+
+/**
+ * @brief A global function definition, or with function NULL an
+ * assignment to a global name, found anywhere in the program.
+ */
+struct Definition {
+    Span name;
+    struct ASTNode* function;
+};
+
+static void add_definition(Optimizer* optimizer, Span name, struct ASTNode* function) {
+    if (optimizer->definitions_count == optimizer->definitions_capacity) {
+        optimizer->definitions_capacity = optimizer->definitions_capacity < 16 ? 16 : optimizer->definitions_capacity * 2;
+        optimizer->definitions = (struct Definition*)realloc(optimizer->definitions,
+                                                             sizeof(struct Definition) * optimizer->definitions_capacity);
+    }
+    optimizer->definitions[optimizer->definitions_count++] = (struct Definition){name, function};
+}
+
+/**
+ * @brief Records every function definition and every assignment to a name
+ * in a statement, including those in the functions it defines. An
+ * assignment to a local counts too, which only makes fewer functions
+ * inlinable.
+ */
+static void collect_definitions(Optimizer* optimizer, struct ASTNode* node) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_ASSIGN:
+            add_definition(optimizer, node->data.assignment.identifier, NULL);
+            break;
+        case NODE_FUNCTION_DEF:
+            add_definition(optimizer, node_at(node->data.function_def.name)->data.identifier_name, node);
+            collect_definitions(optimizer, node_at(node->data.function_def.body));
+            break;
+        case NODE_IF:
+            collect_definitions(optimizer, node_at(node->data.if_statement.then_branch));
+            collect_definitions(optimizer, node_at(node->data.if_statement.else_branch));
+            break;
+        case NODE_WHILE:
+            collect_definitions(optimizer, node_at(node->data.while_statement.body));
+            break;
+        case NODE_FOR:
+            collect_definitions(optimizer, node_at(node->data.for_statement.body));
+            break;
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                collect_definitions(optimizer, statement);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int compare_names(Span a, Span b) {
+    int length = a.length < b.length ? a.length : b.length;
+    int order = memcmp(a.start, b.start, length);
+    return order != 0 ? order : a.length - b.length;
+}
+
+static int compare_definitions(const void* a, const void* b) {
+    return compare_names(((const struct Definition*)a)->name, ((const struct Definition*)b)->name);
+}
+
+/**
+ * @brief Returns how many nodes an expression evaluates, or
+ * INLINE_HOT_MAX_NODES + 1 if it holds anything an inlined function may
+ * not: a call that is not inlined, which could recurse, or a table
+ * constructor.
+ */
+static int inlinable_size(struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_INLINE_CALL:
+            // What runs is the body; the call kept for the guard only adds
+            // code, which INLINE_MAX_EXPANSION bounds
+            return 1 + inlinable_size(node_at(node->data.inline_call.body));
+        case NODE_IDENTIFIER:
+            return 1;
+        case NODE_BINARY_OP:
+            return 1 + inlinable_size(node_at(node->data.binary_op.left)) + inlinable_size(node_at(node->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return 1 + inlinable_size(node_at(node->data.unary_op.right));
+        case NODE_LOGICAL_OP:
+            return 1 + inlinable_size(node_at(node->data.logical_op.left)) + inlinable_size(node_at(node->data.logical_op.right));
+        case NODE_INDEX:
+            return 1 + inlinable_size(node_at(node->data.index.object)) + inlinable_size(node_at(node->data.index.key));
+        default:
+            return is_literal(node) ? 1 : INLINE_HOT_MAX_NODES + 1;
+    }
+}
+
+/**
+ * @brief Returns the expression a function returns if the function is
+ * small enough to inline: its body is a single return of an expression of
+ * at most max_nodes nodes, and it takes at most INLINE_MAX_PARAMETERS
+ * parameters.
+ */
+static struct ASTNode* inlinable_result(struct ASTNode* definition, int max_nodes) {
+    int parameters = 0;
+    for (struct ASTNode* param = node_at(definition->data.function_def.parameters); param; param = node_at(param->next)) parameters++;
+    struct ASTNode* statement = node_at(node_at(definition->data.function_def.body)->data.statements.statement);
+    if (parameters > INLINE_MAX_PARAMETERS || statement == NULL || statement->next != 0 ||
+        statement->type != NODE_RETURN || statement->data.return_statement.expression == 0) {
+        return NULL;
+    }
+    struct ASTNode* result = node_at(statement->data.return_statement.expression);
+    return inlinable_size(result) <= max_nodes ? result : NULL;
+}
+
+/**
+ * @brief Keeps, sorted by name, the definitions of the names that are
+ * defined once, by a function, and never assigned.
+ */
+static void select_single_definitions(Optimizer* optimizer) {
+    // definitions is NULL when nothing was defined, which qsort may not get
+    if (optimizer->definitions_count > 1) {
+        qsort(optimizer->definitions, optimizer->definitions_count, sizeof(struct Definition), compare_definitions);
+    }
+    int kept = 0;
+    for (int i = 0; i < optimizer->definitions_count;) {
+        int end = i + 1;
+        while (end < optimizer->definitions_count &&
+               spans_equal(optimizer->definitions[end].name, optimizer->definitions[i].name)) {
+            end++;
+        }
+        if (end == i + 1 && optimizer->definitions[i].function != NULL) {
+            optimizer->definitions[kept++] = optimizer->definitions[i];
+        }
+        i = end;
+    }
+    optimizer->definitions_count = kept;
+}
+
+static struct Definition* find_definition(Optimizer* optimizer, Span name) {
+    int low = 0;
+    int high = optimizer->definitions_count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int order = compare_names(name, optimizer->definitions[middle].name);
+        if (order == 0) return &optimizer->definitions[middle];
+        if (order < 0) {
+            high = middle - 1;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief A call being inlined: its arguments by parameter, and where the
+ * check that the inlined result evaluates them as the call would is.
+ */
+typedef struct {
+    Function* function;
+    struct ASTNode* parameters;
+    struct ASTNode* arguments[INLINE_MAX_PARAMETERS];
+    bool simple[INLINE_MAX_PARAMETERS];     // A literal or a local: no effect and cannot fail,
+                                            // so it may be evaluated any number of times
+    int count;
+    int next;       // The next argument that is not simple, which must be evaluated next
+    bool ran;       // Something that could fail has been evaluated
+} Inlining;
+
+/**
+ * @brief Returns the position of the parameter a name refers to, or -1.
+ * The last of two parameters with the same name wins, as in codegen.
+ */
+static int parameter_index(Inlining* inlining, Span name) {
+    int found = -1;
+    int index = 0;
+    for (struct ASTNode* param = inlining->parameters; param; param = node_at(param->next), index++) {
+        if (spans_equal(param->data.identifier_name, name)) found = index;
+    }
+    return found;
+}
+
+static int next_evaluated(Inlining* inlining, int index) {
+    while (index < inlining->count && inlining->simple[index]) index++;
+    return index;
+}
+
+/**
+ * @brief Checks that the result, with the arguments in place, evaluates
+ * each argument that is not simple exactly once, unconditionally, in the
+ * order of the call, and before anything in the function that could fail.
+ * The call evaluated all its arguments before running the function, so
+ * then the same effects and errors happen in the same order.
+ */
+static bool keeps_order(Inlining* inlining, struct ASTNode* node, bool conditional) {
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            int index = parameter_index(inlining, node->data.identifier_name);
+            if (index < 0) {
+                // Reading a global fails when it is not defined
+                inlining->ran = true;
+                return true;
+            }
+            if (inlining->simple[index]) return true;
+            if (conditional || inlining->ran || index != inlining->next) return false;
+            inlining->next = next_evaluated(inlining, index + 1);
+            return true;
+        }
+        case NODE_BINARY_OP:
+            if (!keeps_order(inlining, node_at(node->data.binary_op.left), conditional) ||
+                !keeps_order(inlining, node_at(node->data.binary_op.right), conditional)) {
+                return false;
+            }
+            if (node->data.binary_op.op != TOKEN_EQUAL && node->data.binary_op.op != TOKEN_NOT_EQUAL) {
+                inlining->ran = true;
+            }
+            return true;
+        case NODE_UNARY_OP:
+            if (!keeps_order(inlining, node_at(node->data.unary_op.right), conditional)) return false;
+            if (node->data.unary_op.op != TOKEN_NOT) inlining->ran = true;
+            return true;
+        case NODE_LOGICAL_OP:
+            // The right operand does not always run
+            return keeps_order(inlining, node_at(node->data.logical_op.left), conditional) &&
+                   keeps_order(inlining, node_at(node->data.logical_op.right), true);
+        case NODE_INDEX:
+            if (!keeps_order(inlining, node_at(node->data.index.object), conditional) ||
+                !keeps_order(inlining, node_at(node->data.index.key), conditional)) {
+                return false;
+            }
+            inlining->ran = true;
+            return true;
+        case NODE_FUNCTION_CALL:
+            if (!keeps_order(inlining, node_at(node->data.function_call.callee), conditional)) return false;
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                if (!keeps_order(inlining, arg, conditional)) return false;
+            }
+            inlining->ran = true;
+            return true;
+        case NODE_INLINE_CALL:
+            // Either the body or the call runs, and the body may evaluate
+            // the arguments any number of times
+            if (!keeps_order(inlining, node_at(node->data.inline_call.call), true) ||
+                !keeps_order(inlining, node_at(node->data.inline_call.body), true)) {
+                return false;
+            }
+            inlining->ran = true;
+            return true;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Returns whether a global the result reads has the name of a
+ * local somewhere in the calling function, where codegen could resolve it
+ * to that local instead.
+ */
+static bool reads_shadowed_global(Inlining* inlining, struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            if (parameter_index(inlining, node->data.identifier_name) >= 0) return false;
+            for (int i = 0; i < inlining->function->bindings_count; i++) {
+                if (spans_equal(inlining->function->bindings[i].name, node->data.identifier_name)) return true;
+            }
+            return false;
+        case NODE_BINARY_OP:
+            return reads_shadowed_global(inlining, node_at(node->data.binary_op.left)) ||
+                   reads_shadowed_global(inlining, node_at(node->data.binary_op.right));
+        case NODE_UNARY_OP:
+            return reads_shadowed_global(inlining, node_at(node->data.unary_op.right));
+        case NODE_LOGICAL_OP:
+            return reads_shadowed_global(inlining, node_at(node->data.logical_op.left)) ||
+                   reads_shadowed_global(inlining, node_at(node->data.logical_op.right));
+        case NODE_INDEX:
+            return reads_shadowed_global(inlining, node_at(node->data.index.object)) ||
+                   reads_shadowed_global(inlining, node_at(node->data.index.key));
+        case NODE_FUNCTION_CALL:
+            if (reads_shadowed_global(inlining, node_at(node->data.function_call.callee))) return true;
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                if (reads_shadowed_global(inlining, arg)) return true;
+            }
+            return false;
+        case NODE_INLINE_CALL:
+            return reads_shadowed_global(inlining, node_at(node->data.inline_call.call)) ||
+                   reads_shadowed_global(inlining, node_at(node->data.inline_call.body));
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Copies the result with a copy of the argument in place of each
+ * parameter.
+ */
+static NodeId substitute(Inlining* inlining, struct ASTNode* node) {
+    if (node->type == NODE_IDENTIFIER) {
+        int index = parameter_index(inlining, node->data.identifier_name);
+        if (index >= 0) return copy_value(inlining->function, inlining->arguments[index]);
+    }
+
+    struct ASTNode* copy = clone_node(node);
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            set_resolution(inlining->function, copy, -1);
+            break;
+        case NODE_BINARY_OP:
+            copy->data.binary_op.left = substitute(inlining, node_at(node->data.binary_op.left));
+            copy->data.binary_op.right = substitute(inlining, node_at(node->data.binary_op.right));
+            break;
+        case NODE_UNARY_OP:
+            copy->data.unary_op.right = substitute(inlining, node_at(node->data.unary_op.right));
+            break;
+        case NODE_LOGICAL_OP:
+            copy->data.logical_op.left = substitute(inlining, node_at(node->data.logical_op.left));
+            copy->data.logical_op.right = substitute(inlining, node_at(node->data.logical_op.right));
+            break;
+        case NODE_INDEX:
+            copy->data.index.object = substitute(inlining, node_at(node->data.index.object));
+            copy->data.index.key = substitute(inlining, node_at(node->data.index.key));
+            break;
+        case NODE_FUNCTION_CALL: {
+            copy->data.function_call.callee = substitute(inlining, node_at(node->data.function_call.callee));
+            NodeId* tail = &copy->data.function_call.argument;
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                *tail = substitute(inlining, arg);
+                tail = &node_at(*tail)->next;
+            }
+            *tail = 0;
+            break;
+        }
+        case NODE_INLINE_CALL:
+            copy->data.inline_call.call = substitute(inlining, node_at(node->data.inline_call.call));
+            copy->data.inline_call.body = substitute(inlining, node_at(node->data.inline_call.body));
+            break;
+        default:
+            break;
+    }
+    return copy->id;
+}
+
+static int expression_size(struct ASTNode* node) {
+    int size = 0;
+    for (; node != NULL; node = node_at(node->next)) {
+        size++;
+        switch (node->type) {
+            case NODE_BINARY_OP:
+                size += expression_size(node_at(node->data.binary_op.left)) + expression_size(node_at(node->data.binary_op.right));
+                break;
+            case NODE_UNARY_OP:
+                size += expression_size(node_at(node->data.unary_op.right));
+                break;
+            case NODE_LOGICAL_OP:
+                size += expression_size(node_at(node->data.logical_op.left)) + expression_size(node_at(node->data.logical_op.right));
+                break;
+            case NODE_INDEX:
+                size += expression_size(node_at(node->data.index.object)) + expression_size(node_at(node->data.index.key));
+                break;
+            case NODE_FUNCTION_CALL:
+                size += expression_size(node_at(node->data.function_call.callee)) +
+                        expression_size(node_at(node->data.function_call.argument));
+                break;
+            case NODE_TABLE:
+                size += expression_size(node_at(node->data.table.fields));
+                break;
+            case NODE_TABLE_FIELD:
+                size += expression_size(node_at(node->data.table_field.key)) + expression_size(node_at(node->data.table_field.value));
+                break;
+            case NODE_INLINE_CALL:
+                size += expression_size(node_at(node->data.inline_call.call)) + expression_size(node_at(node->data.inline_call.body));
+                break;
+            default:
+                break;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Inlines a call if it calls an inlinable global function with the
+ * right number of arguments, and inlining keeps what the call would do.
+ * With a profile, a call the training run never made is left alone, and
+ * a hot one may inline a larger function.
+ */
+static void inline_call(Function* function, struct ASTNode* call) {
+    struct ASTNode* callee = node_at(call->data.function_call.callee);
+    if (callee->type != NODE_IDENTIFIER || resolution_of(function, callee) >= 0) return;
+    struct Definition* definition = find_definition(function->optimizer, callee->data.identifier_name);
+    if (definition == NULL) return;
+    int max_nodes = INLINE_MAX_NODES;
+    int max_expansion = INLINE_MAX_EXPANSION;
+    const Feedback* feedback = function->optimizer->feedback;
+    if (feedback != NULL) {
+        Span name = callee->data.identifier_name;
+        uint64_t calls = line_calls(feedback, call->line, name.start, name.length);
+        if (calls == 0) return;
+        if (calls >= INLINE_HOT_CALLS) {
+            max_nodes = INLINE_HOT_MAX_NODES;
+            max_expansion = INLINE_HOT_MAX_EXPANSION;
+        }
+    }
+    struct ASTNode* result = inlinable_result(definition->function, max_nodes);
+    if (result == NULL) return;
+
+    Inlining inlining = {0};
+    inlining.function = function;
+    inlining.parameters = node_at(definition->function->data.function_def.parameters);
+    struct ASTNode* param = inlining.parameters;
+    struct ASTNode* argument = node_at(call->data.function_call.argument);
+    for (; param && argument; param = node_at(param->next), argument = node_at(argument->next)) {
+        inlining.arguments[inlining.count] = argument;
+        inlining.simple[inlining.count] = is_literal(argument) ||
+            (argument->type == NODE_IDENTIFIER && resolution_of(function, argument) >= 0);
+        inlining.count++;
+    }
+    // A call with the wrong number of arguments fails, so it stays a call
+    if (param != NULL || argument != NULL) return;
+    inlining.next = next_evaluated(&inlining, 0);
+    if (!keeps_order(&inlining, result, false) || inlining.next != inlining.count ||
+        reads_shadowed_global(&inlining, result)) {
+        return;
+    }
+
+    struct ASTNode* body = node_at(substitute(&inlining, result));
+    // Literal arguments may make the result foldable
+    rewrite_expression(function, body);
+    if (expression_size(body) + expression_size(node_at(call->data.function_call.argument)) > max_expansion) {
+        return;
+    }
+
+    struct ASTNode* original = clone_node(call);
+    call->type = NODE_INLINE_CALL;
+    call->data.inline_call.call = original->id;
+    call->data.inline_call.body = body->id;
+    call->data.inline_call.function = definition->function->id;
+    function->optimizer->calls_inlined++;
+}
+
+/**
+ * @brief Inlines the calls in an expression, innermost first, so that an
+ * argument may itself be an inlined call.
+ */
+static void inline_in_expression(Function* function, struct ASTNode* node) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            inline_in_expression(function, node_at(node->data.binary_op.left));
+            inline_in_expression(function, node_at(node->data.binary_op.right));
+            break;
+        case NODE_UNARY_OP:
+            inline_in_expression(function, node_at(node->data.unary_op.right));
+            break;
+        case NODE_LOGICAL_OP:
+            inline_in_expression(function, node_at(node->data.logical_op.left));
+            inline_in_expression(function, node_at(node->data.logical_op.right));
+            break;
+        case NODE_FUNCTION_CALL:
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                inline_in_expression(function, arg);
+            }
+            inline_call(function, node);
+            break;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                inline_in_expression(function, node_at(field->data.table_field.key));
+                inline_in_expression(function, node_at(field->data.table_field.value));
+            }
+            break;
+        case NODE_INDEX:
+            inline_in_expression(function, node_at(node->data.index.object));
+            inline_in_expression(function, node_at(node->data.index.key));
+            break;
+        case NODE_INLINE_CALL:
+            // The call itself is already inlined
+            for (struct ASTNode* arg = node_at(node_at(node->data.inline_call.call)->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                inline_in_expression(function, arg);
+            }
+            inline_in_expression(function, node_at(node->data.inline_call.body));
+            break;
+        default:
+            break;
+    }
+}
+
+static void inline_in_statement(Function* function, struct ASTNode* node) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_PRINT:
+            inline_in_expression(function, node_at(node->data.print_statement.expression));
+            break;
+        case NODE_ASSIGN:
+            inline_in_expression(function, node_at(node->data.assignment.expression));
+            break;
+        case NODE_INDEX_ASSIGN:
+            inline_in_expression(function, node_at(node->data.index_assign.object));
+            inline_in_expression(function, node_at(node->data.index_assign.key));
+            inline_in_expression(function, node_at(node->data.index_assign.value));
+            break;
+        case NODE_IF:
+            inline_in_expression(function, node_at(node->data.if_statement.condition));
+            inline_in_statement(function, node_at(node->data.if_statement.then_branch));
+            inline_in_statement(function, node_at(node->data.if_statement.else_branch));
+            break;
+        case NODE_WHILE:
+            inline_in_expression(function, node_at(node->data.while_statement.condition));
+            inline_in_statement(function, node_at(node->data.while_statement.body));
+            break;
+        case NODE_FOR:
+            inline_in_expression(function, node_at(node->data.for_statement.start));
+            inline_in_expression(function, node_at(node->data.for_statement.limit));
+            inline_in_expression(function, node_at(node->data.for_statement.step));
+            inline_in_statement(function, node_at(node->data.for_statement.body));
+            break;
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                inline_in_statement(function, statement);
+            }
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            inline_in_expression(function, node_at(node->data.expression_statement.expression));
+            break;
+        case NODE_RETURN:
+            inline_in_expression(function, node_at(node->data.return_statement.expression));
+            break;
+        case NODE_LOCAL_DECLARATION:
+            inline_in_expression(function, node_at(node->data.local_declaration.expression));
+            break;
+        default:
+            // Function definitions are handled as functions of their own
+            break;
+    }
+}
+
+/*
+ * Type inference: follows which locals hold numbers of one subtype through
+ * each function, so arithmetic and comparisons on them can skip the VM's
+ * type checks.
+ */
+
+typedef enum {
+    TYPE_UNKNOWN,   // Anything, as far as the pass can tell
+    TYPE_INTEGER,
+    TYPE_FLOAT,
+} NumberType;
+
+/**
+ * @brief The subtype of every binding at one point of a function. Locals
+ * are only changed by assignments in their own function, so a call does
+ * not lose anything.
+ */
+typedef struct {
+    Function* function;
+    NumberType* types;
+    bool annotate;          // Whether to record proven operands in the AST
+} Inference;
+
+static bool is_numeric(NumberType type) {
+    return type != TYPE_UNKNOWN;
+}
+
+static NumberType join_types(NumberType a, NumberType b) {
+    return a == b ? a : TYPE_UNKNOWN;
+}
+
+/**
+ * @brief Joins another state into the current one, binding by binding.
+ *
+ * @return Whether the current state changed.
+ */
+static bool join_state(Inference* inference, NumberType* other) {
+    bool changed = false;
+    for (int i = 0; i < inference->function->bindings_count; i++) {
+        NumberType joined = join_types(inference->types[i], other[i]);
+        changed |= joined != inference->types[i];
+        inference->types[i] = joined;
+    }
+    return changed;
+}
+
+static NumberType* copy_state(Inference* inference) {
+    int count = inference->function->bindings_count;
+    NumberType* copy = (NumberType*)malloc(sizeof(NumberType) * (count > 0 ? count : 1));
+    memcpy(copy, inference->types, sizeof(NumberType) * count);
+    return copy;
+}
+
+static bool has_typed_form(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+        case TOKEN_MUL:
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Returns the subtype an expression is sure to have when it
+ * evaluates without error, following the VM: integers stay integers under
+ * +, - and *, any float operand makes the result a float, and / always
+ * gives a float.
+ */
+static NumberType infer_expression(Inference* inference, struct ASTNode* node) {
+    if (node == NULL) return TYPE_UNKNOWN;
+    switch (node->type) {
+        case NODE_INTEGER:
+            return TYPE_INTEGER;
+        case NODE_NUMBER:
+            return TYPE_FLOAT;
+        case NODE_IDENTIFIER: {
+            int binding = resolution_of(inference->function, node);
+            return binding < 0 ? TYPE_UNKNOWN : inference->types[binding];
+        }
+        case NODE_BINARY_OP: {
+            TokenType op = node->data.binary_op.op;
+            NumberType left = infer_expression(inference, node_at(node->data.binary_op.left));
+            NumberType right = infer_expression(inference, node_at(node->data.binary_op.right));
+            if (inference->annotate) {
+                OperandTypes operands = OPERANDS_UNKNOWN;
+                if (has_typed_form(op) && left == right && is_numeric(left)) {
+                    operands = left == TYPE_INTEGER ? OPERANDS_INTEGER : OPERANDS_FLOAT;
+                    inference->function->optimizer->operators_typed++;
+                }
+                node->data.binary_op.operands = operands;
+            }
+            if (!is_numeric(left) || !is_numeric(right)) return TYPE_UNKNOWN;
+            switch (op) {
+                case TOKEN_PLUS:
+                case TOKEN_MINUS:
+                case TOKEN_MUL:
+                    return left == TYPE_INTEGER && right == TYPE_INTEGER ? TYPE_INTEGER : TYPE_FLOAT;
+                case TOKEN_DIV:
+                    return TYPE_FLOAT;
+                default:
+                    return TYPE_UNKNOWN;
+            }
+        }
+        case NODE_UNARY_OP: {
+            NumberType operand = infer_expression(inference, node_at(node->data.unary_op.right));
+            switch (node->data.unary_op.op) {
+                case TOKEN_MINUS: return operand;
+                case TOKEN_HASH:  return TYPE_INTEGER;
+                default:          return TYPE_UNKNOWN;
+            }
+        }
+        case NODE_LOGICAL_OP: {
+            // A number is true, so and gives its right operand and or its
+            // left, and "c and a or b" gives a or b
+            struct ASTNode* choice = node_at(node->data.logical_op.left);
+            if (node->data.logical_op.op == TOKEN_OR && choice->type == NODE_LOGICAL_OP &&
+                choice->data.logical_op.op == TOKEN_AND) {
+                infer_expression(inference, node_at(choice->data.logical_op.left));
+                NumberType chosen = infer_expression(inference, node_at(choice->data.logical_op.right));
+                NumberType otherwise = infer_expression(inference, node_at(node->data.logical_op.right));
+                return is_numeric(chosen) ? join_types(chosen, otherwise) : TYPE_UNKNOWN;
+            }
+            NumberType left = infer_expression(inference, node_at(node->data.logical_op.left));
+            NumberType right = infer_expression(inference, node_at(node->data.logical_op.right));
+            if (!is_numeric(left)) return TYPE_UNKNOWN;
+            return node->data.logical_op.op == TOKEN_AND ? right : left;
+        }
+        case NODE_FUNCTION_CALL:
+            infer_expression(inference, node_at(node->data.function_call.callee));
+            for (struct ASTNode* arg = node_at(node->data.function_call.argument); arg; arg = node_at(arg->next)) {
+                infer_expression(inference, arg);
+            }
+            return TYPE_UNKNOWN;
+        case NODE_TABLE:
+            for (struct ASTNode* field = node_at(node->data.table.fields); field; field = node_at(field->next)) {
+                infer_expression(inference, node_at(field->data.table_field.key));
+                infer_expression(inference, node_at(field->data.table_field.value));
+            }
+            return TYPE_UNKNOWN;
+        case NODE_INDEX:
+            infer_expression(inference, node_at(node->data.index.object));
+            infer_expression(inference, node_at(node->data.index.key));
+            return TYPE_UNKNOWN;
+        case NODE_INLINE_CALL:
+            // The guard may fail, and then the result is the call's
+            infer_expression(inference, node_at(node->data.inline_call.call));
+            infer_expression(inference, node_at(node->data.inline_call.body));
+            return TYPE_UNKNOWN;
+        default:
+            return TYPE_UNKNOWN;
+    }
+}
+
+static void infer_statement(Inference* inference, struct ASTNode* node);
+
+/**
+ * @brief Runs one iteration of a loop from the current state: the
+ * condition and body of a while loop, or the body of a for loop with its
+ * variable set.
+ */
+static void infer_iteration(Inference* inference, struct ASTNode* loop, NumberType variable) {
+    if (loop->type == NODE_WHILE) {
+        infer_expression(inference, node_at(loop->data.while_statement.condition));
+        infer_statement(inference, node_at(loop->data.while_statement.body));
+    } else {
+        inference->types[resolution_of(inference->function, loop)] = variable;
+        infer_statement(inference, node_at(loop->data.for_statement.body));
+    }
+}
+
+/**
+ * @brief Finds the state at the head of a loop, which must hold whether the
+ * loop is entered for the first time or comes back around, by joining the
+ * state at the end of the body into it until it stops changing. Each
+ * binding can only go from a subtype to unknown, so that ends. The body is
+ * annotated once, with that state, and the loop leaves it as it is.
+ */
+static void infer_loop(Inference* inference, struct ASTNode* loop, NumberType variable) {
+    bool annotate = inference->annotate;
+    inference->annotate = false;
+    NumberType* head = copy_state(inference);
+    for (;;) {
+        infer_iteration(inference, loop, variable);
+        NumberType* end = inference->types;
+        inference->types = head;
+        bool changed = join_state(inference, end);
+        head = copy_state(inference);
+        free(end);
+        if (!changed) break;
+    }
+    inference->annotate = annotate;
+    if (annotate) infer_iteration(inference, loop, variable);
+    memcpy(inference->types, head, sizeof(NumberType) * inference->function->bindings_count);
+    free(head);
+}
+
+static void infer_statement(Inference* inference, struct ASTNode* node) {
+    switch (node->type) {
+        case NODE_PRINT:
+            infer_expression(inference, node_at(node->data.print_statement.expression));
+            break;
+        case NODE_EXPRESSION_STATEMENT:
+            infer_expression(inference, node_at(node->data.expression_statement.expression));
+            break;
+        case NODE_RETURN:
+            infer_expression(inference, node_at(node->data.return_statement.expression));
+            break;
+        case NODE_ASSIGN: {
+            NumberType type = infer_expression(inference, node_at(node->data.assignment.expression));
+            int binding = resolution_of(inference->function, node);
+            if (binding >= 0) inference->types[binding] = type;
+            break;
+        }
+        case NODE_LOCAL_DECLARATION: {
+            NumberType type = infer_expression(inference, node_at(node->data.local_declaration.expression));
+            inference->types[resolution_of(inference->function, node)] = type;
+            break;
+        }
+        case NODE_INDEX_ASSIGN:
+            infer_expression(inference, node_at(node->data.index_assign.object));
+            infer_expression(inference, node_at(node->data.index_assign.key));
+            infer_expression(inference, node_at(node->data.index_assign.value));
+            break;
+        case NODE_IF: {
+            infer_expression(inference, node_at(node->data.if_statement.condition));
+            NumberType* otherwise = copy_state(inference);
+            infer_statement(inference, node_at(node->data.if_statement.then_branch));
+            if (node->data.if_statement.else_branch) {
+                NumberType* then = inference->types;
+                inference->types = otherwise;
+                infer_statement(inference, node_at(node->data.if_statement.else_branch));
+                otherwise = inference->types;
+                inference->types = then;
+            }
+            join_state(inference, otherwise);
+            free(otherwise);
+            break;
+        }
+        case NODE_WHILE:
+            infer_loop(inference, node, TYPE_UNKNOWN);
+            break;
+        case NODE_FOR: {
+            NumberType start = infer_expression(inference, node_at(node->data.for_statement.start));
+            infer_expression(inference, node_at(node->data.for_statement.limit));
+            NumberType step = node_at(node->data.for_statement.step)
+                ? infer_expression(inference, node_at(node->data.for_statement.step))
+                : TYPE_INTEGER;
+            // The loop counts in integers only when both of these are
+            NumberType variable = TYPE_UNKNOWN;
+            if (is_numeric(start) && is_numeric(step)) {
+                variable = start == TYPE_INTEGER && step == TYPE_INTEGER ? TYPE_INTEGER : TYPE_FLOAT;
+            }
+            infer_loop(inference, node, variable);
+            break;
+        }
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                infer_statement(inference, statement);
+            }
+            break;
+        default:
+            // Function definitions get their own inference
+            break;
+    }
+}
+
+/*
+ * Driver
+ */
+
+typedef void (*FunctionPass)(Optimizer* optimizer, struct ASTNode* parameters, struct ASTNode* body);
+
+/**
+ * @brief Runs a pass over each function defined in a statement. The pass
+ * takes care of the functions defined inside those.
+ */
+static void visit_nested_functions(Optimizer* optimizer, struct ASTNode* node, FunctionPass pass) {
+    if (node == NULL) return;
+    switch (node->type) {
+        case NODE_FUNCTION_DEF:
+            pass(optimizer, node_at(node->data.function_def.parameters), node_at(node->data.function_def.body));
+            break;
+        case NODE_IF:
+            visit_nested_functions(optimizer, node_at(node->data.if_statement.then_branch), pass);
+            visit_nested_functions(optimizer, node_at(node->data.if_statement.else_branch), pass);
+            break;
+        case NODE_WHILE:
+            visit_nested_functions(optimizer, node_at(node->data.while_statement.body), pass);
+            break;
+        case NODE_FOR:
+            visit_nested_functions(optimizer, node_at(node->data.for_statement.body), pass);
+            break;
+        case NODE_STATEMENTS:
+            for (struct ASTNode* statement = node_at(node->data.statements.statement); statement; statement = node_at(statement->next)) {
+                visit_nested_functions(optimizer, statement, pass);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Folds, propagates and eliminates until nothing changes.
+ */
+static void simplify(Function* function) {
+    for (int pass = 0; pass < OPTIMIZER_MAX_PASSES; pass++) {
+        function->changed = false;
+        analyze(function);
+        rewrite_statement(function, function->body);
+        // Propagation leaves locals unused, so count again
+        analyze(function);
+        eliminate_dead_code(function, function->body);
+        if (!function->changed) break;
+    }
+}
+
+static void optimize_function(Optimizer* optimizer, struct ASTNode* parameters, struct ASTNode* body) {
+    visit_nested_functions(optimizer, body, optimize_function);
+
+    Function function = {0};
+    function.optimizer = optimizer;
+    function.parameters = parameters;
+    function.body = body;
+    simplify(&function);
+
+    analyze(&function);
+    int live_locals = 0;
+    for (struct ASTNode* param = parameters; param; param = node_at(param->next)) live_locals++;
+    hoist_invariants(&function, body, live_locals);
+    reuse_values(&function, body, live_locals);
+    if (function.temporaries > 0) {
+        // A local initialized from a value that was reused is now a copy
+        // of the temporary
+        simplify(&function);
+    }
+
+    free(function.bindings);
+    free(function.scope);
+    free(function.resolutions);
+}
+
+static void inline_function_calls(Optimizer* optimizer, struct ASTNode* parameters, struct ASTNode* body) {
+    visit_nested_functions(optimizer, body, inline_function_calls);
+
+    Function function = {0};
+    function.optimizer = optimizer;
+    function.parameters = parameters;
+    function.body = body;
+    analyze(&function);
+    inline_in_statement(&function, body);
+
+    free(function.bindings);
+    free(function.scope);
+    free(function.resolutions);
+}
+
+static void infer_types(Optimizer* optimizer, struct ASTNode* parameters, struct ASTNode* body) {
+    visit_nested_functions(optimizer, body, infer_types);
+
+    Function function = {0};
+    function.optimizer = optimizer;
+    function.parameters = parameters;
+    function.body = body;
+    analyze(&function);
+
+    // Parameters can be passed anything
+    Inference inference = {&function, NULL, true};
+    inference.types = (NumberType*)calloc(function.bindings_count > 0 ? function.bindings_count : 1, sizeof(NumberType));
+    infer_statement(&inference, body);
+
+    free(inference.types);
+    free(function.bindings);
+    free(function.scope);
+    free(function.resolutions);
+}
+
+void init_optimizer(Optimizer* optimizer) {
+    memset(optimizer, 0, sizeof(Optimizer));
+}
+
+/**
+ * @brief Optimizes a program's AST in place, the top-level chunk and each
+ * function on its own: literals are folded with the VM's semantics, locals
+ * that are never reassigned are replaced by their literal or by the local
+ * they copy, unused pure locals and branches that never run are removed,
+ * values such as global loads that are computed again while their inputs
+ * are unchanged are computed once into a temporary local, and so are the
+ * values a while loop computes on every iteration though nothing in the
+ * loop changes them, ahead of the loop. Once every function is optimized,
+ * calls to small global functions defined once are inlined. Last,
+ * operators whose operands are proven to be numbers of one subtype are
+ * marked for codegen to emit their unchecked forms.
+ *
+ * @param optimizer The optimizer. It owns the temporaries' names, so free
+ * it only after generating code from the AST.
+ * @param ast The AST from parse. Nodes the optimizer adds go at its end;
+ * nodes it drops stay there unused until it is freed.
+ */
+void optimize_ast(Optimizer* optimizer, AST* ast) {
+    current_ast = ast;
+    struct ASTNode* program = node_at(ast->root);
+    optimize_function(optimizer, NULL, program);
+
+    collect_definitions(optimizer, program);
+    select_single_definitions(optimizer);
+    for (int round = 0; round < INLINE_MAX_ROUNDS; round++) {
+        int inlined = optimizer->calls_inlined;
+        inline_function_calls(optimizer, NULL, program);
+        if (optimizer->calls_inlined == inlined) break;
+    }
+    infer_types(optimizer, NULL, program);
+}
+
+void free_optimizer(Optimizer* optimizer) {
+    for (int i = 0; i < optimizer->names_count; i++) {
+        free(optimizer->names[i]);
+    }
+    free(optimizer->names);
+    free(optimizer->definitions);
+    init_optimizer(optimizer);
+}
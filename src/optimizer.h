@@ -0,0 +1,41 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "parser.h"
+#include "feedback.h"
+
+struct Definition;
+
+/**
+ * @brief State of the AST optimizer for one program. It owns the names of
+ * the temporaries it introduces, which the AST points to, so free it only
+ * after code generation.
+ */
+typedef struct {
+    char** names;
+    int names_count;
+    int names_capacity;
+
+    // A profile of a training run, which picks the calls to inline, or NULL
+    const Feedback* feedback;
+
+    // Global functions whose calls may be inlined, sorted by name
+    struct Definition* definitions;
+    int definitions_count;
+    int definitions_capacity;
+
+    // What the passes did, summed over all functions
+    int constants_folded;
+    int locals_propagated;
+    int statements_removed;
+    int values_reused;
+    int values_hoisted;
+    int calls_inlined;
+    int operators_typed;
+} Optimizer;
+
+void init_optimizer(Optimizer* optimizer);
+void optimize_ast(Optimizer* optimizer, AST* ast);
+void free_optimizer(Optimizer* optimizer);
+
+#endif // OPTIMIZER_H
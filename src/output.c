@@ -0,0 +1,93 @@
+#include "output.h"
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Sets up an empty buffer for a stream. Whether the stream is a
+ * terminal is checked here, so call it again after redirecting the stream.
+ *
+ * @param output The buffer.
+ * @param stream Where the output goes.
+ */
+void init_output(OutputBuffer* output, FILE* stream) {
+    output->stream = stream;
+    output->interactive = isatty(fileno(stream));
+    output->length = 0;
+}
+
+/**
+ * @brief Writes out everything buffered so far.
+ *
+ * @param output The buffer.
+ */
+void output_flush(OutputBuffer* output) {
+    if (output->length > 0) {
+        fwrite(output->data, 1, output->length, output->stream);
+        output->length = 0;
+    }
+    fflush(output->stream);
+}
+
+/**
+ * @brief Appends text to the buffer. Text that does not fit even in an
+ * empty buffer is written straight through.
+ *
+ * @param output The buffer.
+ * @param text The text.
+ * @param length The length of the text.
+ */
+void output_write(OutputBuffer* output, const char* text, size_t length) {
+    if (output->length + length > OUTPUT_BUFFER_SIZE) {
+        output_flush(output);
+        if (length > OUTPUT_BUFFER_SIZE) {
+            fwrite(text, 1, length, output->stream);
+            return;
+        }
+    }
+    memcpy(output->data + output->length, text, length);
+    output->length += length;
+}
+
+/**
+ * @brief Appends a value and a newline, as the print statement does.
+ * Numbers are formatted straight into the buffer.
+ *
+ * @param output The buffer.
+ * @param value The value to print.
+ */
+void output_print(OutputBuffer* output, Value value) {
+    switch (value.type) {
+        case VAL_INTEGER:
+        case VAL_NUMBER:
+            if (output->length + NUMBER_FORMAT_MAX + 1 > OUTPUT_BUFFER_SIZE) {
+                output_flush(output);
+            }
+            output->length += value.type == VAL_INTEGER
+                ? format_integer(output->data + output->length, value.as.integer)
+                : format_float(output->data + output->length, value.as.number);
+            break;
+        case VAL_STRING:
+            output_write(output, value.as.string, strlen(value.as.string));
+            break;
+        case VAL_TRUE:
+            output_write(output, "true", 4);
+            break;
+        case VAL_FALSE:
+            output_write(output, "false", 5);
+            break;
+        case VAL_NIL:
+            output_write(output, "nil", 3);
+            break;
+        case VAL_FUNCTION:
+            output_write(output, "<function>", 10);
+            break;
+        case VAL_TABLE: {
+            char buffer[48];
+            int length = snprintf(buffer, sizeof(buffer), "table: %p", (void*)value.as.table);
+            output_write(output, buffer, length);
+            break;
+        }
+    }
+    output_write(output, "\n", 1);
+    if (output->interactive) output_flush(output);
+}
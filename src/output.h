@@ -0,0 +1,29 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "value.h"
+
+#define OUTPUT_BUFFER_SIZE 32768
+
+/**
+ * @brief The VM's buffer for print output. It is written out only at
+ * explicit flush points: when it fills up, when a program finishes or
+ * raises a runtime error, and after every print when the stream is a
+ * terminal.
+ */
+typedef struct {
+    FILE* stream;
+    bool interactive;   // Flush after every print
+    int length;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+void init_output(OutputBuffer* output, FILE* stream);
+void output_flush(OutputBuffer* output);
+void output_write(OutputBuffer* output, const char* text, size_t length);
+void output_print(OutputBuffer* output, Value value);
+
+#endif // OUTPUT_H
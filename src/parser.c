@@ -6,10 +6,34 @@
 #include <stdbool.h>
 
 
-static struct ASTNode* create_node(NodeType type) {
-    struct ASTNode* node = (struct ASTNode*)malloc(sizeof(struct ASTNode));
-    node->type = type;
-    node->next = NULL;
+/**
+ * @brief Creates an empty AST.
+ */
+AST* new_ast() {
+    AST* ast = (AST*)calloc(1, sizeof(AST));
+    ast->count = 1;
+    return ast;
+}
+
+/**
+ * @brief Allocates a zeroed node at the end of an AST.
+ *
+ * @return The node, which stays where it is until the AST is freed.
+ */
+struct ASTNode* new_node(AST* ast, NodeType type) {
+    NodeId id = ast->count++;
+    if ((int)(id >> AST_PAGE_BITS) == ast->pages_count) {
+        if (ast->pages_count == ast->pages_capacity) {
+            ast->pages_capacity = ast->pages_capacity < 8 ? 8 : ast->pages_capacity * 2;
+            ast->pages = (struct ASTNode**)realloc(ast->pages, sizeof(struct ASTNode*) * ast->pages_capacity);
+        }
+        ast->pages[ast->pages_count++] = (struct ASTNode*)malloc(sizeof(struct ASTNode) * AST_PAGE_SIZE);
+    }
+    // Indexed directly rather than through ast_node, whose NULL for id 0
+    // made GCC warn about clearing a node that could not exist
+    struct ASTNode* page = ast->pages[id >> AST_PAGE_BITS];
+    struct ASTNode* node = &page[id & (AST_PAGE_SIZE - 1)];
+    *node = (struct ASTNode){.type = type, .id = id};
     return node;
 }
 
@@ -18,6 +42,14 @@ static struct ASTNode* create_node(NodeType type) {
  */
 static Parser parser;
 
+static struct ASTNode* create_node(NodeType type) {
+    return new_node(parser.ast, type);
+}
+
+static struct ASTNode* node_at(NodeId id) {
+    return ast_node(parser.ast, id);
+}
+
 /**
  * @brief Reports an error at the given token.
  *
@@ -64,7 +96,7 @@ static void error_at_current(const char* message) {
  */
 static void advance() {
     parser.previous = parser.current;
-    parser.current = next_token();
+    parser.current = parser.stream ? parser.stream->next_token(parser.stream->context) : next_token();
 #ifdef DEBUG_TRACE_PARSER
     debug_log("Advanced to token %s '%.*s'\n", token_type_to_string(parser.current.type), parser.current.length, parser.current.start);
 #endif
@@ -128,23 +160,25 @@ typedef enum {
 } Precedence;
 
 // Forward declarations for the parsing functions.
-static struct ASTNode* expression();
-static struct ASTNode* statement();
-static struct ASTNode* ParsePrecedence(Precedence precedence);
-static struct ASTNode* unary(bool can_assign);
-static struct ASTNode* binary(struct ASTNode* left, bool can_assign);
-static struct ASTNode* number(bool can_assign);
-static struct ASTNode* string(bool can_assign);
-static struct ASTNode* identifier(bool can_assign);
-static struct ASTNode* grouping(bool can_assign);
-static struct ASTNode* if_statement();
-static struct ASTNode* while_statement();
-static struct ASTNode* function_declaration();
-static struct ASTNode* return_statement();
-static struct ASTNode* local_declaration();
-
-typedef struct ASTNode* (*PrefixParseFn)(bool can_assign);
-typedef struct ASTNode* (*InfixParseFn)(struct ASTNode* left, bool can_assign);
+static NodeId expression();
+static NodeId statement();
+static NodeId ParsePrecedence(Precedence precedence);
+static NodeId unary(bool can_assign);
+static NodeId binary(NodeId left, bool can_assign);
+static NodeId number(bool can_assign);
+static NodeId string(bool can_assign);
+static NodeId identifier(bool can_assign);
+static NodeId grouping(bool can_assign);
+static NodeId if_statement();
+static NodeId while_statement();
+static NodeId for_statement();
+static NodeId function_declaration();
+static NodeId function_definition(bool defer_body);
+static NodeId return_statement();
+static NodeId local_declaration();
+
+typedef NodeId (*PrefixParseFn)(bool can_assign);
+typedef NodeId (*InfixParseFn)(NodeId left, bool can_assign);
 
 typedef struct {
     PrefixParseFn prefix;
@@ -152,12 +186,15 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-static struct ASTNode* literal(bool can_assign);
-static struct ASTNode* call(struct ASTNode* left, bool can_assign);
+static NodeId literal(bool can_assign);
+static NodeId table_constructor(bool can_assign);
+static NodeId call(NodeId left, bool can_assign);
+static NodeId subscript(NodeId left, bool can_assign);
+static NodeId dot(NodeId left, bool can_assign);
 
-static struct ASTNode* logical(struct ASTNode* left, bool can_assign);
+static NodeId logical(NodeId left, bool can_assign);
 
-ParseRule rules[] = {
+ParseRule rules[TOKEN_UNKNOWN + 1] = {
     [TOKEN_LPAREN]    = {grouping, call,   PREC_CALL},
     [TOKEN_RPAREN]    = {NULL,     NULL,   PREC_NONE},
     [TOKEN_COMMA]     = {NULL,     NULL,   PREC_NONE},
@@ -191,7 +228,16 @@ ParseRule rules[] = {
     [TOKEN_NIL]       = {literal,  NULL,   PREC_NONE},
     [TOKEN_NOT]       = {unary,    NULL,   PREC_NONE},
     [TOKEN_CONCAT]    = {NULL,     binary, PREC_TERM},
+    [TOKEN_LOCAL]     = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FOR]       = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LBRACE]    = {table_constructor, NULL, PREC_NONE},
+    [TOKEN_RBRACE]    = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LBRACKET]  = {NULL,     subscript, PREC_CALL},
+    [TOKEN_RBRACKET]  = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DOT]       = {NULL,     dot,    PREC_CALL},
+    [TOKEN_HASH]      = {unary,    NULL,   PREC_NONE},
     [TOKEN_EOF]       = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_UNKNOWN]   = {NULL,     NULL,   PREC_NONE},
 };
 
 static ParseRule* get_rule(TokenType type) {
@@ -214,22 +260,25 @@ static ParseRule* get_rule(TokenType type) {
  *
  * expression -> term ( ( "+" | "-" | ">" | "<" | ">=" | "<=" | "==" | "~=" ) term )*
  *
+ * Assignments are statements, so an expression starts one level above
+ * PREC_ASSIGNMENT and an '=' after it is left for the caller to reject.
+ *
  * @return The parsed AST node.
  */
-static struct ASTNode* expression() {
-    return ParsePrecedence(PREC_ASSIGNMENT);
+static NodeId expression() {
+    return ParsePrecedence(PREC_OR);
 }
 
-static struct ASTNode* ParsePrecedence(Precedence precedence) {
+static NodeId ParsePrecedence(Precedence precedence) {
     advance();
     PrefixParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
     if (prefix_rule == NULL) {
         error("Expect expression.");
-        return NULL;
+        return 0;
     }
 
     bool can_assign = precedence <= PREC_ASSIGNMENT;
-    struct ASTNode* left = prefix_rule(can_assign);
+    NodeId left = prefix_rule(can_assign);
 
     while (precedence <= get_rule(parser.current.type)->precedence) {
         advance();
@@ -243,113 +292,300 @@ static struct ASTNode* ParsePrecedence(Precedence precedence) {
     return left;
 }
 
-static struct ASTNode* number(bool can_assign) {
+/**
+ * @brief Converts the text of a numeric literal. As in Lua 5.3, a literal
+ * without a fraction is an integer unless it does not fit in 64 bits.
+ *
+ * @param start The literal's text.
+ * @param length The length of the text.
+ * @param integer Receives the value of an integer literal.
+ * @param number Receives the value of any other literal.
+ * @return 1 if the literal is an integer, 0 otherwise.
+ */
+int number_literal(const char* start, int length, int64_t* integer, double* number) {
+    uint64_t value = 0;
+    int i = 0;
+    for (; i < length && start[i] >= '0' && start[i] <= '9'; i++) {
+        int digit = start[i] - '0';
+        if (value > (INT64_MAX - digit) / 10) break;
+        value = value * 10 + digit;
+    }
+    if (i == length) {
+        *integer = (int64_t)value;
+        return 1;
+    }
+
+    // strtod needs a terminated copy; literals this long are rare enough to
+    // allocate for.
+    char buffer[64];
+    char* text = length < (int)sizeof(buffer) ? buffer : (char*)malloc(length + 1);
+    memcpy(text, start, length);
+    text[length] = '\0';
+    *number = strtod(text, NULL);
+    if (text != buffer) free(text);
+    return 0;
+}
+
+static NodeId number(bool can_assign) {
+    int64_t integer;
+    double value;
+    if (number_literal(parser.previous.start, parser.previous.length, &integer, &value)) {
+        struct ASTNode* node = create_node(NODE_INTEGER);
+        node->line = parser.previous.line;
+        node->data.integer_value = integer;
+        return node->id;
+    }
+
     struct ASTNode* node = create_node(NODE_NUMBER);
     node->line = parser.previous.line;
-    char* num_str = (char*)malloc(parser.previous.length + 1);
-    memcpy(num_str, parser.previous.start, parser.previous.length);
-    num_str[parser.previous.length] = '\0';
-    node->data.number_value = strtod(num_str, NULL);
-    free(num_str);
-    return node;
+    node->data.number_value = value;
+    return node->id;
 }
 
-static struct ASTNode* string(bool can_assign) {
+static NodeId string(bool can_assign) {
     struct ASTNode* node = create_node(NODE_STRING);
     node->line = parser.previous.line;
-    node->data.string_value = (char*)malloc(parser.previous.length - 1);
-    memcpy(node->data.string_value, parser.previous.start + 1, parser.previous.length - 2);
-    node->data.string_value[parser.previous.length - 2] = '\0';
-    return node;
+    // Without the quotes
+    node->data.string_value = (Span){parser.previous.start + 1, parser.previous.length - 2};
+    return node->id;
+}
+
+/**
+ * @brief Returns the lexeme of the previous token.
+ */
+static Span previous_span() {
+    return (Span){parser.previous.start, parser.previous.length};
 }
 
-static struct ASTNode* identifier(bool can_assign) {
+/**
+ * @brief Creates a NODE_IDENTIFIER for the previous token.
+ */
+static NodeId previous_identifier() {
     struct ASTNode* node = create_node(NODE_IDENTIFIER);
     node->line = parser.previous.line;
-    node->data.identifier_name = (char*)malloc(parser.previous.length + 1);
-    memcpy(node->data.identifier_name, parser.previous.start, parser.previous.length);
-    node->data.identifier_name[parser.previous.length] = '\0';
-    return node;
+    node->data.identifier_name = previous_span();
+    return node->id;
 }
 
-static struct ASTNode* grouping(bool can_assign) {
-    struct ASTNode* expr = expression();
+static NodeId identifier(bool can_assign) {
+    if (can_assign && check(TOKEN_ASSIGN)) {
+        struct ASTNode* node = create_node(NODE_ASSIGN);
+        node->line = parser.previous.line;
+        node->data.assignment.identifier = previous_span();
+        advance();
+        node->data.assignment.expression = expression();
+        return node->id;
+    }
+
+    return previous_identifier();
+}
+
+static NodeId grouping(bool can_assign) {
+    NodeId expr = expression();
     consume(TOKEN_RPAREN, "Expect ')' after expression.");
     return expr;
 }
 
-static struct ASTNode* unary(bool can_assign) {
+static NodeId unary(bool can_assign) {
     TokenType op_type = parser.previous.type;
-    struct ASTNode* right = ParsePrecedence(PREC_UNARY);
+    NodeId right = ParsePrecedence(PREC_UNARY);
     
     struct ASTNode* node = create_node(NODE_UNARY_OP);
     node->line = parser.previous.line;
     node->data.unary_op.op = op_type;
     node->data.unary_op.right = right;
-    return node;
+    return node->id;
 }
 
-static struct ASTNode* binary(struct ASTNode* left, bool can_assign) {
+static NodeId binary(NodeId left, bool can_assign) {
     TokenType op_type = parser.previous.type;
     ParseRule* rule = get_rule(op_type);
-    struct ASTNode* right = ParsePrecedence((Precedence)(rule->precedence + 1));
+    NodeId right = ParsePrecedence((Precedence)(rule->precedence + 1));
 
     struct ASTNode* node = create_node(NODE_BINARY_OP);
     node->line = parser.previous.line;
     node->data.binary_op.op = op_type;
     node->data.binary_op.left = left;
     node->data.binary_op.right = right;
-    return node;
+    return node->id;
 }
 
-static struct ASTNode* logical(struct ASTNode* left, bool can_assign) {
+static NodeId logical(NodeId left, bool can_assign) {
     TokenType op_type = parser.previous.type;
     ParseRule* rule = get_rule(op_type);
-    struct ASTNode* right = ParsePrecedence((Precedence)(rule->precedence + 1));
+    NodeId right = ParsePrecedence((Precedence)(rule->precedence + 1));
 
     struct ASTNode* node = create_node(NODE_LOGICAL_OP);
     node->line = parser.previous.line;
     node->data.logical_op.op = op_type;
     node->data.logical_op.left = left;
     node->data.logical_op.right = right;
-    return node;
+    return node->id;
 }
 
-static struct ASTNode* literal(bool can_assign) {
+static NodeId literal(bool can_assign) {
     switch (parser.previous.type) {
-        case TOKEN_TRUE: return create_node(NODE_TRUE);
-        case TOKEN_FALSE: return create_node(NODE_FALSE);
-        case TOKEN_NIL: return create_node(NODE_NIL);
-        default: return NULL; // Unreachable.
+        case TOKEN_TRUE: return create_node(NODE_TRUE)->id;
+        case TOKEN_FALSE: return create_node(NODE_FALSE)->id;
+        case TOKEN_NIL: return create_node(NODE_NIL)->id;
+        default: return 0; // Unreachable.
     }
 }
 
-static struct ASTNode* call(struct ASTNode* left, bool can_assign) {
+/**
+ * @brief Appends a node to a list given by its head and tail.
+ */
+static void append(NodeId* head, NodeId* tail, NodeId node) {
+    if (*head == 0) {
+        *head = node;
+    } else {
+        node_at(*tail)->next = node;
+    }
+    *tail = node;
+}
+
+static NodeId call(NodeId left, bool can_assign) {
     struct ASTNode* node = create_node(NODE_FUNCTION_CALL);
     node->line = parser.previous.line;
-    node->data.function_call.function_name = left->data.identifier_name;
-    
-    struct ASTNode* args_head = NULL;
-    struct ASTNode* args_tail = NULL;
+    node->data.function_call.callee = left;
+
+    NodeId args_head = 0;
+    NodeId args_tail = 0;
     if (!check(TOKEN_RPAREN)) {
         do {
-            struct ASTNode* arg_node = expression();
-            if (args_head == NULL) {
-                args_head = arg_node;
-                args_tail = arg_node;
-            } else {
-                args_tail->next = arg_node;
-                args_tail = arg_node;
-            }
+            NodeId arg_node = expression();
+            if (arg_node != 0) append(&args_head, &args_tail, arg_node);
         } while (match(TOKEN_COMMA));
     }
     
     node->data.function_call.argument = args_head;
     consume(TOKEN_RPAREN, "Expect ')' after arguments.");
-    return node;
+    return node->id;
+}
+
+/**
+ * @brief Builds an index expression, or an index assignment when the
+ * expression is followed by '=' where an assignment is allowed.
+ */
+static NodeId index_node(NodeId object, NodeId key, bool can_assign, int line) {
+    if (can_assign && match(TOKEN_ASSIGN)) {
+        struct ASTNode* node = create_node(NODE_INDEX_ASSIGN);
+        node->line = line;
+        node->data.index_assign.object = object;
+        node->data.index_assign.key = key;
+        node->data.index_assign.value = expression();
+        return node->id;
+    }
+
+    struct ASTNode* node = create_node(NODE_INDEX);
+    node->line = line;
+    node->data.index.object = object;
+    node->data.index.key = key;
+    return node->id;
+}
+
+/**
+ * @brief Parses an index with brackets.
+ *
+ * subscript -> expression "[" expression "]"
+ */
+static NodeId subscript(NodeId left, bool can_assign) {
+    int line = parser.previous.line;
+    NodeId key = expression();
+    consume(TOKEN_RBRACKET, "Expect ']' after index.");
+    return index_node(left, key, can_assign, line);
+}
+
+/**
+ * @brief Parses a field access, sugar for indexing with a string.
+ *
+ * dot -> expression "." IDENTIFIER
+ */
+static NodeId dot(NodeId left, bool can_assign) {
+    int line = parser.previous.line;
+    consume(TOKEN_IDENTIFIER, "Expect field name after '.'.");
+    struct ASTNode* key = create_node(NODE_STRING);
+    key->line = parser.previous.line;
+    key->data.string_value = previous_span();
+    return index_node(left, key->id, can_assign, line);
+}
+
+/**
+ * @brief Parses a table constructor.
+ *
+ * table -> "{" ( field ( "," field )* ","? )? "}"
+ * field -> "[" expression "]" "=" expression | IDENTIFIER "=" expression | expression
+ *
+ * @return The parsed AST node.
+ */
+static NodeId table_constructor(bool can_assign) {
+    struct ASTNode* node = create_node(NODE_TABLE);
+    node->line = parser.previous.line;
+    NodeId head = 0;
+    NodeId tail = 0;
+
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF)) {
+        struct ASTNode* field = create_node(NODE_TABLE_FIELD);
+        field->line = parser.current.line;
+        if (match(TOKEN_LBRACKET)) {
+            field->data.table_field.key = expression();
+            consume(TOKEN_RBRACKET, "Expect ']' after table key.");
+            consume(TOKEN_ASSIGN, "Expect '=' after table key.");
+            field->data.table_field.value = expression();
+        } else {
+            // With one token of lookahead "name = value" cannot be told from
+            // an expression up front, so parse it as an assignment and take
+            // the assignment apart.
+            struct ASTNode* value = node_at(ParsePrecedence(PREC_ASSIGNMENT));
+            if (value != NULL && value->type == NODE_ASSIGN) {
+                struct ASTNode* key = create_node(NODE_STRING);
+                key->line = value->line;
+                key->data.string_value = value->data.assignment.identifier;
+                field->data.table_field.key = key->id;
+                field->data.table_field.value = value->data.assignment.expression;
+            } else {
+                if (value != NULL && value->type == NODE_INDEX_ASSIGN) {
+                    error("Invalid table field.");
+                }
+                field->data.table_field.value = value != NULL ? value->id : 0;
+            }
+        }
+
+        if (field->data.table_field.key == 0) {
+            node->data.table.array_count++;
+        } else {
+            node->data.table.hash_count++;
+        }
+        append(&head, &tail, field->id);
+
+        if (!match(TOKEN_COMMA)) break;
+    }
+    node->data.table.fields = head;
+
+    consume(TOKEN_RBRACE, "Expect '}' after table fields.");
+    return node->id;
 }
 
+/**
+ * @brief Parses statements up to one of the given terminators, which is
+ * left for the caller.
+ *
+ * @return A NODE_STATEMENTS node with the statements.
+ */
+static NodeId block(TokenType stop, TokenType also_stop) {
+    struct ASTNode* node = create_node(NODE_STATEMENTS);
+    node->line = parser.previous.line;
+    NodeId head = 0;
+    NodeId tail = 0;
 
+    while (!check(stop) && !check(also_stop) && !check(TOKEN_EOF)) {
+        NodeId st = statement();
+        if (st == 0) break;
+        append(&head, &tail, st);
+    }
+    node->data.statements.statement = head;
+    return node->id;
+}
 
 /**
  * @brief Parses an if statement.
@@ -358,61 +594,20 @@ static struct ASTNode* call(struct ASTNode* left, bool can_assign) {
  *
  * @return The parsed AST node.
  */
-static struct ASTNode* if_statement() {
+static NodeId if_statement() {
     struct ASTNode* node = create_node(NODE_IF);
     node->line = parser.previous.line;
 
     node->data.if_statement.condition = expression();
     consume(TOKEN_THEN, "Expect 'then' after if condition.");
-
-    struct ASTNode* then_branch = create_node(NODE_STATEMENTS);
-    then_branch->line = parser.previous.line;
-    then_branch->data.statements.statement = NULL;
-    struct ASTNode* tail = NULL;
-
-    while (!check(TOKEN_ELSE) && !check(TOKEN_END) && !check(TOKEN_EOF)) {
-        struct ASTNode* st = statement();
-        if (st) {
-            if (then_branch->data.statements.statement == NULL) {
-                then_branch->data.statements.statement = st;
-                tail = st;
-            } else {
-                tail->next = st;
-                tail = st;
-            }
-        } else {
-            break;
-        }
-    }
-    node->data.if_statement.then_branch = then_branch;
+    node->data.if_statement.then_branch = block(TOKEN_ELSE, TOKEN_END);
 
     if (match(TOKEN_ELSE)) {
-        struct ASTNode* else_branch = create_node(NODE_STATEMENTS);
-        else_branch->line = parser.previous.line;
-        else_branch->data.statements.statement = NULL;
-        tail = NULL;
-
-        while (!check(TOKEN_END) && !check(TOKEN_EOF)) {
-            struct ASTNode* st = statement();
-            if (st) {
-                if (else_branch->data.statements.statement == NULL) {
-                    else_branch->data.statements.statement = st;
-                    tail = st;
-                } else {
-                    tail->next = st;
-                    tail = st;
-                }
-            } else {
-                break;
-            }
-        }
-        node->data.if_statement.else_branch = else_branch;
-    } else {
-        node->data.if_statement.else_branch = NULL;
+        node->data.if_statement.else_branch = block(TOKEN_END, TOKEN_END);
     }
 
     consume(TOKEN_END, "Expect 'end' after if branches.");
-    return node;
+    return node->id;
 }
 
 /**
@@ -422,55 +617,64 @@ static struct ASTNode* if_statement() {
  *
  * @return The parsed AST node.
  */
-static struct ASTNode* while_statement() {
+static NodeId while_statement() {
     struct ASTNode* node = create_node(NODE_WHILE);
     node->line = parser.previous.line;
 
     node->data.while_statement.condition = expression();
     consume(TOKEN_DO, "Expect 'do' after while condition.");
+    node->data.while_statement.body = block(TOKEN_END, TOKEN_END);
 
-    struct ASTNode* body = create_node(NODE_STATEMENTS);
-    body->line = parser.previous.line;
-    body->data.statements.statement = NULL;
-    struct ASTNode* tail = NULL;
-
-    while (!check(TOKEN_END) && !check(TOKEN_EOF)) {
-        struct ASTNode* st = statement();
-        if (st) {
-            if (body->data.statements.statement == NULL) {
-                body->data.statements.statement = st;
-                tail = st;
-            } else {
-                tail->next = st;
-                tail = st;
-            }
-        } else {
-            break;
-        }
+    consume(TOKEN_END, "Expect 'end' after while body.");
+    return node->id;
+}
+
+/**
+ * @brief Parses a numeric for statement.
+ *
+ * forStatement -> "for" IDENTIFIER "=" expression "," expression ( "," expression )? "do" statement* "end"
+ *
+ * @return The parsed AST node.
+ */
+static NodeId for_statement() {
+    struct ASTNode* node = create_node(NODE_FOR);
+    node->line = parser.previous.line;
+
+    consume(TOKEN_IDENTIFIER, "Expect variable name after 'for'.");
+    node->data.for_statement.variable = previous_identifier();
+
+    consume(TOKEN_ASSIGN, "Expect '=' after for variable.");
+    node->data.for_statement.start = expression();
+    consume(TOKEN_COMMA, "Expect ',' after for initial value.");
+    node->data.for_statement.limit = expression();
+    if (match(TOKEN_COMMA)) {
+        node->data.for_statement.step = expression();
     }
-    node->data.while_statement.body = body;
+    consume(TOKEN_DO, "Expect 'do' after for clauses.");
+    node->data.for_statement.body = block(TOKEN_END, TOKEN_END);
 
-    consume(TOKEN_END, "Expect 'end' after while body.");
-    return node;
+    consume(TOKEN_END, "Expect 'end' after for body.");
+    return node->id;
 }
 
 /**
  * @brief Parses a statement.
  *
- * statement -> printStatement | ifStatement | whileStatement | assignment | expressionStatement
+ * statement -> printStatement | ifStatement | whileStatement | forStatement | assignment | expressionStatement
+ * assignment -> ( IDENTIFIER | expression "[" expression "]" | expression "." IDENTIFIER ) "=" expression
  *
  * @return The parsed AST node.
  */
-static struct ASTNode* statement() {
+static NodeId statement() {
     if (match(TOKEN_PRINT)) {
         consume(TOKEN_LPAREN, "Expect '(' after 'print'.");
-        struct ASTNode* expr = expression();
+        NodeId expr = expression();
         consume(TOKEN_RPAREN, "Expect ')' after expression.");
 
         struct ASTNode* print_node = create_node(NODE_PRINT);
         print_node->line = parser.previous.line;
         print_node->data.print_statement.expression = expr;
-        return print_node;
+        return print_node->id;
     }
 
     if (match(TOKEN_IF)) {
@@ -481,6 +685,10 @@ static struct ASTNode* statement() {
         return while_statement();
     }
 
+    if (match(TOKEN_FOR)) {
+        return for_statement();
+    }
+
     if (match(TOKEN_FUNCTION)) {
         return function_declaration();
     }
@@ -493,160 +701,282 @@ static struct ASTNode* statement() {
         return local_declaration();
     }
 
-    if (check(TOKEN_IDENTIFIER)) {
-        Token identifier_token = parser.current;
-        advance();
-        if (match(TOKEN_ASSIGN)) {
-            struct ASTNode* expr = expression();
-            struct ASTNode* assign_node = create_node(NODE_ASSIGN);
-            assign_node->line = identifier_token.line;
-            assign_node->data.assignment.identifier = (char*)malloc(identifier_token.length + 1);
-            memcpy(assign_node->data.assignment.identifier, identifier_token.start, identifier_token.length);
-            assign_node->data.assignment.identifier[identifier_token.length] = '\0';
-            assign_node->data.assignment.expression = expr;
-            return assign_node;
-        }
-        // Backtrack if it wasn't an assignment
-        parser.current = identifier_token;
-        parser.previous = (Token){.type = TOKEN_UNKNOWN}; // Reset previous
+    // Assignments are parsed by the identifier and index rules, which are
+    // only allowed to consume '=' at this level.
+    struct ASTNode* expr_node = node_at(ParsePrecedence(PREC_ASSIGNMENT));
+    if (expr_node && (expr_node->type == NODE_ASSIGN || expr_node->type == NODE_INDEX_ASSIGN)) {
+        return expr_node->id;
     }
-    
-    struct ASTNode* expr_node = expression();
     if (expr_node) {
         struct ASTNode* stmt_node = create_node(NODE_EXPRESSION_STATEMENT);
         stmt_node->line = expr_node->line;
-        stmt_node->data.expression_statement.expression = expr_node;
-        return stmt_node;
+        stmt_node->data.expression_statement.expression = expr_node->id;
+        return stmt_node->id;
     }
 
-    return NULL;
+    return 0;
+}
+
+static NodeId function_declaration() {
+    return function_definition(parser.defer_functions);
 }
 
-static struct ASTNode* function_declaration() {
+/**
+ * @brief Parses a function definition after its 'function' keyword.
+ *
+ * @param defer_body Whether to only check the body: it is parsed as usual,
+ * so errors in it are reported now, but its nodes are dropped and
+ * parse_function parses it again when the function is first called.
+ * @return The NODE_FUNCTION_DEF node.
+ */
+static NodeId function_definition(bool defer_body) {
     struct ASTNode* node = create_node(NODE_FUNCTION_DEF);
     node->line = parser.previous.line;
+    node->data.function_def.source = parser.previous.start;
 
     consume(TOKEN_IDENTIFIER, "Expect function name.");
-    node->data.function_def.function_name = (char*)malloc(parser.previous.length + 1);
-    memcpy(node->data.function_def.function_name, parser.previous.start, parser.previous.length);
-    node->data.function_def.function_name[parser.previous.length] = '\0';
+    node->data.function_def.name = previous_identifier();
 
     consume(TOKEN_LPAREN, "Expect '(' after function name.");
 
-    struct ASTNode* params_head = NULL;
-    struct ASTNode* params_tail = NULL;
+    NodeId params_head = 0;
+    NodeId params_tail = 0;
     if (!check(TOKEN_RPAREN)) {
         do {
             consume(TOKEN_IDENTIFIER, "Expect parameter name.");
-            struct ASTNode* param_node = create_node(NODE_IDENTIFIER);
-            param_node->line = parser.previous.line;
-            param_node->data.identifier_name = (char*)malloc(parser.previous.length + 1);
-            memcpy(param_node->data.identifier_name, parser.previous.start, parser.previous.length);
-            param_node->data.identifier_name[parser.previous.length] = '\0';
-
-            if (params_head == NULL) {
-                params_head = param_node;
-                params_tail = param_node;
-            } else {
-                params_tail->next = param_node;
-                params_tail = param_node;
-            }
+            append(&params_head, &params_tail, previous_identifier());
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RPAREN, "Expect ')' after parameters.");
 
     node->data.function_def.parameters = params_head;
 
-    struct ASTNode* body = create_node(NODE_STATEMENTS);
-    body->line = parser.previous.line;
-    body->data.statements.statement = NULL;
-    struct ASTNode* tail = NULL;
-
-    while (!check(TOKEN_END) && !check(TOKEN_EOF)) {
-        struct ASTNode* st = statement();
-        if (st) {
-            if (body->data.statements.statement == NULL) {
-                body->data.statements.statement = st;
-                tail = st;
-            } else {
-                tail->next = st;
-                tail = st;
-            }
-        } else {
-            break;
-        }
+    // The body's nodes are the last allocated, so dropping them gives the
+    // space back to the nodes that follow.
+    NodeId body_start = parser.ast->count;
+    NodeId body = block(TOKEN_END, TOKEN_END);
+    if (defer_body) {
+        parser.ast->count = body_start;
+        body = 0;
     }
     node->data.function_def.body = body;
 
     consume(TOKEN_END, "Expect 'end' after function body.");
-    return node;
+    node->data.function_def.length = (int)(parser.previous.start + parser.previous.length - node->data.function_def.source);
+    return node->id;
 }
 
-static struct ASTNode* return_statement() {
+static NodeId return_statement() {
     struct ASTNode* node = create_node(NODE_RETURN);
     node->line = parser.previous.line;
-    node->data.return_statement.expression = expression();
-    return node;
+    if (!check(TOKEN_END) && !check(TOKEN_ELSE) && !check(TOKEN_EOF)) {
+        node->data.return_statement.expression = expression();
+    }
+    return node->id;
 }
 
-static struct ASTNode* local_declaration() {
+static NodeId local_declaration() {
     consume(TOKEN_IDENTIFIER, "Expect variable name.");
     struct ASTNode* node = create_node(NODE_LOCAL_DECLARATION);
     node->line = parser.previous.line;
-    node->data.local_declaration.identifier = (char*)malloc(parser.previous.length + 1);
-    memcpy(node->data.local_declaration.identifier, parser.previous.start, parser.previous.length);
-    node->data.local_declaration.identifier[parser.previous.length] = '\0';
+    node->data.local_declaration.identifier = previous_span();
 
     if (match(TOKEN_ASSIGN)) {
         node->data.local_declaration.expression = expression();
-    } else {
-        node->data.local_declaration.expression = NULL;
     }
 
-    return node;
+    return node->id;
 }
 
 
 /**
- * @brief Parses the given source code.
- * 
- * @param source The source code to parse.
- * @return The root of the AST, or NULL if there were errors.
+ * @brief Starts parsing source into a new AST, lexing it unless a stream
+ * supplies the tokens.
  */
-struct ASTNode* parse(const char* source) {
-    init_lexer(source);
+static void begin_parse(const char* source, int line, int defer_functions, ParseStream* stream) {
+    parser.stream = stream;
+    if (stream == NULL) init_lexer_at(source, line);
     parser.had_error = 0;
     parser.panic_mode = 0;
+    parser.defer_functions = defer_functions;
+    parser.ast = new_ast();
     advance();
+}
 
-    struct ASTNode* head = NULL;
-    struct ASTNode* tail = NULL;
+/**
+ * @brief Returns the AST being built with the given root, or frees it and
+ * returns NULL if there were errors. A stream's AST is left to its caller.
+ */
+static AST* end_parse(NodeId root) {
+    AST* ast = parser.ast;
+    parser.ast = NULL;
+    ast->root = root;
+    if (parser.stream != NULL) {
+        parser.stream->ast = ast;
+        parser.stream = NULL;
+        return parser.had_error || root == 0 ? NULL : ast;
+    }
+    if (parser.had_error || root == 0) {
+        free_ast(ast);
+        return NULL;
+    }
+    return ast;
+}
+
+/**
+ * @brief Parses a whole program, with or without deferring function bodies.
+ * With a stream, top-level statements go to its sink instead of the root.
+ */
+static AST* parse_program(const char* source, int defer_functions, ParseStream* stream) {
+    begin_parse(source, 1, defer_functions, stream);
+
+    struct ASTNode* root = create_node(NODE_STATEMENTS);
+    root->line = 0;
+    NodeId head = 0;
+    NodeId tail = 0;
 
     while(!check(TOKEN_EOF)) {
         if (parser.panic_mode) {
             // TODO: Synchronize
         }
-        struct ASTNode* st = statement();
-        if (st) {
-            if (head == NULL) {
-                head = st;
-                tail = st;
-            } else {
-                tail->next = st;
-                tail = st;
-            }
-        } else {
-            break;
+        NodeId st = statement();
+        if (st == 0) break;
+        if (stream == NULL) {
+            append(&head, &tail, st);
+        } else if (!parser.had_error) {
+            // Left unlinked: the sink's reader may be using the node already
+            stream->statement(stream->context, parser.ast, st);
         }
     }
+    root->data.statements.statement = head;
 
-    if (parser.had_error) {
-        // TODO: Free memory
-        return NULL;
-    }
+    return end_parse(root->id);
+}
+
+/**
+ * @brief Parses the given source code.
+ * 
+ * @param source The source code to parse. The AST points into it, so it must
+ * stay alive until the AST is freed.
+ * @return The AST, or NULL if there were errors.
+ */
+AST* parse(const char* source) {
+    return parse_program(source, 0, NULL);
+}
+
+/**
+ * @brief Parses the given source code like parse, except that the body of
+ * each function definition is only checked: the definition has no body and
+ * parse_function parses it when the function is first called.
+ * 
+ * @param source The source code to parse. Deferred bodies are parsed from
+ * it later, so it must stay alive until they have all been compiled.
+ * @return The AST, or NULL if there were errors.
+ */
+AST* parse_deferring_functions(const char* source) {
+    return parse_program(source, 1, NULL);
+}
+
+/**
+ * @brief Parses a function definition whose body was deferred. Functions
+ * defined inside it are deferred in turn.
+ * 
+ * @param source The definition's 'function' keyword, as recorded by
+ * parse_deferring_functions.
+ * @param line The line the keyword is on.
+ * @return An AST whose root is the NODE_FUNCTION_DEF node with its body, or
+ * NULL if there were errors, which the first parse would have reported
+ * already.
+ */
+AST* parse_function(const char* source, int line) {
+    begin_parse(source, line, 1, NULL);
+    if (!match(TOKEN_FUNCTION)) return end_parse(0);
+    return end_parse(function_definition(false));
+}
+
+/**
+ * @brief Parses a program whose tokens come from a stream, handing each
+ * top-level statement to the stream as soon as it is complete. Its nodes
+ * are final by then: later statements only add nodes after them, and the
+ * pages of nodes never move.
+ *
+ * @param source The source code the tokens were lexed from.
+ * @param stream The token source and statement sink.
+ * @param defer_functions Whether to defer function bodies as
+ * parse_deferring_functions does.
+ * @return The AST, whose root lists no statements, or NULL if there were
+ * errors. Either way, the caller frees stream->ast.
+ */
+AST* parse_stream(const char* source, ParseStream* stream, int defer_functions) {
+    return parse_program(source, defer_functions, stream);
+}
+
+/**
+ * @brief Starts parsing a program a batch at a time. Function bodies are
+ * deferred as by parse_deferring_functions.
+ *
+ * @param batches The state to start.
+ * @param source The source code. It must outlive every function defined
+ * in it.
+ */
+void begin_batches(BatchParser* batches, const char* source) {
+    begin_parse(source, 1, 1, NULL);
+    batches->parser = parser;
+    batches->lexer = save_lexer();
+    batches->failed = 0;
+}
+
+/**
+ * @brief Parses the next top-level statements of a program, stopping after
+ * the first one that takes the batch's AST past a number of nodes.
+ *
+ * @param batches The state begin_batches started.
+ * @param max_nodes The node count after which to end the batch.
+ * @return An AST listing the statements, or NULL if there were errors,
+ * after which there are no more batches.
+ */
+AST* parse_batch(BatchParser* batches, NodeId max_nodes) {
+    parser = batches->parser;
+    restore_lexer(batches->lexer);
+    if (parser.ast == NULL) parser.ast = new_ast();
 
     struct ASTNode* root = create_node(NODE_STATEMENTS);
     root->line = 0;
+    NodeId head = 0;
+    NodeId tail = 0;
+    while (!check(TOKEN_EOF)) {
+        NodeId st = statement();
+        if (st == 0) break;
+        append(&head, &tail, st);
+        if (parser.ast->count > max_nodes) break;
+    }
     root->data.statements.statement = head;
-    return root;
-}
\ No newline at end of file
+
+    AST* ast = end_parse(root->id);
+    batches->failed = ast == NULL;
+    batches->parser = parser;
+    batches->lexer = save_lexer();
+    return ast;
+}
+
+/**
+ * @brief Checks whether a program parsed in batches has been parsed to its
+ * end or stopped at an error.
+ */
+int batches_done(const BatchParser* batches) {
+    return batches->failed || batches->parser.current.type == TOKEN_EOF;
+}
+
+/**
+ * @brief Frees an AST and all its nodes.
+ *
+ * @param ast The AST to free. May be NULL.
+ */
+void free_ast(AST* ast) {
+    if (ast == NULL) return;
+    for (int i = 0; i < ast->pages_count; i++) {
+        free(ast->pages[i]);
+    }
+    free(ast->pages);
+    free(ast);
+}
@@ -2,9 +2,22 @@
 #define PARSER_H
 
 #include "lexer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A stretch of the source text. Names and string literals in the
+ * AST point into the source instead of being copied, so the source must
+ * outlive the AST.
+ */
+typedef struct {
+    const char* start;
+    int length;
+} Span;
 
 typedef enum {
     NODE_NUMBER,
+    NODE_INTEGER,
     NODE_STRING,
     NODE_IDENTIFIER,
     NODE_BINARY_OP,
@@ -14,6 +27,7 @@ typedef enum {
     NODE_ASSIGN,
     NODE_IF,
     NODE_WHILE,
+    NODE_FOR,
     NODE_STATEMENTS,
     NODE_EXPRESSION_STATEMENT,
     NODE_FUNCTION_DEF,
@@ -22,79 +36,204 @@ typedef enum {
     NODE_LOCAL_DECLARATION,
     NODE_TRUE,
     NODE_FALSE,
-    NODE_NIL
+    NODE_NIL,
+    NODE_TABLE,
+    NODE_TABLE_FIELD,
+    NODE_INDEX,
+    NODE_INDEX_ASSIGN,
+    NODE_INLINE_CALL    // Made only by the optimizer
 } NodeType;
 
+/**
+ * @brief The subtype the optimizer proved both operands of an arithmetic or
+ * comparison operator to have, letting codegen emit the instruction in its
+ * quickened form from the start.
+ */
+typedef enum {
+    OPERANDS_UNKNOWN,
+    OPERANDS_INTEGER,
+    OPERANDS_FLOAT,
+} OperandTypes;
+
+/**
+ * @brief Index of a node in its AST. Links between nodes are indexes, half
+ * the size of pointers; 0 is no node.
+ */
+typedef uint32_t NodeId;
+
+/**
+ * @brief A node of the AST, 40 bytes. Child and list links are NodeIds,
+ * resolved with ast_node.
+ */
 typedef struct ASTNode {
     NodeType type;
     int line;
-    struct ASTNode* next;
+    NodeId next;
+    NodeId id;      // The node's own index
     union {
         double number_value;
-        char* string_value;
-        char* identifier_name;
+        int64_t integer_value;
+        Span string_value;
+        Span identifier_name;
         struct {
             TokenType op;
-            struct ASTNode* left;
-            struct ASTNode* right;
+            NodeId left;
+            NodeId right;
+            OperandTypes operands;  // Set only by the optimizer
         } binary_op;
         struct {
             TokenType op;
-            struct ASTNode* right;
+            NodeId right;
         } unary_op;
         struct {
             TokenType op;
-            struct ASTNode* left;
-            struct ASTNode* right;
+            NodeId left;
+            NodeId right;
         } logical_op;
         struct {
-            struct ASTNode* expression;
+            NodeId expression;
         } print_statement;
         struct {
-            char* identifier;
-            struct ASTNode* expression;
+            Span identifier;
+            NodeId expression;
         } assignment;
         struct {
-            struct ASTNode* condition;
-            struct ASTNode* then_branch;
-            struct ASTNode* else_branch;
+            NodeId condition;
+            NodeId then_branch;
+            NodeId else_branch;
         } if_statement;
         struct {
-            struct ASTNode* condition;
-            struct ASTNode* body;
+            NodeId condition;
+            NodeId body;
         } while_statement;
         struct {
-            struct ASTNode* statement;
+            NodeId variable;        // NODE_IDENTIFIER
+            NodeId start;
+            NodeId limit;
+            NodeId step;            // 0 when omitted
+            NodeId body;
+        } for_statement;
+        struct {
+            NodeId statement;
         } statements;
         struct {
-            struct ASTNode* expression;
+            NodeId expression;
         } expression_statement;
         struct {
-            char* function_name;
-            struct ASTNode* parameters;
-            struct ASTNode* body;
+            const char* source;     // The 'function' keyword
+            int length;             // Of the source, through 'end'
+            NodeId name;            // NODE_IDENTIFIER
+            NodeId parameters;
+            NodeId body;            // 0 when parsing it was deferred
         } function_def;
         struct {
-            char* function_name;
-            struct ASTNode* argument;
+            NodeId callee;
+            NodeId argument;
         } function_call;
         struct {
-            struct ASTNode* expression;
+            NodeId expression;
         } return_statement;
         struct {
-            char* identifier;
-            struct ASTNode* expression;
+            Span identifier;
+            NodeId expression;
         } local_declaration;
+        struct {
+            NodeId fields;          // NODE_TABLE_FIELD list
+            int array_count;        // Fields without a key
+            int hash_count;         // Fields with a key
+        } table;
+        struct {
+            NodeId key;             // 0 for a positional field
+            NodeId value;
+        } table_field;
+        struct {
+            NodeId object;
+            NodeId key;
+        } index;
+        struct {
+            NodeId object;
+            NodeId key;
+            NodeId value;
+        } index_assign;
+        struct {
+            NodeId call;            // The NODE_FUNCTION_CALL, made when the guard fails
+            NodeId body;            // The callee's result with the arguments in place
+            NodeId function;        // The NODE_FUNCTION_DEF inlined
+        } inline_call;
     } data;
-} ASTNode;;
+} ASTNode;
+
+// Nodes in each page of an AST's storage
+#define AST_PAGE_BITS 9
+#define AST_PAGE_SIZE (1 << AST_PAGE_BITS)
+
+/**
+ * @brief An AST and the storage of its nodes. Nodes are allocated in
+ * order in fixed-size pages that never move, so a pointer to a node stays
+ * valid while nodes are added and the whole tree is freed a page at a
+ * time. Nodes dropped by the optimizer stay until then.
+ */
+typedef struct {
+    struct ASTNode** pages;
+    int pages_count;
+    int pages_capacity;
+    NodeId count;       // Index of the next node; 0 is never used
+    NodeId root;
+} AST;
+
+/**
+ * @brief Returns the node with the given index, or NULL for 0.
+ */
+static inline struct ASTNode* ast_node(const AST* ast, NodeId id) {
+    if (id == 0) return NULL;
+    return &ast->pages[id >> AST_PAGE_BITS][id & (AST_PAGE_SIZE - 1)];
+}
+
+/**
+ * @brief Where parse_stream gets its tokens from and where it sends each
+ * top-level statement as soon as it has been parsed.
+ */
+typedef struct {
+    Token (*next_token)(void* context);
+    // Not called for the statement with the first error or any after it
+    void (*statement)(void* context, AST* ast, NodeId statement);
+    void* context;
+    // Set by parse_stream, even after errors, since the sink's reader may
+    // still be using the nodes; the caller frees it
+    AST* ast;
+} ParseStream;
 
 typedef struct {
     Token current;
     Token previous;
     int had_error;
     int panic_mode;
+    int defer_functions;    // Check function bodies but drop their AST
+    AST* ast;               // The tree being built
+    ParseStream* stream;    // Token source and statement sink, or NULL
 } Parser;
 
-struct ASTNode* parse(const char* source);
+/**
+ * @brief A program parsed a batch of top-level statements at a time. It
+ * keeps its own parser and lexer state, so parse_function can run between
+ * batches.
+ */
+typedef struct {
+    Parser parser;
+    LexerState lexer;
+    int failed;     // A batch had errors
+} BatchParser;
+
+AST* new_ast();
+struct ASTNode* new_node(AST* ast, NodeType type);
+AST* parse(const char* source);
+AST* parse_deferring_functions(const char* source);
+AST* parse_function(const char* source, int line);
+AST* parse_stream(const char* source, ParseStream* stream, int defer_functions);
+void begin_batches(BatchParser* batches, const char* source);
+AST* parse_batch(BatchParser* batches, NodeId max_nodes);
+int batches_done(const BatchParser* batches);
+void free_ast(AST* ast);
+int number_literal(const char* start, int length, int64_t* integer, double* number);
 
 #endif // PARSER_H
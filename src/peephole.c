@@ -0,0 +1,351 @@
+#include "peephole.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rewriting stops here even if some chain of jumps could still be threaded
+#define PEEPHOLE_MAX_PASSES 16
+
+/**
+ * @brief One decoded instruction. Jump targets are kept as instruction
+ * indexes, so instructions can be removed without touching any offsets
+ * until the code is written back. Index count is the end of the code.
+ */
+typedef struct {
+    int offset;     // Offset in the original code
+    int length;
+    uint8_t op;
+    int target;     // Index jumped to, or -1
+    bool removed;
+} Instruction;
+
+typedef struct {
+    Instruction* code;
+    int count;
+    int* incoming;  // Jumps landing on each index, recounted every pass;
+                    // retargeting only adds, so it never undercounts
+} Program;
+
+static bool is_jump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_INLINE_GUARD:
+        case OP_JUMP:
+        case OP_FORPREP:
+        case OP_FORLOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Conditional jumps read an unsigned offset and only go forward.
+ */
+static bool is_forward_jump(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_POP_JUMP_IF_FALSE ||
+           op == OP_POP_JUMP_IF_TRUE || op == OP_INLINE_GUARD;
+}
+
+/**
+ * @brief Returns the first instruction at or after index that is still in
+ * the code. Jumps to a removed instruction land there.
+ */
+static int next_kept(Program* program, int index) {
+    while (index < program->count && program->code[index].removed) index++;
+    return index;
+}
+
+static int target_of(Program* program, int index) {
+    return next_kept(program, program->code[index].target);
+}
+
+/**
+ * @brief Splits the code into instructions and resolves jump offsets to
+ * instruction indexes.
+ *
+ * @return false if the code holds an instruction the pass does not know.
+ */
+static bool decode(Chunk* chunk, Program* program) {
+    int* index_at = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    program->code = (Instruction*)malloc(sizeof(Instruction) * (chunk->count + 1));
+    program->count = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instruction_length(chunk->code[offset]);
+        if (length == 0 || offset + length > chunk->count) {
+            free(index_at);
+            return false;
+        }
+        index_at[offset] = program->count;
+        for (int i = 1; i < length; i++) index_at[offset + i] = -1;
+        program->code[program->count++] = (Instruction){offset, length, chunk->code[offset], -1, false};
+        offset += length;
+    }
+    index_at[chunk->count] = program->count;
+
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (!is_jump(instruction->op)) continue;
+        // The offset is the last two bytes, relative to the next instruction
+        int end = instruction->offset + instruction->length;
+        uint16_t raw = (uint16_t)(chunk->code[end - 2] << 8 | chunk->code[end - 1]);
+        int destination = end + (is_forward_jump(instruction->op) ? (int)raw : (int)(int16_t)raw);
+        if (destination < 0 || destination > chunk->count || index_at[destination] < 0) {
+            free(index_at);
+            return false;
+        }
+        instruction->target = index_at[destination];
+    }
+    free(index_at);
+    return true;
+}
+
+static void count_incoming(Program* program) {
+    memset(program->incoming, 0, sizeof(int) * (program->count + 1));
+    for (int i = 0; i < program->count; i++) {
+        if (!program->code[i].removed && program->code[i].target >= 0) {
+            program->incoming[target_of(program, i)]++;
+        }
+    }
+}
+
+/**
+ * @brief Points a jump that lands on another jump at wherever that jump
+ * would send it. A conditional jump only follows a jump that is sure to be
+ * taken: the value it tested is still on the stack, so a JUMP_IF_FALSE
+ * landing on another JUMP_IF_FALSE goes on to its target, and one landing
+ * on a JUMP_IF_TRUE goes on to the instruction after it.
+ */
+static bool thread_jump(Program* program, int index) {
+    Instruction* instruction = &program->code[index];
+    int target = target_of(program, index);
+    if (target == program->count) return false;
+    Instruction* landing = &program->code[target];
+
+    int destination = -1;
+    if (landing->op == OP_JUMP) {
+        destination = target_of(program, target);
+    } else if (instruction->op == OP_JUMP_IF_FALSE || instruction->op == OP_JUMP_IF_TRUE) {
+        if (landing->op == instruction->op) {
+            destination = target_of(program, target);
+        } else if (landing->op == OP_JUMP_IF_FALSE || landing->op == OP_JUMP_IF_TRUE) {
+            destination = next_kept(program, target + 1);
+        }
+    }
+    if (destination < 0 || destination == target || destination == index) return false;
+    if (is_forward_jump(instruction->op) && destination <= index) return false;
+    instruction->target = destination;
+    program->incoming[destination]++;
+    return true;
+}
+
+/**
+ * @brief Rewrites the conditional jumps of if, while and or.
+ *
+ * "JUMP_IF_FALSE L; POP ... L: POP" pops the condition on both paths, so
+ * it becomes "POP_JUMP_IF_FALSE L+1": the POP after the jump goes, and
+ * the one at L goes too once nothing else reaches it. The JUMP_IF_TRUE
+ * of an if laid out from a profile becomes a POP_JUMP_IF_TRUE the same way.
+ *
+ * "JUMP_IF_FALSE L; JUMP M; L:" is what or emits to keep a true left
+ * operand; it becomes "JUMP_IF_TRUE M".
+ */
+static bool fuse_conditional(Program* program, int index) {
+    Instruction* instruction = &program->code[index];
+    if (instruction->op != OP_JUMP_IF_FALSE && instruction->op != OP_JUMP_IF_TRUE) return false;
+    int next = next_kept(program, index + 1);
+    int target = target_of(program, index);
+    if (next == program->count || target == program->count || program->incoming[next] > 0) {
+        return false;
+    }
+
+    if (program->code[next].op == OP_POP && program->code[target].op == OP_POP) {
+        instruction->op = instruction->op == OP_JUMP_IF_FALSE ? OP_POP_JUMP_IF_FALSE : OP_POP_JUMP_IF_TRUE;
+        instruction->target = next_kept(program, target + 1);
+        program->incoming[instruction->target]++;
+        program->code[next].removed = true;
+        return true;
+    }
+
+    if (instruction->op == OP_JUMP_IF_FALSE && program->code[next].op == OP_JUMP &&
+        target == next_kept(program, next + 1)) {
+        int destination = target_of(program, next);
+        if (destination <= index) return false;
+        instruction->op = OP_JUMP_IF_TRUE;
+        instruction->target = destination;
+        program->incoming[destination]++;
+        program->code[next].removed = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Removes everything that cannot be reached from the entry point,
+ * such as the POP left behind an if by fuse_conditional or a JUMP after
+ * a return.
+ */
+static bool remove_unreachable(Program* program) {
+    bool* reached = (bool*)calloc(program->count + 1, sizeof(bool));
+    int* worklist = (int*)malloc(sizeof(int) * (program->count + 1));
+    int pending = 0;
+    worklist[pending++] = next_kept(program, 0);
+    reached[worklist[0]] = true;
+
+    while (pending > 0) {
+        int index = worklist[--pending];
+        if (index == program->count) continue;
+        Instruction* instruction = &program->code[index];
+        int successors[2];
+        int successor_count = 0;
+        if (instruction->op != OP_JUMP && instruction->op != OP_RETURN) {
+            successors[successor_count++] = next_kept(program, index + 1);
+        }
+        if (instruction->target >= 0) {
+            successors[successor_count++] = target_of(program, index);
+        }
+        for (int i = 0; i < successor_count; i++) {
+            if (!reached[successors[i]]) {
+                reached[successors[i]] = true;
+                worklist[pending++] = successors[i];
+            }
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < program->count; i++) {
+        if (!program->code[i].removed && !reached[i]) {
+            program->code[i].removed = true;
+            changed = true;
+        }
+    }
+    free(worklist);
+    free(reached);
+    return changed;
+}
+
+/**
+ * @brief Writes the kept instructions back into the chunk, with their
+ * line numbers and with every jump offset recomputed.
+ *
+ * @return false, leaving the chunk untouched, if an offset no longer fits.
+ */
+static bool encode(Chunk* chunk, Program* program) {
+    int* new_offset = (int*)malloc(sizeof(int) * (program->count + 1));
+    int size = 0;
+    for (int i = 0; i < program->count; i++) {
+        new_offset[i] = size;
+        if (!program->code[i].removed) size += program->code[i].length;
+    }
+    new_offset[program->count] = size;
+
+    uint8_t* code = (uint8_t*)malloc(size > 0 ? size : 1);
+    int* lines = (int*)malloc(sizeof(int) * (size > 0 ? size : 1));
+    for (int i = 0; i < program->count; i++) {
+        Instruction* instruction = &program->code[i];
+        if (instruction->removed) continue;
+        int at = new_offset[i];
+        memcpy(code + at, chunk->code + instruction->offset, instruction->length);
+        memcpy(lines + at, chunk->lines + instruction->offset, sizeof(int) * instruction->length);
+        code[at] = instruction->op;
+        if (instruction->target < 0) continue;
+
+        int end = at + instruction->length;
+        int jump = new_offset[target_of(program, i)] - end;
+        bool fits = is_forward_jump(instruction->op) ? jump >= 0 && jump <= UINT16_MAX
+                                                      : jump >= INT16_MIN && jump <= INT16_MAX;
+        if (!fits) {
+            free(lines);
+            free(code);
+            free(new_offset);
+            return false;
+        }
+        code[end - 2] = ((uint16_t)jump >> 8) & 0xFF;
+        code[end - 1] = (uint16_t)jump & 0xFF;
+    }
+    free(new_offset);
+
+    free(chunk->code);
+    free(chunk->lines);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->count = size;
+    chunk->capacity = size > 0 ? size : 1;
+    return true;
+}
+
+static int kept_count(Program* program) {
+    int count = 0;
+    for (int i = 0; i < program->count; i++) {
+        if (!program->code[i].removed) count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Runs the peephole and jump-threading pass over a finished chunk
+ * and every function defined in it. Jump chains are collapsed, the
+ * conditional jumps of if, while and or are fused with the POP or JUMP
+ * around them, and jumps to the next instruction and unreachable code are
+ * removed. Must run before the chunk is first executed, since quickening
+ * and profiles refer to instruction offsets.
+ *
+ * @param chunk The chunk to optimize in place.
+ * @param stats Receives the instruction counts, which leave out chunks
+ * whose code could not be decoded. May be NULL.
+ */
+void optimize_chunk(Chunk* chunk, PeepholeStats* stats) {
+    for (int i = 0; i < chunk->constants_count; i++) {
+        if (chunk->constants[i].type == VAL_FUNCTION) {
+            optimize_chunk(chunk->constants[i].as.function, stats);
+        }
+    }
+
+    Program program;
+    bool decoded = decode(chunk, &program);
+    int before = program.count;
+    int after = program.count;
+
+    if (decoded && program.count > 0) {
+        program.incoming = (int*)malloc(sizeof(int) * (program.count + 1));
+        for (int pass = 0; pass < PEEPHOLE_MAX_PASSES; pass++) {
+            bool changed = false;
+            count_incoming(&program);
+            for (int i = 0; i < program.count; i++) {
+                if (program.code[i].removed || program.code[i].target < 0) continue;
+                changed |= thread_jump(&program, i);
+                changed |= fuse_conditional(&program, i);
+            }
+            changed |= remove_unreachable(&program);
+
+            // A jump to the next instruction does nothing
+            for (int i = 0; i < program.count; i++) {
+                Instruction* instruction = &program.code[i];
+                if (instruction->removed) continue;
+                bool keeps_stack = instruction->op == OP_JUMP || instruction->op == OP_JUMP_IF_FALSE ||
+                                   instruction->op == OP_JUMP_IF_TRUE;
+                if (keeps_stack && target_of(&program, i) == next_kept(&program, i + 1)) {
+                    instruction->removed = true;
+                    changed = true;
+                }
+            }
+            if (!changed) break;
+        }
+        if (encode(chunk, &program)) {
+            after = kept_count(&program);
+        }
+        free(program.incoming);
+    }
+    free(program.code);
+
+    // Code that did not decode was left as it was, and a count of it
+    // would only cover the instructions before the problem
+    if (stats && decoded) {
+        stats->before += before;
+        stats->after += after;
+    }
+}
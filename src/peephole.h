@@ -0,0 +1,17 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "bytecode.h"
+
+/**
+ * @brief Instruction counts before and after optimization, summed over a
+ * chunk and every function nested in it whose code could be decoded.
+ */
+typedef struct {
+    int before;
+    int after;
+} PeepholeStats;
+
+void optimize_chunk(Chunk* chunk, PeepholeStats* stats);
+
+#endif // PEEPHOLE_H
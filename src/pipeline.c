@@ -0,0 +1,238 @@
+#include "pipeline.h"
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ring sizes in items; both must be powers of two
+#define TOKEN_RING_SIZE 4096
+#define MESSAGE_RING_SIZE 1024
+
+/**
+ * @brief A lock-free queue between exactly one producer thread and one
+ * consumer thread. Each side owns one index and keeps a copy of the
+ * other's, reading the shared index only when its copy says the ring is
+ * full or empty, so the two threads rarely touch the same cache line.
+ */
+typedef struct {
+    _Alignas(64) atomic_size_t head;    // Next slot to write, by the producer
+    size_t known_tail;                  // The producer's copy of tail
+    _Alignas(64) atomic_size_t tail;    // Next slot to read, by the consumer
+    size_t known_head;                  // The consumer's copy of head
+    _Alignas(64) atomic_int closed;     // The consumer stopped reading
+    char* slots;
+    size_t mask;
+} Ring;
+
+/**
+ * @return 1, or 0 if its slots could not be allocated.
+ */
+static int init_ring(Ring* ring, size_t size, size_t item_size) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closed, 0);
+    ring->known_tail = 0;
+    ring->known_head = 0;
+    ring->slots = (char*)malloc(size * item_size);
+    ring->mask = size - 1;
+    return ring->slots != NULL;
+}
+
+/**
+ * @brief Appends an item, waiting while the ring is full.
+ *
+ * @return 1, or 0 without appending if the consumer closed the ring.
+ */
+static inline int ring_push(Ring* ring, const void* item, size_t item_size) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head - ring->known_tail > ring->mask) {
+        ring->known_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->known_tail <= ring->mask) break;
+        if (atomic_load_explicit(&ring->closed, memory_order_relaxed)) return 0;
+        sched_yield();
+    }
+    memcpy(ring->slots + (head & ring->mask) * item_size, item, item_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Removes the oldest item, waiting while the ring is empty. The
+ * producer always ends with an item that tells the consumer to stop.
+ */
+static inline void ring_pop(Ring* ring, void* item, size_t item_size) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail == ring->known_head) {
+        ring->known_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail != ring->known_head) break;
+        sched_yield();
+    }
+    memcpy(item, ring->slots + (tail & ring->mask) * item_size, item_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief What the parser sends the code generator: a new page of nodes,
+ * a top-level statement, or, with neither, the end of the program.
+ */
+typedef struct {
+    struct ASTNode* page;
+    NodeId statement;
+} Message;
+
+/**
+ * @brief The state shared by the three stages.
+ */
+typedef struct {
+    const char* source;
+    Chunk* chunk;
+    Ring tokens;            // Lexer to parser
+    Ring messages;          // Parser to code generator
+    int lexed_all;          // The parser has received TOKEN_EOF
+    Token last_token;
+    int pages_sent;         // Pages of the parser's AST sent so far
+} Pipeline;
+
+/**
+ * @brief The lexer stage: lexes the whole source into the token ring.
+ */
+static void* lex_source(void* argument) {
+    Pipeline* pipeline = (Pipeline*)argument;
+    init_lexer(pipeline->source);
+    Token token;
+    do {
+        token = next_token();
+        if (!ring_push(&pipeline->tokens, &token, sizeof(Token))) break;
+    } while (token.type != TOKEN_EOF);
+    return NULL;
+}
+
+/**
+ * @brief The parser's token source. The parser may ask again after the
+ * end, and keeps getting TOKEN_EOF.
+ */
+static Token receive_token(void* context) {
+    Pipeline* pipeline = (Pipeline*)context;
+    if (!pipeline->lexed_all) {
+        ring_pop(&pipeline->tokens, &pipeline->last_token, sizeof(Token));
+        pipeline->lexed_all = pipeline->last_token.type == TOKEN_EOF;
+    }
+    return pipeline->last_token;
+}
+
+static void send_message(Pipeline* pipeline, struct ASTNode* page, NodeId statement) {
+    Message message = {page, statement};
+    ring_push(&pipeline->messages, &message, sizeof(Message));
+}
+
+/**
+ * @brief The parser's statement sink. The code generator never reads the
+ * parser's page table, which moves as it grows; it gets the pages
+ * themselves, which do not, before the first statement that uses them.
+ */
+static void send_statement(void* context, AST* ast, NodeId statement) {
+    Pipeline* pipeline = (Pipeline*)context;
+    while (pipeline->pages_sent < ast->pages_count) {
+        send_message(pipeline, ast->pages[pipeline->pages_sent++], 0);
+    }
+    send_message(pipeline, NULL, statement);
+}
+
+/**
+ * @brief The code generator stage: generates each statement it receives,
+ * reading the nodes through its own table of the pages sent so far.
+ */
+static void* generate_statements(void* argument) {
+    Pipeline* pipeline = (Pipeline*)argument;
+    AST view = {0};
+    for (;;) {
+        Message message;
+        ring_pop(&pipeline->messages, &message, sizeof(Message));
+        if (message.page != NULL) {
+            if (view.pages_count == view.pages_capacity) {
+                view.pages_capacity = view.pages_capacity < 8 ? 8 : view.pages_capacity * 2;
+                view.pages = (struct ASTNode**)realloc(view.pages, sizeof(struct ASTNode*) * view.pages_capacity);
+            }
+            view.pages[view.pages_count++] = message.page;
+        } else if (message.statement != 0) {
+            generate_top_level(&view, message.statement, pipeline->chunk);
+        } else {
+            break;
+        }
+    }
+    free(view.pages);
+    return NULL;
+}
+
+/**
+ * @brief Compiles on the calling thread alone, as compile() does, for when
+ * the pipeline cannot be set up.
+ */
+static int compile_sequentially(const char* source, Chunk* chunk, int defer_functions) {
+    AST* ast = defer_functions ? parse_deferring_functions(source) : parse(source);
+    if (ast == NULL) return 0;
+    generate_code(ast, chunk);
+    free_ast(ast);
+    return 1;
+}
+
+/**
+ * @brief Compiles source code with lexing, parsing and code generation
+ * running at the same time on three threads: the lexer fills a ring of
+ * tokens for the parser, and each top-level statement is generated while
+ * the parser works on the ones after it. The code is the same as
+ * generate_code's from parse() or parse_deferring_functions(), which are
+ * used instead if the rings cannot be allocated or a thread cannot start.
+ *
+ * @param source The source code to compile.
+ * @param chunk The chunk to write the code to. It must be initialized, and
+ * may hold part of the program after errors.
+ * @param defer_functions Whether to generate each function body on its
+ * first call, in which case the source must outlive the chunk.
+ * @return 1 on success, 0 if there were compile errors.
+ */
+int compile_pipelined(const char* source, Chunk* chunk, int defer_functions) {
+    Pipeline pipeline;
+    pipeline.source = source;
+    pipeline.chunk = chunk;
+    int rings = init_ring(&pipeline.tokens, TOKEN_RING_SIZE, sizeof(Token));
+    rings &= init_ring(&pipeline.messages, MESSAGE_RING_SIZE, sizeof(Message));
+    pipeline.lexed_all = 0;
+    pipeline.pages_sent = 0;
+
+    pthread_t lexer_thread;
+    pthread_t codegen_thread;
+    if (!rings || pthread_create(&lexer_thread, NULL, lex_source, &pipeline) != 0) {
+        free(pipeline.tokens.slots);
+        free(pipeline.messages.slots);
+        return compile_sequentially(source, chunk, defer_functions);
+    }
+    if (pthread_create(&codegen_thread, NULL, generate_statements, &pipeline) != 0) {
+        // The lexer owns the lexer's global state until it stops, which it
+        // does at the end of the source or once the closed ring fills
+        atomic_store_explicit(&pipeline.tokens.closed, 1, memory_order_relaxed);
+        pthread_join(lexer_thread, NULL);
+        free(pipeline.tokens.slots);
+        free(pipeline.messages.slots);
+        return compile_sequentially(source, chunk, defer_functions);
+    }
+
+    ParseStream stream = {receive_token, send_statement, &pipeline, NULL};
+    int compiled = parse_stream(source, &stream, defer_functions) != NULL;
+
+    // The parser stops early after some errors, leaving the lexer waiting
+    atomic_store_explicit(&pipeline.tokens.closed, 1, memory_order_relaxed);
+    send_message(&pipeline, NULL, 0);
+    pthread_join(lexer_thread, NULL);
+    pthread_join(codegen_thread, NULL);
+
+    finish_code(chunk);
+    free_ast(stream.ast);
+    free(pipeline.tokens.slots);
+    free(pipeline.messages.slots);
+    return compiled;
+}
@@ -0,0 +1,8 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "bytecode.h"
+
+int compile_pipelined(const char* source, Chunk* chunk, int defer_functions);
+
+#endif // PIPELINE_H
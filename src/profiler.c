@@ -0,0 +1,340 @@
+#include "profiler.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Sample storage is reserved up front because the SIGPROF handler cannot
+// allocate. The pools are calloc'ed, so untouched pages cost no memory.
+#define PROFILER_MAX_SAMPLES (1 << 20)
+#define PROFILER_MAX_FRAMES (1 << 24)
+
+/**
+ * @brief One frame of a sampled call stack.
+ */
+typedef struct {
+    Chunk* chunk;
+    int line;
+} ProfileFrame;
+
+/**
+ * @brief A sampled call stack, stored as a range of the frame pool ordered
+ * from the outermost frame to the innermost one.
+ */
+typedef struct {
+    int first_frame;
+    int depth;
+} ProfileSample;
+
+static VM* volatile profiled_vm = NULL;
+static ProfileSample* samples = NULL;
+static ProfileFrame* frames = NULL;
+static volatile int sample_count = 0;
+static volatile int frame_count = 0;
+static volatile int dropped_count = 0;
+static int sample_hz = PROFILER_DEFAULT_HZ;
+
+/**
+ * @brief Maps a frame's instruction pointer to a source line. The handler
+ * may interrupt the VM half way through updating a frame, so the offset is
+ * clamped instead of trusted.
+ */
+static int frame_line(CallFrame* frame) {
+    Chunk* chunk = frame->chunk;
+    if (chunk == NULL || chunk->count == 0) return 0;
+    long offset = (long)(frame->ip - chunk->code) - 1;
+    if (offset < 0) offset = 0;
+    if (offset >= chunk->count) offset = chunk->count - 1;
+    return chunk->lines[offset];
+}
+
+static void handle_sigprof(int signal) {
+    VM* vm = profiled_vm;
+    if (vm == NULL) return;
+
+    int depth = vm->frame_count;
+    if (depth <= 0) return;
+    if (depth > FRAMES_MAX) depth = FRAMES_MAX;
+
+    if (sample_count == PROFILER_MAX_SAMPLES || frame_count + depth > PROFILER_MAX_FRAMES) {
+        dropped_count++;
+        return;
+    }
+
+    ProfileSample* sample = &samples[sample_count];
+    sample->first_frame = frame_count;
+    sample->depth = depth;
+    for (int i = 0; i < depth; i++) {
+        frames[frame_count + i].chunk = vm->frames[i].chunk;
+        frames[frame_count + i].line = frame_line(&vm->frames[i]);
+    }
+    frame_count += depth;
+    sample_count++;
+}
+
+static void free_pools(void) {
+    free(samples);
+    free(frames);
+    samples = NULL;
+    frames = NULL;
+}
+
+/**
+ * @brief Starts sampling the given VM on SIGPROF.
+ *
+ * @param vm The VM to sample.
+ * @param hz The number of samples per second of CPU time.
+ * @return 1 on success, 0 on failure.
+ */
+int profiler_start(VM* vm, int hz) {
+    samples = (ProfileSample*)calloc(PROFILER_MAX_SAMPLES, sizeof(ProfileSample));
+    frames = (ProfileFrame*)calloc(PROFILER_MAX_FRAMES, sizeof(ProfileFrame));
+    if (samples == NULL || frames == NULL) {
+        free_pools();
+        return 0;
+    }
+    sample_count = 0;
+    frame_count = 0;
+    dropped_count = 0;
+    sample_hz = hz > 0 ? hz : PROFILER_DEFAULT_HZ;
+    profiled_vm = vm;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        profiled_vm = NULL;
+        free_pools();
+        return 0;
+    }
+
+    long period = 1000000 / sample_hz;
+    if (period == 0) period = 1;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = period / 1000000;
+    timer.it_interval.tv_usec = period % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        signal(SIGPROF, SIG_IGN);
+        profiled_vm = NULL;
+        free_pools();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Stops sampling. The collected samples are kept for profiler_write.
+ */
+void profiler_stop(void) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    profiled_vm = NULL;
+}
+
+static const char* chunk_name(Chunk* chunk) {
+    return chunk->name ? chunk->name : "main";
+}
+
+/**
+ * @brief A row of the flat profile: a function, or a line within one.
+ */
+typedef struct {
+    Chunk* chunk;
+    int line;   // -1 for whole-function rows
+    int self;
+    int total;
+} ProfileRow;
+
+static int compare_rows_by_key(const void* a, const void* b) {
+    const ProfileRow* x = (const ProfileRow*)a;
+    const ProfileRow* y = (const ProfileRow*)b;
+    if (x->chunk != y->chunk) return x->chunk < y->chunk ? -1 : 1;
+    return x->line - y->line;
+}
+
+static int compare_rows_by_samples(const void* a, const void* b) {
+    const ProfileRow* x = (const ProfileRow*)a;
+    const ProfileRow* y = (const ProfileRow*)b;
+    if (x->self != y->self) return y->self - x->self;
+    return y->total - x->total;
+}
+
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * @brief Collapses raw rows into unique (chunk, line) rows, summing counts.
+ *
+ * @return The number of unique rows left at the front of the array.
+ */
+static int merge_rows(ProfileRow* rows, int count) {
+    if (count == 0) return 0;
+    qsort(rows, count, sizeof(ProfileRow), compare_rows_by_key);
+    int unique = 0;
+    for (int i = 1; i < count; i++) {
+        if (rows[i].chunk == rows[unique].chunk && rows[i].line == rows[unique].line) {
+            rows[unique].self += rows[i].self;
+            rows[unique].total += rows[i].total;
+        } else {
+            rows[++unique] = rows[i];
+        }
+    }
+    return unique + 1;
+}
+
+/**
+ * @brief Builds the flat rows. A frame counts toward 'total' once per
+ * sample even when it appears several times in a recursive stack.
+ */
+static int build_rows(ProfileRow* rows, int by_line) {
+    int count = 0;
+    for (int s = 0; s < sample_count; s++) {
+        ProfileFrame* stack = &frames[samples[s].first_frame];
+        int depth = samples[s].depth;
+        for (int i = 0; i < depth; i++) {
+            int line = by_line ? stack[i].line : -1;
+            int seen = 0;
+            for (int j = i + 1; j < depth && !seen; j++) {
+                seen = stack[j].chunk == stack[i].chunk && (!by_line || stack[j].line == line);
+            }
+            if (seen) continue;
+            rows[count].chunk = stack[i].chunk;
+            rows[count].line = line;
+            rows[count].self = i == depth - 1;
+            rows[count].total = 1;
+            count++;
+        }
+    }
+    return merge_rows(rows, count);
+}
+
+static void write_rows(FILE* out, ProfileRow* rows, int count) {
+    qsort(rows, count, sizeof(ProfileRow), compare_rows_by_samples);
+    for (int i = 0; i < count; i++) {
+        char where[256];
+        if (rows[i].line >= 0) {
+            snprintf(where, sizeof(where), "%s:%d", chunk_name(rows[i].chunk), rows[i].line);
+        } else {
+            snprintf(where, sizeof(where), "%s", chunk_name(rows[i].chunk));
+        }
+        fprintf(out, "%6.2f%% %6.2f%% %8d %8d  %s\n",
+                100.0 * rows[i].self / sample_count, 100.0 * rows[i].total / sample_count,
+                rows[i].self, rows[i].total, where);
+    }
+}
+
+/**
+ * @brief Writes folded stacks ("main;f;g 42" per line), the input format of
+ * flamegraph.pl and compatible tools.
+ *
+ * @return 1 on success, 0 with errno set if the file could not be opened
+ * or memory ran out.
+ */
+static int write_folded(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) return 0;
+
+    char** stacks = (char**)malloc(sizeof(char*) * (sample_count > 0 ? sample_count : 1));
+    if (stacks == NULL) {
+        fclose(out);
+        return 0;
+    }
+    for (int s = 0; s < sample_count; s++) {
+        ProfileFrame* stack = &frames[samples[s].first_frame];
+        size_t length = 0;
+        for (int i = 0; i < samples[s].depth; i++) {
+            length += strlen(chunk_name(stack[i].chunk)) + 1;
+        }
+        char* text = (char*)malloc(length + 1);
+        if (text == NULL) {
+            while (s > 0) free(stacks[--s]);
+            free(stacks);
+            fclose(out);
+            return 0;
+        }
+        char* p = text;
+        for (int i = 0; i < samples[s].depth; i++) {
+            if (i > 0) *p++ = ';';
+            size_t n = strlen(chunk_name(stack[i].chunk));
+            memcpy(p, chunk_name(stack[i].chunk), n);
+            p += n;
+        }
+        *p = '\0';
+        stacks[s] = text;
+    }
+
+    qsort(stacks, sample_count, sizeof(char*), compare_strings);
+    for (int s = 0; s < sample_count;) {
+        int run = s + 1;
+        while (run < sample_count && strcmp(stacks[run], stacks[s]) == 0) run++;
+        fprintf(out, "%s %d\n", stacks[s], run - s);
+        s = run;
+    }
+
+    for (int s = 0; s < sample_count; s++) free(stacks[s]);
+    free(stacks);
+    fclose(out);
+    return 1;
+}
+
+/**
+ * @brief Writes the flat profile to the given path and folded stacks to
+ * the same path with ".folded" appended, then releases the samples.
+ *
+ * Must be called while the profiled chunks are still alive.
+ *
+ * @param path The output path.
+ * @return 1 on success, 0 if a file could not be written.
+ */
+int profiler_write(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror("Error writing profile");
+        return 0;
+    }
+
+    fprintf(out, "# %d samples at %d Hz", sample_count, sample_hz);
+    if (dropped_count > 0) fprintf(out, ", %d dropped", dropped_count);
+    fprintf(out, "\n");
+
+    if (sample_count > 0) {
+        ProfileRow* rows = (ProfileRow*)malloc(sizeof(ProfileRow) * frame_count);
+        if (rows == NULL) {
+            perror("Error writing profile");
+            fclose(out);
+            free_pools();
+            return 0;
+        }
+
+        fprintf(out, "\n# Functions\n#  self%%  total%%     self    total  function\n");
+        write_rows(out, rows, build_rows(rows, 0));
+
+        fprintf(out, "\n# Lines\n#  self%%  total%%     self    total  function:line\n");
+        write_rows(out, rows, build_rows(rows, 1));
+
+        free(rows);
+    }
+    fclose(out);
+
+    size_t length = strlen(path);
+    char* folded_path = (char*)malloc(length + sizeof(".folded"));
+    int ok = folded_path != NULL;
+    if (ok) {
+        memcpy(folded_path, path, length);
+        memcpy(folded_path + length, ".folded", sizeof(".folded"));
+        ok = write_folded(folded_path);
+    }
+    if (!ok) perror("Error writing folded stacks");
+    free(folded_path);
+
+    free_pools();
+    return ok;
+}
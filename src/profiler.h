@@ -0,0 +1,12 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "vm.h"
+
+#define PROFILER_DEFAULT_HZ 1000
+
+int profiler_start(VM* vm, int hz);
+void profiler_stop(void);
+int profiler_write(const char* path);
+
+#endif // PROFILER_H
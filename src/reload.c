@@ -0,0 +1,238 @@
+#include "reload.h"
+#include "codegen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+volatile sig_atomic_t reload_requested = 0;
+
+static void handle_sighup(int signal) {
+    (void)signal;
+    reload_requested = 1;
+}
+
+/**
+ * @brief Makes SIGHUP request a reload, which the VM performs at its next
+ * function call.
+ *
+ * @return 1 on success, 0 if the handler could not be installed.
+ */
+int watch_for_reload(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_sighup;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGHUP, &action, NULL) == 0;
+}
+
+/**
+ * @brief Starts tracking a script for reloads.
+ *
+ * @param reloader The reloader to initialize.
+ * @param path The script's file, read again on every reload.
+ * @param source The source the running program was compiled from. It must
+ * stay alive until the reloader is freed.
+ */
+void init_reloader(Reloader* reloader, const char* path, const char* source) {
+    reloader->path = path;
+    reloader->source = source;
+    reloader->versions = NULL;
+    reloader->versions_count = 0;
+    reloader->chunks = NULL;
+    reloader->chunks_count = 0;
+    reloader->functions = NULL;
+    reloader->functions_count = 0;
+    init_table(&reloader->index);
+    reloader->indexed = 0;
+}
+
+static void free_functions(FunctionSource* functions, int count, Table* index) {
+    for (int i = 0; i < count; i++) {
+        free(functions[i].name);
+    }
+    free(functions);
+    free_table(index);
+}
+
+/**
+ * @brief Lists the top-level function definitions of a program and
+ * indexes them by name.
+ *
+ * @param ast The program's AST.
+ * @param functions Receives the definitions, in source order.
+ * @param index Receives, for each name, the position of its last
+ * definition, the one the program ends up with. It must be initialized.
+ * @return The number of definitions.
+ */
+static int collect_functions(AST* ast, FunctionSource** functions, Table* index) {
+    int count = 0;
+    int capacity = 0;
+    *functions = NULL;
+    NodeId id = ast_node(ast, ast->root)->data.statements.statement;
+    for (struct ASTNode* node = ast_node(ast, id); node != NULL; node = ast_node(ast, node->next)) {
+        if (node->type != NODE_FUNCTION_DEF) continue;
+        if (count == capacity) {
+            capacity = capacity < 16 ? 16 : capacity * 2;
+            *functions = (FunctionSource*)realloc(*functions, sizeof(FunctionSource) * capacity);
+        }
+        Span name = ast_node(ast, node->data.function_def.name)->data.identifier_name;
+        FunctionSource* function = &(*functions)[count];
+        function->name = strndup(name.start, name.length);
+        function->source = node->data.function_def.source;
+        function->length = node->data.function_def.length;
+        function->line = node->line;
+        function->node = node->id;
+        table_set(index, function->name, (Value){VAL_INTEGER, {.integer = count}});
+        count++;
+    }
+    return count;
+}
+
+static char* read_source(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* buffer = (char*)malloc(length + 1);
+    length = (long)fread(buffer, 1, length, file);
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+/**
+ * @brief Moves the code of a function whose text did not change to where
+ * it now is in the source, so that its errors report the new lines.
+ *
+ * @return 1, or 0 if its code has to be generated again instead: the lines
+ * of functions among its constants, nested or inlined, move differently.
+ */
+static int move_function(Chunk* function, FunctionSource* now, int delta) {
+    function->line = now->line;
+    if (function->deferred_source != NULL) {
+        function->deferred_source = now->source;
+        function->deferred_line = now->line;
+        return 1;
+    }
+    for (int i = 0; i < function->constants_count; i++) {
+        if (function->constants[i].type == VAL_FUNCTION) return 0;
+    }
+    for (int i = 0; i < function->count; i++) {
+        function->lines[i] += delta;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reloads the script's functions from its file. Each top-level
+ * function whose definition changed, or that is new, gets a new chunk in
+ * its global, compiled on its first call; everything else the program
+ * holds, data and the other functions, stays as it is. A global the
+ * program has since set to something other than the function it defined
+ * is left alone, and so are calls in progress and function values stored
+ * elsewhere, which keep the old code. Top-level statements are not run
+ * again.
+ *
+ * @param reloader The reloader.
+ * @param vm The VM running the program.
+ * @return The number of functions replaced, or -1 after reporting why the
+ * file could not be reloaded, in which case the program is unchanged.
+ */
+int reload(Reloader* reloader, VM* vm) {
+    if (!reloader->indexed) {
+        // Parsed only now so that watching costs nothing until a reload
+        AST* running = parse_deferring_functions(reloader->source);
+        if (running != NULL) {
+            reloader->functions_count = collect_functions(running, &reloader->functions, &reloader->index);
+            free_ast(running);
+        }
+        reloader->indexed = 1;
+    }
+
+    char* source = read_source(reloader->path);
+    if (source == NULL) {
+        fprintf(stderr, "Reload: could not read '%s'.\n", reloader->path);
+        return -1;
+    }
+    if (strcmp(source, reloader->source) == 0) {
+        free(source);
+        fprintf(stderr, "Reload: '%s' has not changed.\n", reloader->path);
+        return 0;
+    }
+    AST* ast = parse_deferring_functions(source);
+    if (ast == NULL) {
+        free(source);
+        fprintf(stderr, "Reload: '%s' has errors; the program keeps running as it was.\n", reloader->path);
+        return -1;
+    }
+
+    FunctionSource* functions;
+    Table index;
+    init_table(&index);
+    int count = collect_functions(ast, &functions, &index);
+    int changed = 0;
+    int moved = 0;
+    for (int i = 0; i < count; i++) {
+        FunctionSource* function = &functions[i];
+        Value last;
+        table_get(&index, function->name, &last);
+        if (last.as.integer != i) continue; // Defined again further down
+
+        Value current;
+        int defined = table_get(&vm->globals, function->name, &current);
+        if (defined && (current.type != VAL_FUNCTION || strcmp(current.as.function->name, function->name) != 0)) {
+            continue;
+        }
+
+        Value previous;
+        if (defined && table_get(&reloader->index, function->name, &previous)) {
+            FunctionSource* old = &reloader->functions[previous.as.integer];
+            if (old->length == function->length && memcmp(old->source, function->source, old->length) == 0) {
+                if (old->line == function->line) continue;
+                if (move_function(current.as.function, function, function->line - old->line)) {
+                    moved++;
+                    continue;
+                }
+            }
+        }
+
+        Chunk* chunk = generate_function_code(ast, function->node);
+        reloader->chunks = (Chunk**)realloc(reloader->chunks, sizeof(Chunk*) * (reloader->chunks_count + 1));
+        reloader->chunks[reloader->chunks_count++] = chunk;
+        // The chunk's name outlives the global, as the chunk is only freed
+        // with the reloader
+        table_set(&vm->globals, chunk->name, (Value){VAL_FUNCTION, {.function = chunk}});
+        changed++;
+    }
+    free_ast(ast);
+
+    free_functions(reloader->functions, reloader->functions_count, &reloader->index);
+    reloader->functions = functions;
+    reloader->functions_count = count;
+    reloader->index = index;
+    reloader->versions = (char**)realloc(reloader->versions, sizeof(char*) * (reloader->versions_count + 1));
+    reloader->versions[reloader->versions_count++] = source;
+    reloader->source = source;
+
+    fprintf(stderr, "Reload: '%s': replaced %d functions and moved %d of %d.\n", reloader->path, changed, moved, count);
+    return changed;
+}
+
+/**
+ * @brief Frees a reloader with the sources and chunks its reloads made.
+ * Call it after the VM is freed, as its globals may point at them.
+ */
+void free_reloader(Reloader* reloader) {
+    free_functions(reloader->functions, reloader->functions_count, &reloader->index);
+    for (int i = 0; i < reloader->chunks_count; i++) {
+        free_chunk(reloader->chunks[i]);
+        free(reloader->chunks[i]);
+    }
+    free(reloader->chunks);
+    for (int i = 0; i < reloader->versions_count; i++) {
+        free(reloader->versions[i]);
+    }
+    free(reloader->versions);
+}
@@ -0,0 +1,44 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <signal.h>
+#include "vm.h"
+#include "parser.h"
+
+/**
+ * @brief A top-level function definition in one version of a script.
+ */
+typedef struct {
+    char* name;
+    const char* source;     // From 'function' through 'end'
+    int length;
+    int line;
+    NodeId node;            // Only valid while its AST is
+} FunctionSource;
+
+/**
+ * @brief A running script's source file, from which the functions that
+ * changed since it was loaded can be reloaded.
+ */
+typedef struct Reloader {
+    const char* path;
+    const char* source;         // The version running now
+    char** versions;            // Loaded by reloads; lazily compiled bodies point into them
+    int versions_count;
+    Chunk** chunks;             // Made by reloads
+    int chunks_count;
+    FunctionSource* functions;  // The top-level definitions of source
+    int functions_count;
+    Table index;                // Function name to its last definition in functions
+    int indexed;                // functions and index describe source
+} Reloader;
+
+// Set by SIGHUP once watch_for_reload has been called
+extern volatile sig_atomic_t reload_requested;
+
+void init_reloader(Reloader* reloader, const char* path, const char* source);
+int watch_for_reload(void);
+int reload(Reloader* reloader, VM* vm);
+void free_reloader(Reloader* reloader);
+
+#endif // RELOAD_H
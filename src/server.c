@@ -0,0 +1,566 @@
+#include "server.h"
+#include "vm.h"
+#include "verifier.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/**
+ * @brief A compiled program kept alive between requests.
+ */
+typedef struct {
+    char* key;      // Absolute path, or the source text for source requests.
+    int is_path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    Chunk* chunk;   // NULL if the program failed to compile.
+    char* errors;   // Compile errors captured from stderr.
+    size_t errors_length;
+    unsigned long last_used;
+} CacheEntry;
+
+static CacheEntry cache[SERVER_CACHE_MAX];
+static int cache_count = 0;
+static unsigned long cache_clock = 0;
+
+static int exit_code(InterpretResult result) {
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static int write_all(int fd, const void* data, size_t length) {
+    const char* p = (const char*)data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static int read_all(int fd, void* data, size_t length) {
+    char* p = (char*)data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static int send_frame(int fd, char tag, const void* data, uint32_t length) {
+    char header[5];
+    uint32_t be = htonl(length);
+    header[0] = tag;
+    memcpy(header + 1, &be, 4);
+    return write_all(fd, header, 5) && write_all(fd, data, length);
+}
+
+/**
+ * @brief Reads one frame. The payload is NUL-terminated for convenience.
+ *
+ * @return 1 on success, 0 on EOF or error, or -1 if the payload is longer
+ * than SERVER_FRAME_MAX or could not be allocated, in which case it is
+ * left unread.
+ */
+static int read_frame(int fd, char* tag, char** payload, uint32_t* length) {
+    char header[5];
+    if (!read_all(fd, header, 5)) return 0;
+    uint32_t be;
+    memcpy(&be, header + 1, 4);
+    *tag = header[0];
+    *length = ntohl(be);
+    if (*length > SERVER_FRAME_MAX) return -1;
+    *payload = (char*)malloc(*length + 1);
+    if (*payload == NULL) return -1;
+    if (!read_all(fd, *payload, *length)) {
+        free(*payload);
+        return 0;
+    }
+    (*payload)[*length] = '\0';
+    return 1;
+}
+
+static int send_exit(int fd, int status) {
+    uint32_t be = htonl((uint32_t)status);
+    return send_frame(fd, SERVER_FRAME_EXIT, &be, 4);
+}
+
+/**
+ * @brief Reads a script for the cache.
+ *
+ * @return The source, or NULL with errno set if the path cannot be read,
+ * is not a regular file (fopen opens directories too) or does not fit in
+ * memory.
+ */
+static char* read_file(const char* path, struct stat* st) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+    if (fstat(fileno(file), st) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        fclose(file);
+        errno = S_ISDIR(st->st_mode) ? EISDIR : EINVAL;
+        return NULL;
+    }
+
+    char* buffer = (char*)malloc(st->st_size + 1);
+    if (buffer == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t length = fread(buffer, 1, st->st_size, file);
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+static void release_entry(CacheEntry* entry) {
+    if (entry->chunk) {
+        free_chunk(entry->chunk);
+        free(entry->chunk);
+    }
+    free(entry->key);
+    free(entry->errors);
+    memset(entry, 0, sizeof(CacheEntry));
+}
+
+/**
+ * @brief Returns a free cache slot, evicting the least recently used entry
+ * when the cache is full.
+ */
+static CacheEntry* allocate_entry() {
+    if (cache_count < SERVER_CACHE_MAX) return &cache[cache_count++];
+
+    CacheEntry* victim = &cache[0];
+    for (int i = 1; i < cache_count; i++) {
+        if (cache[i].last_used < victim->last_used) victim = &cache[i];
+    }
+    release_entry(victim);
+    return victim;
+}
+
+/**
+ * @brief Compiles source into a cache entry, capturing anything the
+ * compiler reports on stderr so it can be forwarded to the client.
+ */
+static void compile_entry(CacheEntry* entry, const char* source) {
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    FILE* capture = tmpfile();
+    if (capture) dup2(fileno(capture), STDERR_FILENO);
+
+    entry->chunk = (Chunk*)malloc(sizeof(Chunk));
+    init_chunk(entry->chunk);
+    // Every body is compiled now: the source is freed, and children
+    // forked per request would each compile them again
+    // Verified once here rather than in every child
+    if (!compile(source, entry->chunk, NULL, COMPILE_EAGER) || !verify_program(entry->chunk)) {
+        free_chunk(entry->chunk);
+        free(entry->chunk);
+        entry->chunk = NULL;
+    }
+
+    fflush(stderr);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+
+    if (capture) {
+        long length = ftell(capture);
+        if (length > 0) {
+            entry->errors = (char*)malloc(length);
+            rewind(capture);
+            entry->errors_length = fread(entry->errors, 1, length, capture);
+        }
+        fclose(capture);
+    }
+}
+
+/**
+ * @brief Looks up the compiled program for a request, compiling it on a
+ * miss. Path entries are revalidated against the file's inode, size and
+ * modification time so edited scripts are picked up.
+ *
+ * @return The cache entry, or NULL if the script could not be read.
+ */
+static CacheEntry* lookup_program(char kind, const char* payload) {
+    int is_path = kind == SERVER_REQUEST_PATH;
+    struct stat st;
+    if (is_path && stat(payload, &st) != 0) return NULL;
+
+    for (int i = 0; i < cache_count; i++) {
+        CacheEntry* entry = &cache[i];
+        if (entry->is_path != is_path || strcmp(entry->key, payload) != 0) continue;
+        if (is_path && (entry->dev != st.st_dev || entry->ino != st.st_ino ||
+                        entry->size != st.st_size ||
+                        entry->mtime.tv_sec != st.st_mtim.tv_sec ||
+                        entry->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+            release_entry(entry);
+            entry->key = strdup(payload);
+            entry->is_path = 1;
+            char* source = read_file(payload, &st);
+            if (!source) {
+                // Keep the slot well-formed; it simply never matches again.
+                entry->size = -1;
+                return NULL;
+            }
+            entry->dev = st.st_dev;
+            entry->ino = st.st_ino;
+            entry->size = st.st_size;
+            entry->mtime = st.st_mtim;
+            compile_entry(entry, source);
+            free(source);
+        }
+        entry->last_used = ++cache_clock;
+        return entry;
+    }
+
+    char* source = NULL;
+    if (is_path) {
+        source = read_file(payload, &st);
+        if (!source) return NULL;
+    }
+
+    CacheEntry* entry = allocate_entry();
+    entry->key = strdup(payload);
+    entry->is_path = is_path;
+    if (is_path) {
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+    }
+    compile_entry(entry, is_path ? source : payload);
+    free(source);
+    entry->last_used = ++cache_clock;
+    return entry;
+}
+
+/**
+ * @brief Runs a compiled program in a child forked from the warm server
+ * process and relays its stdout and stderr to the client as frames.
+ *
+ * @return The exit status of the program.
+ */
+static int run_program(VM* vm, int client, Chunk* chunk) {
+    int out_pipe[2], err_pipe[2];
+    if (pipe(out_pipe) != 0) return 70;
+    if (pipe(err_pipe) != 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return 70;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        close(err_pipe[0]);
+        close(err_pipe[1]);
+        return 70;
+    }
+
+    if (pid == 0) {
+        close(client);
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(err_pipe[1], STDERR_FILENO);
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+        signal(SIGPIPE, SIG_DFL);
+
+        InterpretResult result = interpret_chunk(vm, chunk);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(exit_code(result));
+    }
+
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    struct pollfd fds[2] = {
+        {out_pipe[0], POLLIN, 0},
+        {err_pipe[0], POLLIN, 0},
+    };
+    const char tags[2] = {SERVER_FRAME_STDOUT, SERVER_FRAME_STDERR};
+    int open_count = 2;
+    int client_alive = 1;
+    char buffer[16384];
+
+    while (open_count > 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+            ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_count--;
+                continue;
+            }
+            if (client_alive && !send_frame(client, tags[i], buffer, n)) {
+                // The client went away; there is nobody left to run for.
+                client_alive = 0;
+                kill(pid, SIGKILL);
+            }
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (fds[i].fd >= 0) close(fds[i].fd);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+}
+
+/**
+ * @brief Runs a program for a client in a process forked for the
+ * connection, so the server can accept the next one while it runs.
+ */
+static void start_program(VM* vm, int listener, int client, Chunk* chunk) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        const char message[] = "Could not start the program.\n";
+        send_frame(client, SERVER_FRAME_STDERR, message, sizeof(message) - 1);
+        send_exit(client, 70);
+        return;
+    }
+    if (pid == 0) {
+        close(listener);
+        // run_program waits for the program's own process
+        signal(SIGCHLD, SIG_DFL);
+        send_exit(client, run_program(vm, client, chunk));
+        _exit(0);
+    }
+}
+
+/**
+ * @brief Answers one connection. The request is read and compiled here, so
+ * the cache stays in the server process; only the run happens elsewhere.
+ */
+static void handle_client(VM* vm, int listener, int client) {
+    char kind;
+    char* payload;
+    uint32_t length;
+    // A client that connects but never sends must not stall the others
+    struct timeval timeout = {SERVER_REQUEST_TIMEOUT, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int status = read_frame(client, &kind, &payload, &length);
+    if (status < 0) {
+        const char message[] = "Request too large.\n";
+        send_frame(client, SERVER_FRAME_STDERR, message, sizeof(message) - 1);
+        send_exit(client, 64);
+        return;
+    }
+    if (status == 0) return;
+
+    if (kind != SERVER_REQUEST_PATH && kind != SERVER_REQUEST_SOURCE) {
+        const char message[] = "Unknown request.\n";
+        send_frame(client, SERVER_FRAME_STDERR, message, sizeof(message) - 1);
+        send_exit(client, 64);
+        free(payload);
+        return;
+    }
+
+    CacheEntry* entry = lookup_program(kind, payload);
+    if (entry == NULL) {
+        char message[512];
+        int n = snprintf(message, sizeof(message), "Error opening file: %s\n", strerror(errno));
+        send_frame(client, SERVER_FRAME_STDERR, message, n);
+        send_exit(client, 1);
+    } else if (entry->chunk == NULL) {
+        if (entry->errors_length > 0) {
+            send_frame(client, SERVER_FRAME_STDERR, entry->errors, entry->errors_length);
+        }
+        send_exit(client, exit_code(INTERPRET_COMPILE_ERROR));
+    } else {
+        start_program(vm, listener, client, entry->chunk);
+    }
+    free(payload);
+}
+
+/**
+ * @brief Runs the compile server on a Unix domain socket.
+ *
+ * Each connection carries one request. Programs are compiled once and
+ * cached; every run happens in a child forked from this process, so it
+ * starts from an already initialized VM and gets a clean set of globals.
+ * Runs go on concurrently: each connection gets its own process to relay
+ * the program's output, and the server goes back to accepting at once.
+ * Compiling a program the cache does not hold still happens in the
+ * server, one request at a time.
+ *
+ * @param socket_path The path of the socket to listen on.
+ * @return The process exit status.
+ */
+int serve(const char* socket_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Error creating socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        perror("Error binding socket");
+        close(listener);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    // Connection processes are never waited for, so let them be reaped
+    signal(SIGCHLD, SIG_IGN);
+
+    VM vm;
+    init_vm(&vm);
+
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            perror("Error accepting connection");
+            break;
+        }
+        handle_client(&vm, listener, client);
+        close(client);
+    }
+
+    for (int i = 0; i < cache_count; i++) {
+        release_entry(&cache[i]);
+    }
+    free_vm(&vm);
+    close(listener);
+    unlink(socket_path);
+    return 1;
+}
+
+/**
+ * @brief Asks a running server to execute a script and replays its output.
+ *
+ * @param socket_path The path of the server socket.
+ * @param script_path The script to run, or "-" to send stdin as source.
+ * @return The exit status of the script.
+ */
+int run_client(const char* socket_path, const char* script_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("Error connecting to server");
+        close(fd);
+        return 1;
+    }
+
+    int sent;
+    if (strcmp(script_path, "-") == 0) {
+        size_t capacity = 4096, length = 0;
+        char* source = (char*)malloc(capacity);
+        size_t n;
+        while ((n = fread(source + length, 1, capacity - length, stdin)) > 0) {
+            length += n;
+            if (length == capacity) {
+                capacity *= 2;
+                source = (char*)realloc(source, capacity);
+            }
+        }
+        if (length > SERVER_FRAME_MAX) {
+            fprintf(stderr, "Script too large for the server.\n");
+            free(source);
+            close(fd);
+            return 1;
+        }
+        sent = send_frame(fd, SERVER_REQUEST_SOURCE, source, length);
+        free(source);
+    } else {
+        char* resolved = realpath(script_path, NULL);
+        if (!resolved) {
+            perror("Error opening file");
+            close(fd);
+            return 1;
+        }
+        sent = send_frame(fd, SERVER_REQUEST_PATH, resolved, strlen(resolved));
+        free(resolved);
+    }
+    if (!sent) {
+        perror("Error sending request");
+        close(fd);
+        return 1;
+    }
+
+    int status = 1;
+    char tag;
+    char* payload;
+    uint32_t length;
+    while (read_frame(fd, &tag, &payload, &length) > 0) {
+        if (tag == SERVER_FRAME_STDOUT) {
+            fwrite(payload, 1, length, stdout);
+        } else if (tag == SERVER_FRAME_STDERR) {
+            fflush(stdout);
+            fwrite(payload, 1, length, stderr);
+        } else if (tag == SERVER_FRAME_EXIT && length == 4) {
+            uint32_t be;
+            memcpy(&be, payload, 4);
+            status = (int)ntohl(be);
+            free(payload);
+            break;
+        }
+        free(payload);
+    }
+
+    close(fd);
+    return status;
+}
@@ -0,0 +1,26 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Wire protocol shared by the server and the thin client.
+//
+// Request (client -> server):  1 tag byte, 4 byte big-endian length, payload.
+// Response (server -> client): a sequence of frames with the same layout,
+// terminated by a single SERVER_FRAME_EXIT frame.
+#define SERVER_REQUEST_PATH   'P'   // Payload is an absolute script path.
+#define SERVER_REQUEST_SOURCE 'S'   // Payload is the script source itself.
+
+#define SERVER_FRAME_STDOUT   'O'
+#define SERVER_FRAME_STDERR   'E'
+#define SERVER_FRAME_EXIT     'X'   // Payload is the 4 byte exit status.
+
+#define SERVER_CACHE_MAX 64
+// Longest frame payload either side accepts; a request claiming more is
+// answered with an error without reading it
+#define SERVER_FRAME_MAX (16 * 1024 * 1024)
+// Seconds a client has to send its request before the server hangs up
+#define SERVER_REQUEST_TIMEOUT 5
+
+int serve(const char* socket_path);
+int run_client(const char* socket_path, const char* script_path);
+
+#endif // SERVER_H
@@ -0,0 +1,243 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_TOP_PAIRS 20
+
+void init_stats(VMStats* stats) {
+    memset(stats, 0, sizeof(VMStats));
+    stats->previous = -1;
+}
+
+void free_stats(VMStats* stats) {
+    free(stats->functions);
+    init_stats(stats);
+}
+
+static uint32_t hash_pointer(const void* pointer) {
+    uintptr_t value = (uintptr_t)pointer;
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return (uint32_t)value;
+}
+
+static FunctionStats* find_function(FunctionStats* functions, int capacity, Chunk* chunk) {
+    uint32_t index = hash_pointer(chunk) % capacity;
+    for (;;) {
+        FunctionStats* entry = &functions[index];
+        if (entry->chunk == NULL || entry->chunk == chunk) {
+            return entry;
+        }
+        index = (index + 1) % capacity;
+    }
+}
+
+/**
+ * @brief Counts a call of the given function.
+ *
+ * @param stats The statistics to update.
+ * @param chunk The function being called.
+ */
+void stats_record_call(VMStats* stats, Chunk* chunk) {
+    if (stats->functions_count + 1 > stats->functions_capacity * 0.75) {
+        int capacity = stats->functions_capacity < 8 ? 8 : stats->functions_capacity * 2;
+        FunctionStats* functions = (FunctionStats*)calloc(capacity, sizeof(FunctionStats));
+        for (int i = 0; i < stats->functions_capacity; i++) {
+            if (stats->functions[i].chunk == NULL) continue;
+            *find_function(functions, capacity, stats->functions[i].chunk) = stats->functions[i];
+        }
+        free(stats->functions);
+        stats->functions = functions;
+        stats->functions_capacity = capacity;
+    }
+
+    FunctionStats* entry = find_function(stats->functions, stats->functions_capacity, chunk);
+    if (entry->chunk == NULL) {
+        entry->chunk = chunk;
+        stats->functions_count++;
+    }
+    entry->calls++;
+}
+
+typedef struct {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} PairCount;
+
+static int compare_counts_desc(uint64_t a, uint64_t b) {
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+static VMStats* sorting_stats;
+
+static int compare_opcode_counts(const void* a, const void* b) {
+    uint8_t x = *(const uint8_t*)a;
+    uint8_t y = *(const uint8_t*)b;
+    int order = compare_counts_desc(sorting_stats->opcodes[x], sorting_stats->opcodes[y]);
+    return order != 0 ? order : x - y;
+}
+
+static int compare_pairs(const void* a, const void* b) {
+    const PairCount* x = (const PairCount*)a;
+    const PairCount* y = (const PairCount*)b;
+    return compare_counts_desc(x->count, y->count);
+}
+
+static int compare_functions(const void* a, const void* b) {
+    return compare_counts_desc(((const FunctionStats*)a)->calls, ((const FunctionStats*)b)->calls);
+}
+
+/**
+ * @brief Returns the executed opcodes sorted by count, most frequent first.
+ */
+static int sorted_opcodes(VMStats* stats, uint8_t* opcodes) {
+    int count = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (stats->opcodes[op] > 0) opcodes[count++] = (uint8_t)op;
+    }
+    sorting_stats = stats;
+    qsort(opcodes, count, sizeof(uint8_t), compare_opcode_counts);
+    return count;
+}
+
+/**
+ * @brief Returns the executed opcode pairs sorted by count. The caller
+ * frees the array.
+ */
+static PairCount* sorted_pairs(VMStats* stats, int* count) {
+    PairCount* pairs = (PairCount*)malloc(sizeof(PairCount) * OP_COUNT * OP_COUNT);
+    *count = 0;
+    for (int a = 0; a < OP_COUNT; a++) {
+        for (int b = 0; b < OP_COUNT; b++) {
+            if (stats->pairs[a][b] == 0) continue;
+            pairs[*count].first = (uint8_t)a;
+            pairs[*count].second = (uint8_t)b;
+            pairs[*count].count = stats->pairs[a][b];
+            (*count)++;
+        }
+    }
+    qsort(pairs, *count, sizeof(PairCount), compare_pairs);
+    return pairs;
+}
+
+/**
+ * @brief Returns the called functions sorted by call count. The caller
+ * frees the array.
+ */
+static FunctionStats* sorted_functions(VMStats* stats) {
+    FunctionStats* functions = (FunctionStats*)malloc(sizeof(FunctionStats) * (stats->functions_count + 1));
+    int count = 0;
+    for (int i = 0; i < stats->functions_capacity; i++) {
+        if (stats->functions[i].chunk != NULL) functions[count++] = stats->functions[i];
+    }
+    qsort(functions, count, sizeof(FunctionStats), compare_functions);
+    return functions;
+}
+
+static const char* function_name(Chunk* chunk) {
+    return chunk->name ? chunk->name : "main";
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+/**
+ * @brief Prints a human-readable report, with every table sorted by count.
+ *
+ * @param stream The stream to print to.
+ * @param stats The statistics to report.
+ */
+void print_stats(FILE* stream, VMStats* stats) {
+    fprintf(stream, "== Execution statistics ==\n");
+    fprintf(stream, "Instructions executed: %llu\n", (unsigned long long)stats->instructions);
+
+    uint8_t opcodes[OP_COUNT];
+    int opcode_count = sorted_opcodes(stats, opcodes);
+    fprintf(stream, "\nOpcodes:\n");
+    for (int i = 0; i < opcode_count; i++) {
+        uint64_t count = stats->opcodes[opcodes[i]];
+        fprintf(stream, "  %-18s %12llu %6.2f%%\n", opcode_name(opcodes[i]),
+                (unsigned long long)count, percent(count, stats->instructions));
+    }
+
+    int pair_count;
+    PairCount* pairs = sorted_pairs(stats, &pair_count);
+    fprintf(stream, "\nTop opcode pairs:\n");
+    uint64_t pair_total = stats->instructions > 0 ? stats->instructions - 1 : 0;
+    for (int i = 0; i < pair_count && i < STATS_TOP_PAIRS; i++) {
+        fprintf(stream, "  %-18s %-18s %12llu %6.2f%%\n", opcode_name(pairs[i].first),
+                opcode_name(pairs[i].second), (unsigned long long)pairs[i].count,
+                percent(pairs[i].count, pair_total));
+    }
+    free(pairs);
+
+    FunctionStats* functions = sorted_functions(stats);
+    fprintf(stream, "\nCalls per function:\n");
+    for (int i = 0; i < stats->functions_count; i++) {
+        fprintf(stream, "  %-18s %12llu\n", function_name(functions[i].chunk),
+                (unsigned long long)functions[i].calls);
+    }
+    free(functions);
+
+    fprintf(stream, "\nGlobals: %llu reads (%llu misses), %llu writes (%llu new keys, %llu resizes)\n",
+            (unsigned long long)stats->global_reads, (unsigned long long)stats->global_misses,
+            (unsigned long long)stats->global_writes, (unsigned long long)stats->global_inserts,
+            (unsigned long long)stats->global_resizes);
+    fprintf(stream, "Allocations: %llu (%llu bytes)\n",
+            (unsigned long long)stats->allocations, (unsigned long long)stats->allocated_bytes);
+}
+
+static void print_json_string(FILE* stream, const char* text) {
+    fputc('"', stream);
+    for (const char* p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', stream);
+        fputc(*p, stream);
+    }
+    fputc('"', stream);
+}
+
+/**
+ * @brief Prints the statistics as a single JSON object.
+ *
+ * @param stream The stream to print to.
+ * @param stats The statistics to report.
+ */
+void print_stats_json(FILE* stream, VMStats* stats) {
+    fprintf(stream, "{\"instructions\": %llu, \"opcodes\": {", (unsigned long long)stats->instructions);
+
+    uint8_t opcodes[OP_COUNT];
+    int opcode_count = sorted_opcodes(stats, opcodes);
+    for (int i = 0; i < opcode_count; i++) {
+        fprintf(stream, "%s\"%s\": %llu", i > 0 ? ", " : "", opcode_name(opcodes[i]),
+                (unsigned long long)stats->opcodes[opcodes[i]]);
+    }
+
+    int pair_count;
+    PairCount* pairs = sorted_pairs(stats, &pair_count);
+    fprintf(stream, "}, \"pairs\": [");
+    for (int i = 0; i < pair_count; i++) {
+        fprintf(stream, "%s[\"%s\", \"%s\", %llu]", i > 0 ? ", " : "", opcode_name(pairs[i].first),
+                opcode_name(pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+    free(pairs);
+
+    FunctionStats* functions = sorted_functions(stats);
+    fprintf(stream, "], \"calls\": [");
+    for (int i = 0; i < stats->functions_count; i++) {
+        fprintf(stream, "%s[", i > 0 ? ", " : "");
+        print_json_string(stream, function_name(functions[i].chunk));
+        fprintf(stream, ", %llu]", (unsigned long long)functions[i].calls);
+    }
+    free(functions);
+
+    fprintf(stream, "], \"globals\": {\"reads\": %llu, \"misses\": %llu, \"writes\": %llu, "
+            "\"inserts\": %llu, \"resizes\": %llu}",
+            (unsigned long long)stats->global_reads, (unsigned long long)stats->global_misses,
+            (unsigned long long)stats->global_writes, (unsigned long long)stats->global_inserts,
+            (unsigned long long)stats->global_resizes);
+    fprintf(stream, ", \"allocations\": {\"count\": %llu, \"bytes\": %llu}}\n",
+            (unsigned long long)stats->allocations, (unsigned long long)stats->allocated_bytes);
+}
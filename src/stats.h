@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "bytecode.h"
+
+/**
+ * @brief Per-function call counter, keyed by chunk.
+ */
+typedef struct {
+    Chunk* chunk;
+    uint64_t calls;
+} FunctionStats;
+
+/**
+ * @brief Execution statistics collected by the VM when --stats is given.
+ */
+typedef struct VMStats {
+    uint64_t instructions;
+    uint64_t opcodes[OP_COUNT];
+    uint64_t pairs[OP_COUNT][OP_COUNT];
+    int previous;   // Previous opcode, or -1 before the first one
+
+    FunctionStats* functions;   // Open-addressed by chunk pointer
+    int functions_count;
+    int functions_capacity;
+
+    uint64_t global_reads;
+    uint64_t global_misses;
+    uint64_t global_writes;
+    uint64_t global_inserts;
+    uint64_t global_resizes;
+
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} VMStats;
+
+void init_stats(VMStats* stats);
+void free_stats(VMStats* stats);
+void stats_record_call(VMStats* stats, Chunk* chunk);
+void print_stats(FILE* stream, VMStats* stats);
+void print_stats_json(FILE* stream, VMStats* stats);
+
+/**
+ * @brief Counts one executed instruction and the pair it forms with the
+ * previous one. Kept inline since it runs once per dispatch.
+ */
+static inline void stats_record_instruction(VMStats* stats, uint8_t instruction) {
+    stats->instructions++;
+    stats->opcodes[instruction]++;
+    if (stats->previous >= 0) stats->pairs[stats->previous][instruction]++;
+    stats->previous = instruction;
+}
+
+#endif // STATS_H
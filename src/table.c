@@ -44,10 +44,13 @@ static void adjust_capacity(Table* table, int capacity) {
         entries[i].value.as.number = 0;
     }
 
-    for (int i = 0; i < table->count; i++) {
-        Entry* dest = find_entry(entries, capacity, table->entries[i].key);
-        dest->key = table->entries[i].key;
-        dest->value = table->entries[i].value;
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+
+        Entry* dest = find_entry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
     }
 
     free(table->entries);
@@ -1,12 +1,136 @@
 #include "value.h"
 #include "bytecode.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * @brief Writes the decimal digits of an unsigned integer, two at a time.
+ *
+ * @return The number of characters written.
+ */
+static int format_unsigned(char* buffer, uint64_t value) {
+    char digits[20];
+    int start = sizeof(digits);
+    while (value >= 100) {
+        int pair = (int)(value % 100) * 2;
+        value /= 100;
+        digits[--start] = digit_pairs[pair + 1];
+        digits[--start] = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        digits[--start] = digit_pairs[value * 2 + 1];
+        digits[--start] = digit_pairs[value * 2];
+    } else {
+        digits[--start] = (char)('0' + value);
+    }
+    int length = sizeof(digits) - start;
+    memcpy(buffer, digits + start, length);
+    return length;
+}
+
+/**
+ * @brief Formats an integer in decimal, without going through stdio.
+ *
+ * @param buffer Receives the text. It must hold NUMBER_FORMAT_MAX bytes.
+ * @param integer The integer.
+ * @return The length of the text, which is not NUL-terminated.
+ */
+int format_integer(char* buffer, int64_t integer) {
+    if (integer < 0) {
+        buffer[0] = '-';
+        return 1 + format_unsigned(buffer + 1, 0 - (uint64_t)integer);
+    }
+    return format_unsigned(buffer, (uint64_t)integer);
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+
+/**
+ * @brief Formats a float the way Lua 5.3 prints it: "%.14g", plus ".0"
+ * when the result would otherwise read as an integer.
+ *
+ * snprintf is only the fallback. Every float in [1e-4, 1e14) that is
+ * exactly some decimal with at most 14 significant digits, meaning that
+ * decimal rounds to it, prints as that decimal under "%.14g". The
+ * shortest such decimal is found by scaling by 10^k until the product is
+ * an integer that converts back to the same float; it is then written
+ * with the integer formatter. This covers integral floats and the short
+ * fractions that make up most printed output.
+ *
+ * @param buffer Receives the text. It must hold NUMBER_FORMAT_MAX bytes.
+ * @param number The float.
+ * @return The length of the text, which is not NUL-terminated.
+ */
+int format_float(char* buffer, double number) {
+    double magnitude = fabs(number);
+    if (magnitude >= 1e-4 && magnitude < 1e14) {
+        for (int scale = 0; scale < (int)(sizeof(powers_of_ten) / sizeof(powers_of_ten[0])); scale++) {
+            double scaled = magnitude * powers_of_ten[scale];
+            if (scaled >= 1e14) break;
+            if (scaled != floor(scaled) || scaled / powers_of_ten[scale] != magnitude) continue;
+
+            char digits[NUMBER_FORMAT_MAX];
+            int count = format_unsigned(digits, (uint64_t)scaled);
+            int length = 0;
+            if (number < 0) buffer[length++] = '-';
+            if (scale == 0) {
+                memcpy(buffer + length, digits, count);
+                length += count;
+                buffer[length++] = '.';
+                buffer[length++] = '0';
+                return length;
+            }
+            if (count <= scale) {
+                // 0.000ddd
+                buffer[length++] = '0';
+                buffer[length++] = '.';
+                memset(buffer + length, '0', scale - count);
+                length += scale - count;
+                memcpy(buffer + length, digits, count);
+                length += count;
+            } else {
+                memcpy(buffer + length, digits, count - scale);
+                length += count - scale;
+                buffer[length++] = '.';
+                memcpy(buffer + length, digits + count - scale, scale);
+                length += scale;
+            }
+            while (buffer[length - 1] == '0') length--;
+            return length;
+        }
+    } else if (number == 0) {
+        const char* zero = signbit(number) ? "-0.0" : "0.0";
+        int length = (int)strlen(zero);
+        memcpy(buffer, zero, length);
+        return length;
+    }
+
+    int length = snprintf(buffer, NUMBER_FORMAT_MAX, "%.14g", number);
+    if (buffer[strspn(buffer, "-0123456789")] == '\0') {
+        buffer[length++] = '.';
+        buffer[length++] = '0';
+    }
+    return length;
+}
 
 void print_value_to_stream(FILE* stream, Value value) {
+    char buffer[NUMBER_FORMAT_MAX];
     switch (value.type) {
         case VAL_NUMBER:
-            fprintf(stream, "%f", value.as.number);
+            fwrite(buffer, 1, format_float(buffer, value.as.number), stream);
+            break;
+        case VAL_INTEGER:
+            fwrite(buffer, 1, format_integer(buffer, value.as.integer), stream);
             break;
         case VAL_STRING:
             fprintf(stream, "%s", value.as.string);
@@ -23,13 +147,12 @@ void print_value_to_stream(FILE* stream, Value value) {
         case VAL_FUNCTION:
             fprintf(stream, "<function>");
             break;
+        case VAL_TABLE:
+            fprintf(stream, "table: %p", (void*)value.as.table);
+            break;
     }
 }
 
-void print_value(Value value) {
-    print_value_to_stream(stdout, value);
-}
-
 void free_value(Value value) {
     if (value.type == VAL_FUNCTION) {
         free_chunk(value.as.function);
@@ -38,3 +161,88 @@ void free_value(Value value) {
         free(value.as.string);
     }
 }
+
+/**
+ * @brief Orders an integer against a float without rounding the integer,
+ * which a plain conversion to double would do above 2^53.
+ *
+ * @return -1, 0 or 1, or 2 when the float is NaN.
+ */
+static int compare_integer_float(int64_t integer, double number) {
+    if (isnan(number)) return 2;
+    if (number >= 9223372036854775808.0) return -1;   // 2^63
+    if (number < -9223372036854775808.0) return 1;
+    double floor_number = floor(number);
+    int64_t floor_integer = (int64_t)floor_number;
+    if (integer < floor_integer) return -1;
+    if (integer > floor_integer) return 1;
+    return floor_number == number ? 0 : -1;
+}
+
+/**
+ * @brief Orders two numbers of any subtype mathematically.
+ *
+ * @param a The left number.
+ * @param b The right number.
+ * @return -1, 0 or 1 as a is less than, equal to or greater than b, or 2
+ * when either is NaN.
+ */
+int compare_numbers(Value a, Value b) {
+    if (a.type == VAL_INTEGER && b.type == VAL_INTEGER) {
+        return (a.as.integer > b.as.integer) - (a.as.integer < b.as.integer);
+    }
+    if (a.type == VAL_INTEGER) return compare_integer_float(a.as.integer, b.as.number);
+    if (b.type == VAL_INTEGER) {
+        int order = compare_integer_float(b.as.integer, a.as.number);
+        return order == 2 ? 2 : -order;
+    }
+    if (a.as.number < b.as.number) return -1;
+    if (a.as.number > b.as.number) return 1;
+    return a.as.number == b.as.number ? 0 : 2;
+}
+
+/**
+ * @brief Lua's raw equality. Numbers compare by value across subtypes,
+ * strings by contents, functions and tables by identity.
+ *
+ * @param a The left value.
+ * @param b The right value.
+ * @return 1 if the values are equal, 0 otherwise.
+ */
+int values_equal(Value a, Value b) {
+    if (is_number(a) && is_number(b)) return compare_numbers(a, b) == 0;
+    if (a.type != b.type) return 0;
+    switch (a.type) {
+        case VAL_STRING:
+            return a.as.string == b.as.string || strcmp(a.as.string, b.as.string) == 0;
+        case VAL_FUNCTION:
+            return a.as.function == b.as.function;
+        case VAL_TABLE:
+            return a.as.table == b.as.table;
+        default:
+            return 1; // true, false and nil have a single value each
+    }
+}
+
+/**
+ * @brief Returns the Lua type name of a value, for error messages.
+ */
+const char* value_type_name(Value value) {
+    switch (value.type) {
+        case VAL_NUMBER:
+        case VAL_INTEGER:
+            return "number";
+        case VAL_STRING:
+            return "string";
+        case VAL_TRUE:
+        case VAL_FALSE:
+            return "boolean";
+        case VAL_NIL:
+            return "nil";
+        case VAL_FUNCTION:
+            return "function";
+        case VAL_TABLE:
+            return "table";
+    }
+    return "unknown";
+}
@@ -5,26 +5,51 @@
 #include <stdio.h>
 
 typedef enum {
-    VAL_NUMBER,
+    VAL_NUMBER,     // Float subtype of Lua numbers
+    VAL_INTEGER,    // Integer subtype of Lua numbers
     VAL_STRING,
     VAL_TRUE,
     VAL_FALSE,
     VAL_NIL,
     VAL_FUNCTION,
+    VAL_TABLE,
 } ValueType;
 
 typedef struct Value {
     ValueType type;
     union {
         double number;
+        int64_t integer;
         char* string;
         int boolean;
         struct Chunk* function;
+        struct LuaTable* table;
     } as;
 } Value;
 
-void print_value(Value value);
+/**
+ * @brief Returns whether a value is a number of either subtype.
+ */
+static inline int is_number(Value value) {
+    return value.type == VAL_NUMBER || value.type == VAL_INTEGER;
+}
+
+/**
+ * @brief Converts a number of either subtype to a float.
+ */
+static inline double as_float(Value value) {
+    return value.type == VAL_INTEGER ? (double)value.as.integer : value.as.number;
+}
+
+// Longest text format_integer or format_float can produce
+#define NUMBER_FORMAT_MAX 32
+
+int format_integer(char* buffer, int64_t integer);
+int format_float(char* buffer, double number);
 void print_value_to_stream(FILE* stream, Value value);
 void free_value(Value value);
+int compare_numbers(Value a, Value b);
+int values_equal(Value a, Value b);
+const char* value_type_name(Value value);
 
 #endif // VALUE_H
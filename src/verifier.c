@@ -0,0 +1,263 @@
+#include "verifier.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Depth of an offset that is not the start of an instruction, and of one
+// no path has reached yet
+#define NOT_AN_INSTRUCTION -2
+#define UNREACHED -1
+
+typedef struct {
+    Chunk* chunk;
+    int* depths;    // Values in the frame before each instruction runs
+    int* pending;   // Instructions reached whose successors are not checked
+    int pending_count;
+    int max;
+} Verifier;
+
+static int fail(Chunk* chunk, int offset, const char* problem) {
+    if (chunk->name != NULL) {
+        fprintf(stderr, "Invalid bytecode in function '%s' at offset %d: %s.\n", chunk->name, offset, problem);
+    } else {
+        fprintf(stderr, "Invalid bytecode in the main chunk at offset %d: %s.\n", offset, problem);
+    }
+    return 0;
+}
+
+/**
+ * @brief Records that control goes from one instruction to another with
+ * depth values in the frame.
+ *
+ * @return 1, or 0 after reporting that the target is not an instruction
+ * or is reached with another depth on some other path.
+ */
+static int flow(Verifier* verifier, int from, int to, int depth) {
+    if (to < 0 || to >= verifier->chunk->count) {
+        return fail(verifier->chunk, from, "control leaves the code");
+    }
+    int* known = &verifier->depths[to];
+    if (*known == NOT_AN_INSTRUCTION) {
+        return fail(verifier->chunk, from, "jump into the middle of an instruction");
+    }
+    if (*known == UNREACHED) {
+        *known = depth;
+        verifier->pending[verifier->pending_count++] = to;
+        if (depth > verifier->max) verifier->max = depth;
+    } else if (*known != depth) {
+        return fail(verifier->chunk, from, "stack depths differ where paths join");
+    }
+    return 1;
+}
+
+static int is_string_constant(Chunk* chunk, uint32_t index) {
+    return index < (uint32_t)chunk->constants_count && chunk->constants[index].type == VAL_STRING;
+}
+
+static uint32_t long_operand(uint8_t* code) {
+    return (code[1] << 16) | (code[2] << 8) | code[3];
+}
+
+static uint16_t short_operand(uint8_t* bytes) {
+    return (uint16_t)(bytes[0] << 8 | bytes[1]);
+}
+
+/**
+ * @brief Checks one reached instruction and passes the depth after it on
+ * to the instructions that can run next.
+ */
+static int verify_instruction(Verifier* verifier, int offset) {
+    Chunk* chunk = verifier->chunk;
+    uint8_t* code = chunk->code + offset;
+    int depth = verifier->depths[offset];
+    int next = offset + instruction_length(code[0]);
+
+    // Operands each instruction takes off the stack, checked first
+    int needed;
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+        case OP_GET_LOCAL:
+        case OP_JUMP:
+        case OP_NEW_TABLE:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NIL:
+            needed = 0;
+            break;
+        case OP_SET_INDEX:
+        case OP_INIT_FIELD:
+            needed = 3;
+            break;
+        case OP_SET_LIST:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            needed = code[1] + 1;
+            break;
+        case OP_FORPREP:
+        case OP_FORLOOP:
+            // Counter, limit, step and the loop variable
+            needed = code[1] + 4;
+            break;
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+        case OP_SET_LOCAL:
+        case OP_POP:
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_PRINT:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_INLINE_GUARD:
+        case OP_LENGTH:
+        case OP_RETURN:
+            needed = 1;
+            break;
+        default:
+            needed = 2; // Binary operators and OP_GET_INDEX
+            break;
+    }
+    if (depth < needed) return fail(chunk, offset, "stack underflow");
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            if (code[1] >= chunk->constants_count) return fail(chunk, offset, "no such constant");
+            return flow(verifier, offset, next, depth + 1);
+        case OP_CONSTANT_LONG:
+            if (long_operand(code) >= (uint32_t)chunk->constants_count) return fail(chunk, offset, "no such constant");
+            return flow(verifier, offset, next, depth + 1);
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            if (!is_string_constant(chunk, code[1])) return fail(chunk, offset, "global name is not a string constant");
+            return flow(verifier, offset, next, code[0] == OP_GET_GLOBAL ? depth + 1 : depth);
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+            if (!is_string_constant(chunk, long_operand(code))) return fail(chunk, offset, "global name is not a string constant");
+            return flow(verifier, offset, next, code[0] == OP_GET_GLOBAL_LONG ? depth + 1 : depth);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            if (code[1] >= depth) return fail(chunk, offset, "no such local");
+            return flow(verifier, offset, next, code[0] == OP_GET_LOCAL ? depth + 1 : depth);
+        case OP_NEW_TABLE:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NIL:
+            return flow(verifier, offset, next, depth + 1);
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_LENGTH:
+            return flow(verifier, offset, next, depth);
+        case OP_POP:
+        case OP_PRINT:
+            return flow(verifier, offset, next, depth - 1);
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            return flow(verifier, offset, next, depth) &&
+                   flow(verifier, offset, next + (uint16_t)short_operand(code + 1), depth);
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+            return flow(verifier, offset, next, depth - 1) &&
+                   flow(verifier, offset, next + (uint16_t)short_operand(code + 1), depth - 1);
+        case OP_INLINE_GUARD:
+            // Passing pops the callee; failing leaves it for the call
+            if (code[1] >= chunk->inlined_count) return fail(chunk, offset, "no such inlined function");
+            return flow(verifier, offset, next, depth - 1) &&
+                   flow(verifier, offset, next + (uint16_t)short_operand(code + 2), depth);
+        case OP_JUMP:
+            return flow(verifier, offset, next + (int16_t)short_operand(code + 1), depth);
+        case OP_FORPREP:
+        case OP_FORLOOP:
+            return flow(verifier, offset, next, depth) &&
+                   flow(verifier, offset, next + (int16_t)short_operand(code + 2), depth);
+        case OP_SET_INDEX:
+            return flow(verifier, offset, next, depth - 3);
+        case OP_INIT_FIELD:
+            return flow(verifier, offset, next, depth - 2);
+        case OP_SET_LIST:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            // The values, or the callee and its arguments, leave the table
+            // or the result in their place
+            return flow(verifier, offset, next, depth - code[1]);
+        case OP_RETURN:
+            return 1;
+        default:
+            return flow(verifier, offset, next, depth - 1);
+    }
+}
+
+/**
+ * @brief Checks the code of a chunk before it runs, so that the VM can run
+ * it without checking anything per instruction: by following every path
+ * through the code with the number of values in the frame, that each
+ * instruction is complete and has the operands it pops, that constant,
+ * local and inlined function indexes exist, that global names are
+ * strings, that jumps land on instructions, that paths joining agree on
+ * the depth, and that no path runs past the end. The most values the
+ * frame holds goes to chunk->max_stack, which the VM compares against the
+ * room left on its stack once per call.
+ *
+ * @param chunk The chunk.
+ * @param start Where to start, 0 but for the later batches of a streamed
+ * program; the code before it is not checked again.
+ * @param depth The values already in the frame there: the arguments, or
+ * the locals earlier batches left.
+ * @return 1 if the code is sound, or 0 after reporting the first problem,
+ * in which case max_stack is left as it was.
+ */
+int verify_chunk(Chunk* chunk, int start, int depth) {
+    Verifier verifier;
+    verifier.chunk = chunk;
+    verifier.depths = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    verifier.pending = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    verifier.pending_count = 0;
+    verifier.max = depth;
+
+    int valid = 1;
+    for (int offset = start; offset < chunk->count;) {
+        int length = instruction_length(chunk->code[offset]);
+        if (length == 0) {
+            valid = fail(chunk, offset, "unknown opcode");
+            break;
+        }
+        if (offset + length > chunk->count) {
+            valid = fail(chunk, offset, "truncated instruction");
+            break;
+        }
+        verifier.depths[offset] = UNREACHED;
+        for (int i = 1; i < length; i++) verifier.depths[offset + i] = NOT_AN_INSTRUCTION;
+        offset += length;
+    }
+    // Code before start, which was checked already, cannot be jumped to
+    for (int offset = 0; offset < start; offset++) verifier.depths[offset] = NOT_AN_INSTRUCTION;
+
+    if (valid) valid = flow(&verifier, start, start, depth);
+    while (valid && verifier.pending_count > 0) {
+        valid = verify_instruction(&verifier, verifier.pending[--verifier.pending_count]);
+    }
+    if (valid) chunk->max_stack = verifier.max;
+
+    free(verifier.depths);
+    free(verifier.pending);
+    return valid;
+}
+
+/**
+ * @brief Verifies a top-level chunk, and every function among its
+ * constants that has code and was not verified yet, with those nested in
+ * them. Functions compiled on their first call are verified then.
+ *
+ * @return 1 if all of it is sound, 0 after reporting a problem.
+ */
+int verify_program(Chunk* chunk) {
+    if (chunk->max_stack == CHUNK_UNVERIFIED && !verify_chunk(chunk, 0, chunk->arity)) return 0;
+    for (int i = 0; i < chunk->constants_count; i++) {
+        Value constant = chunk->constants[i];
+        if (constant.type != VAL_FUNCTION || constant.as.function->deferred_source != NULL) continue;
+        if (constant.as.function->max_stack == CHUNK_UNVERIFIED && !verify_program(constant.as.function)) return 0;
+    }
+    return 1;
+}
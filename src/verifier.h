@@ -0,0 +1,9 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "bytecode.h"
+
+int verify_chunk(Chunk* chunk, int start, int depth);
+int verify_program(Chunk* chunk);
+
+#endif // VERIFIER_H
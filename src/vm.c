@@ -1,11 +1,17 @@
 #include "vm.h"
 #include "parser.h"
 #include "codegen.h"
+#include "compiler.h"
+#include "pipeline.h"
+#include "reload.h"
+#include "feedback.h"
+#include "verifier.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 
 /**
  * @brief Prints a runtime error message.
@@ -15,6 +21,9 @@
  * @param ... The arguments.
  */
 static void runtime_error(VM* vm, const char* format, ...) {
+    // Whatever the program printed comes before the error
+    output_flush(&vm->output);
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -31,10 +40,27 @@ void init_vm(VM* vm) {
     vm->frame_count = 0;
     vm->stack_top = vm->stack;
     init_table(&vm->globals);
+    vm->tables = NULL;
+    vm->tables_count = 0;
+    vm->next_collection = TABLES_MIN_COLLECTION;
+    vm->gray = NULL;
+    vm->gray_count = 0;
+    vm->gray_capacity = 0;
+    vm->stats = NULL;
+    init_output(&vm->output, stdout);
+    vm->streaming = 0;
+    vm->reloader = NULL;
+    vm->feedback = NULL;
 }
 
 void free_vm(VM* vm) {
     free_table(&vm->globals);
+    while (vm->tables != NULL) {
+        LuaTable* next = vm->tables->next;
+        free_lua_table(vm->tables);
+        vm->tables = next;
+    }
+    free(vm->gray);
 }
 
 /**
@@ -63,15 +89,313 @@ static int is_falsey(Value value) {
     return value.type == VAL_NIL || (value.type == VAL_FALSE && value.as.boolean == false);
 }
 
-static int call_value(VM* vm, Value callee, int arg_count) {
+/**
+ * @brief Records for --profile-out what an instruction about to run sees:
+ * which way a conditional jump goes, the subtypes of an operator's
+ * operands, or the function a call calls.
+ *
+ * @param vm The VM.
+ * @param frame The running frame, whose ip is past the opcode.
+ * @param instruction The opcode.
+ */
+static void record_site(VM* vm, CallFrame* frame, uint8_t instruction) {
+    SiteKind kind = site_kind(instruction);
+    if (kind == SITE_NONE) return;
+    SiteCounts* site = recorded_site(vm->feedback, frame->chunk, (int)(frame->ip - frame->chunk->code) - 1);
+    switch (kind) {
+        case SITE_BRANCH:
+            site->counts[is_falsey(*(vm->stack_top - 1)) ? COUNT_FALSEY : COUNT_TRUTHY]++;
+            break;
+        case SITE_OPERANDS: {
+            Value* a = vm->stack_top - 2;
+            Value* b = vm->stack_top - 1;
+            if (a->type == VAL_INTEGER && b->type == VAL_INTEGER) {
+                site->counts[COUNT_INTEGERS]++;
+            } else if (a->type == VAL_NUMBER && b->type == VAL_NUMBER) {
+                site->counts[COUNT_FLOATS]++;
+            } else {
+                site->counts[COUNT_OTHERS]++;
+            }
+            break;
+        }
+        default: {
+            Value callee;
+            if (instruction == OP_INLINE_GUARD) {
+                // A guard that fails is followed by the call it guards,
+                // which records itself
+                callee = *(vm->stack_top - 1);
+                if (callee.type != VAL_FUNCTION || callee.as.function != frame->chunk->inlined[frame->ip[0]]) break;
+            } else {
+                callee = *(vm->stack_top - 1 - frame->ip[0]);
+                if (callee.type != VAL_FUNCTION) break;
+            }
+            if (site->counts[COUNT_CALLS]++ == 0) {
+                site->callee = callee.as.function;
+            } else if (site->callee != callee.as.function) {
+                site->callee = NULL;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Compiles a function whose body was only checked when the program
+ * was compiled. Its chunk already is the function value, so every
+ * reference to it sees the code from now on.
+ * 
+ * @param vm The VM.
+ * @param function The function's chunk, which has no code yet.
+ * @return 1 on success, 0 after reporting a runtime error.
+ */
+static int compile_deferred(VM* vm, struct Chunk* function) {
+    AST* definition = parse_function(function->deferred_source, function->deferred_line);
+    if (definition == NULL) {
+        runtime_error(vm, "Could not compile function '%s'.", function->name);
+        return 0;
+    }
+    generate_deferred_function(definition, function);
+    free_ast(definition);
+    return 1;
+}
+
+/**
+ * @brief Checks that a value can be called with the given number of
+ * arguments, compiling it if this is its first call.
+ * 
+ * @param vm The VM.
+ * @param callee The value being called.
+ * @param arg_count The number of arguments passed.
+ * @return The function to run, or NULL after reporting a runtime error.
+ */
+static struct Chunk* callable_function(VM* vm, Value callee, int arg_count) {
     if (callee.type != VAL_FUNCTION) {
         runtime_error(vm, "Can only call functions.");
-        return 0;
+        return NULL;
     }
 
     struct Chunk* function = callee.as.function;
     if (arg_count != function->arity) {
         runtime_error(vm, "Expected %d arguments but got %d.", function->arity, arg_count);
+        return NULL;
+    }
+    if (function->deferred_source != NULL && !compile_deferred(vm, function)) {
+        return NULL;
+    }
+    return function;
+}
+
+/**
+ * @brief Converts a for loop limit to an integer for an integer loop,
+ * rounding a float limit toward the loop's direction and clamping it.
+ * 
+ * @param limit The limit, a number.
+ * @param step The loop step, not zero.
+ * @param result Receives the integer limit.
+ * @return 0 if the loop cannot run at all, 1 otherwise.
+ */
+static int for_limit(Value limit, int64_t step, int64_t* result) {
+    if (limit.type == VAL_INTEGER) {
+        *result = limit.as.integer;
+        return 1;
+    }
+    double number = step > 0 ? floor(limit.as.number) : ceil(limit.as.number);
+    if (isnan(number)) return 0;
+    if (number >= 9223372036854775808.0) {         // 2^63
+        if (step < 0) return 0;
+        *result = INT64_MAX;
+    } else if (number < -9223372036854775808.0) {
+        if (step > 0) return 0;
+        *result = INT64_MIN;
+    } else {
+        *result = (int64_t)number;
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks the operands of a numeric for loop and sets up its slots:
+ * index, limit, step and the loop variable.
+ *
+ * When the initial value and the step are integers the loop counts in
+ * integers and, as in Lua 5.4, the limit slot is replaced by the number of
+ * iterations left, so the index can never overflow. Otherwise all three
+ * are converted to floats.
+ * 
+ * @param vm The VM.
+ * @param slots The loop's first slot.
+ * @return 1 if the loop runs, 0 if it should be skipped, -1 after a
+ * runtime error.
+ */
+static int for_prepare(VM* vm, Value* slots) {
+    if (!is_number(slots[0])) {
+        runtime_error(vm, "'for' initial value must be a number.");
+        return -1;
+    }
+    if (!is_number(slots[1])) {
+        runtime_error(vm, "'for' limit must be a number.");
+        return -1;
+    }
+    if (!is_number(slots[2])) {
+        runtime_error(vm, "'for' step must be a number.");
+        return -1;
+    }
+    if (as_float(slots[2]) == 0) {
+        runtime_error(vm, "'for' step is zero.");
+        return -1;
+    }
+
+    if (slots[0].type == VAL_INTEGER && slots[2].type == VAL_INTEGER) {
+        int64_t init = slots[0].as.integer;
+        int64_t step = slots[2].as.integer;
+        int64_t limit;
+        if (!for_limit(slots[1], step, &limit)) return 0;
+        if (step > 0 ? init > limit : init < limit) return 0;
+
+        uint64_t remaining = step > 0
+            ? ((uint64_t)limit - (uint64_t)init) / (uint64_t)step
+            : ((uint64_t)init - (uint64_t)limit) / ((uint64_t)(-(step + 1)) + 1u);
+        slots[1] = (Value){VAL_INTEGER, {.integer = (int64_t)remaining}};
+        slots[3] = slots[0];
+        return 1;
+    }
+
+    double init = as_float(slots[0]);
+    double limit = as_float(slots[1]);
+    double step = as_float(slots[2]);
+    if (step > 0 ? !(init <= limit) : !(init >= limit)) return 0;
+    slots[0] = (Value){VAL_NUMBER, {.number = init}};
+    slots[1] = (Value){VAL_NUMBER, {.number = limit}};
+    slots[2] = (Value){VAL_NUMBER, {.number = step}};
+    slots[3] = slots[0];
+    return 1;
+}
+
+static void mark_table(VM* vm, LuaTable* table) {
+    if (table->marked) return;
+    table->marked = 1;
+    if (vm->gray_count == vm->gray_capacity) {
+        vm->gray_capacity = vm->gray_capacity < 64 ? 64 : vm->gray_capacity * 2;
+        vm->gray = (LuaTable**)realloc(vm->gray, sizeof(LuaTable*) * vm->gray_capacity);
+    }
+    vm->gray[vm->gray_count++] = table;
+}
+
+static void mark_value(VM* vm, Value value) {
+    if (value.type == VAL_TABLE) mark_table(vm, value.as.table);
+}
+
+/**
+ * @brief Frees the tables the program can no longer reach. A table can
+ * only be held by the stack, a global or another table, and this only runs
+ * when a table is allocated, when every value the program holds is in one
+ * of those. Marking works through a list of tables rather than recursion,
+ * so long chains of tables cannot overflow the C stack. The next collection
+ * comes once the live tables have doubled.
+ * 
+ * @param vm The VM.
+ */
+static void collect_tables(VM* vm) {
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+        mark_value(vm, *slot);
+    }
+    for (int i = 0; i < vm->globals.capacity; i++) {
+        if (vm->globals.entries[i].key != NULL) mark_value(vm, vm->globals.entries[i].value);
+    }
+    while (vm->gray_count > 0) {
+        LuaTable* table = vm->gray[--vm->gray_count];
+        for (int i = 0; i < table->array_count; i++) {
+            mark_value(vm, table->array[i]);
+        }
+        for (int i = 0; i < table->hash_capacity; i++) {
+            mark_value(vm, table->entries[i].key);
+            mark_value(vm, table->entries[i].value);
+        }
+    }
+
+    int live = 0;
+    LuaTable** link = &vm->tables;
+    while (*link != NULL) {
+        LuaTable* table = *link;
+        if (table->marked) {
+            table->marked = 0;
+            live++;
+            link = &table->next;
+        } else {
+            *link = table->next;
+            free_lua_table(table);
+        }
+    }
+    vm->tables_count = live;
+    vm->next_collection = live * 2 > TABLES_MIN_COLLECTION ? live * 2 : TABLES_MIN_COLLECTION;
+}
+
+/**
+ * @brief Creates a table owned by the VM, first freeing the unreachable
+ * ones if enough tables were created since that was last done.
+ * 
+ * @param vm The VM.
+ * @param array_size Expected number of keys 1..n.
+ * @param hash_size Expected number of other keys.
+ * @return The new table.
+ */
+static LuaTable* allocate_table(VM* vm, int array_size, int hash_size) {
+    if (vm->tables_count >= vm->next_collection) collect_tables(vm);
+    LuaTable* table = new_lua_table(array_size, hash_size);
+    table->next = vm->tables;
+    vm->tables = table;
+    vm->tables_count++;
+    return table;
+}
+
+/**
+ * @brief Checks that a value can be used as a key when storing into a
+ * table.
+ * 
+ * @param vm The VM.
+ * @param key The key.
+ * @return 1 if it can, 0 after reporting a runtime error.
+ */
+static int check_table_key(VM* vm, Value key) {
+    if (key.type == VAL_NIL) {
+        runtime_error(vm, "Table index is nil.");
+        return 0;
+    }
+    if (key.type == VAL_NUMBER && isnan(key.as.number)) {
+        runtime_error(vm, "Table index is NaN.");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks that a function's frame fits on the stack, verifying the
+ * function first on its first call. The VM runs verified code without
+ * checking its stack accesses, so this is the only check that the values
+ * a function pushes stay on the stack. Reached only when a quick
+ * comparison against max_stack fails, which it always does for a function
+ * not verified yet.
+ * 
+ * @param vm The VM.
+ * @param function The function about to run.
+ * @param slots Where its frame starts.
+ * @return 1 if it fits, 0 after reporting a runtime error.
+ */
+static int check_frame(VM* vm, struct Chunk* function, Value* slots) {
+    if (function->max_stack == CHUNK_UNVERIFIED && !verify_chunk(function, 0, function->arity)) {
+        runtime_error(vm, "Could not verify function '%s'.", function->name);
+        return 0;
+    }
+    if ((slots - vm->stack) + function->max_stack > STACK_MAX) {
+        runtime_error(vm, "Stack overflow.");
+        return 0;
+    }
+    return 1;
+}
+
+static int call_value(VM* vm, Value callee, int arg_count) {
+    struct Chunk* function = callable_function(vm, callee, arg_count);
+    if (function == NULL) {
         return 0;
     }
 
@@ -79,28 +403,173 @@ static int call_value(VM* vm, Value callee, int arg_count) {
         runtime_error(vm, "Stack overflow.");
         return 0;
     }
+    Value* slots = vm->stack_top - arg_count;
+    if ((slots - vm->stack) + function->max_stack > STACK_MAX && !check_frame(vm, function, slots)) {
+        return 0;
+    }
+
+    if (vm->stats) stats_record_call(vm->stats, function);
 
     CallFrame* frame = &vm->frames[vm->frame_count++];
     frame->chunk = function;
     frame->ip = function->code;
-    frame->slots = vm->stack_top - arg_count;
+    frame->slots = slots;
+    return 1;
+}
+
+/**
+ * @brief Calls the function below the arguments on top of the stack by
+ * reusing the current frame. The callee and its arguments are moved down
+ * over the current callee and locals, so tail-recursive loops run in
+ * constant stack space.
+ * 
+ * @param vm The VM.
+ * @param arg_count The number of arguments passed.
+ * @return 1 on success, 0 after reporting a runtime error.
+ */
+static int tail_call_value(VM* vm, int arg_count) {
+    Value* callee = vm->stack_top - 1 - arg_count;
+    // The top-level frame has no callee slot to reuse.
+    if (vm->frame_count == 1) {
+        return call_value(vm, *callee, arg_count);
+    }
+
+    struct Chunk* function = callable_function(vm, *callee, arg_count);
+    if (function == NULL) {
+        return 0;
+    }
+
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    if ((frame->slots - vm->stack) + function->max_stack > STACK_MAX && !check_frame(vm, function, frame->slots)) {
+        return 0;
+    }
+
+    if (vm->stats) stats_record_call(vm->stats, function);
+
+    Value* base = frame->slots - 1;
+    memmove(base, callee, sizeof(Value) * (arg_count + 1));
+    vm->stack_top = base + 1 + arg_count;
+    frame->chunk = function;
+    frame->ip = function->code;
     return 1;
 }
 
 /**
- * @brief The main execution loop of the VM.
+ * @brief The body of the execution loop, specialized by the compiler for
+ * each value of collect_stats and record_feedback.
  * 
  * @param vm The VM.
+ * @param collect_stats Whether to update vm->stats.
+ * @param record_feedback Whether to update vm->feedback.
  * @return The result of the interpretation.
  */
-static InterpretResult run(VM* vm) {
+static inline __attribute__((always_inline)) InterpretResult execute(VM* vm, const bool collect_stats,
+                                                                     const bool record_feedback) {
     CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    VMStats* stats = vm->stats;
 
 // Helper macros for reading from the bytecode
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_CONSTANT() (frame->chunk->constants[READ_BYTE()])
 #define READ_STRING() (READ_CONSTANT().as.string)
+#define READ_CONSTANT_LONG() (frame->ip += 3, frame->chunk->constants[(frame->ip[-3] << 16) | (frame->ip[-2] << 8) | frame->ip[-1]])
+#define READ_STRING_LONG() (READ_CONSTANT_LONG().as.string)
+
+// Generic arithmetic. Integer operands stay integers (wrapping on
+// overflow, computed unsigned to avoid undefined behavior); any float
+// operand promotes both to floats. The result overwrites the left operand
+// in place. When both operands have the same subtype the instruction is
+// quickened to its specialized form for that subtype.
+#define ARITHMETIC_OP(op, int_opcode, float_opcode) \
+    do { \
+        Value* a = vm->stack_top - 2; \
+        Value* b = vm->stack_top - 1; \
+        if (a->type == VAL_INTEGER && b->type == VAL_INTEGER) { \
+            a->as.integer = (int64_t)((uint64_t)a->as.integer op (uint64_t)b->as.integer); \
+            frame->ip[-1] = int_opcode; \
+        } else if (a->type == VAL_NUMBER && b->type == VAL_NUMBER) { \
+            a->as.number = a->as.number op b->as.number; \
+            frame->ip[-1] = float_opcode; \
+        } else if (is_number(*a) && is_number(*b)) { \
+            *a = (Value){VAL_NUMBER, {.number = as_float(*a) op as_float(*b)}}; \
+        } else { \
+            runtime_error(vm, "Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm->stack_top--; \
+    } while (0)
+
+// Generic comparison. Same-subtype operands compare directly and quicken
+// the instruction; mixed ones go through compare_numbers, which is exact
+// and reports NaN as unordered (2).
+#define COMPARISON_OP(op, int_opcode, float_opcode) \
+    do { \
+        Value b = pop(vm); \
+        Value a = pop(vm); \
+        bool result; \
+        if (a.type == VAL_INTEGER && b.type == VAL_INTEGER) { \
+            result = a.as.integer op b.as.integer; \
+            frame->ip[-1] = int_opcode; \
+        } else if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) { \
+            result = a.as.number op b.as.number; \
+            frame->ip[-1] = float_opcode; \
+        } else if (is_number(a) && is_number(b)) { \
+            int order = compare_numbers(a, b); \
+            result = order != 2 && order op 0; \
+        } else { \
+            runtime_error(vm, "Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        push(vm, result ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}}); \
+    } while (0)
+
+// Turns a quickened instruction whose operand types no longer match back
+// into its generic form and dispatches it again. The generic handler will
+// quicken it anew for the types it sees.
+#define DEQUICKEN(generic_opcode) \
+    { \
+        frame->ip[-1] = generic_opcode; \
+        frame->ip--; \
+        continue; \
+    }
+
+// Quickened handlers: a single type check, then the operation.
+#define ARITHMETIC_INT(op, generic_opcode) \
+    { \
+        Value* a = vm->stack_top - 2; \
+        Value* b = vm->stack_top - 1; \
+        if (a->type != VAL_INTEGER || b->type != VAL_INTEGER) DEQUICKEN(generic_opcode); \
+        a->as.integer = (int64_t)((uint64_t)a->as.integer op (uint64_t)b->as.integer); \
+        vm->stack_top--; \
+    }
+
+#define ARITHMETIC_FLOAT(op, generic_opcode) \
+    { \
+        Value* a = vm->stack_top - 2; \
+        Value* b = vm->stack_top - 1; \
+        if (a->type != VAL_NUMBER || b->type != VAL_NUMBER) DEQUICKEN(generic_opcode); \
+        a->as.number = a->as.number op b->as.number; \
+        vm->stack_top--; \
+    }
+
+#define COMPARISON_INT(op, generic_opcode) \
+    { \
+        Value* a = vm->stack_top - 2; \
+        Value* b = vm->stack_top - 1; \
+        if (a->type != VAL_INTEGER || b->type != VAL_INTEGER) DEQUICKEN(generic_opcode); \
+        *a = a->as.integer op b->as.integer ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}}; \
+        vm->stack_top--; \
+    }
+
+#define COMPARISON_FLOAT(op, generic_opcode) \
+    { \
+        Value* a = vm->stack_top - 2; \
+        Value* b = vm->stack_top - 1; \
+        if (a->type != VAL_NUMBER || b->type != VAL_NUMBER) DEQUICKEN(generic_opcode); \
+        *a = a->as.number op b->as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}}; \
+        vm->stack_top--; \
+    }
 
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
@@ -115,22 +584,40 @@ static InterpretResult run(VM* vm) {
 #endif
 
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
+        uint8_t instruction = READ_BYTE();
+        if (collect_stats) stats_record_instruction(stats, instruction);
+        if (record_feedback) record_site(vm, frame, instruction);
+        switch (instruction) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
                 push(vm, constant);
                 break;
             }
-            case OP_SET_GLOBAL: {
-                char* name = READ_STRING();
+            case OP_CONSTANT_LONG: {
+                Value constant = READ_CONSTANT_LONG();
+                push(vm, constant);
+                break;
+            }
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG: {
+                char* name = instruction == OP_SET_GLOBAL ? READ_STRING() : READ_STRING_LONG();
+                if (collect_stats) {
+                    int capacity = vm->globals.capacity;
+                    stats->global_writes++;
+                    stats->global_inserts += table_set(&vm->globals, name, *(vm->stack_top - 1));
+                    stats->global_resizes += vm->globals.capacity != capacity;
+                    break;
+                }
                 table_set(&vm->globals, name, *(vm->stack_top - 1));
                 break;
             }
-            case OP_GET_GLOBAL: {
-                char* name = READ_STRING();
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG: {
+                char* name = instruction == OP_GET_GLOBAL ? READ_STRING() : READ_STRING_LONG();
                 Value value;
+                if (collect_stats) stats->global_reads++;
                 if (!table_get(&vm->globals, name, &value)) {
+                    if (collect_stats) stats->global_misses++;
                     runtime_error(vm, "Undefined variable '%s'.", name);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -151,44 +638,21 @@ static InterpretResult run(VM* vm) {
                 pop(vm);
                 break;
             }
-            case OP_ADD: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, (Value){VAL_NUMBER, {.number = a.as.number + b.as.number}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SUBTRACT: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, (Value){VAL_NUMBER, {.number = a.as.number - b.as.number}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_MULTIPLY: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, (Value){VAL_NUMBER, {.number = a.as.number * b.as.number}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
+            case OP_ADD:      ARITHMETIC_OP(+, OP_ADD_INT, OP_ADD_FLOAT); break;
+            case OP_SUBTRACT: ARITHMETIC_OP(-, OP_SUBTRACT_INT, OP_SUBTRACT_FLOAT); break;
+            case OP_MULTIPLY: ARITHMETIC_OP(*, OP_MULTIPLY_INT, OP_MULTIPLY_FLOAT); break;
+            case OP_ADD_INT:          ARITHMETIC_INT(+, OP_ADD); break;
+            case OP_ADD_FLOAT:        ARITHMETIC_FLOAT(+, OP_ADD); break;
+            case OP_SUBTRACT_INT:     ARITHMETIC_INT(-, OP_SUBTRACT); break;
+            case OP_SUBTRACT_FLOAT:   ARITHMETIC_FLOAT(-, OP_SUBTRACT); break;
+            case OP_MULTIPLY_INT:     ARITHMETIC_INT(*, OP_MULTIPLY); break;
+            case OP_MULTIPLY_FLOAT:   ARITHMETIC_FLOAT(*, OP_MULTIPLY); break;
             case OP_DIVIDE: {
+                // '/' always produces a float, as in Lua 5.3
                 Value b = pop(vm);
                 Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, (Value){VAL_NUMBER, {.number = a.as.number / b.as.number}});
+                if (is_number(a) && is_number(b)) {
+                    push(vm, (Value){VAL_NUMBER, {.number = as_float(a) / as_float(b)}});
                 } else {
                     runtime_error(vm, "Operands must be numbers.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -197,7 +661,9 @@ static InterpretResult run(VM* vm) {
             }
             case OP_NEGATE: {
                 Value value = pop(vm);
-                if (value.type == VAL_NUMBER) {
+                if (value.type == VAL_INTEGER) {
+                    push(vm, (Value){VAL_INTEGER, {.integer = (int64_t)(0 - (uint64_t)value.as.integer)}});
+                } else if (value.type == VAL_NUMBER) {
                     push(vm, (Value){VAL_NUMBER, {.number = -value.as.number}});
                 } else {
                     runtime_error(vm, "Operand must be a number.");
@@ -205,70 +671,32 @@ static InterpretResult run(VM* vm) {
                 }
                 break;
             }
-            case OP_GREATER: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number > b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_GREATER_EQUAL: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number >= b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_LESS: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number < b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_LESS_EQUAL: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number <= b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
+            case OP_GREATER:       COMPARISON_OP(>, OP_GREATER_INT, OP_GREATER_FLOAT); break;
+            case OP_GREATER_EQUAL: COMPARISON_OP(>=, OP_GREATER_EQUAL_INT, OP_GREATER_EQUAL_FLOAT); break;
+            case OP_LESS:          COMPARISON_OP(<, OP_LESS_INT, OP_LESS_FLOAT); break;
+            case OP_LESS_EQUAL:    COMPARISON_OP(<=, OP_LESS_EQUAL_INT, OP_LESS_EQUAL_FLOAT); break;
+            case OP_GREATER_INT:         COMPARISON_INT(>, OP_GREATER); break;
+            case OP_GREATER_FLOAT:       COMPARISON_FLOAT(>, OP_GREATER); break;
+            case OP_GREATER_EQUAL_INT:   COMPARISON_INT(>=, OP_GREATER_EQUAL); break;
+            case OP_GREATER_EQUAL_FLOAT: COMPARISON_FLOAT(>=, OP_GREATER_EQUAL); break;
+            case OP_LESS_INT:            COMPARISON_INT(<, OP_LESS); break;
+            case OP_LESS_FLOAT:          COMPARISON_FLOAT(<, OP_LESS); break;
+            case OP_LESS_EQUAL_INT:      COMPARISON_INT(<=, OP_LESS_EQUAL); break;
+            case OP_LESS_EQUAL_FLOAT:    COMPARISON_FLOAT(<=, OP_LESS_EQUAL); break;
             case OP_EQUAL: {
                 Value b = pop(vm);
                 Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number == b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                bool equal = a.type == VAL_INTEGER && b.type == VAL_INTEGER
+                    ? a.as.integer == b.as.integer : values_equal(a, b);
+                push(vm, equal ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
                 break;
             }
             case OP_NOT_EQUAL: {
                 Value b = pop(vm);
                 Value a = pop(vm);
-                if (a.type == VAL_NUMBER && b.type == VAL_NUMBER) {
-                    push(vm, a.as.number != b.as.number ? (Value){VAL_TRUE, {.boolean = 1}} : (Value){VAL_FALSE, {.boolean = 0}});
-                } else {
-                    runtime_error(vm, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                bool equal = a.type == VAL_INTEGER && b.type == VAL_INTEGER
+                    ? a.as.integer == b.as.integer : values_equal(a, b);
+                push(vm, equal ? (Value){VAL_FALSE, {.boolean = 0}} : (Value){VAL_TRUE, {.boolean = 1}});
                 break;
             }
             case OP_NOT:
@@ -280,6 +708,10 @@ static InterpretResult run(VM* vm) {
                 if (a.type == VAL_STRING && b.type == VAL_STRING) {
                     int length = strlen(a.as.string) + strlen(b.as.string);
                     char* result = (char*)malloc(length + 1);
+                    if (collect_stats) {
+                        stats->allocations++;
+                        stats->allocated_bytes += length + 1;
+                    }
                     memcpy(result, a.as.string, strlen(a.as.string));
                     memcpy(result + strlen(a.as.string), b.as.string, strlen(b.as.string));
                     result[length] = '\0';
@@ -291,9 +723,7 @@ static InterpretResult run(VM* vm) {
                 break;
             }
             case OP_PRINT: {
-                Value value = pop(vm);
-                print_value(value);
-                printf("\n");
+                output_print(&vm->output, pop(vm));
                 break;
             }
             case OP_JUMP_IF_FALSE: {
@@ -303,27 +733,194 @@ static InterpretResult run(VM* vm) {
                 }
                 break;
             }
+            case OP_JUMP_IF_TRUE: {
+                uint16_t offset = READ_SHORT();
+                if (!is_falsey(*(vm->stack_top - 1))) {
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case OP_POP_JUMP_IF_FALSE: {
+                uint16_t offset = READ_SHORT();
+                if (is_falsey(pop(vm))) {
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case OP_POP_JUMP_IF_TRUE: {
+                uint16_t offset = READ_SHORT();
+                if (!is_falsey(pop(vm))) {
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case OP_INLINE_GUARD: {
+                // Runs the inlined body in place of the callee on top of
+                // the stack, or jumps to the real call if the global no
+                // longer holds the function that was inlined
+                struct Chunk* inlined = frame->chunk->inlined[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                Value callee = *(vm->stack_top - 1);
+                if (callee.type == VAL_FUNCTION && callee.as.function == inlined) {
+                    vm->stack_top--;
+                } else {
+                    frame->ip += offset;
+                }
+                break;
+            }
             case OP_JUMP: {
                 int16_t offset = READ_SHORT();
                 frame->ip += offset;
                 break;
             }
+            case OP_FORPREP: {
+                uint8_t base = READ_BYTE();
+                int16_t offset = READ_SHORT();
+                int prepared = for_prepare(vm, frame->slots + base);
+                if (prepared < 0) return INTERPRET_RUNTIME_ERROR;
+                if (prepared == 0) frame->ip += offset;
+                break;
+            }
+            case OP_FORLOOP: {
+                uint8_t base = READ_BYTE();
+                int16_t offset = READ_SHORT();
+                Value* slots = frame->slots + base;
+                if (slots[0].type == VAL_INTEGER) {
+                    // The limit slot holds the iterations left
+                    uint64_t remaining = (uint64_t)slots[1].as.integer;
+                    if (remaining > 0) {
+                        // Whole-Value stores: a later 16-byte copy of a slot
+                        // cannot be forwarded from a store to its payload
+                        // alone, and would stall.
+                        Value index = {VAL_INTEGER, {.integer = (int64_t)((uint64_t)slots[0].as.integer + (uint64_t)slots[2].as.integer)}};
+                        slots[1].as.integer = (int64_t)(remaining - 1);
+                        slots[0] = index;
+                        slots[3] = index;
+                        frame->ip += offset;
+                    }
+                    break;
+                }
+                double step = slots[2].as.number;
+                double index = slots[0].as.number + step;
+                if (step > 0 ? index <= slots[1].as.number : index >= slots[1].as.number) {
+                    slots[0].as.number = index;
+                    slots[3] = slots[0];
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case OP_NEW_TABLE: {
+                uint8_t array_size = READ_BYTE();
+                uint8_t hash_size = READ_BYTE();
+                LuaTable* table = allocate_table(vm, array_size, hash_size);
+                if (collect_stats) {
+                    stats->allocations++;
+                    stats->allocated_bytes += sizeof(LuaTable) + sizeof(Value) * array_size;
+                }
+                push(vm, (Value){VAL_TABLE, {.table = table}});
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value* object = vm->stack_top - 2;
+                Value key = vm->stack_top[-1];
+                if (object->type != VAL_TABLE) {
+                    runtime_error(vm, "Attempt to index a %s value.", value_type_name(*object));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LuaTable* table = object->as.table;
+                if (key.type == VAL_INTEGER) {
+                    *object = lua_table_get_integer(table, key.as.integer);
+                } else {
+                    *object = lua_table_get(table, key);
+                }
+                vm->stack_top--;
+                break;
+            }
+            case OP_SET_INDEX: {
+                Value* object = vm->stack_top - 3;
+                Value key = vm->stack_top[-2];
+                Value value = vm->stack_top[-1];
+                if (object->type != VAL_TABLE) {
+                    runtime_error(vm, "Attempt to index a %s value.", value_type_name(*object));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LuaTable* table = object->as.table;
+                if (key.type == VAL_INTEGER && (uint64_t)key.as.integer - 1 < (uint64_t)table->array_count) {
+                    table->array[key.as.integer - 1] = value;
+                } else {
+                    if (!check_table_key(vm, key)) return INTERPRET_RUNTIME_ERROR;
+                    lua_table_set(table, key, value);
+                }
+                vm->stack_top -= 3;
+                break;
+            }
+            case OP_INIT_FIELD: {
+                // Like OP_SET_INDEX, but the constructor's table stays
+                Value key = vm->stack_top[-2];
+                if (!check_table_key(vm, key)) return INTERPRET_RUNTIME_ERROR;
+                lua_table_set(vm->stack_top[-3].as.table, key, vm->stack_top[-1]);
+                vm->stack_top -= 2;
+                break;
+            }
+            case OP_SET_LIST: {
+                int count = READ_BYTE();
+                int64_t first = READ_BYTE() << 16;
+                first |= READ_SHORT();
+                Value* values = vm->stack_top - count;
+                LuaTable* table = values[-1].as.table;
+                for (int i = 0; i < count; i++) {
+                    lua_table_set(table, (Value){VAL_INTEGER, {.integer = first + i}}, values[i]);
+                }
+                vm->stack_top = values;
+                break;
+            }
+            case OP_LENGTH: {
+                Value* operand = vm->stack_top - 1;
+                if (operand->type == VAL_TABLE) {
+                    *operand = (Value){VAL_INTEGER, {.integer = lua_table_length(operand->as.table)}};
+                } else if (operand->type == VAL_STRING) {
+                    *operand = (Value){VAL_INTEGER, {.integer = (int64_t)strlen(operand->as.string)}};
+                } else {
+                    runtime_error(vm, "Attempt to get length of a %s value.", value_type_name(*operand));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
             case OP_CALL: {
                 int arg_count = READ_BYTE();
+                if (reload_requested) {
+                    // Calls from now on see the new functions; this one
+                    // already has its callee
+                    reload_requested = 0;
+                    if (vm->reloader != NULL) {
+                        output_flush(&vm->output);
+                        reload(vm->reloader, vm);
+                    }
+                }
                 if (!call_value(vm, *(vm->stack_top - 1 - arg_count), arg_count)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm->frames[vm->frame_count - 1];
                 break;
             }
+            case OP_TAIL_CALL: {
+                int arg_count = READ_BYTE();
+                if (!tail_call_value(vm, arg_count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                break;
+            }
             case OP_RETURN: {
                 Value result = pop(vm);
                 vm->frame_count--;
                 if (vm->frame_count == 0) {
-                    pop(vm);
+                    // The top-level locals of a streamed program stay
+                    if (!vm->streaming) vm->stack_top = vm->stack;
                     return INTERPRET_OK;
                 }
-                vm->stack_top = frame->slots;
+                // Discard the arguments, locals and the callee itself
+                vm->stack_top = frame->slots - 1;
                 push(vm, result);
                 frame = &vm->frames[vm->frame_count - 1];
                 break;
@@ -348,26 +945,172 @@ static InterpretResult run(VM* vm) {
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CONSTANT_LONG
+#undef READ_STRING_LONG
+#undef ARITHMETIC_OP
+#undef COMPARISON_OP
+#undef DEQUICKEN
+#undef ARITHMETIC_INT
+#undef ARITHMETIC_FLOAT
+#undef COMPARISON_INT
+#undef COMPARISON_FLOAT
 }
 
-InterpretResult interpret(VM* vm, const char* source) {
-    Chunk chunk;
-    init_chunk(&chunk);
+static InterpretResult run_plain(VM* vm) {
+    return execute(vm, false, false);
+}
 
-    struct ASTNode* ast = parse(source);
+static InterpretResult run_with_stats(VM* vm) {
+    return execute(vm, true, false);
+}
+
+static InterpretResult run_recording(VM* vm) {
+    return execute(vm, false, true);
+}
+
+static InterpretResult run_recording_with_stats(VM* vm) {
+    return execute(vm, true, true);
+}
+
+/**
+ * @brief The main execution loop of the VM. The loop is instantiated for
+ * each combination of statistics and profile recording, so that either
+ * costs nothing when it is disabled.
+ * 
+ * @param vm The VM.
+ * @return The result of the interpretation.
+ */
+static InterpretResult run(VM* vm) {
+    if (vm->feedback) return vm->stats ? run_recording_with_stats(vm) : run_recording(vm);
+    return vm->stats ? run_with_stats(vm) : run_plain(vm);
+}
+
+/**
+ * @brief Compiles source code into a chunk without running it.
+ * 
+ * @param source The source code to compile.
+ * @param chunk The chunk to write the code to. It must be initialized.
+ * @param optimizer Optimizes the AST before code generation, or NULL.
+ * @param mode How to compile. With COMPILE_LAZY function bodies are only
+ * checked, each being compiled on its first call, so the source must
+ * outlive the chunk; COMPILE_PIPELINED does the same on three threads.
+ * Ignored with an optimizer, which needs the AST of every body at once.
+ * @return 1 on success, 0 if there were compile errors.
+ */
+int compile(const char* source, Chunk* chunk, Optimizer* optimizer, CompileMode mode) {
+    if (optimizer == NULL && mode == COMPILE_SINGLE_PASS) {
+        return compile_single_pass(source, chunk);
+    }
+    if (optimizer == NULL && mode == COMPILE_PIPELINED) {
+        return compile_pipelined(source, chunk, 1);
+    }
+
+    AST* ast = optimizer == NULL && mode == COMPILE_LAZY ? parse_deferring_functions(source) : parse(source);
     if (ast == NULL) {
-        return INTERPRET_COMPILE_ERROR;
+        return 0;
+    }
+
+    if (optimizer != NULL) {
+        optimize_ast(optimizer, ast);
+    }
+    generate_code(ast, chunk);
+    free_ast(ast);
+    return 1;
+}
+
+/**
+ * @brief Runs an already compiled top-level chunk, verifying it and the
+ * functions compiled with it first unless that was done already.
+ * 
+ * @param vm The VM.
+ * @param chunk The chunk to run. It is not freed.
+ * @return The result of the interpretation.
+ */
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk) {
+    if (!verify_program(chunk)) return INTERPRET_COMPILE_ERROR;
+    if (chunk->max_stack > STACK_MAX) {
+        fprintf(stderr, "Stack overflow.\n");
+        return INTERPRET_RUNTIME_ERROR;
     }
 
-    generate_code(ast, &chunk);
-    
     CallFrame* frame = &vm->frames[vm->frame_count++];
-    frame->chunk = &chunk;
-    frame->ip = chunk.code;
+    frame->chunk = chunk;
+    frame->ip = chunk->code;
     frame->slots = vm->stack;
+    if (vm->stats) stats_record_call(vm->stats, chunk);
 
+    // Checked per run: a server child runs with stdout redirected
+    init_output(&vm->output, stdout);
     InterpretResult result = run(vm);
+    output_flush(&vm->output);
+    return result;
+}
+
+/**
+ * @brief Parses, compiles and runs a program a batch of top-level
+ * statements at a time, so output starts before the rest is parsed and
+ * only one batch's AST is in memory at once. Each batch's code is
+ * appended to the chunk and run in the same top-level frame, so locals
+ * carry over. A compile error stops the program after the batches before
+ * it have run.
+ * 
+ * @param vm The VM.
+ * @param chunk The top-level chunk, initialized and empty. It is not freed.
+ * @param source The source code. It must outlive the chunk.
+ * @param batch_nodes The number of AST nodes after which a batch ends,
+ * with the statement that takes it past them.
+ * @return The result of the interpretation.
+ */
+InterpretResult interpret_streaming(VM* vm, Chunk* chunk, const char* source, int batch_nodes) {
+    BatchParser batches;
+    begin_batches(&batches, source);
+    init_output(&vm->output, stdout);
+    if (vm->stats) stats_record_call(vm->stats, chunk);
+
+    vm->streaming = 1;
+    InterpretResult result = INTERPRET_OK;
+    while (result == INTERPRET_OK && !batches_done(&batches)) {
+        AST* ast = parse_batch(&batches, batch_nodes);
+        if (ast == NULL) {
+            result = INTERPRET_COMPILE_ERROR;
+            break;
+        }
+        int start = chunk->count;
+        generate_code(ast, chunk);
+        free_ast(ast);
+        int depth = (int)(vm->stack_top - vm->stack);
+        if (!verify_chunk(chunk, start, depth)) {
+            result = INTERPRET_COMPILE_ERROR;
+            break;
+        }
+        if (chunk->max_stack > STACK_MAX) {
+            fprintf(stderr, "Stack overflow.\n");
+            result = INTERPRET_RUNTIME_ERROR;
+            break;
+        }
+
+        CallFrame* frame = &vm->frames[vm->frame_count++];
+        frame->chunk = chunk;
+        frame->ip = chunk->code + start;
+        frame->slots = vm->stack;
+        result = run(vm);
+        output_flush(&vm->output);
+    }
+    vm->streaming = 0;
+    vm->stack_top = vm->stack;
+    return result;
+}
+
+InterpretResult interpret(VM* vm, const char* source) {
+    Chunk chunk;
+    init_chunk(&chunk);
+
+    if (!compile(source, &chunk, NULL, COMPILE_LAZY)) {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    InterpretResult result = interpret_chunk(vm, &chunk);
 
     free_chunk(&chunk);
     return result;
-}
\ No newline at end of file
+}
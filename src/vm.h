@@ -3,9 +3,18 @@
 
 #include "bytecode.h"
 #include "table.h"
+#include "lua_table.h"
+#include "stats.h"
+#include "output.h"
+#include "optimizer.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * 256)
+// AST nodes --stream parses before running what it has, by default
+#define STREAM_BATCH_NODES 8192
+// Tables allocated before the first collection of unreachable ones, and
+// the least allocated between two
+#define TABLES_MIN_COLLECTION 1024
 
 typedef struct {
     Chunk* chunk;
@@ -20,6 +29,17 @@ typedef struct {
     Value stack[STACK_MAX];
     Value* stack_top;
     Table globals;
+    LuaTable* tables;   // Every table alive, freed once unreachable or with the VM
+    int tables_count;
+    int next_collection;    // tables_count at which the next allocation collects
+    LuaTable** gray;        // Tables marked whose contents are not yet, while collecting
+    int gray_count;
+    int gray_capacity;
+    VMStats* stats; // Execution statistics, NULL unless enabled
+    OutputBuffer output;    // print output, flushed when a program ends
+    int streaming;          // A top-level return keeps the stack for the next batch
+    struct Reloader* reloader;  // Reloads functions on SIGHUP, or NULL
+    struct FeedbackRecorder* feedback;  // Records a profile for --profile-out, or NULL
 } VM;
 
 typedef enum {
@@ -28,8 +48,21 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+/**
+ * @brief How compile turns source into bytecode.
+ */
+typedef enum {
+    COMPILE_EAGER,          // Parse, then generate every function body
+    COMPILE_LAZY,           // Generate each function body on its first call
+    COMPILE_SINGLE_PASS,    // Emit bytecode while parsing, without an AST
+    COMPILE_PIPELINED,      // Like COMPILE_LAZY, lexing, parsing and generating on three threads
+} CompileMode;
+
 void init_vm(VM* vm);
 void free_vm(VM* vm);
+int compile(const char* source, Chunk* chunk, Optimizer* optimizer, CompileMode mode);
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk);
+InterpretResult interpret_streaming(VM* vm, Chunk* chunk, const char* source, int batch_nodes);
 InterpretResult interpret(VM* vm, const char* source);
 
 #endif // VM_H
@@ -0,0 +1,29 @@
+-- Enough tables are created to free the unreachable ones several times;
+-- those still reachable must keep their contents
+chain = {value = 0}
+local head = {1, 2, 3}
+local key = {}
+local index = {}
+index[key] = "by table"
+
+local last = chain
+local i = 1
+while i <= 3000 do
+    local garbage = {i, {i}}
+    if i == 1000 or i == 2000 or i == 3000 then
+        last.next = {value = i}
+        last = last.next
+    end
+    i = i + 1
+end
+
+local sum = 0
+local link = chain
+while link ~= nil do
+    sum = sum + link.value
+    link = link.next
+end
+print(sum)
+print(head[1] + head[2] + head[3])
+print(index[key])
+print(last.value)
@@ -0,0 +1,56 @@
+-- Numeric for loops
+local sum = 0
+for i = 1, 10 do
+    sum = sum + i
+end
+print(sum)
+
+for i = 10, 1, -3 do
+    print(i)
+end
+
+for i = 1, 0 do
+    print("never")
+end
+
+for i = 0, 1, 0.5 do
+    print(i)
+end
+
+-- The limit and step are evaluated once
+limit = 3
+for i = 1, limit do
+    limit = 10
+    print(i)
+end
+
+-- Block locals are popped each iteration
+local total = 0
+for i = 1, 1000 do
+    local twice = i * 2
+    local t = total + twice
+    total = t
+end
+print(total)
+
+-- Nested loops and returning from inside a loop
+function find(n)
+    for i = 1, n do
+        for j = 1, n do
+            if i * j == 12 then
+                local found = i * 100 + j
+                return found
+            end
+        end
+    end
+    return nil
+end
+print(find(6))
+
+-- Locals in an untaken branch do not shift later slots
+if false then
+    local skipped = 1
+end
+local after = "after"
+print(after)
+print(sum)
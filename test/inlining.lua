@@ -0,0 +1,44 @@
+-- Calls to small global functions, which -O inlines behind a guard
+
+function add(a, b) return a + b end
+function sq(x) return x * x end
+function clamp(v, lo) return v < lo and lo or v end
+function getk(t, k) return t[k] end
+offset = 10
+function shift(v) return v + offset end
+
+print(add(1, 2))
+local x = 5
+print(add(x, 3))
+print(sq(x) + sq(add(x, 1)))
+print(clamp(x, 7))
+print(clamp(9, 7))
+local t = {1, 2, 3}
+print(getk(t, 2))
+print(shift(x))
+
+-- Arguments with effects keep their order
+function show(v) print(v) return v end
+print(add(show(1), show(2)))
+print(sq(show(3)))
+
+-- Reassigned later: never inlined
+function twice(v) return v * 2 end
+print(twice(4))
+twice = sq
+print(twice(4))
+
+-- A local with the name of a global the function reads
+function glob(v) return v + offset end
+local offset = 1000
+print(glob(1))
+
+-- Recursive and multi-statement functions are called
+function fact(n) if n <= 1 then return 1 end return n * fact(n - 1) end
+print(fact(5))
+
+local total = 0
+for i = 1, 100 do
+  total = add(total, sq(i))
+end
+print(total)
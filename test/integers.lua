@@ -0,0 +1,45 @@
+-- Integer and float subtypes follow Lua 5.3
+print(7 + 3)
+print(7 - 3.0)
+print(2 * 3)
+print(2 * 0.5)
+print(7 / 2)
+print(6 / 3)
+print(-(3))
+print(-(1.5))
+
+-- Integer arithmetic wraps around
+local max = 9223372036854775807
+print(max)
+print(max + 1)
+print(-(max) - 1 == max + 1)
+
+-- Literals too large for an integer are floats
+print(9223372036854775808)
+
+-- Comparisons and equality across subtypes
+print(1 == 1.0)
+print(1 < 1.5)
+print(2 >= 2.0)
+print(9007199254740993 > 9007199254740992.0)
+print("a" == "a")
+print("a" ~= "b")
+print(1 == "1")
+print(nil == false)
+
+-- Float formatting
+print(0.1)
+print(100000000000000)
+print(1000000000000000.0)
+print(3.0)
+
+-- Integer and float loops
+for i = max - 2, max do
+    print(i)
+end
+for i = 1, 2.5 do
+    print(i)
+end
+for i = 1.0, 2 do
+    print(i)
+end
@@ -0,0 +1,64 @@
+-- While loops whose invariant values the optimizer hoists under -O
+
+n = 10
+scale = 3
+local limit = 4
+local i = 0
+local total = 0
+while i < n do
+  total = total + i * scale
+  i = i + 1
+end
+print(total)
+
+i = 0
+while i < limit * 2 do
+  local x = scale * scale + limit
+  total = total + x
+  i = i + 1
+end
+print(total)
+
+-- A call in the loop may change any global
+function bump() scale = scale + 1 end
+i = 0
+while i < 3 do
+  print(scale * 2)
+  bump()
+  i = i + 1
+end
+
+-- Never runs: an undefined global must not be read
+while i < 0 do
+  print(missing * 2)
+end
+
+-- Assigned in the loop
+local k = 0
+while k < n do
+  n = n - 1
+  k = k + 1
+end
+print(k)
+print(n)
+
+-- Nested loops, and a condition that calls a function
+width = 5
+local count = 0
+local y = 0
+while y < 3 do
+  local x = 0
+  while x < width * 2 do
+    count = count + x * scale - width
+    x = x + 1
+  end
+  y = y + 1
+end
+print(count)
+
+function below(v) return v < 3 end
+local j = 0
+while below(j) do
+  print(width * scale)
+  j = j + 1
+end
@@ -0,0 +1,54 @@
+-- Function bodies are compiled on their first call
+
+function unused(a, b)
+  local t = {a, b, "never compiled"}
+  return t[1] .. t[2]
+end
+
+function greet(name)
+  return "hello " .. name
+end
+
+print(greet("world"))
+print(greet("again"))
+
+-- Functions defined inside a function are deferred in turn
+function outer(n)
+  function inner(v)
+    return v * 10
+  end
+  function inner_unused()
+    return nil
+  end
+  return inner(n) + 1
+end
+
+print(outer(4))
+print(inner(5))
+
+-- Calls before and after a redefinition
+function shape() return "square" end
+print(shape())
+function shape() return "circle" end
+print(shape())
+
+-- Stored in a table and called through it
+local ops = {}
+function double(x) return x * 2 end
+ops.double = double
+print(ops.double(21))
+
+-- Recursion compiles the function once
+function fib(n)
+  if n < 2 then return n end
+  return fib(n - 1) + fib(n - 2)
+end
+print(fib(15))
+
+-- Defined in a loop
+local total = 0
+for i = 1, 3 do
+  function step(v) return v + 1 end
+  total = step(total)
+end
+print(total)
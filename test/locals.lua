@@ -0,0 +1,16 @@
+local count = 0
+local total = 0
+while count < 5 do
+  total = total + count
+  count = count + 1
+end
+print(total)
+
+function shadow(x)
+  x = x * 2
+  return x
+end
+
+x = 10
+print(shadow(4))
+print(x)
@@ -0,0 +1,96 @@
+-- Code the AST optimizer rewrites under -O
+
+-- Constant folding
+print(1 + 2 * 3)
+print(7 / 2)
+print(9223372036854775807 + 1)
+print(2 - 0.5)
+print(-(3))
+print(not nil)
+print(1 < 2.5)
+print(0 / 0 == 0 / 0)
+print("a" == "a")
+print(1 == 1.0)
+print(#"hello")
+print(nil or 4)
+print(false and 1)
+print(3 and "x")
+
+-- Propagation of locals that are never reassigned
+local limit = 10
+local step = 2
+local total = 0
+for i = 1, limit, step do
+  total = total + i * step
+end
+print(total)
+
+local x = 5
+local y = x
+local x = 100
+print(y)
+print(x)
+
+local s = "str"
+local copy = s
+print(copy)
+
+function scale(v, factor)
+  local f = factor
+  local unused = 42
+  local k = 3
+  return v * f + k
+end
+print(scale(2, 10))
+
+-- Branches that never run
+if false then
+  print("never")
+else
+  print("else branch")
+end
+if 1 then
+  local inner = 7
+  print(inner)
+end
+while nil do
+  print("never")
+end
+
+-- Values computed again while their inputs are unchanged
+g = 4
+h = 6
+function area()
+  local w = g * h + g
+  local p = g * h + g
+  print(w + p + g)
+  g = 1
+  return g * h + g
+end
+print(area())
+print(g)
+
+function norm(a, b)
+  local s1 = a * a + b * b
+  local s2 = a * a + b * b
+  return s1 + s2
+end
+print(norm(3, 4))
+
+function after_call()
+  local before = g + h
+  bump()
+  return g + h + before
+end
+function bump() g = g + 100 end
+print(after_call())
+
+function shadowed(n)
+  local t = n * n * n
+  if n > 1 then
+    local n = 2
+    print(n * n * n)
+  end
+  return n * n * n + t
+end
+print(shadowed(3))
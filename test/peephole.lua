@@ -0,0 +1,31 @@
+-- Control flow that the peephole optimizer rewrites under -O
+function f(a, b)
+  if a and b then return 1 else if a or b then return 2 else return 3 end end
+end
+function g(a, b, c)
+  local r = 0
+  if a and (b or c) then r = r + 1 end
+  if not a or b and c then r = r + 10 end
+  while r < 100 and (a or c) do
+    if r > 50 then r = r + 7 else r = r + 20 end
+  end
+  return r
+end
+local vals = {true, false}
+for i = 1, 2 do
+  for j = 1, 2 do
+    print(f(vals[i], vals[j]))
+    for k = 1, 2 do
+      print(g(vals[i], vals[j], vals[k]))
+      print((vals[i] or vals[j]) and vals[k])
+      print(vals[i] and vals[j] or vals[k])
+      local x = vals[i] and 5 or 7
+      print(x)
+    end
+  end
+end
+local n = 0
+while true and n < 3 do n = n + 1 end
+print(n)
+if n then end
+if n then else print("no") end
@@ -0,0 +1,26 @@
+-- Integers, including the extremes
+print(0)
+print(-17)
+print(9223372036854775807)
+print(-9223372036854775807 - 1)
+
+-- Floats take the Lua 5.3 format: %.14g, with ".0" on integral values
+print(1.0)
+print(-0.0)
+print(2.5)
+print(0.1 + 0.2)
+print(1 / 3)
+print(-7.25)
+print(0.0001)
+print(0.00001)
+print(123456.789)
+print(99999999999999.0)
+print(100000000000000.0)
+print(100000000000000.5 * 10)
+print(1 / 0)
+print(-1 / 0)
+
+-- Other values
+print("text")
+print(true)
+print(nil)
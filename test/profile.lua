@@ -0,0 +1,78 @@
+-- Profile-guided code: run_tests.sh records a profile of every test and
+-- compiles it again with the profile, which must not change what it does.
+-- These are the shapes the profile changes: ifs whose then branch is hot,
+-- operators that only ever see one subtype, and hot and cold calls.
+
+function step(x, i)
+    if i > 2 then
+        local y = x + 3
+        x = y
+    else
+        local z = x - 1
+        x = z
+    end
+    if x > 0 then
+        x = x - 1
+    end
+    return x
+end
+
+local total = 0
+for i = 1, 20 do
+    total = step(total, i)
+end
+print(total)
+
+-- Hot then branches on one line, nested and behind and/or
+local a = 0
+local b = 0
+for i = 1, 10 do
+    if i > 1 then a = a + 1 else b = b + 1 end
+    if i > 2 and i < 9 then
+        if i ~= 5 or a > 100 then
+            a = a + 10
+        end
+    else
+        b = b + 10
+    end
+end
+print(a)
+print(b)
+
+-- An if whose branches both return
+function sign(n)
+    if n >= 0 then
+        return 1
+    end
+    return -1
+end
+print(sign(3) + sign(4) + sign(-1))
+
+-- One subtype per operator, then a float where only integers ran before
+function scale(v)
+    return v * 2 + 1
+end
+local s = 0
+for i = 1, 10 do
+    s = s + scale(i)
+end
+print(s)
+print(scale(0.25))
+
+-- A larger function called often, which -O inlines only with the profile,
+-- and a call that never runs
+function mix(p, q, r)
+    return (p * 3 + q * 5 - r * 7 + p * q - q * r + r * p) * 2 - (p + q + r) * 3
+end
+function never(v)
+    return v + 1
+end
+local m = 0
+for i = 1, 1000 do
+    m = mix(i, 2, 3) - m
+    if i < 0 then
+        m = never(m)
+    end
+end
+print(m)
+print(never(1))
@@ -0,0 +1,36 @@
+-- Arithmetic and comparisons specialize to the operand types they see and
+-- fall back when the types change.
+function add(a, b)
+    return a + b
+end
+
+function less(a, b)
+    return a < b
+end
+
+print(add(1, 2))
+print(add(1, 2))
+print(add(1.5, 2.25))
+print(add(1.5, 2.25))
+print(add(1, 0.5))
+print(add(3, 4))
+
+print(less(1, 2))
+print(less(2.5, 1.5))
+print(less(2, 2.5))
+print(less(3, 2))
+
+-- One site alternating between subtypes on every iteration
+local total = 0
+local x = 1
+for i = 1, 10 do
+    if i > 5 then
+        x = 0.5
+    end
+    total = total * 2 - x
+end
+print(total)
+
+-- A quickened site still reports type errors
+print(add(1, 2))
+print(add("a", 1))
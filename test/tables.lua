@@ -0,0 +1,90 @@
+-- Constructors and indexing
+local t = {10, 20, 30}
+print(t[1])
+print(t[3])
+print(t[4])
+print(#t)
+
+-- Keyed fields and field syntax
+local p = {x = 1, y = 2, ["z"] = 3}
+print(p.x + p.y + p.z)
+p.x = 5
+print(p["x"])
+print(#p)
+
+-- Filling the array part in order
+local squares = {}
+for i = 1, 10 do
+    squares[i] = i * i
+end
+print(#squares)
+print(squares[7])
+
+-- Keys stored out of order move to the array part once the gap closes
+local r = {}
+r[3] = "c"
+r[2] = "b"
+print(#r)
+r[1] = "a"
+print(#r)
+print(r[1] .. r[2] .. r[3])
+
+-- Float keys with integral values are the same as integers
+local f = {}
+f[2.0] = "two"
+print(f[2])
+f[1] = "one"
+print(#f)
+f[1.5] = "one and a half"
+print(f[1.5])
+
+-- Removing the last element shrinks the length
+squares[10] = nil
+print(#squares)
+
+-- Mixed constructor, nested tables and other key types
+local m = {1, 2, name = "m", {3, 4}, [true] = "yes"}
+print(#m)
+print(m[3][2])
+print(m.name)
+print(m[true])
+
+-- Tables hold functions and compare by identity
+function double(x)
+    return x * 2
+end
+local ops = {apply = double}
+print(ops.apply(21))
+local a = {}
+local b = a
+print(a == b)
+print(a == {})
+
+-- Length of a string
+print(#"hello")
+
+-- Call statements
+b.count = 0
+function bump(t)
+    t.count = t.count + 1
+end
+bump(b)
+bump(b)
+print(a.count)
+
+-- A large constructor spans several batches
+local big = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+    21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60}
+print(#big)
+print(big[60])
+
+-- Many non-integer keys force the hash part to grow
+local h = {}
+for i = 1, 100 do
+    h[i + 0.5] = i
+end
+print(h[50.5])
+h[50.5] = nil
+print(h[50.5])
+print(h[100.5])
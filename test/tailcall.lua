@@ -0,0 +1,44 @@
+function count(n, acc)
+  if n == 0 then
+    return acc
+  end
+  return count(n - 1, acc + 1)
+end
+
+print(count(10000, 0))
+
+function is_even(n)
+  if n == 0 then
+    return true
+  end
+  return is_odd(n - 1)
+end
+
+function is_odd(n)
+  if n == 0 then
+    return false
+  end
+  return is_even(n - 1)
+end
+
+print(is_even(1001))
+
+function fib(n)
+  if n < 2 then
+    return n
+  end
+  return fib(n - 1) + fib(n - 2)
+end
+
+print(fib(10))
+
+function nothing()
+end
+
+print(nothing())
+
+i = 0
+while i < 10000 do
+  i = i + 1
+end
+print(i)
@@ -0,0 +1,67 @@
+-- Locals whose subtype -O proves, and some it must not assume
+
+-- Integers updated with arithmetic stay integers
+local i = 0
+local sum = 0
+while i < 10 do
+  sum = sum + i * i
+  i = i + 1
+end
+print(sum)
+
+-- A local that becomes a float inside the loop
+local x = 1
+local n = 0
+while n < 5 do
+  if n == 2 then x = x / 2 end
+  x = x + 1
+  n = n + 1
+end
+print(x)
+
+-- Floats only
+local f = 0.5
+for k = 1, 4 do
+  f = f * 2.0 + 0.25
+end
+print(f)
+print(f > 10.0)
+print(f <= 10.0)
+
+-- A float loop counter
+local g = 0.0
+for k = 0.5, 3 do
+  g = g + k
+end
+print(g)
+
+-- Branches that disagree
+local y = 3
+if sum > 100 then y = 2.5 else y = 4 end
+print(y + 1)
+if sum > 1000 then y = "text" end
+print(y * 2)
+
+-- Integer arithmetic wraps
+local big = 9223372036854775807
+big = big + 1
+print(big)
+print(big - 1 < big)
+
+-- Values from a table or a call are not assumed
+local t = {1, 2.5}
+local a = t[1]
+local b = t[2]
+print(a + b)
+print(a * 2)
+print(b - 1)
+function half(v) return v / 2 end
+local h = half(5)
+print(h + 1)
+
+-- and/or of numbers
+local m = i > 5 and 7 or 8
+print(m + 1)
+local z = 0
+z = (z or 1) + 1
+print(z)
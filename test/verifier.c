@@ -0,0 +1,66 @@
+/*
+ * Verifier test.
+ *
+ * Builds small chunks by hand, since the compiler never emits invalid
+ * code, and prints whether verify_chunk accepts each one and the max_stack
+ * it computed. Rejections are reported by the verifier on stderr, which
+ * run_tests.sh merges with stdout and compares against verifier.expected.
+ */
+#include "bytecode.h"
+#include "verifier.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+/**
+ * @brief Builds a chunk from the given bytes, verifies it and prints the
+ * result.
+ *
+ * @param name What the chunk tests.
+ * @param constant A constant to add, or a VAL_NIL value for none.
+ * @param arity The arguments already in the frame.
+ * @param count The number of bytes that follow.
+ */
+static void check(const char* name, Value constant, int arity, int count, ...) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    chunk.arity = arity;
+    if (constant.type != VAL_NIL) add_constant(&chunk, constant);
+
+    va_list bytes;
+    va_start(bytes, count);
+    for (int i = 0; i < count; i++) write_chunk(&chunk, (uint8_t)va_arg(bytes, int), 1);
+    va_end(bytes);
+
+    printf("%s: ", name);
+    fflush(stdout);
+    if (verify_chunk(&chunk, 0, arity)) {
+        printf("valid, max_stack %d\n", chunk.max_stack);
+    } else if (chunk.max_stack != CHUNK_UNVERIFIED) {
+        printf("max_stack set on a rejected chunk\n");
+    }
+    fflush(stdout);
+    free_chunk(&chunk);
+}
+
+int main(void) {
+    Value none = {VAL_NIL, {.integer = 0}};
+    Value integer = {VAL_INTEGER, {.integer = 7}};
+
+    check("constants", integer, 0, 8,
+          OP_CONSTANT, 0, OP_CONSTANT, 0, OP_ADD, OP_PRINT, OP_NIL, OP_RETURN);
+    check("arguments", none, 2, 6,
+          OP_GET_LOCAL, 1, OP_GET_LOCAL, 0, OP_ADD, OP_RETURN);
+    check("branches", none, 0, 8,
+          OP_TRUE, OP_POP_JUMP_IF_FALSE, 0, 2, OP_NIL, OP_POP, OP_NIL, OP_RETURN);
+
+    check("underflow", integer, 0, 4, OP_CONSTANT, 0, OP_ADD, OP_RETURN);
+    check("constant", integer, 0, 3, OP_CONSTANT, 1, OP_RETURN);
+    check("global", integer, 0, 3, OP_GET_GLOBAL, 0, OP_RETURN);
+    check("local", none, 1, 3, OP_GET_LOCAL, 1, OP_RETURN);
+    check("mid-instruction", integer, 0, 6, OP_CONSTANT, 0, OP_JUMP, 0xFF, 0xFC, OP_RETURN);
+    check("join", none, 0, 6, OP_TRUE, OP_JUMP_IF_FALSE, 0, 1, OP_NIL, OP_RETURN);
+    check("end", none, 0, 2, OP_NIL, OP_POP);
+    check("truncated", integer, 0, 1, OP_CONSTANT);
+    check("opcode", none, 0, 2, OP_COUNT, OP_RETURN);
+    return 0;
+}